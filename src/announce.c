@@ -0,0 +1,326 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "announce.h"
+#include "callbacks.h"
+#include "msg_processor.h"
+#include "iothread.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+struct dsvdc_bulk;
+
+/* one device of a bulk announcement */
+typedef struct dsvdc_bulk_item
+{
+    struct dsvdc_bulk *bulk;
+    const char *dsuid;
+    size_t index;
+    /* sessions that took the announcement and how many of them answered */
+    unsigned int receivers;
+    unsigned int answered;
+    /* first error of any of the sessions */
+    int code;
+} dsvdc_bulk_item_t;
+
+/* State of dsvdc_bulk_announce(), protected by the handle mutex. It is freed
+ * once every device was reported and no thread works on it. */
+typedef struct dsvdc_bulk
+{
+    dsvdc_t *handle;
+    unsigned int session_id;
+    /* NULL if the items are containers */
+    char *container_dsuid;
+    dsvdc_bulk_item_t *items;
+    size_t n;
+    /* next device to send and number of devices that were reported */
+    size_t next;
+    size_t completed;
+    unsigned int window;
+    unsigned int in_flight;
+    unsigned int refs;
+    void *arg;
+    void (*function)(dsvdc_t *handle, size_t index, int code, void *arg,
+                     void *userdata);
+} dsvdc_bulk_t;
+
+static void dsvdc_bulk_free(dsvdc_bulk_t *bulk)
+{
+    free(bulk->items);
+    free(bulk->container_dsuid);
+    free(bulk);
+}
+
+static void dsvdc_bulk_release(dsvdc_bulk_t *bulk)
+{
+    dsvdc_t *handle = bulk->handle;
+    bool done;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    done = (--bulk->refs == 0) && (bulk->completed == bulk->n);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (done)
+    {
+        log("bulk announcement of %zu devices done\n", bulk->n);
+        dsvdc_bulk_free(bulk);
+    }
+}
+
+/* the caller holds a reference */
+static void dsvdc_bulk_report(dsvdc_bulk_t *bulk, dsvdc_bulk_item_t *item)
+{
+    dsvdc_t *handle = bulk->handle;
+    dsvdc_callbacks_t cb;
+
+    dsvdc_get_callbacks(handle, &cb);
+    bulk->function(handle, item->index, item->code, bulk->arg, cb.userdata);
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    bulk->completed++;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+static void dsvdc_bulk_fill(dsvdc_bulk_t *bulk);
+
+static void dsvdc_bulk_done(dsvdc_t *handle, int code, void *arg,
+                            void *userdata)
+{
+    dsvdc_bulk_item_t *item = (dsvdc_bulk_item_t *)arg;
+    dsvdc_bulk_t *bulk = item->bulk;
+    (void)userdata;
+
+    /* the device is done when every session that took it answered */
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    item->answered++;
+    if ((code != DSVDC_OK) && (item->code == DSVDC_OK))
+    {
+        item->code = code;
+    }
+
+    if (item->answered < item->receivers)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return;
+    }
+
+    /* the window is refilled once half of it returned, so that the next
+     * devices go out together instead of one per response */
+    bool refill = (--bulk->in_flight <= bulk->window / 2);
+    bulk->refs++;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    dsvdc_bulk_report(bulk, item);
+    if (refill)
+    {
+        dsvdc_bulk_fill(bulk);
+    }
+    dsvdc_bulk_release(bulk);
+}
+
+/* Sends devices until the window is full. The messages of one round are
+ * gathered and written together, unless the I/O thread sends them, which
+ * does the same for everything that was queued meanwhile. A device that can
+ * not be sent is reported right away. The caller holds a reference. */
+static void dsvdc_bulk_fill(dsvdc_bulk_t *bulk)
+{
+    dsvdc_t *handle = bulk->handle;
+    bool cork = !dsvdc_io_mode(handle);
+
+    for (;;)
+    {
+        dsvdc_bulk_item_t *failed = NULL;
+
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        if (cork)
+        {
+            dsvdc_tx_cork(handle);
+        }
+
+        while ((bulk->next < bulk->n) && (bulk->in_flight < bulk->window))
+        {
+            dsvdc_bulk_item_t *item = &bulk->items[bulk->next];
+            int ret;
+            if (bulk->container_dsuid)
+            {
+                ret = dsvdc_send_device_announcement(handle,
+                                bulk->session_id, bulk->container_dsuid,
+                                item->dsuid, item, dsvdc_bulk_done,
+                                &item->receivers);
+            }
+            else
+            {
+                ret = dsvdc_send_container_announcement(handle,
+                                bulk->session_id, item->dsuid, item,
+                                dsvdc_bulk_done, &item->receivers);
+            }
+
+            /* other requests hold the pool, continue when ours return */
+            if ((ret == DSVDC_ERR_TOO_MANY_REQUESTS) && (bulk->in_flight > 0))
+            {
+                break;
+            }
+
+            bulk->next++;
+            if (ret != DSVDC_OK)
+            {
+                item->code = ret;
+                failed = item;
+                break;
+            }
+            bulk->in_flight++;
+        }
+
+        if (cork)
+        {
+            dsvdc_tx_uncork(handle);
+        }
+        bool report = (handle->tx_done_count > 0);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+        if (report)
+        {
+            dsvdc_report_send_done(handle);
+        }
+
+        if (!failed)
+        {
+            return;
+        }
+        dsvdc_bulk_report(bulk, failed);
+    }
+}
+
+int dsvdc_bulk_announce(dsvdc_t *handle, unsigned int session_id,
+                        const char *container_dsuid, const char **dsuids,
+                        size_t n, unsigned int window, void *arg,
+                        void (*function)(dsvdc_t *handle, size_t index,
+                                         int code, void *arg, void *userdata))
+{
+    dsvdc_bulk_t *bulk;
+    size_t i;
+
+    bulk = calloc(1, sizeof(dsvdc_bulk_t));
+    if (!bulk)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    /* the dSUIDs are copied into the block behind the items, the caller may
+     * free them right away */
+    size_t size = n * sizeof(dsvdc_bulk_item_t);
+    for (i = 0; i < n; i++)
+    {
+        size += strlen(dsuids[i]) + 1;
+    }
+
+    bulk->items = malloc(size);
+    if (container_dsuid)
+    {
+        bulk->container_dsuid = strdup(container_dsuid);
+    }
+    if (!bulk->items || (container_dsuid && !bulk->container_dsuid))
+    {
+        log("could not allocate bulk announcement of %zu devices\n", n);
+        dsvdc_bulk_free(bulk);
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    char *strings = (char *)(bulk->items + n);
+    for (i = 0; i < n; i++)
+    {
+        size_t len = strlen(dsuids[i]) + 1;
+        memcpy(strings, dsuids[i], len);
+
+        bulk->items[i].bulk = bulk;
+        bulk->items[i].dsuid = strings;
+        bulk->items[i].index = i;
+        bulk->items[i].receivers = 0;
+        bulk->items[i].answered = 0;
+        bulk->items[i].code = DSVDC_OK;
+        strings += len;
+    }
+
+    bulk->handle = handle;
+    bulk->session_id = session_id;
+    bulk->n = n;
+    bulk->window = window;
+    bulk->refs = 1;
+    bulk->arg = arg;
+    bulk->function = function;
+
+    log("announcing %zu %s, %u at a time\n", n,
+        container_dsuid ? "devices" : "containers", window);
+    dsvdc_bulk_fill(bulk);
+    dsvdc_bulk_release(bulk);
+    return DSVDC_OK;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+/* public interface */
+int dsvdc_announce_devices(dsvdc_t *handle, const char *container_dsuid,
+                           const char **dsuids, size_t n, unsigned int window,
+                           void *arg,
+                           void (*function)(dsvdc_t *handle, size_t index,
+                                            int code, void *arg,
+                                            void *userdata))
+{
+    size_t i;
+
+    if (!handle || !container_dsuid || !dsuids || (n == 0) ||
+        (window == 0) || !function)
+    {
+        log("invalid parameters for bulk announcement\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (!dsuids[i])
+        {
+            log("missing dSUID of device %zu\n", i);
+            return DSVDC_ERR_PARAM;
+        }
+    }
+
+    if (__atomic_load_n(&handle->n_established, __ATOMIC_ACQUIRE) == 0)
+    {
+        log("not announcing devices, no open vdSM connection.\n");
+        return DSVDC_ERR_NOT_CONNECTED;
+    }
+
+    return dsvdc_bulk_announce(handle, ALL_SESSIONS, container_dsuid, dsuids,
+                               n, window, arg, function);
+}
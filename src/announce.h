@@ -0,0 +1,48 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_ANNOUNCE_H__
+#define __DSVDC_ANNOUNCE_H__
+
+#include <stddef.h>
+
+#include "common.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Announces the devices of the container to the session, or to all
+ * established sessions for ALL_SESSIONS, with up to window of them waiting
+ * for their responses, see dsvdc_announce_devices(). If container_dsuid is
+ * NULL, the dSUIDs are containers. Unlike the public function, a missing
+ * session is reported through the callback of every device. */
+int dsvdc_bulk_announce(dsvdc_t *handle, unsigned int session_id,
+                        const char *container_dsuid, const char **dsuids,
+                        size_t n, unsigned int window, void *arg,
+                        void (*function)(dsvdc_t *handle, size_t index,
+                                         int code, void *arg, void *userdata));
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_ANNOUNCE_H__*/
@@ -0,0 +1,156 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+#define ARENA_ALIGN     16
+#define ARENA_ROUND(x)  (((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/* block header is padded so that the data area stays aligned */
+#define ARENA_HEADER    ARENA_ROUND(sizeof(dsvdc_arena_block_t))
+
+static void *dsvdc_arena_pb_alloc(void *allocator_data, size_t size)
+{
+    return dsvdc_arena_alloc((dsvdc_arena_t *)allocator_data, size);
+}
+
+static void dsvdc_arena_pb_free(void *allocator_data, void *pointer)
+{
+    /* released in one go by dsvdc_arena_reset() */
+    (void)allocator_data;
+    (void)pointer;
+}
+
+static dsvdc_arena_block_t *dsvdc_arena_new_block(dsvdc_arena_t *arena,
+                                                  size_t size)
+{
+    dsvdc_arena_block_t *block = malloc(ARENA_HEADER + size);
+    if (!block)
+    {
+        log("could not allocate arena block of %zu bytes\n", size);
+        return NULL;
+    }
+
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->n_heap_allocs++;
+    return block;
+}
+
+void dsvdc_arena_init(dsvdc_arena_t *arena, size_t block_size)
+{
+    memset(arena, 0, sizeof(dsvdc_arena_t));
+    arena->block_size = ARENA_ROUND(block_size);
+    arena->allocator.alloc = dsvdc_arena_pb_alloc;
+    arena->allocator.free = dsvdc_arena_pb_free;
+    arena->allocator.allocator_data = arena;
+}
+
+void *dsvdc_arena_alloc(dsvdc_arena_t *arena, size_t size)
+{
+    dsvdc_arena_block_t *block = arena->blocks;
+
+    size = ARENA_ROUND(size ? size : 1);
+    arena->n_allocs++;
+
+    if (!block || (block->size - block->used < size))
+    {
+        size_t block_size = arena->block_size;
+        if (size > block_size)
+        {
+            block_size = size;
+        }
+
+        block = dsvdc_arena_new_block(arena, block_size);
+        if (!block)
+        {
+            return NULL;
+        }
+    }
+
+    void *ptr = (unsigned char *)block + ARENA_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void dsvdc_arena_reset(dsvdc_arena_t *arena)
+{
+    dsvdc_arena_block_t *block = arena->blocks;
+
+    if (!block)
+    {
+        return;
+    }
+
+    if (!block->next)
+    {
+        block->used = 0;
+        return;
+    }
+
+    /* the data did not fit into one block, replace all blocks by a single
+     * one that is large enough next time */
+    size_t total = 0;
+    while (block)
+    {
+        dsvdc_arena_block_t *next = block->next;
+        total += block->size;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+
+    if (total > arena->block_size)
+    {
+        arena->block_size = total;
+    }
+    dsvdc_arena_new_block(arena, arena->block_size);
+}
+
+void dsvdc_arena_cleanup(dsvdc_arena_t *arena)
+{
+    dsvdc_arena_block_t *block = arena->blocks;
+    while (block)
+    {
+        dsvdc_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,71 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_ARENA_H__
+#define __DSVDC_ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HAVE_GOOGLE_PROTOBUF_C_PROTOBUF_C_H
+#include <google/protobuf-c/protobuf-c.h>
+#else
+#include <protobuf-c/protobuf-c.h>
+#endif
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+typedef struct dsvdc_arena_block
+{
+    struct dsvdc_arena_block *next;
+    size_t size;
+    size_t used;
+} dsvdc_arena_block_t;
+
+/* Bump allocator, individual allocations are never freed, everything is
+ * released at once by dsvdc_arena_reset(). If the first block was too small
+ * additional blocks are chained, on reset they are merged into one block of
+ * the combined size, so that the steady state does not touch the heap. */
+typedef struct dsvdc_arena
+{
+    dsvdc_arena_block_t *blocks;
+    size_t block_size;
+
+    /* can be passed to the protobuf-c unpack functions */
+    ProtobufCAllocator allocator;
+
+    /* statistics: all allocations and the ones that needed a new block */
+    uint64_t n_allocs;
+    uint64_t n_heap_allocs;
+} dsvdc_arena_t;
+
+void dsvdc_arena_init(dsvdc_arena_t *arena, size_t block_size);
+void *dsvdc_arena_alloc(dsvdc_arena_t *arena, size_t size);
+void dsvdc_arena_reset(dsvdc_arena_t *arena);
+void dsvdc_arena_cleanup(dsvdc_arena_t *arena);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_ARENA_H__*/
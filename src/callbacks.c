@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "callbacks.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+int dsvdc_callbacks_init(dsvdc_t *handle, void *userdata)
+{
+    dsvdc_callbacks_t *cb = calloc(1, sizeof(dsvdc_callbacks_t));
+    if (!cb)
+    {
+        log("could not allocate callback table\n");
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    cb->userdata = userdata;
+    handle->callbacks = cb;
+    handle->callbacks_retired = NULL;
+    handle->callbacks_readers = 0;
+    return DSVDC_OK;
+}
+
+static void dsvdc_callbacks_free_retired(dsvdc_t *handle)
+{
+    dsvdc_callbacks_t *cb = handle->callbacks_retired;
+
+    while (cb)
+    {
+        dsvdc_callbacks_t *next = cb->retired;
+        free(cb);
+        cb = next;
+    }
+    handle->callbacks_retired = NULL;
+}
+
+void dsvdc_callbacks_cleanup(dsvdc_t *handle)
+{
+    dsvdc_callbacks_free_retired(handle);
+    free(handle->callbacks);
+    handle->callbacks = NULL;
+}
+
+dsvdc_callbacks_t *dsvdc_callbacks_edit(dsvdc_t *handle)
+{
+    dsvdc_callbacks_t *cb = malloc(sizeof(dsvdc_callbacks_t));
+    if (!cb)
+    {
+        log("could not allocate callback table\n");
+        return NULL;
+    }
+
+    /* only writers replace the table and they hold the mutex */
+    *cb = *handle->callbacks;
+    cb->retired = NULL;
+    return cb;
+}
+
+void dsvdc_callbacks_publish(dsvdc_t *handle, dsvdc_callbacks_t *cb)
+{
+    dsvdc_callbacks_t *old = __atomic_exchange_n(&handle->callbacks, cb,
+                                                 __ATOMIC_SEQ_CST);
+    old->retired = handle->callbacks_retired;
+    handle->callbacks_retired = old;
+
+    /* A reader that loaded a retired pointer is still counted. Readers that
+     * start from now on see the new table, so everything retired so far can
+     * go if nobody is copying right now. Otherwise the next writer or the
+     * cleanup frees it. */
+    if (__atomic_load_n(&handle->callbacks_readers, __ATOMIC_SEQ_CST) == 0)
+    {
+        dsvdc_callbacks_free_retired(handle);
+    }
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,87 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_CALLBACKS_H__
+#define __DSVDC_CALLBACKS_H__
+
+#include "common.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* The callback table is published through an atomic pointer and never
+ * modified afterwards. Dispatching copies the current table without taking
+ * the handle mutex, setters publish a modified copy and retire the old table.
+ * A retired table is freed as soon as no reader is between loading the
+ * pointer and finishing its copy. */
+
+int dsvdc_callbacks_init(dsvdc_t *handle, void *userdata);
+void dsvdc_callbacks_cleanup(dsvdc_t *handle);
+
+/* Copy of the published callbacks for one dispatch, the callbacks are
+ * invoked from the copy without any lock held. */
+static inline void dsvdc_get_callbacks(dsvdc_t *handle, dsvdc_callbacks_t *cb)
+{
+    /* pairs with the exchange and the reader check in
+     * dsvdc_callbacks_publish() */
+    __atomic_add_fetch(&handle->callbacks_readers, 1, __ATOMIC_SEQ_CST);
+    *cb = *__atomic_load_n(&handle->callbacks, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&handle->callbacks_readers, 1, __ATOMIC_RELEASE);
+}
+
+/* Writers must hold the handle mutex. Returns a private copy of the
+ * published table or NULL if out of memory, the copy is modified and then
+ * handed to dsvdc_callbacks_publish(). */
+dsvdc_callbacks_t *dsvdc_callbacks_edit(dsvdc_t *handle);
+void dsvdc_callbacks_publish(dsvdc_t *handle, dsvdc_callbacks_t *cb);
+
+/* Body of the public callback setters. They can not return an error, if the
+ * table can not be copied the previous callback stays and this is logged. */
+#define DSVDC_SET_CALLBACK(handle, field, function)                         \
+    do                                                                      \
+    {                                                                       \
+        dsvdc_callbacks_t *cb_;                                             \
+        if (!(handle))                                                      \
+        {                                                                   \
+            break;                                                          \
+        }                                                                   \
+        pthread_mutex_lock(&(handle)->dsvdc_handle_mutex);                  \
+        cb_ = dsvdc_callbacks_edit(handle);                                 \
+        if (cb_)                                                            \
+        {                                                                   \
+            cb_->field = (function);                                        \
+            dsvdc_callbacks_publish((handle), cb_);                         \
+        }                                                                   \
+        else                                                                \
+        {                                                                   \
+            log("could not set the " #field " callback, keeping the old "   \
+                "one\n");                                                   \
+        }                                                                   \
+        pthread_mutex_unlock(&(handle)->dsvdc_handle_mutex);                \
+    } while (0)
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_CALLBACKS_H__*/
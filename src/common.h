@@ -28,12 +28,22 @@
 #include <pthread.h>
 
 #ifdef HAVE_AVAHI
+#include <poll.h>
 #include <avahi-client/publish.h>
 #include <avahi-common/simple-watch.h>
 #endif
 
 
 #include "dsvdc.h"
+#include "eventloop.h"
+#include "ringbuf.h"
+#include "arena.h"
+#include "sendqueue.h"
+#include "lfqueue.h"
+#include "timerwheel.h"
+#include "reqmap.h"
+#include "reqpool.h"
+#include "registry.h"
 
 /* for some reason -export-symbols-regex had no effect, eventhough the
    contets of the .exp file were correct */
@@ -41,79 +51,139 @@
     #pragma GCC visibility push(hidden)
 #endif
 
-/* search for free ports will start with this value */
+/* preferred port, the system picks another one if it is in use */
 #define DEFAULT_VDC_PORT        49500
 
 /* 16k - maximum meaningful size of one message, reject everything bigger */
 #define MAX_DATA_SIZE           16384
 
+/* size of the receive ring buffer, must be a power of two and able to hold
+ * at least one complete frame including the length prefix */
+#define RX_RING_SIZE            65536
+
+/* default number of messages that are processed per loop iteration */
+#define DEFAULT_RX_BUDGET       64
+
+/* initial size of the arena that holds decoded messages, grows on demand */
+#define RX_ARENA_SIZE           16384
+
+/* initial size of the buffer outgoing messages are packed into */
+#define TX_BUFFER_SIZE          1024
+
+/* initial number of send completions that wait to be reported */
+#define TX_DONE_SIZE            16
+
 /* Currently known and supported API version */
 #define SUPPORTED_API_VERSION   2
 
 /* length of a dSUID as string (not containing NULL terminator) */
 #define DSUID_LENGTH            34
 
-/* max time to wait for a socket to become ready when sending a messsage */
-#define SOCKET_WRITE_TIMEOUT    2 /* seconds */
+/* default number of vdSM sessions that may be open at the same time */
+#define DEFAULT_MAX_SESSIONS    4
+
+/* session id that addresses all established sessions */
+#define ALL_SESSIONS            0
+
+/* while sends are corked, frames are gathered up to this many bytes before
+ * they are written together */
+#define TX_COALESCE_BYTES       32768
+
+/* default limit of the outbound queue, messages are rejected beyond it */
+#define DEFAULT_TX_QUEUE_LIMIT  65536
+
+/* size of the queue that carries received messages and callbacks from the
+ * I/O thread to the application, must be a power of two */
+#define IO_EVENT_QUEUE_SIZE     262144
+
+/* how long the I/O thread sleeps at most when nothing happens (in ms) */
+#define IO_THREAD_TIMEOUT       1000
 
 /* defaults for optional parameters */
 #define DEFAULT_UNKNOWN_ZONE    -1
 #define DEFAULT_UNKNOWN_GROUP   -1
 
-/* minimum value during which we expect the vdSM to answer our messages (in
- * seconds). Actual duration may be longer (depending on the check intervals) */
-#define DEFAULT_VDSM_MSG_TIMEOUT 10
+/* time during which we expect the vdSM to answer our requests (in ms) */
+#define DEFAULT_REQUEST_TIMEOUT 10000
+
+/* number of requests that may wait for a response at the same time */
+#define DEFAULT_MAX_REQUESTS    1024
+
+/* announcements of registered devices that may wait for their responses */
+#define DEFAULT_ANNOUNCE_WINDOW 32
 
 /* request id of zero must be ignored, i.e. don't assume it's an answer to
  * a particular request */
 #define RESERVED_REQUEST_ID     0
 
-/* how often do we need to iterate the request list in order to dump timed out
- * messages? */
-#define REQLIST_CHECK_INTERVAL  20
-
 typedef struct cached_request
 {
-    struct cached_request *next;
+    /* armed with the timeout of the request, see dsvdc_expire_requests() */
+    dsvdc_timer_t timer;
+    struct dsvdc_session *session;
     uint32_t message_id;
-    time_t timestamp;
     void *arg;
     void (*callback)(dsvdc_t *handle, int code, void *arg, void *userdata);
 } cached_request_t;
 
-/* "instance" structure */
-struct dsvdc {
-    pthread_mutex_t dsvdc_handle_mutex;
-    unsigned short port;
-    int listen_fd;
-    int connected_fd;
-    /* a string for now, will be a byte array later */
+/* one vdSM connection, several of them may be open at the same time */
+typedef struct dsvdc_session
+{
+    struct dsvdc_session *next;
+    dsvdc_t *handle;
+    unsigned int id;
+    int fd;
+
+    /* HELLO was answered, notifications and pushes are sent to us */
+    bool established;
     char vdsm_dsuid[DSUID_LENGTH + 1];
-    char vdc_dsuid[DSUID_LENGTH + 1];
-    char *vdsm_push_uri;
 
-    /* cached requests linked list */
-    cached_request_t *requests_list;
-    time_t last_list_cleanup;
-    uint32_t request_id;
+    /* received data, may hold several frames with a partial one at the end */
+    dsvdc_ring_t rx_ring;
+    /* set once the ring was processed in the current loop iteration */
+    bool rx_visited;
 
-    /* vdsm has connected vdc -> session running */
-    int session;
+    /* messages the socket did not take yet, flushed by the loop thread when
+     * the connection becomes writable */
+    dsvdc_txq_t txq;
 
-    /* announcements */
-#ifdef HAVE_AVAHI
-    AvahiEntryGroup *avahi_group;
-    AvahiSimplePoll *avahi_poll;
-    AvahiClient *avahi_client;
-    char *avahi_name;
-    bool noauto;
-#endif
+    /* requests we sent to this vdSM and that wait for a response */
+    dsvdc_reqmap_t requests;
+
+    /* events and send completions that still point to the session, it is
+     * only freed once they were dispatched */
+    unsigned int refs;
+    /* the application asked to close the connection */
+    bool close_pending;
+    /* selected as a receiver of the message that is being sent */
+    bool tx_target;
+} dsvdc_session_t;
 
-    /* callbacks */
-    void *callback_userdata;
+/* a message that left the send queue, see dsvdc_report_send_done() */
+typedef struct dsvdc_send_done
+{
+    dsvdc_session_t *session;
+    uint32_t message_id;
+    int code;
+} dsvdc_send_done_t;
+
+/* statistics are also updated by the I/O thread without the handle mutex */
+#define DSVDC_STAT_ADD(handle, field, n) \
+    __atomic_add_fetch(&(handle)->stats.field, (n), __ATOMIC_RELAXED)
+
+/* Callbacks of the application, see the dsvdc_set_*_callback() functions.
+ * A published table is never modified, the setters publish a new one, see
+ * callbacks.h. */
+typedef struct dsvdc_callbacks
+{
+    /* next table that waits for the readers to leave, see callbacks.c */
+    struct dsvdc_callbacks *retired;
+    void *userdata;
     void (*vdsm_new_session) (dsvdc_t *handle, void *userdata);
     void (*vdsm_end_session) (dsvdc_t *handle, void *userdata);
     void (*vdsm_send_ping)(dsvdc_t *handle, const char *dsuid, void *userdata);
+    void (*vdsm_send_complete)(dsvdc_t *handle, uint32_t message_id, int code,
+                               void *userdata);
     bool (*vdsm_send_remove)(dsvdc_t *handle, const char *dsuid,
                              void *userdata);
     void (*vdsm_send_call_scene)(dsvdc_t *handle, char **dsuid,
@@ -149,6 +219,153 @@ struct dsvdc {
                                  size_t n_dsuid, bool apply,
                                  int32_t channel, double value,
                                  void *userdata);
+    /* binary variants of the notifications above, see dsuid.c */
+    void (*vdsm_send_call_scene_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t scene, bool force, int32_t group,
+                                 int32_t zone_id, void *userdata);
+    void (*vdsm_send_save_scene_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t scene, int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_undo_scene_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t scene, int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_set_local_prio_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t scene, int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_call_min_scene_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_identify_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_set_control_value_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 int32_t value, int32_t group, int32_t zone_id,
+                                 void *userdata);
+    void (*vdsm_send_output_channel_value_bin)(dsvdc_t *handle,
+                                 const dsvdc_dsuid_t *dsuid, size_t n_dsuid,
+                                 bool apply, int32_t channel, double value,
+                                 void *userdata);
+    void (*dispatch_complete)(dsvdc_t *handle, size_t n_devices,
+                              uint64_t elapsed_us, void *userdata);
+} dsvdc_callbacks_t;
+
+/* "instance" structure */
+struct dsvdc {
+    pthread_mutex_t dsvdc_handle_mutex;
+    dsvdc_transport_t transport;
+    unsigned short port;
+    /* Unix socket file to remove on cleanup, NULL for other transports and
+     * the abstract namespace */
+    char *unix_path;
+    int listen_fd;
+    dsvdc_loop_t loop;
+
+    /* open vdSM connections, closed ones are freed by the loop thread */
+    dsvdc_session_t *sessions;
+    unsigned int n_sessions;
+    unsigned int max_sessions;
+    unsigned int session_id;
+    /* sessions that completed the handshake, also read without the mutex */
+    unsigned int n_established;
+
+    /* frames that wrap around the end of a receive ring are copied here */
+    unsigned char *rx_frame;
+    unsigned int rx_budget;
+    /* decoded messages are allocated here, reset after each message */
+    dsvdc_arena_t rx_arena;
+
+    /* outgoing messages are packed here once, also when they go out to
+     * several sessions, protected by the handle mutex */
+    uint8_t *tx_buf;
+    size_t tx_buf_size;
+    /* tx_buf holds a message that is still being handed to the sessions */
+    bool tx_buf_busy;
+    size_t tx_queue_limit;
+    /* frames are only queued while set, see dsvdc_tx_cork() */
+    unsigned int tx_cork;
+    /* send completions that wait for the send complete callback */
+    dsvdc_send_done_t *tx_done;
+    size_t tx_done_count;
+    size_t tx_done_size;
+    bool tx_reporting;
+
+    dsvdc_stats_t stats;
+
+    /* optional I/O thread, see dsvdc_start_io_thread() */
+    pthread_t io_thread;
+    bool io_active;
+    bool io_stop;
+    /* received messages and callbacks for the dispatching thread, the pipe
+     * is readable while some are waiting */
+    dsvdc_spsc_t io_events;
+    int io_event_fd[2];
+    bool io_event_signaled;
+    /* events that did not fit into the queue, private to the I/O thread */
+    struct dsvdc_io_event *io_backlog;
+    struct dsvdc_io_event *io_backlog_tail;
+    /* the I/O thread waits for room in the event queue */
+    bool io_blocked;
+    /* outgoing messages of all application threads */
+    dsvdc_mpsc_t io_sends;
+    bool io_send_signaled;
+    /* size of the send queues, published by the I/O thread */
+    size_t io_tx_bytes;
+    size_t io_tx_messages;
+
+    /* the string goes into the messages, vdc_id is only set if it was a
+     * valid dSUID, dsvdc_new() accepts any string */
+    char vdc_dsuid[DSUID_LENGTH + 1];
+    dsvdc_dsuid_t vdc_id;
+    bool vdc_id_valid;
+    char *vdsm_push_uri;
+
+    /* the requests live in the sessions, ids are unique per handle, their
+     * timeouts of all sessions are kept in one wheel, the entries come from
+     * the pool */
+    dsvdc_reqpool_t request_pool;
+    dsvdc_timer_wheel_t request_timers;
+    unsigned int request_timeout;
+    uint32_t request_id;
+
+    /* announced again whenever a session starts */
+    dsvdc_registry_t registry;
+    /* workers for the device handlers, NULL to call them directly, see
+     * dispatch.h */
+    struct dsvdc_dispatch *dispatch;
+    /* held while the workers are replaced, draining is set until the
+     * previous ones are stopped, see dsvdc_set_dispatch_workers() */
+    pthread_mutex_t dispatch_mutex;
+    bool dispatch_draining;
+
+    /* announcements */
+#ifdef HAVE_AVAHI
+    AvahiEntryGroup *avahi_group;
+    AvahiSimplePoll *avahi_poll;
+    AvahiClient *avahi_client;
+    char *avahi_name;
+    bool noauto;
+
+    /* descriptors and timeout avahi asked for in its last iteration, the
+     * descriptors are also registered with the event loop */
+    struct pollfd *avahi_fds;
+    unsigned int avahi_nfds;
+    int avahi_timeout;
+    uint64_t avahi_poll_time;
+#endif
+
+    /* published callback table, replaced atomically by the setters which
+     * are serialized by the mutex, retired tables are freed once no reader
+     * copies from them */
+    dsvdc_callbacks_t *callbacks;
+    dsvdc_callbacks_t *callbacks_retired;
+    unsigned int callbacks_readers;
 };
 
 #if __GNUC__ >= 4
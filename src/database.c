@@ -145,18 +145,12 @@ int dsvdc_database_load_property(const dsvdc_database_t *db, const char *key, ds
         return DSVDC_ERR_INVALID_PROPERTY;
     }
 
-    ret = DSVDC_OK;
-
-    (*property)->n_properties = msg->n_properties;
-    if (msg->n_properties > 0)
+    ret = dsvdc_property_append_copy(*property, msg->properties,
+                                     msg->n_properties);
+    if (ret != DSVDC_OK)
     {
-        (*property)->properties = dsvdc_property_deep_copy(msg->properties,
-                                                           msg->n_properties);
-        if ((*property)->properties == NULL)
-        {
-            dsvdc_property_free(*property);
-            ret = DSVDC_ERR_OUT_OF_MEMORY;
-        }
+        dsvdc_property_free(*property);
+        *property = NULL;
     }
 
     vdcapi__vdc__send_push_property__free_unpacked(msg, NULL);
@@ -39,6 +39,8 @@
 #include <avahi-common/simple-watch.h>
 
 #include "discovery.h"
+#include "session.h"
+#include "util.h"
 #include "log.h"
 
 
@@ -287,6 +289,73 @@ static void dsvdc_avahi_client_callback(AvahiClient *client,
     }
 }
 
+/* must be called with an already locked handle mutex */
+static void dsvdc_discovery_unregister_fds(dsvdc_t *handle)
+{
+    unsigned int i;
+    for (i = 0; i < handle->avahi_nfds; i++)
+    {
+        int fd = handle->avahi_fds[i].fd;
+        /* avahi may have closed the descriptor and the number may be in use
+         * by one of our own sockets by now */
+        if ((fd == handle->listen_fd) || dsvdc_session_find_fd(handle, fd) ||
+            (fd == handle->loop.wakeup_fd[0]))
+        {
+            continue;
+        }
+        dsvdc_loop_remove(&handle->loop, fd);
+    }
+    handle->avahi_nfds = 0;
+}
+
+/* Replaces poll() in avahi_simple_poll_run(), never blocks. Waiting is done
+ * by dsvdc_work() or by an external event loop, so we only remember what avahi
+ * is interested in and check the descriptors. */
+static int dsvdc_discovery_poll(struct pollfd *ufds, unsigned int nfds,
+                                int timeout, void *userdata)
+{
+    dsvdc_t *handle = (dsvdc_t *)userdata;
+    unsigned int i;
+
+    dsvdc_discovery_unregister_fds(handle);
+
+    if (nfds > 0)
+    {
+        struct pollfd *fds = realloc(handle->avahi_fds,
+                                     sizeof(struct pollfd) * nfds);
+        if (!fds)
+        {
+            log("could not allocate memory for avahi descriptors\n");
+            return -1;
+        }
+        handle->avahi_fds = fds;
+    }
+
+    for (i = 0; i < nfds; i++)
+    {
+        int events = 0;
+        if (ufds[i].events & POLLIN)
+        {
+            events |= DSVDC_EV_READ;
+        }
+        if (ufds[i].events & POLLOUT)
+        {
+            events |= DSVDC_EV_WRITE;
+        }
+
+        handle->avahi_fds[handle->avahi_nfds++] = ufds[i];
+        if (dsvdc_loop_add(&handle->loop, ufds[i].fd, events) != DSVDC_OK)
+        {
+            log("could not register avahi descriptor %d\n", ufds[i].fd);
+        }
+    }
+
+    handle->avahi_timeout = timeout;
+    handle->avahi_poll_time = monotonic_ms();
+
+    return poll(ufds, nfds, 0);
+}
+
 int dsvdc_discovery_init(dsvdc_t *handle, const char *name, bool noauto)
 {
     int error = 0;
@@ -307,6 +376,12 @@ int dsvdc_discovery_init(dsvdc_t *handle, const char *name, bool noauto)
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
+    avahi_simple_poll_set_func(handle->avahi_poll, dsvdc_discovery_poll,
+                               handle);
+    /* make sure avahi gets iterated before anyone waits on its descriptors */
+    handle->avahi_timeout = 0;
+    handle->avahi_poll_time = monotonic_ms();
+
     if (!name)
     {
         handle->avahi_name = avahi_strdup(DEFAULT_AVAHI_SERVICE_NAME);
@@ -351,8 +426,16 @@ void dsvdc_discovery_work(dsvdc_t *handle)
     }
 
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    /* check justone event and return immediately */
-    if (avahi_simple_poll_iterate(handle->avahi_poll, 0) != 0)
+    /* not announced, i.e. listening on a Unix domain socket */
+    if (!handle->avahi_poll)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return;
+    }
+
+    /* check just one event, dsvdc_discovery_poll() returns immediately, the
+     * timeout is passed on to it so that we know when avahi wants to run */
+    if (avahi_simple_poll_iterate(handle->avahi_poll, -1) != 0)
     {
         /* if daemon connection is lost we need to reinit */
         log("avahi error, reinitializing...\n");
@@ -367,6 +450,31 @@ void dsvdc_discovery_work(dsvdc_t *handle)
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
+int dsvdc_discovery_next_timeout(dsvdc_t *handle)
+{
+    int timeout;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (!handle->avahi_poll || (handle->avahi_timeout < 0))
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return -1;
+    }
+
+    uint64_t elapsed = monotonic_ms() - handle->avahi_poll_time;
+    if (elapsed >= (uint64_t)handle->avahi_timeout)
+    {
+        timeout = 0;
+    }
+    else
+    {
+        timeout = handle->avahi_timeout - (int)elapsed;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    return timeout;
+}
+
 void dsvdc_discovery_cleanup(dsvdc_t *handle)
 {
     if (!handle)
@@ -394,6 +502,13 @@ void dsvdc_discovery_cleanup(dsvdc_t *handle)
         handle->avahi_poll = NULL;
     }
 
+    dsvdc_discovery_unregister_fds(handle);
+    if (handle->avahi_fds)
+    {
+        free(handle->avahi_fds);
+        handle->avahi_fds = NULL;
+    }
+
     if (handle->avahi_name)
     {
         avahi_free(handle->avahi_name);
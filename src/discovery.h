@@ -32,6 +32,8 @@ enum
 
 int dsvdc_discovery_init(dsvdc_t *handle, const char* name, bool noauto);
 void dsvdc_discovery_work(dsvdc_t *handle);
+/* milliseconds until avahi wants to be iterated again, -1 if no timeout */
+int dsvdc_discovery_next_timeout(dsvdc_t *handle);
 void dsvdc_discovery_cleanup(dsvdc_t *handle);
 
 #endif//__DSVDC_DISCOVERY_H__
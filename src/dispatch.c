@@ -0,0 +1,498 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "callbacks.h"
+#include "dispatch.h"
+#include "log.h"
+#include "util.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+struct dsvdc_batch;
+
+/* one handler call, queued on the worker of its device */
+typedef struct dsvdc_job
+{
+    struct dsvdc_job *next;
+    struct dsvdc_batch *batch;
+    dsvdc_target_t target;
+} dsvdc_job_t;
+
+/* the handler calls of one notification, freed by the worker that finishes
+ * the last one */
+typedef struct dsvdc_batch
+{
+    dsvdc_t *handle;
+    dsvdc_notification_t notification;
+    void (*complete)(dsvdc_t *handle, size_t n_devices, uint64_t elapsed_us,
+                     void *userdata);
+    void *userdata;
+    uint64_t start_us;
+    size_t n_jobs;
+    size_t remaining;
+    dsvdc_job_t jobs[];
+} dsvdc_batch_t;
+
+typedef struct dsvdc_worker
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    dsvdc_job_t *head;
+    dsvdc_job_t *tail;
+    /* queued jobs wait until the previous pool is gone, see
+     * dsvdc_dispatch_release() */
+    bool held;
+    bool stop;
+    struct dsvdc_dispatch *pool;
+} dsvdc_worker_t;
+
+struct dsvdc_dispatch
+{
+    dsvdc_t *handle;
+    /* jobs that were queued and did not finish yet, protected by
+     * idle_mutex, see dsvdc_wait_dispatch() */
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    size_t pending;
+    unsigned int n_workers;
+    dsvdc_worker_t workers[];
+};
+
+static void dsvdc_call_handler(dsvdc_t *handle, const dsvdc_target_t *target,
+                               const dsvdc_notification_t *notification)
+{
+    const dsvdc_device_handlers_t *handlers = target->handlers;
+
+    switch (notification->type)
+    {
+        case DSVDC_NOTIFY_CALL_SCENE:
+            if (handlers->call_scene)
+            {
+                handlers->call_scene(handle, &target->id,
+                        notification->scene, notification->force,
+                        notification->group, notification->zone_id,
+                        target->context);
+            }
+            break;
+
+        case DSVDC_NOTIFY_SAVE_SCENE:
+            if (handlers->save_scene)
+            {
+                handlers->save_scene(handle, &target->id,
+                        notification->scene, notification->group,
+                        notification->zone_id, target->context);
+            }
+            break;
+
+        case DSVDC_NOTIFY_IDENTIFY:
+            if (handlers->identify)
+            {
+                handlers->identify(handle, &target->id, notification->group,
+                        notification->zone_id, target->context);
+            }
+            break;
+
+        case DSVDC_NOTIFY_OUTPUT_CHANNEL_VALUE:
+            if (handlers->output_channel_value)
+            {
+                handlers->output_channel_value(handle, &target->id,
+                        notification->apply, notification->channel,
+                        notification->value, target->context);
+            }
+            break;
+    }
+}
+
+static void dsvdc_job_done(dsvdc_job_t *job)
+{
+    dsvdc_batch_t *batch = job->batch;
+
+    if (__atomic_sub_fetch(&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (batch->complete)
+        {
+            batch->complete(batch->handle, batch->n_jobs,
+                            monotonic_us() - batch->start_us,
+                            batch->userdata);
+        }
+        free(batch);
+    }
+}
+
+static void *dsvdc_worker_thread(void *arg)
+{
+    dsvdc_worker_t *worker = (dsvdc_worker_t *)arg;
+    dsvdc_dispatch_t *pool = worker->pool;
+
+    for (;;)
+    {
+        dsvdc_job_t *job;
+        size_t done = 0;
+
+        pthread_mutex_lock(&worker->mutex);
+        while ((!worker->head || worker->held) && !worker->stop)
+        {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        job = worker->head;
+        worker->head = NULL;
+        worker->tail = NULL;
+        pthread_mutex_unlock(&worker->mutex);
+
+        /* stop only takes effect once the queue ran empty */
+        if (!job)
+        {
+            break;
+        }
+
+        while (job)
+        {
+            dsvdc_job_t *next = job->next;
+            dsvdc_call_handler(pool->handle, &job->target,
+                               &job->batch->notification);
+            dsvdc_job_done(job);
+            job = next;
+            done++;
+        }
+
+        pthread_mutex_lock(&pool->idle_mutex);
+        pool->pending -= done;
+        if (pool->pending == 0)
+        {
+            pthread_cond_broadcast(&pool->idle_cond);
+        }
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+    return NULL;
+}
+
+dsvdc_dispatch_t *dsvdc_dispatch_start(dsvdc_t *handle, unsigned int workers)
+{
+    dsvdc_dispatch_t *pool;
+    unsigned int i;
+
+    pool = calloc(1, sizeof(dsvdc_dispatch_t) +
+                     workers * sizeof(dsvdc_worker_t));
+    if (!pool)
+    {
+        return NULL;
+    }
+
+    pool->handle = handle;
+    pthread_mutex_init(&pool->idle_mutex, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    for (i = 0; i < workers; i++)
+    {
+        dsvdc_worker_t *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->held = true;
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->thread, NULL, dsvdc_worker_thread,
+                           worker) != 0)
+        {
+            log("could not start dispatch worker %u\n", i);
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->mutex);
+            dsvdc_dispatch_stop(pool);
+            return NULL;
+        }
+        pool->n_workers++;
+    }
+    return pool;
+}
+
+void dsvdc_dispatch_stop(dsvdc_dispatch_t *pool)
+{
+    unsigned int i;
+
+    if (!pool)
+    {
+        return;
+    }
+
+    for (i = 0; i < pool->n_workers; i++)
+    {
+        dsvdc_worker_t *worker = &pool->workers[i];
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->stop = true;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    for (i = 0; i < pool->n_workers; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_cond_destroy(&pool->workers[i].cond);
+        pthread_mutex_destroy(&pool->workers[i].mutex);
+    }
+
+    pthread_cond_destroy(&pool->idle_cond);
+    pthread_mutex_destroy(&pool->idle_mutex);
+    free(pool);
+}
+
+void dsvdc_dispatch_release(dsvdc_dispatch_t *pool)
+{
+    unsigned int i;
+
+    if (!pool)
+    {
+        return;
+    }
+
+    for (i = 0; i < pool->n_workers; i++)
+    {
+        dsvdc_worker_t *worker = &pool->workers[i];
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->held = false;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+/* waits until dsvdc_set_dispatch_workers() stopped the previous pool, must
+ * be called without the handle mutex */
+static void dsvdc_dispatch_wait_draining(dsvdc_t *handle)
+{
+    pthread_mutex_lock(&handle->dispatch_mutex);
+    pthread_mutex_unlock(&handle->dispatch_mutex);
+}
+
+/* hands the jobs to the workers of their devices, with one lock per worker
+ * and not per job */
+static void dsvdc_dispatch_queue(dsvdc_dispatch_t *pool, dsvdc_batch_t *batch)
+{
+    dsvdc_job_t *head[MAX_DISPATCH_WORKERS] = { NULL };
+    dsvdc_job_t *tail[MAX_DISPATCH_WORKERS];
+    unsigned int w;
+    size_t i;
+
+    pthread_mutex_lock(&pool->idle_mutex);
+    pool->pending += batch->n_jobs;
+    pthread_mutex_unlock(&pool->idle_mutex);
+
+    for (i = 0; i < batch->n_jobs; i++)
+    {
+        dsvdc_job_t *job = &batch->jobs[i];
+
+        w = dsvdc_dsuid_hash(&job->target.id) % pool->n_workers;
+        job->next = NULL;
+        if (head[w])
+        {
+            tail[w]->next = job;
+        }
+        else
+        {
+            head[w] = job;
+        }
+        tail[w] = job;
+    }
+
+    for (w = 0; w < pool->n_workers; w++)
+    {
+        dsvdc_worker_t *worker = &pool->workers[w];
+
+        if (!head[w])
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&worker->mutex);
+        if (worker->tail)
+        {
+            worker->tail->next = head[w];
+        }
+        else
+        {
+            worker->head = head[w];
+        }
+        worker->tail = tail[w];
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+void dsvdc_dispatch_targets(dsvdc_t *handle, const dsvdc_target_t *targets,
+                            size_t n_targets,
+                            const dsvdc_notification_t *notification)
+{
+    dsvdc_callbacks_t cb;
+    dsvdc_batch_t *batch = NULL;
+    bool draining = false;
+    uint64_t start = monotonic_us();
+    size_t i;
+
+    dsvdc_get_callbacks(handle, &cb);
+
+    /* the pool can not go away while the jobs are queued */
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (handle->dispatch)
+    {
+        batch = malloc(sizeof(dsvdc_batch_t) +
+                       n_targets * sizeof(dsvdc_job_t));
+        if (batch)
+        {
+            batch->handle = handle;
+            batch->notification = *notification;
+            batch->complete = cb.dispatch_complete;
+            batch->userdata = cb.userdata;
+            batch->start_us = start;
+            batch->n_jobs = n_targets;
+            batch->remaining = n_targets;
+            for (i = 0; i < n_targets; i++)
+            {
+                batch->jobs[i].batch = batch;
+                batch->jobs[i].target = targets[i];
+            }
+            dsvdc_dispatch_queue(handle->dispatch, batch);
+        }
+        else
+        {
+            log("could not queue %zu handler calls, calling them "
+                "directly\n", n_targets);
+        }
+    }
+    else
+    {
+        draining = handle->dispatch_draining;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (batch)
+    {
+        return;
+    }
+
+    /* workers that were just stopped may still run earlier handler calls of
+     * the same devices */
+    if (draining)
+    {
+        dsvdc_dispatch_wait_draining(handle);
+    }
+
+    for (i = 0; i < n_targets; i++)
+    {
+        dsvdc_call_handler(handle, &targets[i], notification);
+    }
+
+    if (cb.dispatch_complete)
+    {
+        cb.dispatch_complete(handle, n_targets, monotonic_us() - start,
+                             cb.userdata);
+    }
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+/* public interface */
+
+int dsvdc_set_dispatch_workers(dsvdc_t *handle, unsigned int workers)
+{
+    dsvdc_dispatch_t *pool = NULL;
+    dsvdc_dispatch_t *old;
+
+    if (!handle || (workers > MAX_DISPATCH_WORKERS))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dispatch_mutex);
+    if (workers > 0)
+    {
+        pool = dsvdc_dispatch_start(handle, workers);
+        if (!pool)
+        {
+            pthread_mutex_unlock(&handle->dispatch_mutex);
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    old = handle->dispatch;
+    handle->dispatch = pool;
+    handle->dispatch_draining = (old != NULL);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    /* the handlers may call into the library, wait for them unlocked, the
+     * new workers and handlers that are called directly only start once
+     * the old ones are done so that the handler calls of a device are not
+     * reordered */
+    dsvdc_dispatch_stop(old);
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    handle->dispatch_draining = false;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    dsvdc_dispatch_release(pool);
+    pthread_mutex_unlock(&handle->dispatch_mutex);
+    return DSVDC_OK;
+}
+
+void dsvdc_wait_dispatch(dsvdc_t *handle)
+{
+    dsvdc_dispatch_t *pool;
+
+    if (!handle)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (handle->dispatch_draining)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        dsvdc_dispatch_wait_draining(handle);
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    }
+
+    pool = handle->dispatch;
+    if (!pool)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->idle_mutex);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+    }
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
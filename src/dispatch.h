@@ -0,0 +1,83 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_DISPATCH_H__
+#define __DSVDC_DISPATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* upper limit for dsvdc_set_dispatch_workers() */
+#define MAX_DISPATCH_WORKERS    64
+
+/* the handler of dsvdc_device_handlers_t a notification goes to */
+typedef enum
+{
+    DSVDC_NOTIFY_CALL_SCENE,
+    DSVDC_NOTIFY_SAVE_SCENE,
+    DSVDC_NOTIFY_IDENTIFY,
+    DSVDC_NOTIFY_OUTPUT_CHANNEL_VALUE
+} dsvdc_notify_type_t;
+
+/* parameters of a notification, only the ones of its type are used */
+typedef struct dsvdc_notification
+{
+    dsvdc_notify_type_t type;
+    int32_t scene;
+    bool force;
+    int32_t group;
+    int32_t zone_id;
+    bool apply;
+    int32_t channel;
+    double value;
+} dsvdc_notification_t;
+
+/* Optional pool of worker threads the per device handlers run on. Every
+ * device is served by one worker that is picked by the hash of its dSUID,
+ * so the handler calls of one device keep their order. */
+typedef struct dsvdc_dispatch dsvdc_dispatch_t;
+
+/* The workers of a new pool hold the jobs that are queued for them until
+ * the pool is released. */
+dsvdc_dispatch_t *dsvdc_dispatch_start(dsvdc_t *handle, unsigned int workers);
+void dsvdc_dispatch_release(dsvdc_dispatch_t *pool);
+
+/* Runs the handlers that are still queued and joins the workers. */
+void dsvdc_dispatch_stop(dsvdc_dispatch_t *pool);
+
+/* Calls the handlers of the targets on the workers, or on the calling
+ * thread if there are none. Must be called without the handle mutex. */
+void dsvdc_dispatch_targets(dsvdc_t *handle, const dsvdc_target_t *targets,
+                            size_t n_targets,
+                            const dsvdc_notification_t *notification);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_DISPATCH_H__*/
@@ -0,0 +1,226 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "dsuid.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+static inline int dsvdc_hex_nibble(unsigned char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+
+    c |= 0x20;
+    if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static inline char dsvdc_hex_char(uint8_t nibble)
+{
+    return (nibble < 10) ? '0' + nibble : 'a' + nibble - 10;
+}
+
+#ifdef __SSE2__
+/* 16 hex characters into 8 bytes, false if one of them is not a hex digit */
+static inline bool dsvdc_hex_decode16(const char *in, uint8_t *out)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)in);
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+    /* bytes above 0x7f are negative and fail both ranges */
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(
+                            _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                            _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+    {
+        return false;
+    }
+
+    __m128i value = _mm_or_si128(
+            _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+            _mm_andnot_si128(digit,
+                             _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+    /* every 16 bit lane holds the high nibble in its low byte */
+    __m128i pairs = _mm_or_si128(
+            _mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00ff)), 4),
+            _mm_srli_epi16(value, 8));
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(pairs, pairs));
+    return true;
+}
+
+/* 16 bytes into 32 lower case hex characters */
+static inline void dsvdc_hex_encode16(const uint8_t *in, char *out)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)in);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), mask);
+    __m128i lo = _mm_and_si128(b, mask);
+    __m128i nibbles[2] = { _mm_unpacklo_epi8(hi, lo),
+                           _mm_unpackhi_epi8(hi, lo) };
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        __m128i letters = _mm_and_si128(
+                _mm_cmpgt_epi8(nibbles[i], _mm_set1_epi8(9)),
+                _mm_set1_epi8('a' - '0' - 10));
+        __m128i ascii = _mm_add_epi8(
+                _mm_add_epi8(nibbles[i], _mm_set1_epi8('0')), letters);
+        _mm_storeu_si128((__m128i *)(out + i * 16), ascii);
+    }
+}
+#endif
+
+size_t dsvdc_dsuid_parse_array(char **str, size_t n, dsvdc_dsuid_t *ids)
+{
+    size_t n_ids = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (str[i] && (dsvdc_dsuid_parse(str[i], &ids[n_ids]) == DSVDC_OK))
+        {
+            n_ids++;
+        }
+        else
+        {
+            log("skipping invalid dSUID %s\n", str[i] ? str[i] : "(null)");
+        }
+    }
+    return n_ids;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+/* public interface */
+
+int dsvdc_dsuid_parse(const char *str, dsvdc_dsuid_t *dsuid)
+{
+    size_t i = 0;
+
+    if (!str || !dsuid || (strnlen(str, DSUID_LENGTH + 1) != DSUID_LENGTH))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+#ifdef __SSE2__
+    /* the length check above makes the 16 byte loads safe */
+    for (; i + 16 <= DSUID_LENGTH; i += 16)
+    {
+        if (!dsvdc_hex_decode16(str + i, dsuid->id + i / 2))
+        {
+            return DSVDC_ERR_PARAM;
+        }
+    }
+#endif
+
+    for (; i < DSUID_LENGTH; i += 2)
+    {
+        int hi = dsvdc_hex_nibble(str[i]);
+        int lo = dsvdc_hex_nibble(str[i + 1]);
+        if ((hi < 0) || (lo < 0))
+        {
+            return DSVDC_ERR_PARAM;
+        }
+        dsuid->id[i / 2] = (uint8_t)((hi << 4) | lo);
+    }
+    return DSVDC_OK;
+}
+
+void dsvdc_dsuid_format(const dsvdc_dsuid_t *dsuid, char *str)
+{
+    size_t i = 0;
+
+    if (!dsuid || !str)
+    {
+        return;
+    }
+
+#ifdef __SSE2__
+    for (; i + 16 <= DSVDC_DSUID_BYTES; i += 16)
+    {
+        dsvdc_hex_encode16(dsuid->id + i, str + i * 2);
+    }
+#endif
+
+    for (; i < DSVDC_DSUID_BYTES; i++)
+    {
+        str[i * 2] = dsvdc_hex_char(dsuid->id[i] >> 4);
+        str[i * 2 + 1] = dsvdc_hex_char(dsuid->id[i] & 0x0f);
+    }
+    str[DSUID_LENGTH] = '\0';
+}
+
+bool dsvdc_dsuid_equal(const dsvdc_dsuid_t *a, const dsvdc_dsuid_t *b)
+{
+    uint8_t diff = 0;
+    size_t i;
+
+    /* no early exit, the time does not depend on where they differ */
+    for (i = 0; i < DSVDC_DSUID_BYTES; i++)
+    {
+        diff |= a->id[i] ^ b->id[i];
+    }
+    return diff == 0;
+}
+
+uint32_t dsvdc_dsuid_hash(const dsvdc_dsuid_t *dsuid)
+{
+    uint64_t a;
+    uint64_t b;
+
+    memcpy(&a, dsuid->id, sizeof(a));
+    memcpy(&b, dsuid->id + sizeof(a), sizeof(b));
+
+    /* the 64 bit finalizer of MurmurHash3, dSUIDs that only differ in the
+     * last bytes still spread over all bits */
+    uint64_t h = a ^ (b * 0x9e3779b97f4a7c15ull) ^ dsuid->id[16];
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
@@ -0,0 +1,42 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_DSUID_H__
+#define __DSVDC_DSUID_H__
+
+#include <stddef.h>
+
+#include "dsvdc.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Parses the dSUID strings of a notification into ids, entries that are not
+ * valid are skipped. Returns the number of ids that were written, ids must
+ * have room for n of them. */
+size_t dsvdc_dsuid_parse_array(char **str, size_t n, dsvdc_dsuid_t *ids);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_DSUID_H__*/
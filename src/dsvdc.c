@@ -29,21 +29,27 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <limits.h>
 #include <utlist.h>
 #include <ctype.h>
 
 #include "common.h"
+#include "callbacks.h"
+#include "dispatch.h"
 #include "dsvdc.h"
 #include "sockutil.h"
 #include "msg_processor.h"
+#include "session.h"
+#include "listener.h"
+#include "iothread.h"
 #include "messages.pb-c.h"
 #include "log.h"
+#include "util.h"
 
 #ifdef HAVE_AVAHI
 #include "discovery.h"
@@ -56,37 +62,59 @@ static int dsvdc_setup_handle(uint16_t port, const char *dsuid,
     pthread_mutexattr_t attr;
 
     /* init members */
-    memset(inst->vdsm_dsuid, 0, sizeof(inst->vdsm_dsuid));
     memset(inst->vdc_dsuid, 0, sizeof(inst->vdc_dsuid));
+    inst->transport = DSVDC_TRANSPORT_TCP;
     inst->port = port;
+    inst->unix_path = NULL;
     inst->listen_fd = -1;
-    inst->connected_fd = -1;
+    inst->sessions = NULL;
+    inst->n_sessions = 0;
+    inst->n_established = 0;
+    inst->max_sessions = DEFAULT_MAX_SESSIONS;
+    inst->session_id = 0;
+    inst->rx_frame = NULL;
+    inst->rx_budget = DEFAULT_RX_BUDGET;
+    dsvdc_arena_init(&inst->rx_arena, RX_ARENA_SIZE);
+    inst->tx_buf = NULL;
+    inst->tx_buf_size = 0;
+    inst->tx_buf_busy = false;
+    inst->tx_queue_limit = DEFAULT_TX_QUEUE_LIMIT;
+    inst->tx_cork = 0;
+    inst->tx_done = NULL;
+    inst->tx_done_count = 0;
+    inst->tx_done_size = 0;
+    inst->tx_reporting = false;
+    memset(&inst->stats, 0, sizeof(inst->stats));
+    inst->io_active = false;
+    inst->io_stop = false;
+    memset(&inst->io_events, 0, sizeof(inst->io_events));
+    inst->io_event_fd[0] = -1;
+    inst->io_event_fd[1] = -1;
+    inst->io_backlog = NULL;
+    inst->io_backlog_tail = NULL;
+    memset(&inst->loop, 0, sizeof(inst->loop));
+    inst->loop.epoll_fd = -1;
+    inst->loop.wakeup_fd[0] = -1;
+    inst->loop.wakeup_fd[1] = -1;
     inst->vdsm_push_uri = NULL;
-    inst->requests_list = NULL;
-    inst->last_list_cleanup = time(NULL);
+    dsvdc_wheel_init(&inst->request_timers, monotonic_ms());
+    inst->request_timeout = DEFAULT_REQUEST_TIMEOUT;
+    memset(&inst->request_pool, 0, sizeof(inst->request_pool));
+    dsvdc_registry_init(&inst->registry);
+    inst->dispatch = NULL;
+    inst->dispatch_draining = false;
     inst->request_id = 0;
-    inst->session = 0;
-    inst->callback_userdata = userdata;
 #ifdef HAVE_AVAHI
     inst->avahi_group = NULL;
     inst->avahi_poll = NULL;
     inst->avahi_client = NULL;
     inst->avahi_name = NULL;
     inst->noauto = false;
+    inst->avahi_fds = NULL;
+    inst->avahi_nfds = 0;
+    inst->avahi_timeout = -1;
+    inst->avahi_poll_time = 0;
 #endif
-    inst->vdsm_new_session = NULL;
-    inst->vdsm_end_session = NULL;
-    inst->vdsm_send_ping = NULL;
-    inst->vdsm_send_remove = NULL;
-    inst->vdsm_send_call_scene = NULL;
-    inst->vdsm_send_save_scene = NULL;
-    inst->vdsm_send_undo_scene = NULL;
-    inst->vdsm_send_set_local_prio = NULL;
-    inst->vdsm_send_call_min_scene = NULL;
-    inst->vdsm_send_identify = NULL;
-    inst->vdsm_send_set_control_value = NULL;
-    inst->vdsm_request_get_property = NULL;
-    inst->vdsm_send_output_channel_value = NULL;
 
     if (pthread_mutexattr_init(&attr) != 0)
     {
@@ -115,73 +143,67 @@ static int dsvdc_setup_handle(uint16_t port, const char *dsuid,
 
     pthread_mutexattr_destroy(&attr);
 
-    size_t i;
-    for (i = 0; i < DSUID_LENGTH; i++)
+    if (pthread_mutex_init(&inst->dispatch_mutex, NULL) != 0)
     {
-        if (dsuid[i] == '\0')
-        {
-            break;
-        }
-        inst->vdc_dsuid[i] = tolower(dsuid[i]);
+        log("could not initialize dispatch_mutex: %s\n", strerror(errno));
+        pthread_mutex_destroy(&inst->dsvdc_handle_mutex);
+        free(inst);
+        return DSVDC_ERR_OUT_OF_MEMORY;
     }
-    inst->vdc_dsuid[DSUID_LENGTH] = '\0';
-    inst->last_list_cleanup = time(NULL);
-
-    return DSVDC_OK;
-}
-
-/* walk the requests list and remove obsolete requests */
-static void dsvdc_cleanup_request_list(dsvdc_t *handle, bool connected)
-{
-    cached_request_t *request = NULL;
-    cached_request_t *tmp = NULL;
 
-    int code;
-
-    if (connected)
+    if (dsvdc_reqpool_init(&inst->request_pool, DEFAULT_MAX_REQUESTS) !=
+        DSVDC_OK)
     {
-        code = DSVDC_ERR_TIMEOUT;
+        pthread_mutex_destroy(&inst->dispatch_mutex);
+        pthread_mutex_destroy(&inst->dsvdc_handle_mutex);
+        free(inst);
+        return DSVDC_ERR_OUT_OF_MEMORY;
     }
-    else
+
+    if (dsvdc_callbacks_init(inst, userdata) != DSVDC_OK)
     {
-        code = DSVDC_ERR_NOT_CONNECTED;
+        dsvdc_reqpool_cleanup(&inst->request_pool);
+        pthread_mutex_destroy(&inst->dispatch_mutex);
+        pthread_mutex_destroy(&inst->dsvdc_handle_mutex);
+        free(inst);
+        return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
-    time_t now = time(NULL);
-
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (connected &&
-        (difftime(now, handle->last_list_cleanup) < REQLIST_CHECK_INTERVAL))
+    inst->vdc_id_valid = (dsvdc_dsuid_parse(dsuid, &inst->vdc_id) ==
+                          DSVDC_OK);
+    if (inst->vdc_id_valid)
     {
-        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-        return;
+        dsvdc_dsuid_format(&inst->vdc_id, inst->vdc_dsuid);
     }
-
-    if (handle->requests_list)
+    else
     {
-        LL_FOREACH_SAFE(handle->requests_list, request, tmp)
+        size_t i;
+        for (i = 0; i < DSUID_LENGTH; i++)
         {
-            if (!connected ||
-                (difftime(now, request->timestamp) > DEFAULT_VDSM_MSG_TIMEOUT))
+            if (dsuid[i] == '\0')
             {
-                log("removing request with id %u from list...\n",
-                     request->message_id);
-
-                LL_DELETE(handle->requests_list, request);
-                request->callback(handle, code, request->arg,
-                                  handle->callback_userdata);
-                free(request);
+                break;
             }
+            inst->vdc_dsuid[i] = tolower(dsuid[i]);
         }
+        inst->vdc_dsuid[DSUID_LENGTH] = '\0';
     }
-    handle->last_list_cleanup = time(NULL);
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    return DSVDC_OK;
 }
 
-static void dsvdc_cleanup_handle(dsvdc_t *handle)
+static void dsvdc_remove_unix_path(dsvdc_t *handle)
 {
-    dsvdc_cleanup_request_list(handle, false);
+    if (handle->unix_path)
+    {
+        unlink(handle->unix_path);
+        free(handle->unix_path);
+        handle->unix_path = NULL;
+    }
+}
 
+static void dsvdc_cleanup_handle(dsvdc_t *handle)
+{
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
 
     if (handle->listen_fd > -1)
@@ -189,25 +211,41 @@ static void dsvdc_cleanup_handle(dsvdc_t *handle)
         close(handle->listen_fd);
         handle->listen_fd = -1;
     }
+    dsvdc_remove_unix_path(handle);
+
+    /* pending requests fail with DSVDC_ERR_NOT_CONNECTED, the sessions end
+     * without notification as the handle is going away */
+    dsvdc_callbacks_t *cb = dsvdc_callbacks_edit(handle);
+    if (cb)
+    {
+        cb->vdsm_end_session = NULL;
+        dsvdc_callbacks_publish(handle, cb);
+    }
+    dsvdc_session_cleanup_all(handle);
+    dsvdc_registry_cleanup(&handle->registry);
 
-    if (handle->connected_fd > -1)
+    dsvdc_arena_cleanup(&handle->rx_arena);
+    if (handle->tx_buf)
     {
-        close(handle->connected_fd);
-        handle->connected_fd = -1;
+        free(handle->tx_buf);
+        handle->tx_buf = NULL;
+        handle->tx_buf_size = 0;
+    }
+    if (handle->tx_done)
+    {
+        free(handle->tx_done);
+        handle->tx_done = NULL;
+    }
+    if (handle->rx_frame)
+    {
+        free(handle->rx_frame);
+        handle->rx_frame = NULL;
     }
 
-    handle->vdsm_request_get_property = NULL;
-    handle->vdsm_send_ping = NULL;
-    handle->vdsm_send_remove = NULL;
-    handle->vdsm_send_call_scene = NULL;
-    handle->vdsm_send_save_scene = NULL;
-    handle->vdsm_send_undo_scene = NULL;
-    handle->vdsm_send_set_local_prio = NULL;
-    handle->vdsm_send_call_min_scene = NULL;
-    handle->vdsm_send_identify = NULL;
-    handle->vdsm_send_set_control_value = NULL;
-    handle->vdsm_send_output_channel_value = NULL;
-    handle->callback_userdata = NULL;
+    dsvdc_loop_cleanup(&handle->loop);
+
+    dsvdc_callbacks_cleanup(handle);
+    dsvdc_reqpool_cleanup(&handle->request_pool);
 
     if (handle->vdsm_push_uri)
     {
@@ -215,127 +253,115 @@ static void dsvdc_cleanup_handle(dsvdc_t *handle)
     }
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
     pthread_mutex_destroy(&handle->dsvdc_handle_mutex);
+    pthread_mutex_destroy(&handle->dispatch_mutex);
 }
 
-static int dsvdc_setup_socket(dsvdc_t *handle)
+static int dsvdc_setup_socket(dsvdc_t *handle, const dsvdc_options_t *options)
 {
-    struct sockaddr_in addr;
-    int reuse_on = 1;
     int retcode;
 
     handle->listen_fd = -1;
-    handle->connected_fd = -1;
 
-    struct linger
+    switch (options->transport)
     {
-        int l_on;
-        int l_linger;
-    } linger;
-
-    linger.l_on = 1;
-    linger.l_linger = 30;
+        case DSVDC_TRANSPORT_TCP:
+            retcode = dsvdc_listen_tcp(AF_INET, &handle->port,
+                                       handle->max_sessions);
+            break;
+        case DSVDC_TRANSPORT_TCP6:
+            retcode = dsvdc_listen_tcp(AF_INET6, &handle->port,
+                                       handle->max_sessions);
+            break;
+        case DSVDC_TRANSPORT_UNIX:
+            retcode = dsvdc_listen_unix(options->path, handle->max_sessions);
+            if ((retcode >= 0) && (options->path[0] != '@'))
+            {
+                handle->unix_path = strdup(options->path);
+            }
+            break;
+        default:
+            log("unsupported transport %d\n", options->transport);
+            retcode = DSVDC_ERR_PARAM;
+            break;
+    }
 
-    handle->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (handle->listen_fd < 0)
+    if (retcode < 0)
     {
-        log("could not create socket. %s\n", strerror(errno));
-        return DSVDC_ERR_SOCKET;
+        return retcode;
     }
 
-    retcode = setsockopt(handle->listen_fd, SOL_SOCKET, SO_REUSEADDR,
-                         (const char*)&reuse_on, sizeof(int));
-    if (retcode < 0)
+    handle->listen_fd = retcode;
+    handle->transport = options->transport;
+
+    retcode = dsvdc_loop_init(&handle->loop, DSVDC_IO_BACKEND_DEFAULT);
+    if (retcode == DSVDC_OK)
     {
-        close(handle->listen_fd);
-        handle->listen_fd = -1;
-        log("could not set socket option SO_REUSEDDR. %s\n", strerror(errno));
-        return DSVDC_ERR_SOCKET;
+        retcode = dsvdc_loop_add(&handle->loop, handle->listen_fd,
+                                 DSVDC_EV_READ);
     }
 
-    retcode = setsockopt(handle->listen_fd, SOL_SOCKET, SO_LINGER,
-                         (const char*)&linger, sizeof(linger));
-    if (retcode < 0)
+    if (retcode != DSVDC_OK)
     {
+        dsvdc_loop_cleanup(&handle->loop);
+        dsvdc_remove_unix_path(handle);
         close(handle->listen_fd);
         handle->listen_fd = -1;
-        log("could not set socket option SO_LINGER. %s\n", strerror(errno));
-        return DSVDC_ERR_SOCKET;
+        log("failed to set up event loop\n");
+        return retcode;
     }
 
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
+    return DSVDC_OK;
+}
 
-    int portsearch = 0;
-    if (handle->port == 0)
-    {
-        handle->port = DEFAULT_VDC_PORT;
-        portsearch = 1;
-    }
-    log("setting start port to %d\n", handle->port);
-    addr.sin_port = htons(handle->port);
+/* Watch the connections for write readiness only while something is queued,
+ * this function must be called with an already locked handle mutex */
+static void dsvdc_update_write_interest(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+    size_t bytes = 0;
+    size_t messages = 0;
 
-    while (1)
+    /* nothing can be handed to the application, stop reading until it
+     * caught up */
+    bool blocked = dsvdc_io_thread_self(handle) && dsvdc_io_blocked(handle);
+
+    LL_FOREACH(handle->sessions, session)
     {
-        retcode = bind(handle->listen_fd, (struct sockaddr *)&addr,
-                       sizeof(addr));
-        if (retcode < 0)
+        if (session->fd < 0)
         {
-            if ((portsearch == 1) && (errno == EADDRINUSE) &&
-               (handle->port < (USHRT_MAX - 1)))
-            {
-                addr.sin_port = htons(++handle->port);
-                continue;
-            }
+            continue;
         }
 
-        break;
-    } /* "while" port search loop */
-
-    if (retcode < 0)
-    {
-        close(handle->listen_fd);
-        handle->listen_fd = -1;
-        log("failed to bind to socket. %s\n", strerror(errno));
-        return DSVDC_ERR_SOCKET;
-    }
-
-    log("bound to port %d\n", handle->port);
+        int events = blocked ? 0 : DSVDC_EV_READ;
+        if (dsvdc_txq_bytes(&session->txq) > 0)
+        {
+            events |= DSVDC_EV_WRITE;
+        }
 
-    retcode = listen(handle->listen_fd, 1);
-    if (retcode < 0)
-    {
-        close(handle->listen_fd);
-        handle->listen_fd = -1;
-        log("failed to listen on socket. %s\n", strerror(errno));
-        return DSVDC_ERR_SOCKET;
+        dsvdc_loop_add(&handle->loop, session->fd, events);
+        bytes += dsvdc_txq_bytes(&session->txq);
+        messages += dsvdc_txq_messages(&session->txq);
     }
 
-    return DSVDC_OK;
+    /* the send queues belong to the I/O thread, others read this copy */
+    __atomic_store_n(&handle->io_tx_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&handle->io_tx_messages, messages, __ATOMIC_RELAXED);
 }
 
-/* this function must be called with an already locked handle mutex */
-static void dsvdc_end_session(dsvdc_t *handle)
+void dsvdc_options_init(dsvdc_options_t *options)
 {
-    if (handle->session)
+    if (!options)
     {
-        handle->session = false;
-        if (handle->vdsm_end_session)
-        {
-            handle->vdsm_end_session(handle, handle->callback_userdata);
-        }
+        return;
     }
+
+    memset(options, 0, sizeof(dsvdc_options_t));
+    options->transport = DSVDC_TRANSPORT_TCP;
 }
 
-int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
-              bool noauto, void *userdata, dsvdc_t **handle)
+int dsvdc_new_ex(const char *dsuid, const dsvdc_options_t *options,
+                 dsvdc_t **handle)
 {
-
-#ifndef HAVE_AVAHI
-    (void)name;
-    (void)noauto;
-#endif
-
     *handle = NULL;
 
 
@@ -345,6 +371,12 @@ int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
         return DSVDC_ERR_PARAM;
     }
 
+    if (options == NULL)
+    {
+        log("could not initialise dsvdc instance, missing options\n");
+        return DSVDC_ERR_PARAM;
+    }
+
     dsvdc_t *inst = malloc(sizeof(struct dsvdc));
     if (!inst)
     {
@@ -352,24 +384,39 @@ int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
-    int ret = dsvdc_setup_handle(port, dsuid, userdata, inst);
+    int ret = dsvdc_setup_handle(options->port, dsuid, options->userdata,
+                                 inst);
     if (ret != DSVDC_OK)
     {
         return ret;
     }
 
-    ret = dsvdc_setup_socket(inst);
+    ret = dsvdc_setup_socket(inst, options);
     if (ret != DSVDC_OK)
     {
+        dsvdc_callbacks_cleanup(inst);
+        dsvdc_reqpool_cleanup(&inst->request_pool);
+        pthread_mutex_destroy(&inst->dispatch_mutex);
         pthread_mutex_destroy(&inst->dsvdc_handle_mutex);
         free(inst);
         return ret;
     }
 
 #ifdef HAVE_AVAHI
-    ret = dsvdc_discovery_init(inst, name, noauto);
+    /* the service record announces a TCP port, local sockets are configured
+     * on the vdSM side */
+    if (inst->transport != DSVDC_TRANSPORT_UNIX)
+    {
+        ret = dsvdc_discovery_init(inst, options->name, options->noauto);
+    }
     if (ret != DSVDC_OK)
     {
+        dsvdc_loop_cleanup(&inst->loop);
+        dsvdc_remove_unix_path(inst);
+        close(inst->listen_fd);
+        dsvdc_callbacks_cleanup(inst);
+        dsvdc_reqpool_cleanup(&inst->request_pool);
+        pthread_mutex_destroy(&inst->dispatch_mutex);
         pthread_mutex_destroy(&inst->dsvdc_handle_mutex);
         free(inst);
         return ret;
@@ -378,366 +425,1137 @@ int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
 
     *handle = inst;
     return DSVDC_OK;
-};
+}
+
+int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
+              bool noauto, void *userdata, dsvdc_t **handle)
+{
+    dsvdc_options_t options;
+
+    dsvdc_options_init(&options);
+    options.port = port;
+    options.name = name;
+    options.noauto = noauto;
+    options.userdata = userdata;
+
+    return dsvdc_new_ex(dsuid, &options, handle);
+}
 
 bool dsvdc_has_session(dsvdc_t *handle)
 {
     bool connected;
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    connected = (handle->connected_fd > -1);
-    connected &= handle->session;
+    connected = dsvdc_session_any_established(handle);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
     return connected;
 }
 
-void dsvdc_work(dsvdc_t *handle, unsigned short timeout)
+static void dsvdc_accept_connection(dsvdc_t *handle)
 {
-    fd_set rfds;
-    int retcode;
-    struct sockaddr fsaddr;
+    struct sockaddr_storage fsaddr;
     socklen_t fromlen;
-    int max_fd;
-    bool locked = true;
 
-    if (!handle)
+    memset(&fsaddr, 0, sizeof(fsaddr));
+    fromlen = sizeof(fsaddr);
+
+    int new_fd = accept(handle->listen_fd, (struct sockaddr *)&fsaddr,
+                        &fromlen);
+    if (new_fd < 0)
     {
-        log("invalid (NULL) handle parameter\n");
+        log("could not accept new connection. %s\n", strerror(errno));
         return;
     }
 
-#ifdef HAVE_AVAHI
-    dsvdc_discovery_work(handle);
-#endif
-
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    int connected = (handle->connected_fd >= 0);
 
-    /* if we are connected, respect the timeouts, otherwise wipe the list */
-    dsvdc_cleanup_request_list(handle, connected);
+    /* all session slots are taken, reject the new connection */
+    if (handle->n_sessions >= handle->max_sessions)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        log("vDC already serves %u vdSM sessions, "
+            "rejecting new incoming connection.\n", handle->max_sessions);
+        dsvdc_refuse_connection(new_fd,
+                VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE);
+        close(new_fd);
+        return;
+    }
 
-    max_fd = handle->connected_fd;
+    /* messages are small request/response pairs and every message is sent
+     * in one write, do not let Nagle hold them back */
+    if (handle->transport != DSVDC_TRANSPORT_UNIX)
+    {
+        int nodelay = 1;
+        setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                   sizeof(nodelay));
+    }
 
-    struct timeval tv;
+    /* frames are processed one at a time, all sessions share the buffer */
+    if (!handle->rx_frame)
+    {
+        handle->rx_frame = malloc(MAX_DATA_SIZE);
+    }
 
-    FD_ZERO(&rfds);
-    FD_SET(handle->listen_fd, &rfds);
-    if (handle->connected_fd > -1)
+    dsvdc_session_t *session = NULL;
+    if (handle->rx_frame)
     {
-        FD_SET(handle->connected_fd, &rfds);
+        session = dsvdc_session_new(handle, new_fd);
     }
 
-    if (timeout != 0)
+    if (!session)
+    {
+        log("could not allocate receive buffer, closing new connection.\n");
+        close(new_fd);
+    }
+    else if (dsvdc_loop_add(&handle->loop, new_fd, DSVDC_EV_READ) != DSVDC_OK)
     {
-        tv.tv_sec = timeout;
+        log("could not register new connection, closing it.\n");
+        dsvdc_session_close(session);
     }
     else
     {
-        tv.tv_sec = 0;
+        log("accepted vdSM connection as session %u\n", session->id);
+    }
+
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+/* Looks at the front of the receive ring, returns 1 and the payload if a
+ * complete frame is available, 0 if more data is needed and -1 if the frame
+ * is invalid. */
+static int dsvdc_next_frame(dsvdc_session_t *session,
+                            const unsigned char **data, uint16_t *size)
+{
+    uint16_t netlen;
+    size_t used = dsvdc_ring_used(&session->rx_ring);
+
+    if (used < sizeof(uint16_t))
+    {
+        return 0;
     }
 
-    tv.tv_usec = 0;
+    memcpy(&netlen, dsvdc_ring_peek(&session->rx_ring, 0, sizeof(uint16_t),
+                                    (unsigned char *)&netlen),
+           sizeof(uint16_t));
+    *size = ntohs(netlen);
 
-    max_fd = (handle->listen_fd > max_fd ? handle->listen_fd : max_fd);
+    /* if the data is too big (i.e. protocol got out of sync or someone is
+     * messing with us), then reset the connection */
+    if (*size > MAX_DATA_SIZE)
+    {
+        log("message (%u) exceeds allowed size, resetting connection.\n",
+            *size);
+        return -1;
+    }
 
-    retcode = select(max_fd + 1, &rfds, NULL, NULL, &tv);
+    if (used < sizeof(uint16_t) + *size)
+    {
+        return 0;
+    }
 
-#ifdef DEBUG
-        if ((retcode < 0) && (errno != EINTR))
-        {
-            log("select returned %d: %s\n", retcode, strerror(errno));
-        }
-#endif
+    *data = dsvdc_ring_peek(&session->rx_ring, sizeof(uint16_t), *size,
+                            session->handle->rx_frame);
+    return 1;
+}
+
+/* true if a complete frame is waiting in the receive ring, i.e. the budget
+ * was exhausted in the last iteration */
+static bool dsvdc_rx_pending(dsvdc_session_t *session)
+{
+    const unsigned char *data;
+    uint16_t size;
 
-    if (retcode <= 0)
+    if (session->fd < 0)
     {
-        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-        return;
+        return false;
     }
 
-    /* incoming connection */
-    if (FD_ISSET(handle->listen_fd, &rfds))
+    /* the I/O thread waits for the application to make room */
+    if (dsvdc_io_thread_self(session->handle) &&
+        dsvdc_io_blocked(session->handle))
     {
-        memset(&fsaddr, 0, sizeof(struct sockaddr));
-        fromlen = sizeof(struct sockaddr);
+        return false;
+    }
 
-        int new_fd = accept(handle->listen_fd, &fsaddr, &fromlen);
-        if (new_fd < 0)
+    return (dsvdc_next_frame(session, &data, &size) == 1);
+}
+
+/* Processes up to rx_budget complete frames. When the ring runs out of
+ * complete frames everything the socket has is pulled in with one scattered
+ * recv, the socket is never read in a blocking way. A partial frame stays in
+ * the ring until the rest of it arrives. Returns the number of processed
+ * messages. */
+static unsigned int dsvdc_receive_frames(dsvdc_session_t *session, int fd,
+                                         unsigned int *syscalls)
+{
+    dsvdc_t *handle = session->handle;
+    struct iovec iov[2];
+    const unsigned char *data;
+    unsigned int processed = 0;
+    bool drained = false;
+    bool io = dsvdc_io_thread_self(handle);
+    uint16_t size;
+    size_t len;
+
+    while ((handle->rx_budget == 0) || (processed < handle->rx_budget))
+    {
+        int ret = dsvdc_next_frame(session, &data, &size);
+        if (ret < 0)
         {
-            log("could not accept new connection. %s\n", strerror(errno));
+            pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+            dsvdc_session_close(session);
+            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+            break;
         }
-        else
+
+        if (ret == 1)
         {
-            /* we already have an active connection, reject the new one */
-            if (handle->connected_fd >= 0)
+            if (io && (size > 0))
             {
-                log("vDC is already connected to the vdSM, "
-                    "rejecting new incoming connection.\n");
-                dsvdc_t fake_handle;
-                if (dsvdc_setup_handle(handle->port, handle->vdc_dsuid,
-                    NULL, &fake_handle) == DSVDC_OK)
+                /* decoded by the application thread, the frame stays in the
+                 * ring while there is no room for it */
+                if (!dsvdc_io_post_frame(session, data, size))
                 {
-
-                    fake_handle.connected_fd = new_fd;
-                    dsvdc_send_error_message(&fake_handle,
-                            VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
-                            RESERVED_REQUEST_ID);
-                    dsvdc_cleanup_handle(&fake_handle);
-                } else {
-                    close(new_fd);
+                    break;
                 }
             }
-            else
+            else if (size > 0)
             {
-                handle->connected_fd = new_fd;
+                dsvdc_process_message(handle, session, (unsigned char *)data,
+                                      size);
             }
+            processed++;
+
+            /* connection was closed while processing the message, i.e. BYE */
+            if (session->fd != fd)
+            {
+                break;
+            }
+
+            dsvdc_ring_consume(&session->rx_ring, sizeof(uint16_t) + size);
+            continue;
         }
-    }
 
-    if (connected && FD_ISSET(handle->connected_fd, &rfds))
-    {
-        uint16_t size;
-        size_t len;
-        retcode = sockread(handle->connected_fd,
-                            (unsigned char *)(&size),
-                             sizeof(uint16_t), timeout, &len);
-        /* if data packet length could not be read, or the data is too big (i.e.
-         * protocol got out of sync or someone is messing with us), then
-         * reset the connection */
-        if ((retcode != socket_ok) || (len != sizeof(uint16_t)) ||
-           (ntohs(size) > MAX_DATA_SIZE))
+        /* a short read means the socket is empty, don't ask again */
+        if (drained)
         {
-            close(handle->connected_fd);
-            handle->connected_fd = -1;
-            log("could not read incoming message length or "
-                "message (%u) exceeds allowed size, resetting connection.\n",
-                ntohs(size));
-            dsvdc_end_session(handle);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-            return;
+            break;
         }
 
-        size = ntohs(size);
-        if (size > 0)
-        {
-            unsigned char *data = malloc(size);
-            if (!data)
-            {
-                close(handle->connected_fd);
-                handle->connected_fd = -1;
-
-                log("could not allocate memory for incoming "
-                    "message, resetting connection.\n");
-                dsvdc_end_session(handle);
-                pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-                return;
-            }
+        int n = dsvdc_ring_write_iov(&session->rx_ring, iov);
+        size_t space = dsvdc_ring_space(&session->rx_ring);
 
-            retcode = sockread(handle->connected_fd, data, size, timeout, &len);
-            if ((retcode != socket_ok) || ((uint16_t)len != size))
-            {
-                close(handle->connected_fd);
-                handle->connected_fd = -1;
-                free(data);
-
-                log("could not read incoming message, resetting connection.\n");
-                dsvdc_end_session(handle);
-                pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-                return;
-            }
+        (*syscalls)++;
+        if (sockrecv(fd, iov, n, &len) != socket_ok)
+        {
+            log("could not read from vdSM connection, "
+                "resetting connection.\n");
+            pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+            dsvdc_session_close(session);
             pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-            locked = false;
-            dsvdc_process_message(handle, data, size);
-            free(data);
+            break;
         }
-    }
 
-    if (locked)
-    {
-        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        if (len == 0)
+        {
+            break;
+        }
+
+        dsvdc_ring_commit(&session->rx_ring, len);
+        drained = (len < space);
     }
+
+    return processed;
 }
 
-void dsvdc_set_new_session_callback(dsvdc_t *handle,
-        void (*function)(dsvdc_t *handle, void *userdata))
+static void dsvdc_read_messages(dsvdc_session_t *session)
 {
-    if (!handle)
+    dsvdc_t *handle = session->handle;
+
+    /* the rings and the arena are only touched by the thread that drives the
+     * loop, no need to hold the mutex while processing */
+    int fd = session->fd;
+    if (fd < 0)
     {
         return;
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_new_session = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-}
 
-void dsvdc_set_end_session_callback(dsvdc_t *handle,
-        void (*function)(dsvdc_t *handle, void *userdata))
-{
-    if (!handle)
+    unsigned int syscalls = 0;
+    unsigned int processed = dsvdc_receive_frames(session, fd, &syscalls);
+
+    DSVDC_STAT_ADD(handle, rx_syscalls, syscalls);
+
+    /* in I/O thread mode messages are counted when they are decoded */
+    if (!dsvdc_io_thread_self(handle))
     {
-        return;
+        DSVDC_STAT_ADD(handle, rx_messages, processed);
+        __atomic_store_n(&handle->stats.rx_decoder_allocs,
+                         handle->rx_arena.n_allocs, __ATOMIC_RELAXED);
+        __atomic_store_n(&handle->stats.rx_heap_allocs,
+                         handle->rx_arena.n_heap_allocs, __ATOMIC_RELAXED);
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_end_session = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-
-void dsvdc_set_ping_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, const char *dsuid,
-                                         void *userdata))
+static void dsvdc_write_messages(dsvdc_session_t *session)
 {
-    if (!handle)
+    dsvdc_t *handle = session->handle;
+
+    /* the I/O thread owns the send queues and writes without the mutex */
+    bool io = dsvdc_io_thread_self(handle);
+    if (!io)
     {
-        return;
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_ping = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-}
 
-void dsvdc_set_remove_callback(dsvdc_t *handle,
-                        bool (*function)(dsvdc_t *handle, const char *dsuid,
-                                         void *userdata))
-{
-    if (!handle)
+    if (dsvdc_flush_send_queue(session) != DSVDC_OK)
     {
-        return;
+        log("could not write to vdSM connection, resetting connection.\n");
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        dsvdc_session_close(session);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_remove = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-}
 
-void dsvdc_set_call_scene_notification_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t scene,
-                                         bool force, int32_t group,
-                                         int32_t zone_id, void *userdata))
-{
-    if (!handle)
+    if (!io)
     {
-        return;
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        dsvdc_report_send_done(handle);
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_call_scene = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-void dsvdc_set_save_scene_notification_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t scene,
-                                         int32_t group, int32_t zone_id,
-                                         void *userdata))
+/* run everything that is due independently of socket events */
+static void dsvdc_run_timers(dsvdc_t *handle)
 {
-    if (!handle)
-    {
-        return;
-    }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_save_scene = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+#ifdef HAVE_AVAHI
+    dsvdc_discovery_work(handle);
+#endif
+
+    dsvdc_expire_requests(handle);
 }
 
-void dsvdc_set_undo_scene_notification_callback(dsvdc_t *handle,
-        void (*function)(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
-                         int32_t scene, int32_t group, int32_t zone_id,
-                         void *userdata))
+/* Continue with frames that were left over due to the budget in sessions
+ * that were not read in this iteration, then free the sessions that were
+ * closed. */
+static void dsvdc_read_pending(dsvdc_t *handle)
 {
-    if (!handle)
+    dsvdc_session_t *session;
+
+    LL_FOREACH(handle->sessions, session)
     {
-        return;
+        if (!session->rx_visited && dsvdc_rx_pending(session))
+        {
+            dsvdc_read_messages(session);
+        }
+        session->rx_visited = false;
     }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_undo_scene = function;
+    dsvdc_session_reap(handle);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-void dsvdc_set_local_priority_notification_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t scene,
-                                         int32_t group, int32_t zone_id,
-                                         void *userdata))
+/* returns true if the descriptor belongs to the library and was handled,
+ * all other registered descriptors belong to avahi */
+static bool dsvdc_dispatch_event(dsvdc_t *handle, int fd, int events)
 {
-    if (!handle)
+    if (fd == handle->listen_fd)
     {
-        return;
+        dsvdc_accept_connection(handle);
+        return true;
     }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_set_local_prio = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    /* sessions are only added and removed by the thread running the loop */
+    dsvdc_session_t *session = dsvdc_session_find_fd(handle, fd);
+    if (session)
+    {
+        if (events & DSVDC_EV_WRITE)
+        {
+            dsvdc_write_messages(session);
+        }
+        if (events & (DSVDC_EV_READ | DSVDC_EV_ERROR))
+        {
+            session->rx_visited = true;
+            dsvdc_read_messages(session);
+        }
+        return true;
+    }
+
+    if (dsvdc_loop_check_wakeup(&handle->loop, fd))
+    {
+        /* only interrupted the wait, the interest set is updated before the
+         * next one */
+        return true;
+    }
+
+    return false;
 }
 
-void dsvdc_set_call_min_scene_notification_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t group,
-                                         int32_t zone_id, void *userdata))
+/* Hand over to the loop what the application threads left for the I/O
+ * thread: events that did not fit into the queue, outgoing messages and
+ * sessions to close. */
+static void dsvdc_io_prepare(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+
+    dsvdc_io_flush_backlog(handle);
+    dsvdc_io_flush_sends(handle);
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (session->close_pending && (session->fd > -1))
+        {
+            dsvdc_session_close(session);
+        }
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+/* one iteration of the loop, waits up to wait milliseconds for events */
+static void dsvdc_iterate(dsvdc_t *handle, int wait)
+{
+    dsvdc_loop_event_t events[DSVDC_LOOP_MAX_EVENTS];
+    bool discovery = false;
+    int i;
+    int n;
+
+    if (dsvdc_io_thread_self(handle))
+    {
+        dsvdc_io_prepare(handle);
+    }
+
+    dsvdc_run_timers(handle);
+
+    /* wake up early if avahi or the request list needs attention */
+    int next = dsvdc_next_timeout_ms(handle);
+    if ((next >= 0) && (next < wait))
+    {
+        wait = next;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    dsvdc_update_write_interest(handle);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    /* descriptors are registered with the loop, so there is no need to hold
+     * the handle mutex while waiting, senders must not be blocked by us.
+     * Senders that queue a message wake us up through the loop. */
+    n = dsvdc_loop_wait(&handle->loop, wait, events, DSVDC_LOOP_MAX_EVENTS);
+
+    for (i = 0; i < n; i++)
+    {
+        if (!dsvdc_dispatch_event(handle, events[i].fd, events[i].events))
+        {
+            discovery = true;
+        }
+    }
+
+    dsvdc_read_pending(handle);
+
+    /* the wait may have been shortened for a request timeout, fail the
+     * requests in this call rather than in the next one */
+    dsvdc_expire_requests(handle);
+
+#ifdef HAVE_AVAHI
+    if (discovery)
+    {
+        dsvdc_discovery_work(handle);
+    }
+#else
+    (void)discovery;
+#endif
+
+    /* messages that were dropped when a session was closed */
+    if (!dsvdc_io_thread_self(handle))
+    {
+        dsvdc_report_send_done(handle);
+    }
+}
+
+void dsvdc_work(dsvdc_t *handle, unsigned short timeout)
 {
     if (!handle)
     {
+        log("invalid (NULL) handle parameter\n");
         return;
     }
+
+    /* the I/O thread does the work, callbacks are run here */
+    if (dsvdc_io_mode(handle))
+    {
+        dsvdc_io_dispatch(handle, timeout * 1000);
+        return;
+    }
+
+    dsvdc_iterate(handle, timeout * 1000);
+}
+
+static void *dsvdc_io_thread(void *arg)
+{
+    dsvdc_t *handle = (dsvdc_t *)arg;
+
+    dsvdc_io_set_thread(handle);
+    while (!__atomic_load_n(&handle->io_stop, __ATOMIC_ACQUIRE))
+    {
+        dsvdc_iterate(handle, IO_THREAD_TIMEOUT);
+    }
+
+    return NULL;
+}
+
+int dsvdc_start_io_thread(dsvdc_t *handle)
+{
+    if (!handle)
+    {
+        log("invalid (NULL) handle parameter\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    if (__atomic_load_n(&handle->io_active, __ATOMIC_ACQUIRE))
+    {
+        log("I/O thread is already running\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    int ret = dsvdc_io_init(handle);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    /* messages that are sent before the thread runs wait in its queue */
+    __atomic_store_n(&handle->io_active, true, __ATOMIC_RELEASE);
+    if (pthread_create(&handle->io_thread, NULL, dsvdc_io_thread,
+                       handle) != 0)
+    {
+        log("could not start I/O thread: %s\n", strerror(errno));
+        __atomic_store_n(&handle->io_active, false, __ATOMIC_RELEASE);
+        dsvdc_io_cleanup(handle);
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    log("started I/O thread\n");
+    return DSVDC_OK;
+}
+
+int dsvdc_stop_io_thread(dsvdc_t *handle)
+{
+    if (!handle)
+    {
+        log("invalid (NULL) handle parameter\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    if (!dsvdc_io_mode(handle))
+    {
+        log("I/O thread is not running or can not stop itself\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    __atomic_store_n(&handle->io_stop, true, __ATOMIC_RELEASE);
+    dsvdc_loop_wakeup(&handle->loop);
+    pthread_join(handle->io_thread, NULL);
+    __atomic_store_n(&handle->io_active, false, __ATOMIC_RELEASE);
+
+    /* the caller drives the loop again, finish what the threads left */
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_call_min_scene= function;
+    dsvdc_io_flush_sends(handle);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    do
+    {
+        dsvdc_io_flush_backlog(handle);
+        dsvdc_io_dispatch(handle, 0);
+    } while (handle->io_backlog);
+
+    dsvdc_io_cleanup(handle);
+    log("stopped I/O thread\n");
+    return DSVDC_OK;
 }
 
-void dsvdc_set_identify_notification_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t group,
-                                         int32_t zone_id, void *userdata))
+int dsvdc_get_pollfds(dsvdc_t *handle, struct pollfd *fds, size_t *nfds)
 {
+    size_t i;
+
+    if (!handle || !nfds)
+    {
+        log("invalid (NULL) parameter\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    /* only the event pipe of the I/O thread needs to be watched */
+    if (dsvdc_io_mode(handle))
+    {
+        if (fds && (*nfds > 0))
+        {
+            fds[0].fd = handle->io_event_fd[0];
+            fds[0].events = POLLIN;
+            fds[0].revents = 0;
+        }
+        int ret = (fds && (*nfds < 1)) ? DSVDC_ERR_PARAM : DSVDC_OK;
+        *nfds = 1;
+        return ret;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    dsvdc_update_write_interest(handle);
+    if (!fds || (*nfds < handle->loop.n_fds))
+    {
+        *nfds = handle->loop.n_fds;
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return fds ? DSVDC_ERR_PARAM : DSVDC_OK;
+    }
+
+    for (i = 0; i < handle->loop.n_fds; i++)
+    {
+        fds[i].fd = handle->loop.fds[i].fd;
+        fds[i].events = 0;
+        fds[i].revents = 0;
+        if (handle->loop.fds[i].events & DSVDC_EV_READ)
+        {
+            fds[i].events |= POLLIN;
+        }
+        if (handle->loop.fds[i].events & DSVDC_EV_WRITE)
+        {
+            fds[i].events |= POLLOUT;
+        }
+    }
+    *nfds = handle->loop.n_fds;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    return DSVDC_OK;
+}
+
+int dsvdc_process_ready(dsvdc_t *handle, const struct pollfd *fds,
+                        size_t nfds)
+{
+    size_t i;
+
+    if (!handle || (!fds && (nfds > 0)))
+    {
+        log("invalid (NULL) parameter\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    if (dsvdc_io_mode(handle))
+    {
+        dsvdc_io_dispatch(handle, 0);
+        return DSVDC_OK;
+    }
+
+    for (i = 0; i < nfds; i++)
+    {
+        int events = 0;
+        if (fds[i].revents & (POLLIN | POLLHUP))
+        {
+            events |= DSVDC_EV_READ;
+        }
+        if (fds[i].revents & POLLOUT)
+        {
+            events |= DSVDC_EV_WRITE;
+        }
+        if (fds[i].revents & (POLLERR | POLLNVAL))
+        {
+            events |= DSVDC_EV_ERROR;
+        }
+
+        if (events)
+        {
+            dsvdc_dispatch_event(handle, fds[i].fd, events);
+        }
+    }
+
+    dsvdc_read_pending(handle);
+
+    /* also iterates avahi, which checks its own descriptors */
+    dsvdc_run_timers(handle);
+
+    return DSVDC_OK;
+}
+
+int dsvdc_next_timeout_ms(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+    int next;
+
     if (!handle)
     {
-        return;
+        log("invalid (NULL) handle parameter\n");
+        return -1;
+    }
+
+    /* the event pipe becomes readable when there is something to do */
+    if (dsvdc_io_mode(handle))
+    {
+        return -1;
     }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_identify = function;
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (dsvdc_rx_pending(session))
+        {
+            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+            return 0;
+        }
+    }
+
+    next = dsvdc_requests_next_timeout(handle);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+#ifdef HAVE_AVAHI
+    int avahi = dsvdc_discovery_next_timeout(handle);
+    if ((avahi >= 0) && ((next < 0) || (avahi < next)))
+    {
+        next = avahi;
+    }
+#endif
+
+    return next;
 }
 
-void dsvdc_set_control_value_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, int32_t value,
-                                         int32_t group, int32_t zone_id,
-                                         void *userdata))
+int dsvdc_set_io_backend(dsvdc_t *handle, dsvdc_io_backend_t backend)
+{
+    dsvdc_loop_t loop;
+    size_t i;
+
+    /* the running I/O thread waits in the loop */
+    if (!handle || __atomic_load_n(&handle->io_active, __ATOMIC_ACQUIRE))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    int ret = dsvdc_loop_init(&loop, backend);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    for (i = 0; i < handle->loop.n_fds; i++)
+    {
+        /* the new loop has its own wakeup pipe */
+        if (handle->loop.fds[i].fd == handle->loop.wakeup_fd[0])
+        {
+            continue;
+        }
+
+        ret = dsvdc_loop_add(&loop, handle->loop.fds[i].fd,
+                             handle->loop.fds[i].events);
+        if (ret != DSVDC_OK)
+        {
+            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+            dsvdc_loop_cleanup(&loop);
+            return ret;
+        }
+    }
+
+    dsvdc_loop_cleanup(&handle->loop);
+    handle->loop = loop;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    log("switched to I/O backend %d\n", loop.backend);
+    return DSVDC_OK;
+}
+
+void dsvdc_get_stats(dsvdc_t *handle, dsvdc_stats_t *stats)
+{
+    if (!handle || !stats)
+    {
+        return;
+    }
+
+    /* the counters are updated without the mutex */
+    stats->rx_messages = __atomic_load_n(&handle->stats.rx_messages,
+                                         __ATOMIC_RELAXED);
+    stats->rx_decoder_allocs = __atomic_load_n(
+                        &handle->stats.rx_decoder_allocs, __ATOMIC_RELAXED);
+    stats->rx_heap_allocs = __atomic_load_n(&handle->stats.rx_heap_allocs,
+                                            __ATOMIC_RELAXED);
+    stats->rx_syscalls = __atomic_load_n(&handle->stats.rx_syscalls,
+                                         __ATOMIC_RELAXED);
+    stats->tx_messages = __atomic_load_n(&handle->stats.tx_messages,
+                                         __ATOMIC_RELAXED);
+    stats->tx_syscalls = __atomic_load_n(&handle->stats.tx_syscalls,
+                                         __ATOMIC_RELAXED);
+    stats->tx_queued = __atomic_load_n(&handle->stats.tx_queued,
+                                       __ATOMIC_RELAXED);
+    stats->tx_rejected = __atomic_load_n(&handle->stats.tx_rejected,
+                                         __ATOMIC_RELAXED);
+    stats->requests_pending = __atomic_load_n(
+                        &handle->stats.requests_pending, __ATOMIC_RELAXED);
+    stats->requests_peak = __atomic_load_n(&handle->stats.requests_peak,
+                                           __ATOMIC_RELAXED);
+    stats->requests_rejected = __atomic_load_n(
+                        &handle->stats.requests_rejected, __ATOMIC_RELAXED);
+    stats->announce_rounds = __atomic_load_n(&handle->stats.announce_rounds,
+                                             __ATOMIC_RELAXED);
+    stats->announce_time_ms = __atomic_load_n(
+                        &handle->stats.announce_time_ms, __ATOMIC_RELAXED);
+    stats->property_cache_hits = __atomic_load_n(
+                        &handle->stats.property_cache_hits, __ATOMIC_RELAXED);
+    stats->property_cache_partial = __atomic_load_n(
+                        &handle->stats.property_cache_partial,
+                        __ATOMIC_RELAXED);
+}
+
+void dsvdc_set_receive_budget(dsvdc_t *handle, unsigned int messages)
 {
     if (!handle)
     {
         return;
     }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_set_control_value = function;
+    handle->rx_budget = messages;
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-void dsvdc_set_output_channel_value_callback(dsvdc_t *handle,
-                        void(*function)(dsvdc_t *handle, char **dsuid,
-                                         size_t n_dsuid, bool apply,
-                                         int32_t channel, double value,
-                                         void *userdata))
+int dsvdc_set_send_queue_limit(dsvdc_t *handle, size_t bytes)
+{
+    if (!handle || (bytes == 0))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    handle->tx_queue_limit = bytes;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
+}
+
+int dsvdc_set_request_timeout(dsvdc_t *handle, unsigned int timeout)
+{
+    if (!handle || (timeout == 0) || (timeout > DSVDC_WHEEL_MAX_MS))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    handle->request_timeout = timeout;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
+}
+
+int dsvdc_set_max_requests(dsvdc_t *handle, unsigned int requests)
+{
+    dsvdc_reqpool_t pool;
+    int ret;
+
+    if (!handle || (requests == 0))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (handle->request_pool.used > 0)
+    {
+        log("can not resize the request pool, %zu requests are pending\n",
+            handle->request_pool.used);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_PARAM;
+    }
+
+    ret = dsvdc_reqpool_init(&pool, requests);
+    if (ret == DSVDC_OK)
+    {
+        dsvdc_reqpool_cleanup(&handle->request_pool);
+        handle->request_pool = pool;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return ret;
+}
+
+void dsvdc_get_send_queue(dsvdc_t *handle, size_t *bytes, size_t *messages)
 {
     if (!handle)
     {
         return;
     }
+
+    dsvdc_session_t *session;
+    size_t total_bytes = 0;
+    size_t total_messages = 0;
+
+    if (dsvdc_io_mode(handle))
+    {
+        /* as of the last iteration of the I/O thread */
+        total_bytes = __atomic_load_n(&handle->io_tx_bytes, __ATOMIC_RELAXED);
+        total_messages = __atomic_load_n(&handle->io_tx_messages,
+                                         __ATOMIC_RELAXED);
+    }
+    else
+    {
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        LL_FOREACH(handle->sessions, session)
+        {
+            total_bytes += dsvdc_txq_bytes(&session->txq);
+            total_messages += dsvdc_txq_messages(&session->txq);
+        }
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    }
+
+    if (bytes)
+    {
+        *bytes = total_bytes;
+    }
+    if (messages)
+    {
+        *messages = total_messages;
+    }
+}
+
+int dsvdc_set_max_sessions(dsvdc_t *handle, unsigned int sessions)
+{
+    if (!handle || (sessions == 0))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_send_output_channel_value = function;
+    handle->max_sessions = sessions;
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
 }
 
-void dsvdc_set_get_property_callback(dsvdc_t *handle,
-                        void (*function)(dsvdc_t *handle, const char *dsuid,
-                                         dsvdc_property_t *property,
-                                         const dsvdc_property_t *query,
-                                         void *userdata))
+unsigned int dsvdc_get_session_count(dsvdc_t *handle)
 {
+    dsvdc_session_t *session;
+    unsigned int count = 0;
+
     if (!handle)
     {
-        return;
+        return 0;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    LL_FOREACH(handle->sessions, session)
+    {
+        if ((session->fd > -1) && session->established)
+        {
+            count++;
+        }
     }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return count;
+}
+
+unsigned int dsvdc_get_current_session(dsvdc_t *handle)
+{
+    dsvdc_session_t *session = dsvdc_session_get_current();
+    if (!handle || !session || (session->handle != handle))
+    {
+        return 0;
+    }
+
+    return session->id;
+}
+
+int dsvdc_get_vdsm_dsuid(dsvdc_t *handle, unsigned int session_id,
+                         char *dsuid, size_t size)
+{
+    if (!handle || !dsuid || (size <= DSUID_LENGTH))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_request_get_property = function;
+    dsvdc_session_t *session = dsvdc_session_find(handle, session_id);
+    if (!session || !session->established)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_NOT_CONNECTED;
+    }
+
+    strncpy(dsuid, session->vdsm_dsuid, size);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
+}
+
+void dsvdc_set_new_session_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_new_session, function);
+}
+
+void dsvdc_set_end_session_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_end_session, function);
+}
+
+
+void dsvdc_set_ping_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, const char *dsuid,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_ping, function);
+}
+
+void dsvdc_set_remove_callback(dsvdc_t *handle,
+                        bool (*function)(dsvdc_t *handle, const char *dsuid,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_remove, function);
+}
+
+void dsvdc_set_send_complete_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, uint32_t message_id,
+                                         int code, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_complete, function);
+}
+
+void dsvdc_set_call_scene_notification_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t scene,
+                                         bool force, int32_t group,
+                                         int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_call_scene, function);
+}
+
+void dsvdc_set_save_scene_notification_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t scene,
+                                         int32_t group, int32_t zone_id,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_save_scene, function);
+}
+
+void dsvdc_set_undo_scene_notification_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_undo_scene, function);
+}
+
+void dsvdc_set_local_priority_notification_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t scene,
+                                         int32_t group, int32_t zone_id,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_set_local_prio, function);
+}
+
+void dsvdc_set_call_min_scene_notification_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t group,
+                                         int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_call_min_scene, function);
+}
+
+void dsvdc_set_identify_notification_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t group,
+                                         int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_identify, function);
+}
+
+void dsvdc_set_control_value_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, int32_t value,
+                                         int32_t group, int32_t zone_id,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_set_control_value, function);
+}
+
+void dsvdc_set_output_channel_value_callback(dsvdc_t *handle,
+                        void(*function)(dsvdc_t *handle, char **dsuid,
+                                         size_t n_dsuid, bool apply,
+                                         int32_t channel, double value,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_output_channel_value, function);
+}
+
+void dsvdc_set_call_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, bool force, int32_t group,
+                         int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_call_scene_bin, function);
+}
+
+void dsvdc_set_save_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_save_scene_bin, function);
+}
+
+void dsvdc_set_undo_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_undo_scene_bin, function);
+}
+
+void dsvdc_set_local_priority_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_set_local_prio_bin, function);
+}
+
+void dsvdc_set_call_min_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t group, int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_call_min_scene_bin, function);
+}
+
+void dsvdc_set_identify_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t group, int32_t zone_id, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_identify_bin, function);
+}
+
+void dsvdc_set_control_value_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t value, int32_t group, int32_t zone_id,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_set_control_value_bin, function);
+}
+
+void dsvdc_set_output_channel_value_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         bool apply, int32_t channel, double value,
+                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_send_output_channel_value_bin, function);
+}
+
+void dsvdc_set_dispatch_complete_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, size_t n_devices,
+                         uint64_t elapsed_us, void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, dispatch_complete, function);
+}
+
+void dsvdc_set_get_property_callback(dsvdc_t *handle,
+                        void (*function)(dsvdc_t *handle, const char *dsuid,
+                                         dsvdc_property_t *property,
+                                         const dsvdc_property_t *query,
+                                         void *userdata))
+{
+    DSVDC_SET_CALLBACK(handle, vdsm_request_get_property, function);
 }
 
 void dsvdc_set_set_property_callback(dsvdc_t *handle,
@@ -746,13 +1564,7 @@ void dsvdc_set_set_property_callback(dsvdc_t *handle,
                                          const dsvdc_property_t *properties,
                                          void *userdata))
 {
-    if (!handle)
-    {
-        return;
-    }
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    handle->vdsm_request_set_property = function;
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    DSVDC_SET_CALLBACK(handle, vdsm_request_set_property, function);
 }
 
 void dsvdc_cleanup(dsvdc_t *handle)
@@ -762,6 +1574,15 @@ void dsvdc_cleanup(dsvdc_t *handle)
         return;
     }
 
+    if (dsvdc_io_mode(handle))
+    {
+        dsvdc_stop_io_thread(handle);
+    }
+
+    /* queued handlers may still call into the library */
+    dsvdc_dispatch_stop(handle->dispatch);
+    handle->dispatch = NULL;
+
 #ifdef HAVE_AVAHI
     dsvdc_discovery_cleanup(handle);
 #endif
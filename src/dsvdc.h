@@ -32,6 +32,8 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <poll.h>
 
 typedef struct dsvdc dsvdc_t;
 typedef struct dsvdc_property dsvdc_property_t;
@@ -54,6 +56,8 @@ enum
     DSVDC_ERR_FILE_NOT_FOUND = -10, /*!< specified file was not found */
     DSVDC_ERR_DATABASE = -11,       /*!< database related error */
     DSVDC_ERR_DATA_NOT_FOUND = -12, /*!< requested data was not found */
+    DSVDC_ERR_QUEUE_FULL = -13,     /*!< send queue limit reached */
+    DSVDC_ERR_TOO_MANY_REQUESTS = -14, /*!< request limit reached */
 
     /* vDC API errors as received from vdSM (synced with messages.proto) */
     DSVDC_ERR_MESSAGE_UNKNOWN = 1,
@@ -70,6 +74,131 @@ enum
     DSVDC_ERR_NOT_AUTHORIZED = 12
 };
 
+/*! \brief I/O backends that can be used by dsvdc_work() to wait for socket
+ *  events, see dsvdc_set_io_backend().
+ */
+typedef enum
+{
+    DSVDC_IO_BACKEND_DEFAULT = 0,   /*!< epoll if available, select otherwise */
+    DSVDC_IO_BACKEND_SELECT = 1,    /*!< select(), limited to FD_SETSIZE */
+    DSVDC_IO_BACKEND_EPOLL = 2      /*!< epoll(), Linux only */
+} dsvdc_io_backend_t;
+
+/*! \brief Transports the vDC can listen on for vdSM connections, see
+ *  dsvdc_new_ex().
+ */
+typedef enum
+{
+    DSVDC_TRANSPORT_TCP = 0,    /*!< IPv4 TCP, as used by dsvdc_new() */
+    DSVDC_TRANSPORT_TCP6 = 1,   /*!< dual-stack TCP, IPv6 and IPv4 */
+    DSVDC_TRANSPORT_UNIX = 2    /*!< Unix domain socket, vdSM on the same box */
+} dsvdc_transport_t;
+
+/*! \brief Options for dsvdc_new_ex(), must be initialized with
+ *  dsvdc_options_init() so that fields added later get their defaults.
+ */
+typedef struct dsvdc_options
+{
+    dsvdc_transport_t transport; /*!< transport to listen on */
+    unsigned short port;    /*!< TCP port, zero for automatic selection */
+    const char *path;       /*!< Unix socket path, a leading '@' selects the
+                                 abstract namespace */
+    const char *name;       /*!< Avahi service name, NULL for the default */
+    bool noauto;            /*!< avoid being connected automatically */
+    void *userdata;         /*!< passed to all callback functions */
+} dsvdc_options_t;
+
+/*! \brief Library statistics, see dsvdc_get_stats(). All counters except
+ *  requests_pending and announce_time_ms are cumulative since the handle
+ *  was created.
+ */
+typedef struct dsvdc_stats
+{
+    uint64_t rx_messages;       /*!< messages received from the vdSM */
+    uint64_t rx_decoder_allocs; /*!< allocations made to decode them */
+    uint64_t rx_heap_allocs;    /*!< decoder allocations that hit the heap */
+    uint64_t rx_syscalls;       /*!< system calls made to receive them */
+    uint64_t tx_messages;       /*!< messages sent to the vdSM */
+    uint64_t tx_syscalls;       /*!< system calls made to send them */
+    uint64_t tx_queued;         /*!< messages that had to be queued */
+    uint64_t tx_rejected;       /*!< messages rejected due to a full queue */
+    uint64_t requests_pending;  /*!< requests waiting for a response */
+    uint64_t requests_peak;     /*!< most requests that waited at once */
+    uint64_t requests_rejected; /*!< requests rejected due to the limit */
+    uint64_t announce_rounds;   /*!< sessions the registry was announced to
+                                     completely, see dsvdc_register_device() */
+    uint64_t announce_time_ms;  /*!< time from the start of the last of these
+                                     sessions until all was announced */
+    uint64_t property_cache_hits; /*!< get property requests answered from
+                                       the cache, see
+                                       dsvdc_set_property_cache() */
+    uint64_t property_cache_partial; /*!< of these the ones that still
+                                          needed the callback */
+} dsvdc_stats_t;
+
+/*! \brief Announcement state of a registered container or device, see
+ *  dsvdc_get_announce_status().
+ */
+typedef enum dsvdc_announce_status
+{
+    DSVDC_ANNOUNCE_PENDING = 0, /*!< not announced yet */
+    DSVDC_ANNOUNCE_SENT,        /*!< waiting for the vdSM to answer */
+    DSVDC_ANNOUNCE_DONE,        /*!< accepted by the vdSM */
+    DSVDC_ANNOUNCE_FAILED       /*!< rejected, not answered or not sent */
+} dsvdc_announce_status_t;
+
+/*! \brief Number of bytes in a binary dSUID. */
+#define DSVDC_DSUID_BYTES   17
+
+/*! \brief Binary dSUID, see dsvdc_dsuid_parse(). Two dSUIDs are equal if
+ *  their bytes are equal.
+ */
+typedef struct dsvdc_dsuid
+{
+    uint8_t id[DSVDC_DSUID_BYTES];
+} dsvdc_dsuid_t;
+
+/*! \brief Notification handlers of a registered device or of a class of
+ *  devices, see dsvdc_set_device_handlers(). Each handler is called once for
+ *  every device a notification names, with the context of that device.
+ *  Handlers that are NULL are not called. The parameters are the same as
+ *  for the global notification callbacks.
+ */
+typedef struct dsvdc_device_handlers
+{
+    void (*call_scene)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                       int32_t scene, bool force, int32_t group,
+                       int32_t zone_id, void *context);
+    void (*save_scene)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                       int32_t scene, int32_t group, int32_t zone_id,
+                       void *context);
+    void (*identify)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                     int32_t group, int32_t zone_id, void *context);
+    void (*output_channel_value)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                                 bool apply, int32_t channel, double value,
+                                 void *context);
+} dsvdc_device_handlers_t;
+
+/*! \brief Source of a top level property that is not cached, see
+ *  dsvdc_set_property_cache().
+ */
+typedef struct dsvdc_property_provider
+{
+    /*! name of the top level property */
+    const char *name;
+    /*! Called when a query asks for the property, query holds what is asked
+     *  for below it, empty for all of it. Adds the property to response,
+     *  usually as one element with the given name, see
+     *  dsvdc_property_query(). The callback runs like the get property
+     *  callback and must not send the response. NULL passes the property to
+     *  the get property callback instead. */
+    void (*provide)(dsvdc_t *handle, const char *dsuid, const char *name,
+                    const dsvdc_property_t *query, dsvdc_property_t *response,
+                    void *context);
+    /*! passed to the callback */
+    void *context;
+} dsvdc_property_provider_t;
+
 /*! \brief Initialize new library instance.
  *  \param[in] port port to listen for incoming vdSM connections. Use zero
  *              for automatic port selection.
@@ -87,6 +216,32 @@ enum
 int dsvdc_new(unsigned short port, const char *dsuid, const char *name,
               bool noauto, void *userdata, dsvdc_t **handle);
 
+/*! \brief Set all options to their defaults: IPv4 TCP on an automatically
+ *  selected port, default Avahi name, no userdata.
+ *
+ *  \param[out] options options to initialize.
+ */
+void dsvdc_options_init(dsvdc_options_t *options);
+
+/*! \brief Initialize new library instance with a choice of transport.
+ *
+ * With automatic port selection the vDC listens on port 49500, or on a port
+ * assigned by the system if that one is in use. Instances that listen on a
+ * Unix domain socket are not announced via Avahi, the vdSM has to be
+ * configured with the socket path. A socket file that is left over from an
+ * instance that did not shut down cleanly is replaced, if another instance
+ * still listens on it DSVDC_ERR_SOCKET is returned and errno is set to
+ * EADDRINUSE.
+ *
+ *  \param[in] dsuid dSUID of the vDC.
+ *  \param[in] options transport and other settings, see dsvdc_options_t.
+ *  \param[out] handle newly allocated library handle, must be freed using
+ *              dsvdc_cleanup() when no longer needed.
+ *  \return Error/success code.
+ */
+int dsvdc_new_ex(const char *dsuid, const dsvdc_options_t *options,
+                 dsvdc_t **handle);
+
 /*! \brief Free library instance and all associated resources.
  *
  * This function must be called when the instance is no longer needed, it frees
@@ -102,21 +257,269 @@ void dsvdc_cleanup(dsvdc_t *handle);
  * appropriate callbacks in the library.
  *
  * \param[in] handle dsvdc handle that was returned by dsvdc_new().
- * \param[in] timeout timeout for select on socket in seconds, actually spent
- * time may be two times higher than specified. Use zero for no timeout.
+ * \param[in] timeout timeout for waiting on the sockets in seconds. Use zero
+ * for no timeout. Sockets are never read in a blocking way, a partially
+ * received message is kept until the rest of it arrives.
  * If you have an own thread which will just loop on dsvdc_work() then
  * you should use some higher value to avoid unnecessary polling.
+ *
+ * Callbacks for messages from the vdSM run without any library lock held,
+ * they may call every library function including the callback setters, and
+ * other threads can send in the meantime. The callbacks are looked up before
+ * a message is dispatched, a callback that was replaced or unregistered by
+ * another thread may therefore still run once. The session end and send
+ * completion callbacks, and the callbacks of requests that fail because
+ * their session closed, can still be raised from inside a library call that
+ * holds the lock unless the I/O thread is running, see
+ * dsvdc_start_io_thread().
+ *
+ * The callback setters copy the table of all callbacks. If that copy can not
+ * be allocated the previous callback stays registered, the setters have no
+ * way to report this and only log it.
  */
 void dsvdc_work(dsvdc_t *handle, unsigned short timeout);
 
+/*! \brief Let a library thread do the socket I/O.
+ *
+ * The thread accepts connections, receives and sends messages and runs the
+ * timers, it never calls back into the application. Received messages and
+ * all callbacks are handed to the application through a lock-free queue and
+ * run when the application calls dsvdc_work() or dsvdc_process_ready(), only
+ * one thread at a time may do that. dsvdc_get_pollfds() returns a single
+ * descriptor that becomes readable when callbacks are waiting.
+ *
+ * Messages that are sent from any thread are handed to the I/O thread through
+ * a lock-free queue, sending never waits for the handle mutex or the socket.
+ * Delivery is asynchronous: send functions only fail if no session is
+ * established or the message can not be serialized, later errors are
+ * reported through the send complete callback, see
+ * dsvdc_set_send_complete_callback(), and to the callbacks of requests like
+ * dsvdc_announce_device().
+ *
+ * dsvdc_set_io_backend() can not be used while the thread runs.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \return DSVDC_OK, DSVDC_ERR_PARAM if the thread is already running.
+ */
+int dsvdc_start_io_thread(dsvdc_t *handle);
+
+/*! \brief Stop the thread that was started by dsvdc_start_io_thread().
+ *
+ * Messages that were sent before the call are handed to the sockets, waiting
+ * callbacks are run on the calling thread, afterwards dsvdc_work() has to be
+ * called again. dsvdc_cleanup() stops the thread as well.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \return DSVDC_OK, DSVDC_ERR_PARAM if the thread is not running.
+ */
+int dsvdc_stop_io_thread(dsvdc_t *handle);
+
+/*! \brief Select the I/O backend that is used by dsvdc_work().
+ *
+ * All sockets of the library instance are registered with the backend once
+ * and only sockets that are actually ready are processed. By default epoll is
+ * used if the library was compiled with epoll support, otherwise the library
+ * falls back to select(). The backend can be switched at any time, but the
+ * function must not be called while another thread is inside dsvdc_work().
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] backend the backend to use.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM if the requested backend is
+ * not available.
+ */
+int dsvdc_set_io_backend(dsvdc_t *handle, dsvdc_io_backend_t backend);
+
+/*! \brief Get a snapshot of the library statistics.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[out] stats receives the current counters.
+ */
+void dsvdc_get_stats(dsvdc_t *handle, dsvdc_stats_t *stats);
+
+/*! \brief Limit the number of messages that are processed per iteration.
+ *
+ * Incoming data is read in bulk and all complete messages are processed in
+ * one dsvdc_work() or dsvdc_process_ready() call, up to the given budget.
+ * Messages that exceed the budget are processed in the next iteration, which
+ * then does not wait for the sockets. The default budget is 64 messages.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] messages maximum number of messages per iteration, use zero for
+ * no limit.
+ */
+void dsvdc_set_receive_budget(dsvdc_t *handle, unsigned int messages);
+
+/*! \brief Limit the size of the send queue.
+ *
+ * Messages are written to the vdSM connection right away if the socket takes
+ * them, the rest is queued and sent by dsvdc_work() or dsvdc_process_ready()
+ * once the connection becomes writable, so sending never blocks. Once the
+ * queued data would exceed the limit, further messages are rejected with
+ * DSVDC_ERR_QUEUE_FULL until the queue drained. An empty queue always accepts
+ * one message. The default limit is 64 kB.
+ *
+ * Queued messages are sent by priority: pongs, generic responses and the
+ * hello response first, then responses to property requests, then pushed
+ * properties, announcements and other notifications. The first group is
+ * never rejected, so a full queue can not make the vdSM consider the vDC
+ * dead.
+ *
+ * Every vdSM session has its own queue, the limit applies to each of them.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] bytes maximum number of queued bytes.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_set_send_queue_limit(dsvdc_t *handle, size_t bytes);
+
+/*! \brief Set how long the vdSM may take to answer a request.
+ *
+ * Requests such as announcements that are not answered within the timeout
+ * fail with DSVDC_ERR_TIMEOUT, each session that took the request is timed
+ * separately. The timeout is measured on a monotonic clock with millisecond
+ * resolution, dsvdc_next_timeout_ms() includes the next expiry. The new
+ * value applies to requests that are sent afterwards, the default is 10
+ * seconds.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] timeout timeout in milliseconds, at most about four hours.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_set_request_timeout(dsvdc_t *handle, unsigned int timeout);
+
+/*! \brief Set how many requests may wait for a response at the same time.
+ *
+ * The entries that track the requests are allocated up front, a request
+ * takes one per session that it is sent to before the message goes out and
+ * returns it when the response arrives, the request times out or fails.
+ * Requests beyond the limit are not sent and fail with
+ * DSVDC_ERR_TOO_MANY_REQUESTS. The occupancy is reported by
+ * dsvdc_get_stats(). The default is 1024 requests, the limit can only be
+ * changed while no request is pending.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] requests maximum number of pending requests, must not be 0.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters or if
+ * requests are pending, DSVDC_ERR_OUT_OF_MEMORY if the entries could not be
+ * allocated.
+ */
+int dsvdc_set_max_requests(dsvdc_t *handle, unsigned int requests);
+
+/*! \brief Get the current depth of the send queue.
+ *
+ * Applications that produce many messages can use this to slow down before
+ * the queue limit is reached. The values are summed up over all sessions.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[out] bytes number of queued bytes, may be NULL.
+ * \param[out] messages number of queued messages, may be NULL.
+ */
+void dsvdc_get_send_queue(dsvdc_t *handle, size_t *bytes, size_t *messages);
+
+/*! \brief Get the descriptors that need to be watched by an external event
+ * loop.
+ *
+ * This function and dsvdc_process_ready() and dsvdc_next_timeout_ms() can be
+ * used instead of dsvdc_work() if the application runs its own event loop.
+ * The returned set includes the listening socket, the vdSM connections and the
+ * Avahi descriptors, as well as an internal descriptor that signals changes
+ * from other threads. It changes when connections are accepted or closed and
+ * when messages are queued for sending, so it must be fetched again after
+ * every call to dsvdc_process_ready().
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[out] fds array that receives the descriptors along with the events
+ * of interest (POLLIN, POLLOUT), may be NULL to query the required size.
+ * \param[in,out] nfds capacity of the fds array, on return the number of
+ * descriptors.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM if the array is too small,
+ * in this case nfds is set to the required size.
+ */
+int dsvdc_get_pollfds(dsvdc_t *handle, struct pollfd *fds, size_t *nfds);
+
+/*! \brief Process descriptors that were reported ready by an external event
+ * loop.
+ *
+ * Handles incoming connections and messages on all descriptors with non-zero
+ * revents, then runs due timers (Avahi, request timeouts). The function may
+ * also be called with no descriptors when dsvdc_next_timeout_ms() expired.
+ * Callbacks are triggered from within this function. It must not be mixed
+ * with concurrent dsvdc_work() calls on the same handle.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] fds descriptors as returned by dsvdc_get_pollfds() with the
+ * revents filled in, entries with zero revents are skipped.
+ * \param[in] nfds number of entries in fds.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_process_ready(dsvdc_t *handle, const struct pollfd *fds,
+                        size_t nfds);
+
+/*! \brief Time until the library needs to be called again, regardless of
+ * descriptor activity.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \return timeout in milliseconds after which dsvdc_process_ready() must be
+ * called, 0 if it should be called right away, -1 if there is no timeout.
+ */
+int dsvdc_next_timeout_ms(dsvdc_t *handle);
+
 /*! \brief Return connection status information if the vDC has an active
  * connection to a vdSM.
  *
  * \param[in] handle dsvdc handle that was returned by dsvdc_new().
- * \return true if there is a connection, false if there is no connection.
+ * \return true if there is at least one session, false if there is no
+ * connection.
  */
 bool dsvdc_has_session(dsvdc_t *handle);
 
+/*! \brief Set the number of vdSM sessions that are served at the same time.
+ *
+ * Several vdSMs (i.e. a primary and a standby dSS) may connect to the vDC,
+ * every connection is a session of its own with its own send queue and its
+ * own pending requests. Messages that the vDC sends on its own, like pushed
+ * properties and announcements, go out to all sessions, responses go back to
+ * the session that sent the request. Connections beyond the limit are
+ * answered with a "service not available" response and closed. The default
+ * is 4 sessions, the limit does not affect sessions that are already open.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] sessions maximum number of sessions, must not be 0.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_set_max_sessions(dsvdc_t *handle, unsigned int sessions);
+
+/*! \brief Get the number of vdSM sessions that completed the HELLO handshake.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \return number of sessions.
+ */
+unsigned int dsvdc_get_session_count(dsvdc_t *handle);
+
+/*! \brief Get the session that triggered the running callback.
+ *
+ * Session ids are never 0 and are not reused while the handle exists. This
+ * can be called from within any callback to tell the vdSMs apart, i.e. to
+ * keep track of them in the new and end session callbacks. Announcement
+ * callbacks are triggered once per session.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \return session id, 0 if called outside of a callback.
+ */
+unsigned int dsvdc_get_current_session(dsvdc_t *handle);
+
+/*! \brief Get the dSUID of the vdSM of a session.
+ *
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] session session id as returned by dsvdc_get_current_session().
+ * \param[out] dsuid buffer that receives the zero terminated dSUID.
+ * \param[in] size size of the buffer, at least 35 bytes.
+ * \return DSVDC_OK on success, DSVDC_ERR_NOT_CONNECTED if there is no such
+ * session, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_get_vdsm_dsuid(dsvdc_t *handle, unsigned int session, char *dsuid,
+                         size_t size);
+
 /*! \brief Register "new_session" callback.
  *
  * The callback is triggered when a vdsm connects to the vdc. Actually when the
@@ -183,6 +586,33 @@ void dsvdc_set_remove_callback(dsvdc_t *handle,
 void dsvdc_set_ping_callback(dsvdc_t *handle,
         void (*function)(dsvdc_t *handle, const char *dsuid, void *userdata));
 
+/*! \brief Register "send complete" callback.
+ *
+ * The callback is called once for every message that was accepted for
+ * sending, either when it was completely written to the vdSM connection or
+ * when it was dropped because the connection was closed. Messages that are
+ * rejected by the sending function are not reported. Pass NULL for the
+ * callback function to unregister the callback.
+ *
+ * The callback runs after the sending function or dsvdc_work() released the
+ * handle, never in the middle of writing the send queue, so it may send
+ * further messages.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param void (*function)(dsvdc_t *handle, uint32_t message_id, int code,
+ * void *userdata) callback function.
+ *
+ * The callback parameters are:
+ * \param[in] handle dsvdc handle that was returned by dsvdc_new().
+ * \param[in] message_id id of the message, zero for notifications.
+ * \param[in] code DSVDC_OK if the message was sent, DSVDC_ERR_NOT_CONNECTED
+ * if it was dropped.
+ * \param[in] userdata userdata pointer that was passed to dsvdc_new().
+ */
+void dsvdc_set_send_complete_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, uint32_t message_id, int code,
+                         void *userdata));
+
 /*! \brief Register "call scene notificatoin" callback.
  *
  * The callback function will be called each time a VDSM_NOTIFICATION_CALL_SCENE
@@ -332,12 +762,66 @@ void dsvdc_set_output_channel_value_callback(dsvdc_t *handle,
                          int32_t channel, double value,
                          void *userdata));
 
+/*! \brief Binary dSUID variants of the notification callbacks above.
+ *
+ * The callbacks are called for the same messages and with the same
+ * parameters as their string counterparts, except that the dSUIDs are
+ * already parsed, see dsvdc_dsuid_parse(). dSUIDs that are not valid are left
+ * out, the callback is not called if none is left. Both variants of a
+ * callback may be registered at the same time, the string variant is called
+ * first. Pass NULL for the callback function to unregister the callback.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param function callback function.
+ */
+void dsvdc_set_call_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, bool force, int32_t group,
+                         int32_t zone_id, void *userdata));
+void dsvdc_set_save_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata));
+void dsvdc_set_undo_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata));
+void dsvdc_set_local_priority_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t scene, int32_t group, int32_t zone_id,
+                         void *userdata));
+void dsvdc_set_call_min_scene_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t group, int32_t zone_id, void *userdata));
+void dsvdc_set_identify_notification_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t group, int32_t zone_id, void *userdata));
+void dsvdc_set_control_value_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         int32_t value, int32_t group, int32_t zone_id,
+                         void *userdata));
+void dsvdc_set_output_channel_value_callback_bin(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                         size_t n_dsuid,
+                         bool apply, int32_t channel, double value,
+                         void *userdata));
+
 /*! \brief Register "get property" callback.
  *
  * The callback function will be called each time a
  * VDSM_REQUEST_GET_PROPERTY message is received from the vdSM.
  * Pass NULL for the callback function to unregister the callback.
  *
+ * The query parameter is only valid while the callback runs, see
+ * dsvdc_property_clone().
+ *
  * \param handle dsvdc handle that was returned by dsvdc_new().
  * \param void (*function)(dsvdc_t *handle, const char *dsuid, const char *name,
  *                         uint32_t index, uint32_t offset, void *userdata)
@@ -355,6 +839,9 @@ void dsvdc_set_get_property_callback(dsvdc_t *handle,
  * VDSM_REQUEST_SET_PROPERTY message is received from the vdSM.
  * Pass NULL for the callback function to unregister the callback.
  *
+ * The properties parameter is only valid while the callback runs, see
+ * dsvdc_property_clone().
+ *
  * \param handle dsvdc handle that was returned by dsvdc_new().
  * \param void (*function)(dsvdc_t *handle, const char *dsuid, const char *name,
  *                         uint32_t index, uint32_t offset, void *userdata)
@@ -370,6 +857,8 @@ void dsvdc_set_set_property_callback(dsvdc_t *handle,
 /*! \brief Send pong reply to a ping request.
  *
  * Each time you receive a ping callback, respond to it using this function.
+ * Called from within the ping callback the pong goes to the session that
+ * sent the ping, otherwise to all sessions.
  *
  * \param handle dsvdc handle that was returned by dsvdc_new().
  * \param dsuid the device identifier that was received in the ping callback.
@@ -419,6 +908,224 @@ int dsvdc_announce_device(dsvdc_t *handle, const char *container_dsuid,
                           void (*function)(dsvdc_t *handle, int code, void *arg,
                                            void *userdata));
 
+/*! \brief Announce many devices of a container to the vdSM.
+ *
+ * Announces the devices like dsvdc_announce_device() does, but keeps up to
+ * window announcements waiting for their responses instead of one. The
+ * next devices are sent as responses arrive and the messages that are sent
+ * together are written together, so announcing a large number of devices
+ * takes about as long as transferring them rather than one round trip per
+ * device.
+ *
+ * The progress callback is fired exactly once per device if the function
+ * returned with DSVDC_OK, in the order the responses arrive. The code is
+ * DSVDC_OK if every session that took the announcement accepted it, the
+ * first error otherwise, devices that could not be sent at all are
+ * reported with the error of the send. The dSUIDs are copied, the array
+ * may be freed when the function returns.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param container_dsuid the device container identifier.
+ * \param dsuids the device identifiers.
+ * \param n number of devices.
+ * \param window number of announcements that may wait for their response
+ * at the same time, each of them takes a request per session, see
+ * dsvdc_set_max_requests().
+ * \param arg arbitrary argument that will be returned to you in the
+ * callback.
+ * \param function progress callback, index is the position of the device
+ * in dsuids.
+ * \return DSVDC_OK if the announcement started, DSVDC_ERR_NOT_CONNECTED if
+ * no vdSM is connected, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_announce_devices(dsvdc_t *handle, const char *container_dsuid,
+                           const char **dsuids, size_t n, unsigned int window,
+                           void *arg,
+                           void (*function)(dsvdc_t *handle, size_t index,
+                                            int code, void *arg,
+                                            void *userdata));
+
+/*! \brief Let the library announce a container.
+ *
+ * Registered containers and their devices are announced by the library
+ * whenever a vdSM session starts, right after the new session callback
+ * returned, there is no need to announce them from the callback. The
+ * containers are announced first, the devices of a container once the vdSM
+ * accepted it, with dsvdc_announce_devices(). The time until everything was
+ * announced to a new session is reported by dsvdc_get_stats(). A container
+ * that is registered while a vdSM is connected is announced right away.
+ * Registering a container again has no effect.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param dsuid the container identifier, must be a valid dSUID, see
+ * dsvdc_dsuid_parse(). It is announced in lower case.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters or if
+ * the dSUID is registered as a device, DSVDC_ERR_OUT_OF_MEMORY.
+ */
+int dsvdc_register_container(dsvdc_t *handle, const char *dsuid);
+
+/*! \brief Let the library announce a device.
+ *
+ * The device is announced with its container, see
+ * dsvdc_register_container(). A device that is registered while a vdSM is
+ * connected is announced right away. Registering a device again has no
+ * effect.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param container_dsuid the registered container of the device.
+ * \param dsuid the device identifier, must be a valid dSUID.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters, if
+ * the container is not registered or if the device is registered with
+ * another container, DSVDC_ERR_OUT_OF_MEMORY.
+ */
+int dsvdc_register_device(dsvdc_t *handle, const char *container_dsuid,
+                          const char *dsuid);
+
+/*! \brief Remove a container or a device from the registry.
+ *
+ * The devices of a container are removed with it. Nothing is sent to the
+ * vdSM, use dsvdc_device_vanished() to report a device that is gone.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param dsuid the container or device identifier.
+ * \return DSVDC_OK on success, DSVDC_ERR_DATA_NOT_FOUND if it was not
+ * registered, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_unregister(dsvdc_t *handle, const char *dsuid);
+
+/*! \brief Get the announcement state of a registered container or device.
+ *
+ * The state describes the last announcement, after a session start it
+ * changes to DSVDC_ANNOUNCE_SENT again.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param dsuid the container or device identifier.
+ * \param[out] status receives the state.
+ * \return DSVDC_OK on success, DSVDC_ERR_DATA_NOT_FOUND if it is not
+ * registered, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_get_announce_status(dsvdc_t *handle, const char *dsuid,
+                              dsvdc_announce_status_t *status);
+
+/*! \brief Set how many registered devices are announced at the same time.
+ *
+ * This is the window of dsvdc_announce_devices() that is used for the
+ * registry, the default is 32.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param window announcements that may wait for their responses, must not
+ * be 0.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters.
+ */
+int dsvdc_set_announce_window(dsvdc_t *handle, unsigned int window);
+
+/*! \brief Dispatch notifications for a registered device to its own
+ * handlers.
+ *
+ * When a call scene, save scene, identify or set output channel value
+ * notification names the device, the matching handler is called with the
+ * context of the device, once per device. dSUIDs of devices without
+ * handlers are skipped, dSUIDs the vDC did not register never reach a
+ * handler. The handlers run after the global callbacks, outside the library
+ * lock, or on worker threads, see dsvdc_set_dispatch_workers(). A handler
+ * that was replaced or whose device was unregistered by another thread may
+ * therefore still run once.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param dsuid the device identifier, see dsvdc_register_device().
+ * \param handlers handlers of the device, NULL to stop dispatching to it.
+ * The same table can be shared by many devices and must stay valid while it
+ * is set.
+ * \param context passed to the handlers of this device.
+ * \return DSVDC_OK on success, DSVDC_ERR_DATA_NOT_FOUND if the device is not
+ * registered, DSVDC_ERR_PARAM on invalid parameters or if dsuid is a
+ * container.
+ */
+int dsvdc_set_device_handlers(dsvdc_t *handle, const char *dsuid,
+                              const dsvdc_device_handlers_t *handlers,
+                              void *context);
+
+/*! \brief Answer get property requests of a registered container or device
+ * from a property tree and property providers.
+ *
+ * Static properties like the name, model or the descriptions of inputs and
+ * sensors are put into the tree once, the library then answers the vdSM
+ * directly, nested and wildcard queries included. Top level properties that
+ * change are left to a provider, it is called with the part of the query
+ * below the property. A provider without a callback and names that are
+ * neither cached nor provided are passed to the get property callback, it
+ * gets a response that already holds the rest of the answer. Without that
+ * callback the response holds just the rest. The tree is dropped together
+ * with its entry, see dsvdc_unregister().
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param dsuid identifier of the container or device, see
+ * dsvdc_register_device().
+ * \param properties property tree, see dsvdc_property_new(), may be NULL if
+ * there are providers. On success the library takes ownership and sets it
+ * to NULL.
+ * \param providers providers of top level properties, the names are copied,
+ * a provider takes precedence over a cached property of the same name.
+ * \param n_providers number of providers, neither a tree nor providers
+ * remove the cache.
+ * \return DSVDC_OK on success, DSVDC_ERR_DATA_NOT_FOUND if dsuid is not
+ * registered, DSVDC_ERR_PARAM on invalid parameters,
+ * DSVDC_ERR_OUT_OF_MEMORY if the cache could not be allocated.
+ */
+int dsvdc_set_property_cache(dsvdc_t *handle, const char *dsuid,
+                             dsvdc_property_t **properties,
+                             const dsvdc_property_provider_t *providers,
+                             size_t n_providers);
+
+/*! \brief Run the device handlers on a pool of worker threads.
+ *
+ * A notification that names many devices is spread over the workers, see
+ * dsvdc_set_device_handlers(). Every device is always served by the same
+ * worker, the handler calls of one device are therefore never reordered,
+ * while different devices are handled in parallel. The global notification
+ * callbacks keep running on the thread that calls dsvdc_work(), which does
+ * not wait for the workers. By default there are no workers and the
+ * handlers run on that thread as well.
+ *
+ * Must not be called from a handler. Changing the workers waits until the
+ * handlers that are already queued have returned.
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ * \param workers number of worker threads, at most 64, 0 to stop them.
+ * \return DSVDC_OK on success, DSVDC_ERR_PARAM on invalid parameters,
+ * DSVDC_ERR_OUT_OF_MEMORY if the threads could not be started.
+ */
+int dsvdc_set_dispatch_workers(dsvdc_t *handle, unsigned int workers);
+
+/*! \brief Wait until the workers ran all queued device handlers.
+ *
+ * Returns right away if there are no workers. Must not be called from a
+ * handler or at the same time as dsvdc_set_dispatch_workers().
+ *
+ * \param handle dsvdc handle that was returned by dsvdc_new().
+ */
+void dsvdc_wait_dispatch(dsvdc_t *handle);
+
+/*! \brief Register "dispatch complete" callback.
+ *
+ * The callback function is called once all device handlers of one
+ * notification have returned, from the worker that ran the last of them or
+ * right after the handlers when there are no workers, see
+ * dsvdc_set_dispatch_workers(). Notifications that do not name a device
+ * with handlers are not reported. Pass NULL for the callback function to
+ * unregister the callback.
+ *
+ * The callback parameters are:
+ * \param[in] handle dsvdc Handle that was returned by dsvdc_new().
+ * \param[in] n_devices number of handlers that were called.
+ * \param[in] elapsed_us time from the dispatch until the last handler
+ * returned.
+ * \param[in] userdata userdata pointer that was passed to dsvdc_new().
+ */
+void dsvdc_set_dispatch_complete_callback(dsvdc_t *handle,
+        void (*function)(dsvdc_t *handle, size_t n_devices,
+                         uint64_t elapsed_us, void *userdata));
+
 /*! \brief Notify vdSM that the device has vanished.
  *
  * Use this function to tell the vdSM that your device has been physically
@@ -512,6 +1219,39 @@ int dsvdc_send_set_property_response(dsvdc_t *handle,
  */
 int dsvdc_push_property(dsvdc_t *handle, const char *dsuid,
                         dsvdc_property_t *property);
+
+/*
+ * ****************************************************************************
+ * dSUID functions.
+ * ****************************************************************************
+ */
+
+/*! \brief Parse and validate a dSUID string.
+ *
+ * \param[in] str dSUID as 34 hex digits, upper and lower case are accepted.
+ * \param[out] dsuid binary dSUID.
+ * \return DSVDC_OK or DSVDC_ERR_PARAM if the string is not a valid dSUID.
+ */
+int dsvdc_dsuid_parse(const char *str, dsvdc_dsuid_t *dsuid);
+
+/*! \brief Format a binary dSUID as string.
+ *
+ * \param[in] dsuid binary dSUID.
+ * \param[out] str buffer of at least 35 bytes, receives 34 lower case hex
+ * digits and the NULL terminator.
+ */
+void dsvdc_dsuid_format(const dsvdc_dsuid_t *dsuid, char *str);
+
+/*! \brief Compare two binary dSUIDs. The time taken does not depend on
+ * their contents.
+ *
+ * \return true if both are equal.
+ */
+bool dsvdc_dsuid_equal(const dsvdc_dsuid_t *a, const dsvdc_dsuid_t *b);
+
+/*! \brief Hash of a binary dSUID for use in hash tables.
+ */
+uint32_t dsvdc_dsuid_hash(const dsvdc_dsuid_t *dsuid);
 /*
  * ****************************************************************************
  * Property functions.
@@ -534,6 +1274,17 @@ typedef enum
     DSVDC_PROPERTY_VALUE_BYTES      /*!< property value is a uint8_t* */
 } dsvdc_property_value_t;
 
+/*! \brief Read-only position on one level of a property tree, see
+ *  dsvdc_property_cursor(). A cursor does not own anything, it borrows from
+ *  the property it was taken from and is valid as long as that property.
+ *  The members are private.
+ */
+typedef struct dsvdc_property_cursor
+{
+    const void *const *elements;
+    size_t n_elements;
+} dsvdc_property_cursor_t;
+
 
 /*! \brief Allocate new property for further manipulation.
  *
@@ -550,6 +1301,37 @@ typedef enum
 
 int dsvdc_property_new(dsvdc_property_t **property);
 
+/*! \brief Allocate new property that is backed by an arena.
+ *
+ * Works like dsvdc_property_new(), but all elements that are added to the
+ * property are carved from a few larger memory blocks instead of being
+ * allocated one by one. Freeing or sending the property releases the blocks
+ * in one go, which makes building large responses considerably cheaper.
+ *
+ * Use dsvdc_property_new_nested() to create properties that are added to
+ * this one via dsvdc_property_add_property(), they share the arena. Other
+ * properties are copied when they are added.
+ *
+ * \param[out] property the newly allocated property.
+ * \return error code, indicating if the property was allocated.
+ */
+int dsvdc_property_new_arena(dsvdc_property_t **property);
+
+/*! \brief Allocate new property that will be added to another one.
+ *
+ * If the parent property is backed by an arena, see
+ * dsvdc_property_new_arena(), the new property uses the same arena and
+ * adding it to the tree of the parent does not copy anything. It must
+ * then not be used after the parent has been freed or sent. Otherwise
+ * this is the same as dsvdc_property_new().
+ *
+ * \param[in] parent property the new one is going to be added to
+ * \param[out] property the newly allocated property.
+ * \return error code, indicating if the property was allocated.
+ */
+int dsvdc_property_new_nested(dsvdc_property_t *parent,
+                              dsvdc_property_t **property);
+
 /*! \brief Free previously allocated property.
  *
  * Use this function to free the resources for a property that has been
@@ -569,6 +1351,21 @@ int dsvdc_property_new(dsvdc_property_t **property);
  */
 void dsvdc_property_free(dsvdc_property_t *property);
 
+/*! \brief Copy a property.
+ *
+ * The query of the get property callback and the properties of the set
+ * property callback borrow from the received message and are only valid
+ * until the callback returns. They must not be freed. Use this function if
+ * you need to keep them for longer.
+ *
+ * \param[in] property property to copy.
+ * \param[out] clone copy that must be freed by the caller, see
+ * dsvdc_property_free().
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_clone(const dsvdc_property_t *property,
+                         dsvdc_property_t **clone);
+
 /*!\brief Add an integer element to a property.
  *
  * \param[in] property property handle
@@ -637,7 +1434,8 @@ int dsvdc_property_add_bytes(dsvdc_property_t *property, const char *key,
  * it has been passed to this function. The data below the value parameter
  * will be freed together with the property to which it is attached either
  * when the property is sent or freed explicitly via the dsvdc_property_free()
- * call.
+ * call. The content of the value is moved if both properties use the same
+ * memory, see dsvdc_property_new_nested(), and copied otherwise.
  *
  * \param[in] property property handle
  * \param[in] name, optoinal name of the property, may be NULL
@@ -796,6 +1594,143 @@ int dsvdc_property_get_property_by_name(const dsvdc_property_t *property,
 int dsvdc_property_get_property_by_index(const dsvdc_property_t *property,
                                          size_t index, dsvdc_property_t **out);
 
+/*!\brief Answer a get property query from a property tree.
+ *
+ * Matches the query against the tree in one pass and adds the answer to the
+ * response: names select the element with that name, an element without a
+ * name selects all elements of its level, elements of the query select
+ * below the matching element, a query element without elements selects the
+ * whole subtree. Names that the tree does not have are left out. Only the
+ * answer is copied, the tree can for example be loaded from the database
+ * once, see dsvdc_database_load_property().
+ *
+ * \param[in] source property tree that holds the values.
+ * \param[in] query query as passed to the get property callback.
+ * \param[in] response property the answer is added to.
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_query(const dsvdc_property_t *source,
+                         const dsvdc_property_t *query,
+                         dsvdc_property_t *response);
+
+/*!\brief Start navigating a property without copies.
+ *
+ * The dsvdc_property_cursor_xxx() functions walk a property tree like the
+ * dsvdc_property_get_xxx() functions, but they never allocate: names,
+ * strings and bytes are returned as pointers into the property together with
+ * their length, nested properties as cursors. Use them to read the query or
+ * the properties that a callback receives.
+ *
+ * \param[in] property property handle
+ * \param[out] cursor cursor on the top level of the property
+ */
+void dsvdc_property_cursor(const dsvdc_property_t *property,
+                           dsvdc_property_cursor_t *cursor);
+
+/*!\brief Retrieve the level below a property element.
+ *
+ * \param[in] cursor cursor on the level of the element
+ * \param[in] index element index, see dsvdc_property_cursor_count()
+ * \param[out] child cursor on the nested properties of the element, it is
+ * empty for an element that only has a value.
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_child(const dsvdc_property_cursor_t *cursor,
+                                size_t index, dsvdc_property_cursor_t *child);
+
+/*!\brief Retrieve the level below the first element with the given name.
+ *
+ * \param[in] cursor cursor on the level of the element
+ * \param[in] name element name
+ * \param[out] child cursor on the nested properties of the element
+ * \return error code, DSVDC_ERR_DATA_NOT_FOUND if there is no such element.
+ */
+int dsvdc_property_cursor_child_by_name(const dsvdc_property_cursor_t *cursor,
+                                        const char *name,
+                                        dsvdc_property_cursor_t *child);
+
+/*!\brief Retrieve the number of elements on the level of a cursor.
+ *
+ * \param[in] cursor cursor
+ * \return number of elements
+ */
+size_t dsvdc_property_cursor_count(const dsvdc_property_cursor_t *cursor);
+
+/*!\brief Find the index of the first element with the given name.
+ *
+ * \param[in] cursor cursor
+ * \param[in] name element name
+ * \param[out] index element index
+ * \return error code, DSVDC_ERR_DATA_NOT_FOUND if there is no such element.
+ */
+int dsvdc_property_cursor_find(const dsvdc_property_cursor_t *cursor,
+                               const char *name, size_t *index);
+
+/*!\brief Retrieve the name of an element.
+ *
+ * \param[in] cursor cursor
+ * \param[in] index element index
+ * \param[out] name name of the element, NULL if it has none, it must not be
+ * freed.
+ * \param[out] len length of the name
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_name(const dsvdc_property_cursor_t *cursor,
+                               size_t index, const char **name, size_t *len);
+
+/*!\brief Retrieve the value type of an element, see
+ * dsvdc_property_get_value_type().
+ *
+ * \param[in] cursor cursor
+ * \param[in] index element index
+ * \param[out] type value type of the element
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_value_type(const dsvdc_property_cursor_t *cursor,
+                                     size_t index,
+                                     dsvdc_property_value_t *type);
+
+/*!\brief Retrieve a value of an element.
+ *
+ * Like the matching dsvdc_property_get_xxx() function.
+ *
+ * \param[in] cursor cursor
+ * \param[in] index element index
+ * \param[out] out element value
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_bool(const dsvdc_property_cursor_t *cursor,
+                               size_t index, bool *out);
+int dsvdc_property_cursor_uint(const dsvdc_property_cursor_t *cursor,
+                               size_t index, uint64_t *out);
+int dsvdc_property_cursor_int(const dsvdc_property_cursor_t *cursor,
+                              size_t index, int64_t *out);
+int dsvdc_property_cursor_double(const dsvdc_property_cursor_t *cursor,
+                                 size_t index, double *out);
+
+/*!\brief Retrieve the string value of an element.
+ *
+ * \param[in] cursor cursor
+ * \param[in] index element index
+ * \param[out] out string in the property, it must not be freed.
+ * \param[out] len length of the string
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_string(const dsvdc_property_cursor_t *cursor,
+                                 size_t index, const char **out, size_t *len);
+
+/*!\brief Retrieve the bytes value of an element.
+ *
+ * \param[in] cursor cursor
+ * \param[in] index element index
+ * \param[out] out bytes in the property, they must not be freed.
+ * \param[out] len number of bytes
+ * \return error code, indicating if the operation was successful.
+ */
+int dsvdc_property_cursor_bytes(const dsvdc_property_cursor_t *cursor,
+                                size_t index, const uint8_t **out,
+                                size_t *len);
+
 
 /*
  * ****************************************************************************
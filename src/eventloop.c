@@ -0,0 +1,423 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include "eventloop.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+static dsvdc_loop_event_t *dsvdc_loop_find(dsvdc_loop_t *loop, int fd)
+{
+    size_t i;
+    for (i = 0; i < loop->n_fds; i++)
+    {
+        if (loop->fds[i].fd == fd)
+        {
+            return &loop->fds[i];
+        }
+    }
+    return NULL;
+}
+
+#ifdef HAVE_EPOLL
+static uint32_t dsvdc_loop_to_epoll(int events)
+{
+    uint32_t ev = 0;
+    if (events & DSVDC_EV_READ)
+    {
+        ev |= EPOLLIN;
+    }
+    if (events & DSVDC_EV_WRITE)
+    {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+static int dsvdc_loop_wait_epoll(dsvdc_loop_t *loop, int timeout,
+                                 dsvdc_loop_event_t *events, int max_events)
+{
+    struct epoll_event ev[DSVDC_LOOP_MAX_EVENTS];
+    int i;
+
+    if (max_events > DSVDC_LOOP_MAX_EVENTS)
+    {
+        max_events = DSVDC_LOOP_MAX_EVENTS;
+    }
+
+    int ret = epoll_wait(loop->epoll_fd, ev, max_events, timeout);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    for (i = 0; i < ret; i++)
+    {
+        events[i].fd = ev[i].data.fd;
+        events[i].events = 0;
+        if (ev[i].events & (EPOLLIN | EPOLLHUP))
+        {
+            events[i].events |= DSVDC_EV_READ;
+        }
+        if (ev[i].events & EPOLLOUT)
+        {
+            events[i].events |= DSVDC_EV_WRITE;
+        }
+        if (ev[i].events & EPOLLERR)
+        {
+            events[i].events |= DSVDC_EV_ERROR;
+        }
+    }
+
+    return ret;
+}
+#endif
+
+static int dsvdc_loop_wait_select(dsvdc_loop_t *loop, int timeout,
+                                  dsvdc_loop_event_t *events, int max_events)
+{
+    fd_set rfds;
+    fd_set wfds;
+    struct timeval tv;
+    int max_fd = -1;
+    size_t i;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+
+    for (i = 0; i < loop->n_fds; i++)
+    {
+        if (loop->fds[i].events & DSVDC_EV_READ)
+        {
+            FD_SET(loop->fds[i].fd, &rfds);
+        }
+        if (loop->fds[i].events & DSVDC_EV_WRITE)
+        {
+            FD_SET(loop->fds[i].fd, &wfds);
+        }
+        if (loop->fds[i].fd > max_fd)
+        {
+            max_fd = loop->fds[i].fd;
+        }
+    }
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    int ret = select(max_fd + 1, &rfds, &wfds, NULL,
+                     (timeout < 0) ? NULL : &tv);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    ret = 0;
+    for (i = 0; (i < loop->n_fds) && (ret < max_events); i++)
+    {
+        int ev = 0;
+        if (FD_ISSET(loop->fds[i].fd, &rfds))
+        {
+            ev |= DSVDC_EV_READ;
+        }
+        if (FD_ISSET(loop->fds[i].fd, &wfds))
+        {
+            ev |= DSVDC_EV_WRITE;
+        }
+
+        if (ev)
+        {
+            events[ret].fd = loop->fds[i].fd;
+            events[ret].events = ev;
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+dsvdc_io_backend_t dsvdc_loop_default_backend(void)
+{
+#ifdef HAVE_EPOLL
+    return DSVDC_IO_BACKEND_EPOLL;
+#else
+    return DSVDC_IO_BACKEND_SELECT;
+#endif
+}
+
+static int dsvdc_loop_setup_wakeup(dsvdc_loop_t *loop)
+{
+    int i;
+
+    if (pipe(loop->wakeup_fd) < 0)
+    {
+        log("could not create wakeup pipe: %s\n", strerror(errno));
+        loop->wakeup_fd[0] = -1;
+        loop->wakeup_fd[1] = -1;
+        return DSVDC_ERR_SOCKET;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        int flags = fcntl(loop->wakeup_fd[i], F_GETFL);
+        fcntl(loop->wakeup_fd[i], F_SETFL, flags | O_NONBLOCK);
+        fcntl(loop->wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return dsvdc_loop_add(loop, loop->wakeup_fd[0], DSVDC_EV_READ);
+}
+
+int dsvdc_loop_init(dsvdc_loop_t *loop, dsvdc_io_backend_t backend)
+{
+    int ret;
+
+    loop->epoll_fd = -1;
+    loop->fds = NULL;
+    loop->n_fds = 0;
+    loop->max_fds = 0;
+    loop->wakeup_fd[0] = -1;
+    loop->wakeup_fd[1] = -1;
+
+    if (backend == DSVDC_IO_BACKEND_DEFAULT)
+    {
+        backend = dsvdc_loop_default_backend();
+    }
+
+    loop->backend = backend;
+
+    if (backend == DSVDC_IO_BACKEND_EPOLL)
+    {
+#ifdef HAVE_EPOLL
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd < 0)
+        {
+            log("could not create epoll instance: %s\n", strerror(errno));
+            return DSVDC_ERR_SOCKET;
+        }
+#else
+        log("epoll backend requested, but not available\n");
+        return DSVDC_ERR_PARAM;
+#endif
+    }
+    else if (backend != DSVDC_IO_BACKEND_SELECT)
+    {
+        log("unknown I/O backend %d requested\n", backend);
+        return DSVDC_ERR_PARAM;
+    }
+
+    ret = dsvdc_loop_setup_wakeup(loop);
+    if (ret != DSVDC_OK)
+    {
+        dsvdc_loop_cleanup(loop);
+    }
+
+    return ret;
+}
+
+void dsvdc_loop_cleanup(dsvdc_loop_t *loop)
+{
+    if (loop->epoll_fd > -1)
+    {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+
+    if (loop->wakeup_fd[0] > -1)
+    {
+        close(loop->wakeup_fd[0]);
+        close(loop->wakeup_fd[1]);
+        loop->wakeup_fd[0] = -1;
+        loop->wakeup_fd[1] = -1;
+    }
+
+    if (loop->fds)
+    {
+        free(loop->fds);
+        loop->fds = NULL;
+    }
+
+    loop->n_fds = 0;
+    loop->max_fds = 0;
+}
+
+void dsvdc_loop_wakeup(dsvdc_loop_t *loop)
+{
+    const char c = 0;
+
+    if (loop->wakeup_fd[1] > -1)
+    {
+        /* a full pipe already has a wakeup pending */
+        if ((write(loop->wakeup_fd[1], &c, 1) < 0) && (errno != EAGAIN))
+        {
+            log("could not wake up event loop: %s\n", strerror(errno));
+        }
+    }
+}
+
+bool dsvdc_loop_check_wakeup(dsvdc_loop_t *loop, int fd)
+{
+    char buf[64];
+
+    if ((fd < 0) || (fd != loop->wakeup_fd[0]))
+    {
+        return false;
+    }
+
+    while (read(fd, buf, sizeof(buf)) > 0);
+    return true;
+}
+
+int dsvdc_loop_add(dsvdc_loop_t *loop, int fd, int events)
+{
+    if (fd < 0)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    dsvdc_loop_event_t *entry = dsvdc_loop_find(loop, fd);
+    if (entry && (entry->events == events))
+    {
+        return DSVDC_OK;
+    }
+
+    if (!entry)
+    {
+        if ((loop->backend == DSVDC_IO_BACKEND_SELECT) && (fd >= FD_SETSIZE))
+        {
+            log("descriptor %d exceeds FD_SETSIZE, select backend can not "
+                "handle it\n", fd);
+            return DSVDC_ERR_SOCKET;
+        }
+
+        if (loop->n_fds == loop->max_fds)
+        {
+            size_t max = loop->max_fds ? loop->max_fds * 2 : 4;
+            dsvdc_loop_event_t *fds = realloc(loop->fds,
+                                              sizeof(dsvdc_loop_event_t) * max);
+            if (!fds)
+            {
+                log("could not allocate memory for descriptor list\n");
+                return DSVDC_ERR_OUT_OF_MEMORY;
+            }
+            loop->fds = fds;
+            loop->max_fds = max;
+        }
+    }
+
+#ifdef HAVE_EPOLL
+    if (loop->backend == DSVDC_IO_BACKEND_EPOLL)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = dsvdc_loop_to_epoll(events);
+        ev.data.fd = fd;
+        int ret = epoll_ctl(loop->epoll_fd,
+                            entry ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+        /* the descriptor was closed and its number reused in the meantime,
+         * closing removed it from the epoll set */
+        if ((ret < 0) && entry && (errno == ENOENT))
+        {
+            ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        if (ret < 0)
+        {
+            log("could not register descriptor %d: %s\n", fd, strerror(errno));
+            return DSVDC_ERR_SOCKET;
+        }
+    }
+#endif
+
+    if (!entry)
+    {
+        entry = &loop->fds[loop->n_fds++];
+        entry->fd = fd;
+    }
+    entry->events = events;
+
+    return DSVDC_OK;
+}
+
+void dsvdc_loop_remove(dsvdc_loop_t *loop, int fd)
+{
+    dsvdc_loop_event_t *entry = dsvdc_loop_find(loop, fd);
+    if (!entry)
+    {
+        return;
+    }
+
+#ifdef HAVE_EPOLL
+    if (loop->backend == DSVDC_IO_BACKEND_EPOLL)
+    {
+        /* the event argument is ignored, but must not be NULL on old kernels */
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+    }
+#endif
+
+    *entry = loop->fds[--loop->n_fds];
+}
+
+int dsvdc_loop_wait(dsvdc_loop_t *loop, int timeout,
+                    dsvdc_loop_event_t *events, int max_events)
+{
+    int ret;
+
+#ifdef HAVE_EPOLL
+    if (loop->backend == DSVDC_IO_BACKEND_EPOLL)
+    {
+        ret = dsvdc_loop_wait_epoll(loop, timeout, events, max_events);
+    }
+    else
+#endif
+    {
+        ret = dsvdc_loop_wait_select(loop, timeout, events, max_events);
+    }
+
+#ifdef DEBUG
+    if ((ret < 0) && (errno != EINTR))
+    {
+        log("waiting for events failed: %s\n", strerror(errno));
+    }
+#endif
+
+    return ret;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
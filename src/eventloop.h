@@ -0,0 +1,93 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_EVENTLOOP_H__
+#define __DSVDC_EVENTLOOP_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "dsvdc.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* event flags, may be combined */
+#define DSVDC_EV_READ       0x01
+#define DSVDC_EV_WRITE      0x02
+#define DSVDC_EV_ERROR      0x04
+
+/* maximum number of events that are handled in one loop iteration */
+#define DSVDC_LOOP_MAX_EVENTS   16
+
+typedef struct dsvdc_loop_event
+{
+    int fd;
+    int events;
+} dsvdc_loop_event_t;
+
+/* Descriptors are registered once and stay registered until they are removed,
+ * the backend only reports descriptors that are actually ready. The select
+ * backend is kept for systems without epoll, it is limited to FD_SETSIZE.
+ * The read end of the wakeup pipe is always registered, other threads use it
+ * to interrupt a wait when the set of events we are interested in changes. */
+typedef struct dsvdc_loop
+{
+    dsvdc_io_backend_t backend;
+    int epoll_fd;
+
+    /* registered descriptors and the events we are interested in */
+    dsvdc_loop_event_t *fds;
+    size_t n_fds;
+    size_t max_fds;
+
+    int wakeup_fd[2];
+} dsvdc_loop_t;
+
+/* returns the backend that is used if DSVDC_IO_BACKEND_DEFAULT is requested */
+dsvdc_io_backend_t dsvdc_loop_default_backend(void);
+
+int dsvdc_loop_init(dsvdc_loop_t *loop, dsvdc_io_backend_t backend);
+void dsvdc_loop_cleanup(dsvdc_loop_t *loop);
+
+/* interrupt a thread that is waiting on the loop, may be called from any
+ * thread */
+void dsvdc_loop_wakeup(dsvdc_loop_t *loop);
+
+/* returns true if fd is the wakeup pipe, the pending wakeups are consumed */
+bool dsvdc_loop_check_wakeup(dsvdc_loop_t *loop, int fd);
+
+/* register a descriptor, or update the events of an already registered one */
+int dsvdc_loop_add(dsvdc_loop_t *loop, int fd, int events);
+void dsvdc_loop_remove(dsvdc_loop_t *loop, int fd);
+
+/* Wait for events, timeout is in milliseconds, -1 waits forever. Returns the
+ * number of ready descriptors stored in events, 0 on timeout or a negative
+ * value on error. */
+int dsvdc_loop_wait(dsvdc_loop_t *loop, int timeout,
+                    dsvdc_loop_event_t *events, int max_events);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_EVENTLOOP_H__*/
@@ -0,0 +1,551 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "callbacks.h"
+#include "iothread.h"
+#include "msg_processor.h"
+#include "session.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* handle whose I/O thread the calling thread is, if any */
+static __thread dsvdc_t *dsvdc_io_handle = NULL;
+
+void dsvdc_io_set_thread(dsvdc_t *handle)
+{
+    dsvdc_io_handle = handle;
+}
+
+bool dsvdc_io_mode(dsvdc_t *handle)
+{
+    return __atomic_load_n(&handle->io_active, __ATOMIC_ACQUIRE) &&
+           (dsvdc_io_handle != handle);
+}
+
+bool dsvdc_io_thread_self(dsvdc_t *handle)
+{
+    return (dsvdc_io_handle == handle) &&
+           __atomic_load_n(&handle->io_active, __ATOMIC_ACQUIRE);
+}
+
+int dsvdc_io_init(dsvdc_t *handle)
+{
+    int i;
+
+    int ret = dsvdc_spsc_init(&handle->io_events, IO_EVENT_QUEUE_SIZE);
+    if (ret != DSVDC_OK)
+    {
+        log("could not allocate event queue\n");
+        return ret;
+    }
+
+    if (pipe(handle->io_event_fd) < 0)
+    {
+        log("could not create event pipe: %s\n", strerror(errno));
+        dsvdc_spsc_free(&handle->io_events);
+        handle->io_event_fd[0] = -1;
+        handle->io_event_fd[1] = -1;
+        return DSVDC_ERR_SOCKET;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        int flags = fcntl(handle->io_event_fd[i], F_GETFL);
+        fcntl(handle->io_event_fd[i], F_SETFL, flags | O_NONBLOCK);
+        fcntl(handle->io_event_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    dsvdc_mpsc_init(&handle->io_sends);
+    handle->io_backlog = NULL;
+    handle->io_backlog_tail = NULL;
+    handle->io_event_signaled = false;
+    handle->io_send_signaled = false;
+    handle->io_blocked = false;
+    handle->io_stop = false;
+    handle->io_tx_bytes = 0;
+    handle->io_tx_messages = 0;
+    return DSVDC_OK;
+}
+
+void dsvdc_io_cleanup(dsvdc_t *handle)
+{
+    if (handle->io_event_fd[0] > -1)
+    {
+        close(handle->io_event_fd[0]);
+        close(handle->io_event_fd[1]);
+        handle->io_event_fd[0] = -1;
+        handle->io_event_fd[1] = -1;
+    }
+    dsvdc_spsc_free(&handle->io_events);
+}
+
+/* wake up the dispatching thread, once until it looked at the queue */
+static void dsvdc_io_signal(dsvdc_t *handle)
+{
+    char c = 0;
+
+    if (!__atomic_exchange_n(&handle->io_event_signaled, true,
+                             __ATOMIC_SEQ_CST))
+    {
+        /* a full pipe already has a wakeup pending */
+        if ((write(handle->io_event_fd[1], &c, 1) < 0) && (errno != EAGAIN))
+        {
+            log("could not signal event: %s\n", strerror(errno));
+        }
+    }
+}
+
+/* copy the event into the queue, false if there is no room for it */
+static bool dsvdc_io_push(dsvdc_t *handle, const dsvdc_io_event_t *event,
+                          const unsigned char *data)
+{
+    size_t len = sizeof(dsvdc_io_event_t) + event->len;
+
+    dsvdc_io_event_t *slot = dsvdc_spsc_reserve(&handle->io_events, len);
+    if (!slot)
+    {
+        /* ask the dispatching thread for a wakeup, then look again in case
+         * it made room before it could see the request */
+        __atomic_store_n(&handle->io_blocked, true, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        slot = dsvdc_spsc_reserve(&handle->io_events, len);
+        if (!slot)
+        {
+            return false;
+        }
+    }
+
+    memcpy(slot, event, sizeof(dsvdc_io_event_t));
+    slot->next = NULL;
+    if (event->len > 0)
+    {
+        memcpy(slot->data, data, event->len);
+    }
+    dsvdc_spsc_commit(&handle->io_events);
+    dsvdc_io_signal(handle);
+    return true;
+}
+
+/* callbacks are never lost, if the queue is full they wait in the backlog
+ * and keep their order */
+static void dsvdc_io_post(dsvdc_t *handle, dsvdc_io_event_t *event)
+{
+    if (event->session)
+    {
+        __atomic_add_fetch(&event->session->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    if (!handle->io_backlog && dsvdc_io_push(handle, event, NULL))
+    {
+        return;
+    }
+
+    dsvdc_io_event_t *copy = malloc(sizeof(dsvdc_io_event_t));
+    if (!copy)
+    {
+        log("could not allocate memory for event, dropping it\n");
+        if (event->session)
+        {
+            __atomic_sub_fetch(&event->session->refs, 1, __ATOMIC_RELEASE);
+        }
+        return;
+    }
+
+    memcpy(copy, event, sizeof(dsvdc_io_event_t));
+    copy->next = NULL;
+    if (handle->io_backlog_tail)
+    {
+        handle->io_backlog_tail->next = copy;
+    }
+    else
+    {
+        handle->io_backlog = copy;
+    }
+    handle->io_backlog_tail = copy;
+    __atomic_store_n(&handle->io_blocked, true, __ATOMIC_SEQ_CST);
+}
+
+bool dsvdc_io_post_frame(dsvdc_session_t *session, const unsigned char *data,
+                         uint16_t len)
+{
+    dsvdc_t *handle = session->handle;
+    dsvdc_io_event_t event;
+
+    /* the backlog goes first */
+    if (handle->io_backlog)
+    {
+        __atomic_store_n(&handle->io_blocked, true, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.type = DSVDC_IO_FRAME;
+    event.session = session;
+    event.len = len;
+
+    __atomic_add_fetch(&session->refs, 1, __ATOMIC_RELAXED);
+    if (!dsvdc_io_push(handle, &event, data))
+    {
+        __atomic_sub_fetch(&session->refs, 1, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+void dsvdc_io_post_send_done(dsvdc_t *handle, dsvdc_session_t *session,
+                             uint32_t message_id, int code)
+{
+    dsvdc_io_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = DSVDC_IO_SEND_DONE;
+    event.session = session;
+    event.message_id = message_id;
+    event.code = code;
+    dsvdc_io_post(handle, &event);
+}
+
+void dsvdc_io_post_request_done(dsvdc_t *handle, dsvdc_session_t *session,
+                                cached_request_t *request, int code)
+{
+    dsvdc_io_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = DSVDC_IO_REQUEST_DONE;
+    event.session = session;
+    event.message_id = request->message_id;
+    event.code = code;
+    event.arg = request->arg;
+    event.callback = request->callback;
+    dsvdc_io_post(handle, &event);
+}
+
+void dsvdc_io_post_session_end(dsvdc_session_t *session)
+{
+    dsvdc_io_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = DSVDC_IO_SESSION_END;
+    event.session = session;
+    dsvdc_io_post(session->handle, &event);
+}
+
+void dsvdc_io_flush_backlog(dsvdc_t *handle)
+{
+    while (handle->io_backlog)
+    {
+        dsvdc_io_event_t *event = handle->io_backlog;
+        if (!dsvdc_io_push(handle, event, NULL))
+        {
+            return;
+        }
+
+        handle->io_backlog = event->next;
+        if (!handle->io_backlog)
+        {
+            handle->io_backlog_tail = NULL;
+        }
+        free(event);
+    }
+}
+
+bool dsvdc_io_blocked(dsvdc_t *handle)
+{
+    return __atomic_load_n(&handle->io_blocked, __ATOMIC_ACQUIRE);
+}
+
+/* Write one message to its receivers. They are picked under the mutex, as
+ * the handshake state is changed by the dispatching thread, the sockets are
+ * written without it. */
+static void dsvdc_io_send_message(dsvdc_t *handle, dsvdc_io_send_t *send)
+{
+    dsvdc_session_t *session;
+    unsigned int sent = 0;
+    int ret = DSVDC_ERR_NOT_CONNECTED;
+
+    /* requests take their entries before the message goes out, a full pool
+     * fails the request like a failed send */
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    dsvdc_select_receivers(handle, send->session_id);
+    if (send->callback)
+    {
+        int code = dsvdc_register_requests(handle, send->message_id,
+                                           send->timeout, send->arg,
+                                           send->callback);
+        if (code != DSVDC_OK)
+        {
+            LL_FOREACH(handle->sessions, session)
+            {
+                session->tx_target = false;
+            }
+            ret = code;
+        }
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    /* sessions are only added and freed by this thread */
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (!session->tx_target)
+        {
+            continue;
+        }
+
+        int code = dsvdc_session_send(session, send->lane, send->data,
+                                      send->len, send->message_id);
+        if (code != DSVDC_OK)
+        {
+            if (send->callback)
+            {
+                pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+                dsvdc_session_cancel_request(session, send->message_id);
+                pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+            }
+            if (ret != DSVDC_OK)
+            {
+                ret = code;
+            }
+            continue;
+        }
+        ret = DSVDC_OK;
+        sent++;
+    }
+
+    /* the callbacks are posted after this, by this thread */
+    if (send->receivers)
+    {
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        *send->receivers = sent;
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    }
+
+    cached_request_t failed;
+    failed.message_id = send->message_id;
+    failed.arg = send->arg;
+    failed.callback = send->callback;
+
+    LL_FOREACH(handle->sessions, session)
+    {
+        session->tx_target = false;
+    }
+
+    /* the sender got DSVDC_OK already, report the failure like a
+     * synchronous sender would have seen it */
+    if (ret != DSVDC_OK)
+    {
+        log("could not send message %u: %d\n", send->message_id, ret);
+        if (send->callback)
+        {
+            dsvdc_io_post_request_done(handle, NULL, &failed, ret);
+        }
+        else
+        {
+            dsvdc_io_post_send_done(handle, NULL, send->message_id, ret);
+        }
+    }
+}
+
+void dsvdc_io_flush_sends(dsvdc_t *handle)
+{
+    dsvdc_mpsc_node_t *node;
+
+    /* senders signal again from now on */
+    __atomic_store_n(&handle->io_send_signaled, false, __ATOMIC_SEQ_CST);
+
+    /* everything that was queued meanwhile goes out in as few writes as
+     * possible */
+    dsvdc_tx_cork(handle);
+    while ((node = dsvdc_mpsc_pop(&handle->io_sends)) != NULL)
+    {
+        dsvdc_io_send_message(handle, (dsvdc_io_send_t *)node);
+        free(node);
+    }
+    dsvdc_tx_uncork(handle);
+}
+
+int dsvdc_io_send(dsvdc_t *handle, unsigned int session_id,
+                  Vdcapi__Message *msg, unsigned int timeout, void *arg,
+                  void (*function)(dsvdc_t *handle, int code, void *arg,
+                                   void *userdata),
+                  unsigned int *receivers)
+{
+    if ((session_id == ALL_SESSIONS) &&
+        (__atomic_load_n(&handle->n_established, __ATOMIC_ACQUIRE) == 0))
+    {
+        log("not sending message, no open vdSM connection.\n");
+        return DSVDC_ERR_NOT_CONNECTED;
+    }
+
+    if (function)
+    {
+        msg->message_id = __atomic_add_fetch(&handle->request_id, 1,
+                                             __ATOMIC_RELAXED);
+        msg->has_message_id = 1;
+    }
+
+    size_t len = vdcapi__message__get_packed_size(msg);
+    if (len > UINT16_MAX)
+    {
+        log("message of %zu bytes can not be framed\n", len);
+        return DSVDC_ERR_PARAM;
+    }
+
+    /* every sender packs into its own node, nothing is shared */
+    dsvdc_io_send_t *send = malloc(sizeof(dsvdc_io_send_t) + len);
+    if (!send)
+    {
+        log("could not allocate %zu bytes for outgoing message\n", len);
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    vdcapi__message__pack(msg, send->data);
+    send->len = len;
+    send->session_id = session_id;
+    send->lane = dsvdc_message_lane(msg);
+    send->message_id = msg->has_message_id ? msg->message_id :
+                                             RESERVED_REQUEST_ID;
+    send->timeout = timeout;
+    send->arg = arg;
+    send->callback = function;
+    send->receivers = receivers;
+
+    dsvdc_mpsc_push(&handle->io_sends, &send->node);
+    if (!__atomic_exchange_n(&handle->io_send_signaled, true,
+                             __ATOMIC_SEQ_CST))
+    {
+        dsvdc_loop_wakeup(&handle->loop);
+    }
+    return DSVDC_OK;
+}
+
+/* callbacks run without the handle mutex like in the loop thread */
+static void dsvdc_io_run_event(dsvdc_t *handle, dsvdc_io_event_t *event)
+{
+    dsvdc_session_t *session = event->session;
+    dsvdc_session_t *previous;
+    dsvdc_callbacks_t cb;
+
+    switch (event->type)
+    {
+        case DSVDC_IO_FRAME:
+            /* the application closed the session, drop what is left */
+            if (!session->close_pending)
+            {
+                dsvdc_process_message(handle, session, event->data,
+                                      event->len);
+            }
+            DSVDC_STAT_ADD(handle, rx_messages, 1);
+            __atomic_store_n(&handle->stats.rx_decoder_allocs,
+                             handle->rx_arena.n_allocs, __ATOMIC_RELAXED);
+            __atomic_store_n(&handle->stats.rx_heap_allocs,
+                             handle->rx_arena.n_heap_allocs,
+                             __ATOMIC_RELAXED);
+            break;
+
+        case DSVDC_IO_SEND_DONE:
+            dsvdc_get_callbacks(handle, &cb);
+            if (cb.vdsm_send_complete)
+            {
+                previous = dsvdc_session_set_current(session);
+                cb.vdsm_send_complete(handle, event->message_id, event->code,
+                                      cb.userdata);
+                dsvdc_session_set_current(previous);
+            }
+            break;
+
+        case DSVDC_IO_REQUEST_DONE:
+            dsvdc_get_callbacks(handle, &cb);
+            previous = dsvdc_session_set_current(session);
+            event->callback(handle, event->code, event->arg, cb.userdata);
+            dsvdc_session_set_current(previous);
+            break;
+
+        case DSVDC_IO_SESSION_END:
+            dsvdc_get_callbacks(handle, &cb);
+            if (cb.vdsm_end_session)
+            {
+                previous = dsvdc_session_set_current(session);
+                cb.vdsm_end_session(handle, cb.userdata);
+                dsvdc_session_set_current(previous);
+            }
+            break;
+    }
+
+    /* the I/O thread may free the session now */
+    if (session)
+    {
+        __atomic_sub_fetch(&session->refs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void dsvdc_io_dispatch(dsvdc_t *handle, int wait_ms)
+{
+    dsvdc_io_event_t *event;
+    char buf[64];
+    size_t len;
+
+    event = dsvdc_spsc_peek(&handle->io_events, &len);
+    if (!event && (wait_ms != 0))
+    {
+        struct pollfd pfd;
+        pfd.fd = handle->io_event_fd[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, wait_ms);
+    }
+
+    /* events that are posted from now on signal again */
+    while (read(handle->io_event_fd[0], buf, sizeof(buf)) > 0);
+    __atomic_store_n(&handle->io_event_signaled, false, __ATOMIC_SEQ_CST);
+
+    while ((event = dsvdc_spsc_peek(&handle->io_events, &len)) != NULL)
+    {
+        dsvdc_io_run_event(handle, event);
+        dsvdc_spsc_release(&handle->io_events);
+    }
+
+    /* there is room again, the I/O thread continues where it stopped */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&handle->io_blocked, false, __ATOMIC_SEQ_CST))
+    {
+        dsvdc_loop_wakeup(&handle->loop);
+    }
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
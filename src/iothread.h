@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_IOTHREAD_H__
+#define __DSVDC_IOTHREAD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "messages.pb-c.h"
+#include "common.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* In I/O thread mode the library thread owns the sockets. It hands complete
+ * frames and all callbacks to the application thread that calls dsvdc_work()
+ * through the event queue, the application hands outgoing messages to it
+ * through the send queue. Neither side waits for the other. */
+
+typedef enum dsvdc_io_event_type
+{
+    DSVDC_IO_FRAME,         /* a message was received, data holds it */
+    DSVDC_IO_SEND_DONE,     /* a message left the send queue */
+    DSVDC_IO_REQUEST_DONE,  /* a request was answered or failed */
+    DSVDC_IO_SESSION_END    /* an established session was closed */
+} dsvdc_io_event_type_t;
+
+typedef struct dsvdc_io_event
+{
+    /* only used while the event waits in the backlog */
+    struct dsvdc_io_event *next;
+    dsvdc_io_event_type_t type;
+    int code;
+    uint32_t message_id;
+    /* the event holds a reference, NULL if no session was involved */
+    dsvdc_session_t *session;
+    void *arg;
+    void (*callback)(dsvdc_t *handle, int code, void *arg, void *userdata);
+    uint16_t len;
+    unsigned char data[];
+} dsvdc_io_event_t;
+
+/* one message waiting for the I/O thread, serialized by the sender */
+typedef struct dsvdc_io_send
+{
+    dsvdc_mpsc_node_t node;
+    unsigned int session_id;
+    dsvdc_tx_lane_t lane;
+    uint32_t message_id;
+    /* set for requests, the response is tracked per session */
+    unsigned int timeout;
+    void *arg;
+    void (*callback)(dsvdc_t *handle, int code, void *arg, void *userdata);
+    /* receives the number of sessions that took the request, may be NULL */
+    unsigned int *receivers;
+    size_t len;
+    uint8_t data[];
+} dsvdc_io_send_t;
+
+/* true if the I/O thread is running and the caller is not that thread */
+bool dsvdc_io_mode(dsvdc_t *handle);
+
+/* true if the caller is the running I/O thread */
+bool dsvdc_io_thread_self(dsvdc_t *handle);
+
+/* called by the I/O thread when it starts */
+void dsvdc_io_set_thread(dsvdc_t *handle);
+
+int dsvdc_io_init(dsvdc_t *handle);
+void dsvdc_io_cleanup(dsvdc_t *handle);
+
+/* Functions for the I/O thread. Events that do not fit into the queue wait
+ * in a backlog, frames are refused instead and stay in the receive ring of
+ * the session until the application caught up. */
+bool dsvdc_io_post_frame(dsvdc_session_t *session, const unsigned char *data,
+                         uint16_t len);
+void dsvdc_io_post_send_done(dsvdc_t *handle, dsvdc_session_t *session,
+                             uint32_t message_id, int code);
+void dsvdc_io_post_request_done(dsvdc_t *handle, dsvdc_session_t *session,
+                                cached_request_t *request, int code);
+void dsvdc_io_post_session_end(dsvdc_session_t *session);
+
+/* moves the backlog into the event queue as far as it fits */
+void dsvdc_io_flush_backlog(dsvdc_t *handle);
+
+/* true while the receive path waits for room in the event queue */
+bool dsvdc_io_blocked(dsvdc_t *handle);
+
+/* writes all messages the application queued since the last call */
+void dsvdc_io_flush_sends(dsvdc_t *handle);
+
+/* Serializes the message and hands it to the I/O thread, the message id of
+ * requests is assigned here. Delivery is reported asynchronously. */
+int dsvdc_io_send(dsvdc_t *handle, unsigned int session_id,
+                  Vdcapi__Message *msg, unsigned int timeout, void *arg,
+                  void (*function)(dsvdc_t *handle, int code, void *arg,
+                                   void *userdata),
+                  unsigned int *receivers);
+
+/* Runs the callbacks of all queued events on the calling thread, waits up to
+ * wait_ms milliseconds for the first one. Only one thread at a time may
+ * dispatch. */
+void dsvdc_io_dispatch(dsvdc_t *handle, int wait_ms);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_IOTHREAD_H__*/
@@ -0,0 +1,193 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsvdc.h"
+#include "lfqueue.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* every record starts with its length, records are aligned to it */
+#define SPSC_HEADER     sizeof(size_t)
+#define SPSC_ALIGN(x)   (((x) + SPSC_HEADER - 1) & ~(SPSC_HEADER - 1))
+/* length of the marker that tells the consumer to continue at the start */
+#define SPSC_WRAP       SIZE_MAX
+
+int dsvdc_spsc_init(dsvdc_spsc_t *queue, size_t size)
+{
+    memset(queue, 0, sizeof(dsvdc_spsc_t));
+    if ((size == 0) || (size & (size - 1)) || (size < SPSC_HEADER))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    /* the records hold structures with pointers and 64 bit members */
+    if (posix_memalign((void **)&queue->data, 16, size) != 0)
+    {
+        queue->data = NULL;
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    queue->size = size;
+    return DSVDC_OK;
+}
+
+void dsvdc_spsc_free(dsvdc_spsc_t *queue)
+{
+    free(queue->data);
+    memset(queue, 0, sizeof(dsvdc_spsc_t));
+}
+
+void *dsvdc_spsc_reserve(dsvdc_spsc_t *queue, size_t len)
+{
+    size_t need = SPSC_ALIGN(SPSC_HEADER + len);
+    size_t tail = queue->tail;
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    size_t pos = tail & (queue->size - 1);
+    size_t skip = 0;
+
+    /* does not fit before the end, waste the rest and start over */
+    if (need > queue->size - pos)
+    {
+        skip = queue->size - pos;
+    }
+
+    if ((tail - head) + skip + need > queue->size)
+    {
+        return NULL;
+    }
+
+    if (skip)
+    {
+        *(size_t *)(queue->data + pos) = SPSC_WRAP;
+        pos = 0;
+    }
+
+    *(size_t *)(queue->data + pos) = len;
+    queue->reserved = skip + need;
+    return queue->data + pos + SPSC_HEADER;
+}
+
+void dsvdc_spsc_commit(dsvdc_spsc_t *queue)
+{
+    __atomic_store_n(&queue->tail, queue->tail + queue->reserved,
+                     __ATOMIC_RELEASE);
+    queue->reserved = 0;
+}
+
+void *dsvdc_spsc_peek(dsvdc_spsc_t *queue, size_t *len)
+{
+    size_t head = queue->head;
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    size_t skip = 0;
+
+    if (head == tail)
+    {
+        return NULL;
+    }
+
+    size_t pos = head & (queue->size - 1);
+    if (*(size_t *)(queue->data + pos) == SPSC_WRAP)
+    {
+        skip = queue->size - pos;
+        pos = 0;
+    }
+
+    *len = *(size_t *)(queue->data + pos);
+    queue->peeked = skip + SPSC_ALIGN(SPSC_HEADER + *len);
+    return queue->data + pos + SPSC_HEADER;
+}
+
+void dsvdc_spsc_release(dsvdc_spsc_t *queue)
+{
+    __atomic_store_n(&queue->head, queue->head + queue->peeked,
+                     __ATOMIC_RELEASE);
+    queue->peeked = 0;
+}
+
+void dsvdc_mpsc_init(dsvdc_mpsc_t *queue)
+{
+    queue->stub.next = NULL;
+    queue->tail = &queue->stub;
+    queue->head = &queue->stub;
+}
+
+void dsvdc_mpsc_push(dsvdc_mpsc_t *queue, dsvdc_mpsc_node_t *node)
+{
+    node->next = NULL;
+    dsvdc_mpsc_node_t *prev = __atomic_exchange_n(&queue->tail, node,
+                                                  __ATOMIC_ACQ_REL);
+    /* between the exchange and this store the consumer sees a gap */
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+dsvdc_mpsc_node_t *dsvdc_mpsc_pop(dsvdc_mpsc_t *queue)
+{
+    dsvdc_mpsc_node_t *head = queue->head;
+    dsvdc_mpsc_node_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if (head == &queue->stub)
+    {
+        if (!next)
+        {
+            return NULL;
+        }
+        queue->head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next)
+    {
+        queue->head = next;
+        return head;
+    }
+
+    /* head is the last node, a producer is about to link another one */
+    if (head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    /* put the stub back so that the last node can be handed out */
+    dsvdc_mpsc_push(queue, &queue->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next)
+    {
+        queue->head = next;
+        return head;
+    }
+
+    return NULL;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,91 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_LFQUEUE_H__
+#define __DSVDC_LFQUEUE_H__
+
+#include <stddef.h>
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Lock-free queues between the I/O thread and the application threads. */
+
+/* Single producer, single consumer queue of variable sized records in a
+ * byte ring, the size must be a power of two. Like dsvdc_ring_t head and
+ * tail are free running counters, the head is only written by the consumer
+ * and the tail only by the producer. A record never wraps around the end of
+ * the buffer, so the consumer always gets a contiguous pointer. */
+typedef struct dsvdc_spsc
+{
+    unsigned char *data;
+    size_t size;
+    size_t head;
+    size_t tail;
+    /* private to the producer: bytes taken by the reserved record */
+    size_t reserved;
+    /* private to the consumer: bytes taken by the peeked record */
+    size_t peeked;
+} dsvdc_spsc_t;
+
+int dsvdc_spsc_init(dsvdc_spsc_t *queue, size_t size);
+void dsvdc_spsc_free(dsvdc_spsc_t *queue);
+
+/* Producer: returns space for a record of len bytes, aligned for any
+ * structure, or NULL if the queue is full. The record becomes visible to the
+ * consumer with dsvdc_spsc_commit(). */
+void *dsvdc_spsc_reserve(dsvdc_spsc_t *queue, size_t len);
+void dsvdc_spsc_commit(dsvdc_spsc_t *queue);
+
+/* Consumer: returns the oldest record or NULL if the queue is empty, the
+ * record stays valid until dsvdc_spsc_release(). */
+void *dsvdc_spsc_peek(dsvdc_spsc_t *queue, size_t *len);
+void dsvdc_spsc_release(dsvdc_spsc_t *queue);
+
+/* Intrusive multiple producer, single consumer queue (Vyukov). Producers
+ * never wait for each other or for the consumer, a push is one atomic
+ * exchange. Nodes are embedded at the start of the queued structures. */
+typedef struct dsvdc_mpsc_node
+{
+    struct dsvdc_mpsc_node *next;
+} dsvdc_mpsc_node_t;
+
+typedef struct dsvdc_mpsc
+{
+    /* last pushed node, shared by all producers */
+    dsvdc_mpsc_node_t *tail;
+    /* next node to pop, private to the consumer */
+    dsvdc_mpsc_node_t *head;
+    dsvdc_mpsc_node_t stub;
+} dsvdc_mpsc_t;
+
+void dsvdc_mpsc_init(dsvdc_mpsc_t *queue);
+void dsvdc_mpsc_push(dsvdc_mpsc_t *queue, dsvdc_mpsc_node_t *node);
+/* returns NULL if the queue is empty or a push is just in progress, in the
+ * latter case the node shows up on one of the next calls */
+dsvdc_mpsc_node_t *dsvdc_mpsc_pop(dsvdc_mpsc_t *queue);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_LFQUEUE_H__*/
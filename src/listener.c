@@ -0,0 +1,230 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "listener.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+static int dsvdc_listen_fail(int fd, const char *what)
+{
+#ifndef DEBUG
+    (void)what;
+#endif
+    log("%s failed: %s\n", what, strerror(errno));
+    close(fd);
+    return DSVDC_ERR_SOCKET;
+}
+
+static int dsvdc_bind_tcp(int fd, int family, unsigned short port)
+{
+    if (family == AF_INET6)
+    {
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        return bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    return bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+int dsvdc_listen_tcp(int family, unsigned short *port, int backlog)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int reuse_on = 1;
+    int v6only_off = 0;
+
+    struct linger
+    {
+        int l_on;
+        int l_linger;
+    } linger;
+
+    linger.l_on = 1;
+    linger.l_linger = 30;
+
+    int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        log("could not create socket. %s\n", strerror(errno));
+        return DSVDC_ERR_SOCKET;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse_on,
+                   sizeof(int)) < 0)
+    {
+        return dsvdc_listen_fail(fd, "setting SO_REUSEADDR");
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_LINGER, (const char*)&linger,
+                   sizeof(linger)) < 0)
+    {
+        return dsvdc_listen_fail(fd, "setting SO_LINGER");
+    }
+
+    /* one socket for both, the vdSM may connect via IPv4 or IPv6 */
+    if ((family == AF_INET6) &&
+        (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only_off,
+                    sizeof(v6only_off)) < 0))
+    {
+        return dsvdc_listen_fail(fd, "clearing IPV6_V6ONLY");
+    }
+
+    if (*port != 0)
+    {
+        if (dsvdc_bind_tcp(fd, family, *port) < 0)
+        {
+            return dsvdc_listen_fail(fd, "binding to the requested port");
+        }
+    }
+    /* the well known port is preferred, the kernel picks one if it is taken,
+     * the vdSM learns about it via Avahi */
+    else if ((dsvdc_bind_tcp(fd, family, DEFAULT_VDC_PORT) < 0) &&
+             ((errno != EADDRINUSE) || (dsvdc_bind_tcp(fd, family, 0) < 0)))
+    {
+        return dsvdc_listen_fail(fd, "binding to a free port");
+    }
+
+    if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0)
+    {
+        return dsvdc_listen_fail(fd, "querying the bound port");
+    }
+
+    if (addr.ss_family == AF_INET6)
+    {
+        *port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    }
+    else
+    {
+        *port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+    }
+    log("bound to port %d\n", *port);
+
+    if (listen(fd, backlog) < 0)
+    {
+        return dsvdc_listen_fail(fd, "listening on socket");
+    }
+
+    return fd;
+}
+
+/* a socket file nobody accepts connections on is left over from an
+ * instance that did not shut down cleanly */
+static bool dsvdc_unix_stale(const struct sockaddr_un *addr, socklen_t len)
+{
+    bool stale;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    stale = (connect(fd, (const struct sockaddr *)addr, len) < 0) &&
+            (errno == ECONNREFUSED);
+    close(fd);
+    return stale;
+}
+
+int dsvdc_listen_unix(const char *path, int backlog)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    size_t len = path ? strlen(path) : 0;
+    if ((len == 0) || (len >= sizeof(addr.sun_path)))
+    {
+        log("invalid Unix socket path\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, len);
+
+    /* abstract sockets start with a zero byte and are not zero terminated */
+    if (path[0] == '@')
+    {
+        addr.sun_path[0] = '\0';
+    }
+    else if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+    {
+        if (!dsvdc_unix_stale(&addr,
+                              offsetof(struct sockaddr_un, sun_path) + len))
+        {
+            log("Unix socket %s is in use\n", path);
+            errno = EADDRINUSE;
+            return DSVDC_ERR_SOCKET;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        log("could not create socket. %s\n", strerror(errno));
+        return DSVDC_ERR_SOCKET;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr,
+             offsetof(struct sockaddr_un, sun_path) + len) < 0)
+    {
+        return dsvdc_listen_fail(fd, "binding to Unix socket");
+    }
+
+    log("bound to Unix socket %s\n", path);
+
+    if (listen(fd, backlog) < 0)
+    {
+        return dsvdc_listen_fail(fd, "listening on socket");
+    }
+
+    return fd;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
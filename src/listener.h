@@ -0,0 +1,44 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_LISTENER_H__
+#define __DSVDC_LISTENER_H__
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Create a listening TCP socket for AF_INET or AF_INET6, the latter also
+ * accepts IPv4 connections. Port zero selects DEFAULT_VDC_PORT, or a port
+ * picked by the kernel if that one is taken, the port that is used is stored
+ * back. Returns the descriptor or a negative error code. */
+int dsvdc_listen_tcp(int family, unsigned short *port, int backlog);
+
+/* Create a listening Unix domain socket, a leading '@' selects the abstract
+ * namespace. A stale socket file at the path is replaced. Returns the
+ * descriptor or a negative error code. */
+int dsvdc_listen_unix(const char *path, int backlog);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_LISTENER_H__*/
@@ -24,141 +24,637 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <utlist.h>
 #include <errno.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #include "common.h"
+#include "callbacks.h"
+#include "dispatch.h"
+#include "dsuid.h"
 #include "msg_processor.h"
+#include "session.h"
 #include "sockutil.h"
 #include "log.h"
 #include "properties.h"
+#include "propcache.h"
+#include "iothread.h"
 
 #if __GNUC__ >= 4
     #pragma GCC visibility push(hidden)
 #endif
 
-int dsvdc_send_message(dsvdc_t *handle, Vdcapi__Message *msg)
+/* Called for every message that left the send queue of a session. The
+ * callback may send again, it is only run by dsvdc_report_send_done() once
+ * the queue is consistent and the handle mutex was released. */
+static void dsvdc_send_done(void *ctx, uint32_t message_id, int code)
+{
+    dsvdc_session_t *session = (dsvdc_session_t *)ctx;
+    dsvdc_t *handle = session->handle;
+    dsvdc_callbacks_t cb;
+
+    if (code == DSVDC_OK)
+    {
+        DSVDC_STAT_ADD(handle, tx_messages, 1);
+    }
+
+    dsvdc_get_callbacks(handle, &cb);
+    if (!cb.vdsm_send_complete)
+    {
+        return;
+    }
+
+    /* the application thread runs the callback */
+    if (dsvdc_io_thread_self(handle))
+    {
+        dsvdc_io_post_send_done(handle, session, message_id, code);
+        return;
+    }
+
+    if (handle->tx_done_count == handle->tx_done_size)
+    {
+        size_t size = handle->tx_done_size ? handle->tx_done_size * 2 :
+                                             TX_DONE_SIZE;
+        dsvdc_send_done_t *done = realloc(handle->tx_done,
+                                          size * sizeof(*done));
+        if (!done)
+        {
+            log("could not allocate memory, not reporting message %u\n",
+                message_id);
+            return;
+        }
+        handle->tx_done = done;
+        handle->tx_done_size = size;
+    }
+
+    /* the session is not freed before it was reported */
+    __atomic_add_fetch(&session->refs, 1, __ATOMIC_RELAXED);
+    dsvdc_send_done_t *done = &handle->tx_done[handle->tx_done_count++];
+    done->session = session;
+    done->message_id = message_id;
+    done->code = code;
+}
+
+void dsvdc_report_send_done(dsvdc_t *handle)
+{
+    dsvdc_send_done_t done;
+    dsvdc_callbacks_t cb;
+    size_t i;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+
+    /* a corked batch is reported by whoever uncorks it, callbacks that send
+     * again are reported by the loop that is already running */
+    if ((handle->tx_cork > 0) || handle->tx_reporting)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return;
+    }
+
+    handle->tx_reporting = true;
+    for (i = 0; i < handle->tx_done_count; i++)
+    {
+        /* the array moves if the callback sends again */
+        done = handle->tx_done[i];
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+        dsvdc_get_callbacks(handle, &cb);
+        if (cb.vdsm_send_complete)
+        {
+            dsvdc_session_t *previous =
+                dsvdc_session_set_current(done.session);
+            cb.vdsm_send_complete(handle, done.message_id, done.code,
+                                  cb.userdata);
+            dsvdc_session_set_current(previous);
+        }
+
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        __atomic_sub_fetch(&done.session->refs, 1, __ATOMIC_RELEASE);
+    }
+    handle->tx_done_count = 0;
+    handle->tx_reporting = false;
+
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+/* Answers the vdSM waits for on the connection level go first, then
+ * answers to its requests, everything we send on our own goes last. */
+dsvdc_tx_lane_t dsvdc_message_lane(const Vdcapi__Message *msg)
+{
+    switch (msg->type)
+    {
+        case VDCAPI__TYPE__VDC_SEND_PONG:
+        case VDCAPI__TYPE__GENERIC_RESPONSE:
+        case VDCAPI__TYPE__VDC_RESPONSE_HELLO:
+            return DSVDC_TX_LANE_CONTROL;
+        case VDCAPI__TYPE__VDC_RESPONSE_GET_PROPERTY:
+        case VDCAPI__TYPE__VDC_RESPONSE_SET_PROPERTY:
+            return DSVDC_TX_LANE_INTERACTIVE;
+        default:
+            return DSVDC_TX_LANE_BULK;
+    }
+}
+
+/* Serialize the message into the pack buffer of the handle, it is done once
+ * no matter to how many sessions the message goes. The buffer stays in use
+ * until dsvdc_release_message(), a message that is packed meanwhile, e.g.
+ * by a callback that sends while a fan-out is running, gets a buffer of its
+ * own. Must be called with an already locked handle mutex. */
+static int dsvdc_pack_message(dsvdc_t *handle, Vdcapi__Message *msg,
+                              uint8_t **data, size_t *msg_len)
+{
+    *msg_len = vdcapi__message__get_packed_size(msg);
+    if (*msg_len > UINT16_MAX)
+    {
+        log("message of %zu bytes can not be framed\n", *msg_len);
+        return DSVDC_ERR_PARAM;
+    }
+
+    if (handle->tx_buf_busy)
+    {
+        *data = malloc(*msg_len ? *msg_len : 1);
+        if (!*data)
+        {
+            log("could not allocate %zu bytes for protobuf message "
+                "serialization.\n", *msg_len);
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+        vdcapi__message__pack(msg, *data);
+        return DSVDC_OK;
+    }
+
+    /* the pack buffer is kept and only grows, most messages are small */
+    if (*msg_len > handle->tx_buf_size)
+    {
+        size_t size = handle->tx_buf_size ? handle->tx_buf_size * 2 :
+                                            TX_BUFFER_SIZE;
+        if (size < *msg_len)
+        {
+            size = *msg_len;
+        }
+
+        uint8_t *buf = realloc(handle->tx_buf, size);
+        if (!buf)
+        {
+            log("could not allocate %zu bytes for protobuf message "
+                "serialization.\n", *msg_len);
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+        handle->tx_buf = buf;
+        handle->tx_buf_size = size;
+    }
+
+    vdcapi__message__pack(msg, handle->tx_buf);
+    handle->tx_buf_busy = true;
+    *data = handle->tx_buf;
+    return DSVDC_OK;
+}
+
+/* the message was handed to all sessions, they copied what they queued */
+static void dsvdc_release_message(dsvdc_t *handle, uint8_t *data)
+{
+    if (data == handle->tx_buf)
+    {
+        handle->tx_buf_busy = false;
+    }
+    else
+    {
+        free(data);
+    }
+}
+
+int dsvdc_session_send(dsvdc_session_t *session, dsvdc_tx_lane_t lane,
+                       const uint8_t *data, size_t msg_len,
+                       uint32_t message_id)
+{
+    dsvdc_t *handle = session->handle;
+    struct iovec iov[2];
+    unsigned int syscalls = 0;
+    int ret;
+
+    size_t queued = dsvdc_txq_bytes(&session->txq);
+    size_t frame_len = sizeof(uint16_t) + msg_len;
+
+    /* a corked batch is written before it would get too large */
+    bool corked = handle->tx_cork > 0;
+    if (corked && (queued > 0) &&
+        ((queued + frame_len > TX_COALESCE_BYTES) ||
+         (queued + frame_len > handle->tx_queue_limit)))
+    {
+        dsvdc_flush_send_queue(session);
+        queued = dsvdc_txq_bytes(&session->txq);
+    }
+
+    /* an empty queue always takes one message, so that messages larger than
+     * the limit can still be sent, control messages are never held back */
+    if ((queued > 0) && (lane != DSVDC_TX_LANE_CONTROL) &&
+        (queued + frame_len > handle->tx_queue_limit))
+    {
+        log("send queue of session %u is full, rejecting message\n",
+            session->id);
+        DSVDC_STAT_ADD(handle, tx_rejected, 1);
+        return DSVDC_ERR_QUEUE_FULL;
+    }
+
+    uint16_t netlen = htons(msg_len);
+
+    /* length prefix and payload go out in one system call */
+    iov[0].iov_base = &netlen;
+    iov[0].iov_len = sizeof(uint16_t);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = msg_len;
+
+    /* nothing is waiting, try to send right away without blocking, whatever
+     * does not fit into the socket buffer is queued */
+    ssize_t written = 0;
+    if ((queued == 0) && !corked)
+    {
+        written = sockwritev(session->fd, iov, 2, &syscalls);
+        DSVDC_STAT_ADD(handle, tx_syscalls, syscalls);
+        if (written < 0)
+        {
+            log("could not send message to vdSM\n");
+            return DSVDC_ERR_SOCKET;
+        }
+
+        if ((size_t)written == frame_len)
+        {
+            dsvdc_send_done(session, message_id, DSVDC_OK);
+            return DSVDC_OK;
+        }
+    }
+
+    /* sockwritev() left only the unsent part in the iovecs */
+    ret = dsvdc_txq_push(&session->txq, lane, iov, 2, written, message_id);
+    if (ret != DSVDC_OK)
+    {
+        /* the frame was partially written, the stream is broken */
+        if (written > 0)
+        {
+            shutdown(session->fd, SHUT_RDWR);
+        }
+        return ret;
+    }
+
+    DSVDC_STAT_ADD(handle, tx_queued, 1);
+
+    /* the loop thread has to start watching for write readiness, the I/O
+     * thread does that before it waits anyway */
+    if (queued == 0)
+    {
+        if (!dsvdc_io_thread_self(handle))
+        {
+            dsvdc_loop_wakeup(&handle->loop);
+        }
+    }
+    /* Overtake the bulk lane right away if the socket has room, errors are
+     * left to the loop thread which owns the connection. Bulk messages wait
+     * for the loop, so that a producer does not try to write on a full
+     * socket for every message. */
+    else if (!corked && (lane != DSVDC_TX_LANE_BULK))
+    {
+        dsvdc_flush_send_queue(session);
+    }
+
+    return DSVDC_OK;
+}
+
+int dsvdc_send_message_to(dsvdc_t *handle, unsigned int session_id,
+                          Vdcapi__Message *msg)
 {
+    dsvdc_session_t *session = NULL;
+    uint8_t *data;
+    size_t msg_len;
+    int ret;
+
+    if (dsvdc_io_mode(handle))
+    {
+        return dsvdc_io_send(handle, session_id, msg, 0, NULL, NULL, NULL);
+    }
+
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->connected_fd < 0)
+    if (session_id != ALL_SESSIONS)
+    {
+        session = dsvdc_session_find(handle, session_id);
+        if (!session)
+        {
+            log("not sending message, session %u is gone.\n", session_id);
+            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+            return DSVDC_ERR_NOT_CONNECTED;
+        }
+    }
+    else if (!dsvdc_session_any_established(handle))
     {
         log("not sending message, no open vdSM connection.\n");
         pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
         return DSVDC_ERR_NOT_CONNECTED;
     }
 
-    size_t msg_len = vdcapi__message__get_packed_size(msg);
-    uint8_t *msg_buf = malloc(msg_len * sizeof(uint8_t));
-    if (!msg_buf)
+    ret = dsvdc_pack_message(handle, msg, &data, &msg_len);
+    if (ret != DSVDC_OK)
     {
-        log("could not allocate %zu bytes for protobuf message "
-            "serialization.\n", msg_len);
         pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-        return DSVDC_ERR_OUT_OF_MEMORY;
+        return ret;
     }
 
-    vdcapi__message__pack(msg, msg_buf);
-    uint16_t netlen = htons(msg_len);
-    if (sockwrite(handle->connected_fd, (unsigned char *)&netlen,
-                  sizeof(uint16_t), SOCKET_WRITE_TIMEOUT) != sizeof(uint16_t))
+    dsvdc_tx_lane_t lane = dsvdc_message_lane(msg);
+    uint32_t message_id = msg->has_message_id ? msg->message_id :
+                                                RESERVED_REQUEST_ID;
+
+    if (session)
+    {
+        ret = dsvdc_session_send(session, lane, data, msg_len, message_id);
+    }
+    else
+    {
+        /* fan out, one session that takes the message is a success, the
+         * others are accounted for in the statistics */
+        ret = DSVDC_ERR_NOT_CONNECTED;
+        LL_FOREACH(handle->sessions, session)
+        {
+            if ((session->fd < 0) || !session->established)
+            {
+                continue;
+            }
+
+            int code = dsvdc_session_send(session, lane, data, msg_len,
+                                          message_id);
+            if ((code == DSVDC_OK) || (ret != DSVDC_OK))
+            {
+                ret = code;
+            }
+        }
+    }
+    dsvdc_release_message(handle, data);
+
+    bool report = (handle->tx_done_count > 0);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (report)
+    {
+        dsvdc_report_send_done(handle);
+    }
+    return ret;
+}
+
+int dsvdc_send_message(dsvdc_t *handle, Vdcapi__Message *msg)
+{
+    return dsvdc_send_message_to(handle, ALL_SESSIONS, msg);
+}
+
+int dsvdc_send_request(dsvdc_t *handle, unsigned int session_id,
+                       Vdcapi__Message *msg, unsigned int timeout, void *arg,
+                       void (*function)(dsvdc_t *handle, int code, void *arg,
+                                        void *userdata),
+                       unsigned int *receivers)
+{
+    dsvdc_session_t *session;
+    unsigned int sent = 0;
+    uint8_t *data;
+    size_t msg_len;
+    int ret;
+
+    if (dsvdc_io_mode(handle))
+    {
+        return dsvdc_io_send(handle, session_id, msg, timeout, arg,
+                             function, receivers);
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    msg->message_id = __atomic_add_fetch(&handle->request_id, 1,
+                                         __ATOMIC_RELAXED);
+    msg->has_message_id = 1;
+
+    ret = dsvdc_pack_message(handle, msg, &data, &msg_len);
+    if (ret != DSVDC_OK)
     {
-        log("could not send message to vdSM\n");
-        free(msg_buf);
         pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-        return DSVDC_ERR_SOCKET;
+        return ret;
     }
 
-    int written = sockwrite(handle->connected_fd, (unsigned char *)msg_buf,
-                            msg_len, SOCKET_WRITE_TIMEOUT);
-    if ((written < 0) || ((size_t)written != msg_len))
+    /* every session answers on its own, the response callback is triggered
+     * once per session that took the request. All of them are registered
+     * before anything goes out, so that a fast response finds its entry and
+     * a full pool stops the request before any session got it. */
+    dsvdc_select_receivers(handle, session_id);
+    ret = dsvdc_register_requests(handle, msg->message_id, timeout, arg,
+                                  function);
+    if (ret != DSVDC_OK)
     {
-        log("could not send message to vdSM\n");
-        free(msg_buf);
+        LL_FOREACH(handle->sessions, session)
+        {
+            session->tx_target = false;
+        }
+        dsvdc_release_message(handle, data);
         pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-        return DSVDC_ERR_SOCKET;
+        return ret;
+    }
+
+    ret = DSVDC_ERR_NOT_CONNECTED;
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (!session->tx_target)
+        {
+            continue;
+        }
+        session->tx_target = false;
+
+        int code = dsvdc_session_send(session, dsvdc_message_lane(msg), data,
+                                      msg_len, msg->message_id);
+        if (code != DSVDC_OK)
+        {
+            dsvdc_session_cancel_request(session, msg->message_id);
+            if (ret != DSVDC_OK)
+            {
+                ret = code;
+            }
+            continue;
+        }
+
+        log("request %u sent to session %u\n", msg->message_id, session->id);
+        ret = DSVDC_OK;
+        sent++;
+    }
+    dsvdc_release_message(handle, data);
+
+    if (receivers)
+    {
+        *receivers = sent;
     }
 
-    free(msg_buf);
+    bool report = (handle->tx_done_count > 0);
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (report)
+    {
+        dsvdc_report_send_done(handle);
+    }
+    return ret;
+}
+
+int dsvdc_flush_send_queue(dsvdc_session_t *session)
+{
+    struct iovec iov[DSVDC_TXQ_MAX_IOV];
+    unsigned int syscalls = 0;
+
+    if ((session->fd < 0) || (dsvdc_txq_bytes(&session->txq) == 0))
+    {
+        return DSVDC_OK;
+    }
+
+    int n = dsvdc_txq_iov(&session->txq, iov);
+    ssize_t written = sockwritev(session->fd, iov, n, &syscalls);
+    DSVDC_STAT_ADD(session->handle, tx_syscalls, syscalls);
+    if (written < 0)
+    {
+        log("could not flush send queue to vdSM\n");
+        return DSVDC_ERR_SOCKET;
+    }
+
+    dsvdc_txq_consume(&session->txq, written, dsvdc_send_done, session);
     return DSVDC_OK;
 }
 
-void dsvdc_send_error_message(dsvdc_t *handle, Vdcapi__ResultCode code,
-                              uint32_t message_id)
+void dsvdc_tx_cork(dsvdc_t *handle)
 {
-    if (!handle)
+    handle->tx_cork++;
+}
+
+void dsvdc_tx_uncork(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+
+    if (--handle->tx_cork > 0)
     {
         return;
     }
 
-    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
-    Vdcapi__GenericResponse submsg = VDCAPI__GENERIC_RESPONSE__INIT;
+    /* errors are left to the loop thread which owns the connections, like
+     * for any other write that does not come from the loop */
+    LL_FOREACH(handle->sessions, session)
+    {
+        dsvdc_flush_send_queue(session);
+    }
+}
+
+void dsvdc_drop_send_queue(dsvdc_session_t *session, int code)
+{
+    dsvdc_txq_drop(&session->txq, code, dsvdc_send_done, session);
+}
 
-    submsg.code = code;
+static void dsvdc_init_error_message(Vdcapi__Message *msg,
+                                     Vdcapi__GenericResponse *submsg,
+                                     Vdcapi__ResultCode code,
+                                     uint32_t message_id)
+{
+    submsg->code = code;
 
     switch (code)
     {
         case VDCAPI__RESULT_CODE__ERR_OK:
-            submsg.description = "OK";
+            submsg->description = "OK";
             break;
         case VDCAPI__RESULT_CODE__ERR_MESSAGE_UNKNOWN:
-            submsg.description = "Unknown message type";
+            submsg->description = "Unknown message type";
             break;
         case VDCAPI__RESULT_CODE__ERR_INCOMPATIBLE_API:
-            submsg.description = "Incompatible API version";
+            submsg->description = "Incompatible API version";
             break;
         case VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE:
-            submsg.description = "Service not available";
+            submsg->description = "Service not available";
             break;
         case VDCAPI__RESULT_CODE__ERR_INSUFFICIENT_STORAGE:
-            submsg.description = "Insufficient storage";
+            submsg->description = "Insufficient storage";
             break;
         case VDCAPI__RESULT_CODE__ERR_FORBIDDEN:
-            submsg.description = "Forbidden";
+            submsg->description = "Forbidden";
             break;
         case VDCAPI__RESULT_CODE__ERR_NOT_IMPLEMENTED:
-            submsg.description = "Not implemented";
+            submsg->description = "Not implemented";
             break;
         case VDCAPI__RESULT_CODE__ERR_NO_CONTENT_FOR_ARRAY:
-            submsg.description = "No content for array"; /* do we need that? */
+            submsg->description = "No content for array"; /* do we need that? */
             break;
         case VDCAPI__RESULT_CODE__ERR_INVALID_VALUE_TYPE:
-            submsg.description = "Invalid or unexpected value type";
+            submsg->description = "Invalid or unexpected value type";
             break;
         case VDCAPI__RESULT_CODE__ERR_MISSING_SUBMESSAGE:
-            submsg.description = "Missing protocol submessage";
+            submsg->description = "Missing protocol submessage";
             break;
         case VDCAPI__RESULT_CODE__ERR_MISSING_DATA:
-            submsg.description = "Missing data / empty message";
+            submsg->description = "Missing data / empty message";
             break;
         case VDCAPI__RESULT_CODE__ERR_NOT_FOUND:
-            submsg.description = "Requested entity was not found";
+            submsg->description = "Requested entity was not found";
             break;
         case VDCAPI__RESULT_CODE__ERR_NOT_AUTHORIZED:
-            submsg.description = "Not authorized to perform requested action";
+            submsg->description = "Not authorized to perform requested action";
             break;
         default:
             log("unhandled error code: %d\n", code);
     }
 
-    msg.type = VDCAPI__TYPE__GENERIC_RESPONSE;
-    msg.message_id = message_id;
-    msg.has_message_id = 1;
-    msg.generic_response = &submsg;
-    dsvdc_send_message(handle, &msg);
+    msg->type = VDCAPI__TYPE__GENERIC_RESPONSE;
+    msg->message_id = message_id;
+    msg->has_message_id = 1;
+    msg->generic_response = submsg;
 }
 
-#if __GNUC__ >= 4
-    #pragma GCC visibility pop
-#endif
+void dsvdc_send_error_message(dsvdc_t *handle, unsigned int session,
+                              Vdcapi__ResultCode code, uint32_t message_id)
+{
+    if (!handle)
+    {
+        return;
+    }
 
-/* public interface */
-int dsvdc_announce_container(dsvdc_t *handle, const char *dsuid, void *arg,
-                             void (*function)(dsvdc_t *handle, int code,
-                                              void *arg, void *userdata))
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__GenericResponse submsg = VDCAPI__GENERIC_RESPONSE__INIT;
+
+    dsvdc_init_error_message(&msg, &submsg, code, message_id);
+    dsvdc_send_message_to(handle, session, &msg);
+}
+
+void dsvdc_refuse_connection(int fd, Vdcapi__ResultCode code)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__GenericResponse submsg = VDCAPI__GENERIC_RESPONSE__INIT;
+    uint8_t buf[128];
+    uint16_t netlen;
+    struct iovec iov[2];
+    unsigned int syscalls = 0;
+
+    dsvdc_init_error_message(&msg, &submsg, code, RESERVED_REQUEST_ID);
+
+    size_t msg_len = vdcapi__message__get_packed_size(&msg);
+    if (msg_len > sizeof(buf))
+    {
+        return;
+    }
+    vdcapi__message__pack(&msg, buf);
+
+    netlen = htons(msg_len);
+    iov[0].iov_base = &netlen;
+    iov[0].iov_len = sizeof(uint16_t);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = msg_len;
+
+    /* best effort, the connection is closed right after */
+    sockwritev(fd, iov, 2, &syscalls);
+}
+
+int dsvdc_send_container_announcement(dsvdc_t *handle,
+                                      unsigned int session_id,
+                                      const char *dsuid, void *arg,
+                                      void (*function)(dsvdc_t *handle,
+                                                       int code, void *arg,
+                                                       void *userdata),
+                                      unsigned int *receivers)
 {
     int ret;
     Vdcapi__Message  msg = VDCAPI__MESSAGE__INIT;
@@ -167,46 +663,21 @@ int dsvdc_announce_container(dsvdc_t *handle, const char *dsuid, void *arg,
     submsg.dsuid = (char *)dsuid;
 
     msg.type = VDCAPI__TYPE__VDC_SEND_ANNOUNCE_VDC;
-
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    msg.message_id = ++(handle->request_id);
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-
-    msg.has_message_id = 1;
     msg.vdc_send_announce_vdc = &submsg;
 
     log("sending VDC_SEND_ANNOUNCE_VDC for container %s\n", dsuid);
-    ret = dsvdc_send_message(handle, &msg);
-    if (ret == DSVDC_OK)
-    {
-        log("VDC_SEND_ANNOUNCE_VDC sent, caching id %u for response "
-            "tracking\n", msg.message_id);
-
-        cached_request_t *request = malloc(sizeof(cached_request_t));
-        if (!request)
-        {
-            log("VDC_SEND_ANNOUNCE_VDC: could not allocate memory for "
-                "cache\n");
-            return DSVDC_ERR_OUT_OF_MEMORY;
-        }
-
-        request->arg = arg;
-        request->callback = (void *)function;
-        time(&request->timestamp);
-        request->message_id = msg.message_id;
-        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-        LL_PREPEND(handle->requests_list, request);
-        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-    }
-
+    ret = dsvdc_send_request(handle, session_id, &msg, 0, arg, function,
+                             receivers);
+    log("VDC_SEND_ANNOUNCE_VDC sent with code %d\n", ret);
     return ret;
 }
 
-
-int dsvdc_announce_device(dsvdc_t *handle, const char *container_dsuid,
-                          const char *dsuid, void *arg,
-                          void (*function)(dsvdc_t *handle, int code,
-                                           void *arg, void *userdata))
+int dsvdc_send_device_announcement(dsvdc_t *handle, unsigned int session_id,
+                                   const char *container_dsuid,
+                                   const char *dsuid, void *arg,
+                                   void (*function)(dsvdc_t *handle, int code,
+                                                    void *arg, void *userdata),
+                                   unsigned int *receivers)
 {
     int ret;
     Vdcapi__Message  msg = VDCAPI__MESSAGE__INIT;
@@ -217,40 +688,38 @@ int dsvdc_announce_device(dsvdc_t *handle, const char *container_dsuid,
     submsg.vdc_dsuid = (char *)container_dsuid;
 
     msg.type = VDCAPI__TYPE__VDC_SEND_ANNOUNCE_DEVICE;
-
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    msg.message_id = ++(handle->request_id);
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-
-    msg.has_message_id = 1;
     msg.vdc_send_announce_device = &submsg;
 
     log("sending VDC_SEND_ANNOUNCE_DEVICE for device %s in container %s\n",
         dsuid, container_dsuid);
-    ret = dsvdc_send_message(handle, &msg);
-    if (ret == DSVDC_OK)
-    {
-        log("VDC_SEND_ANNOUNCE_DEVICE sent, caching id %u for response "
-            "tracking\n", msg.message_id);
+    ret = dsvdc_send_request(handle, session_id, &msg, 0, arg, function,
+                             receivers);
+    log("VDC_SEND_ANNOUNCE_DEVICE sent with code %d\n", ret);
+    return ret;
+}
 
-        cached_request_t *request = malloc(sizeof(cached_request_t));
-        if (!request)
-        {
-            log("VDC_SEND_ANNOUNCE_DEVICE: could not allocate memory for "
-                "cache\n");
-            return DSVDC_ERR_OUT_OF_MEMORY;
-        }
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
 
-        request->arg = arg;
-        request->callback = (void *)function;
-        time(&request->timestamp);
-        request->message_id = msg.message_id;
-        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-        LL_PREPEND(handle->requests_list, request);
-        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-    }
+/* public interface */
+int dsvdc_announce_container(dsvdc_t *handle, const char *dsuid, void *arg,
+                             void (*function)(dsvdc_t *handle, int code,
+                                              void *arg, void *userdata))
+{
+    return dsvdc_send_container_announcement(handle, ALL_SESSIONS, dsuid, arg,
+                                             function, NULL);
+}
 
-    return ret;
+
+int dsvdc_announce_device(dsvdc_t *handle, const char *container_dsuid,
+                          const char *dsuid, void *arg,
+                          void (*function)(dsvdc_t *handle, int code,
+                                           void *arg, void *userdata))
+{
+    return dsvdc_send_device_announcement(handle, ALL_SESSIONS,
+                                          container_dsuid, dsuid, arg,
+                                          function, NULL);
 }
 
 int dsvdc_send_pong(dsvdc_t *handle, const char *dsuid)
@@ -276,7 +745,12 @@ int dsvdc_send_pong(dsvdc_t *handle, const char *dsuid)
     reply.type = VDCAPI__TYPE__VDC_SEND_PONG;
     reply.vdc_send_pong = &submsg;
 
-    ret = dsvdc_send_message(handle, &reply);
+    /* answer the session whose ping is being handled */
+    dsvdc_session_t *session = dsvdc_session_get_current();
+    ret = dsvdc_send_message_to(handle,
+                (session && (session->handle == handle)) ? session->id :
+                                                           ALL_SESSIONS,
+                &reply);
     log("VDC_SEND_PONG sent with code %d\n", ret);
     return ret;
 }
@@ -343,7 +817,8 @@ int dsvdc_device_vanished(dsvdc_t *handle, const char *dsuid)
 
 /* private functions */
 
-static void dsvdc_process_hello(dsvdc_t *handle, Vdcapi__Message *msg)
+static void dsvdc_process_hello(dsvdc_t *handle, dsvdc_session_t *session,
+                                Vdcapi__Message *msg)
 {
     int ret;
     log("received VDSM_REQUEST_HELLO\n");
@@ -383,7 +858,7 @@ static void dsvdc_process_hello(dsvdc_t *handle, Vdcapi__Message *msg)
 
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
     /* handle's dsuid is already nulled out*/
-    strncpy(handle->vdsm_dsuid, msg->vdsm_request_hello->dsuid,
+    strncpy(session->vdsm_dsuid, msg->vdsm_request_hello->dsuid,
             DSUID_LENGTH);
 
     submsg.dsuid = handle->vdc_dsuid;
@@ -394,24 +869,40 @@ static void dsvdc_process_hello(dsvdc_t *handle, Vdcapi__Message *msg)
     reply.has_message_id = 1;
     reply.vdc_response_hello = &submsg;
 
-    ret = dsvdc_send_message(handle, &reply);
+    ret = dsvdc_send_message_to(handle, session->id, &reply);
     if (DSVDC_OK != ret)
     {
         log("VDC__RESPONSE_HELLO sent with code %d\n", ret);
     }
 
-    log("Connected to vdsm %s\n", msg->vdsm_request_hello->dsuid);
+    log("Connected to vdsm %s in session %u\n",
+        msg->vdsm_request_hello->dsuid, session->id);
+
+    bool established = false;
+    dsvdc_callbacks_t cb;
 
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (!handle->session)
+    if (!session->established && (session->fd > -1) &&
+        !session->close_pending)
     {
-        handle->session = true;
-        if (handle->vdsm_new_session)
-        {
-            handle->vdsm_new_session(handle, handle->callback_userdata);
-        }
+        session->established = true;
+        __atomic_add_fetch(&handle->n_established, 1, __ATOMIC_RELEASE);
+        established = true;
     }
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (!established)
+    {
+        return;
+    }
+
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_new_session)
+    {
+        cb.vdsm_new_session(handle, cb.userdata);
+    }
+
+    dsvdc_registry_announce(handle, session->id);
 }
 
 static void dsvdc_process_ping(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -430,25 +921,39 @@ static void dsvdc_process_ping(dsvdc_t *handle, Vdcapi__Message *msg)
         return;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    /* ping goes out for our vDC, reply automatically */
-    if (strncmp(handle->vdc_dsuid, msg->vdsm_send_ping->dsuid,
-                DSUID_LENGTH) == 0)
+    /* ping goes out for our vDC, reply automatically, the dSUID of the vDC
+     * does not change */
+    dsvdc_dsuid_t id;
+    bool ours;
+    if (handle->vdc_id_valid &&
+        (dsvdc_dsuid_parse(msg->vdsm_send_ping->dsuid, &id) == DSVDC_OK))
+    {
+        ours = dsvdc_dsuid_equal(&handle->vdc_id, &id);
+    }
+    else
+    {
+        ours = (strncmp(handle->vdc_dsuid, msg->vdsm_send_ping->dsuid,
+                        DSUID_LENGTH) == 0);
+    }
+
+    if (ours)
     {
         dsvdc_send_pong(handle, handle->vdc_dsuid);
     }
     else /* ping goes out to a virtual device */
     {
-        if (handle->vdsm_send_ping)
+        dsvdc_callbacks_t cb;
+        dsvdc_get_callbacks(handle, &cb);
+        if (cb.vdsm_send_ping)
         {
-            handle->vdsm_send_ping(handle, msg->vdsm_send_ping->dsuid,
-                                   handle->callback_userdata);
+            cb.vdsm_send_ping(handle, msg->vdsm_send_ping->dsuid,
+                              cb.userdata);
         }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-static void dsvdc_process_remove(dsvdc_t *handle, Vdcapi__Message *msg)
+static void dsvdc_process_remove(dsvdc_t *handle, dsvdc_session_t *session,
+                                 Vdcapi__Message *msg)
 {
     log("received VDSM_SEND_REMOVE\n");
 
@@ -457,7 +962,7 @@ static void dsvdc_process_remove(dsvdc_t *handle, Vdcapi__Message *msg)
         log("received VDSM_SEND_REMOVE message type, but data is missing!\n");
         if (msg->has_message_id)
         {
-            dsvdc_send_error_message(handle,
+            dsvdc_send_error_message(handle, session->id,
                                      VDCAPI__RESULT_CODE__ERR_MISSING_DATA,
                                      msg->message_id);
         }
@@ -469,34 +974,34 @@ static void dsvdc_process_remove(dsvdc_t *handle, Vdcapi__Message *msg)
         log("received VDSM_SEND_REMOVE: missing dSUID!\n");
         if (msg->has_message_id)
         {
-            dsvdc_send_error_message(handle,
+            dsvdc_send_error_message(handle, session->id,
                                      VDCAPI__RESULT_CODE__ERR_MISSING_DATA,
                                      msg->message_id);
         }
         return;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
 
-    if (handle->vdsm_send_remove)
+    if (cb.vdsm_send_remove)
     {
-        bool ret = handle->vdsm_send_remove(handle, 
-                                            msg->vdsm_send_remove->dsuid,
-                                            handle->callback_userdata);
+        bool ret = cb.vdsm_send_remove(handle, msg->vdsm_send_remove->dsuid,
+                                       cb.userdata);
         if (msg->has_message_id)
         {
-            dsvdc_send_error_message(handle,
+            dsvdc_send_error_message(handle, session->id,
                                 ret == true ?
                                 VDCAPI__RESULT_CODE__ERR_OK :
                                 VDCAPI__RESULT_CODE__ERR_MISSING_DATA,
                                      msg->message_id);
         }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 
-static void dsvdc_process_bye(dsvdc_t *handle, Vdcapi__Message *msg)
+static void dsvdc_process_bye(dsvdc_t *handle, dsvdc_session_t *session,
+                              Vdcapi__Message *msg)
 {
     log("received VDSM_SEND_BYE\n");
 
@@ -513,21 +1018,42 @@ static void dsvdc_process_bye(dsvdc_t *handle, Vdcapi__Message *msg)
     }
 
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->connected_fd >= 0)
+    dsvdc_session_close(session);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+/* number of dSUIDs of a notification that are parsed on the stack for the
+ * binary callback variants, larger notifications go to the heap */
+#define DSUID_STACK_IDS     64
+
+/* Parses the dSUIDs of a notification for the binary callback variants.
+ * Returns stack or an allocated array that the caller has to free, NULL if
+ * no valid dSUID was left. */
+static dsvdc_dsuid_t *dsvdc_parse_dsuids(char **dsuid, size_t n_dsuid,
+                                         dsvdc_dsuid_t *stack, size_t *n_ids)
+{
+    dsvdc_dsuid_t *ids = stack;
+
+    if (n_dsuid > DSUID_STACK_IDS)
     {
-        close(handle->connected_fd);
-        handle->connected_fd = -1;
+        ids = malloc(n_dsuid * sizeof(dsvdc_dsuid_t));
+        if (!ids)
+        {
+            log("could not allocate %zu binary dSUIDs\n", n_dsuid);
+            return NULL;
+        }
     }
 
-    if (handle->session)
+    *n_ids = dsvdc_dsuid_parse_array(dsuid, n_dsuid, ids);
+    if (*n_ids == 0)
     {
-        handle->session = false;
-        if (handle->vdsm_end_session)
+        if (ids != stack)
         {
-            handle->vdsm_end_session(handle, handle->callback_userdata);
+            free(ids);
         }
+        return NULL;
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return ids;
 }
 
 static void dsvdc_process_call_scene(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -573,17 +1099,58 @@ static void dsvdc_process_call_scene(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_call_scene->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_call_scene)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_call_scene)
     {
-        handle->vdsm_send_call_scene(handle,
+        cb.vdsm_send_call_scene(handle,
                 msg->vdsm_send_call_scene->dsuid,
                 msg->vdsm_send_call_scene->n_dsuid,
                 msg->vdsm_send_call_scene->scene,
                 msg->vdsm_send_call_scene->force,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_call_scene_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_call_scene->dsuid,
+                msg->vdsm_send_call_scene->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_call_scene_bin(handle, ids, n_ids,
+                    msg->vdsm_send_call_scene->scene,
+                    msg->vdsm_send_call_scene->force,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
+    }
+
+    dsvdc_target_t targets_stack[DSUID_STACK_IDS];
+    size_t n_targets;
+    dsvdc_target_t *targets = dsvdc_registry_targets(handle,
+            msg->vdsm_send_call_scene->dsuid,
+            msg->vdsm_send_call_scene->n_dsuid, targets_stack,
+            DSUID_STACK_IDS, &n_targets);
+    if (targets)
+    {
+        dsvdc_notification_t notification = { 0 };
+        notification.type = DSVDC_NOTIFY_CALL_SCENE;
+        notification.scene = msg->vdsm_send_call_scene->scene;
+        notification.force = msg->vdsm_send_call_scene->force;
+        notification.group = group;
+        notification.zone_id = zone_id;
+        dsvdc_dispatch_targets(handle, targets, n_targets, &notification);
+        if (targets != targets_stack)
+        {
+            free(targets);
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_save_scene(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -623,16 +1190,55 @@ static void dsvdc_process_save_scene(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_save_scene->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_save_scene)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_save_scene)
     {
-        handle->vdsm_send_save_scene(handle,
+        cb.vdsm_send_save_scene(handle,
                 msg->vdsm_send_save_scene->dsuid,
                 msg->vdsm_send_save_scene->n_dsuid,
                 msg->vdsm_send_save_scene->scene,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_save_scene_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_save_scene->dsuid,
+                msg->vdsm_send_save_scene->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_save_scene_bin(handle, ids, n_ids,
+                    msg->vdsm_send_save_scene->scene,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
+    }
+
+    dsvdc_target_t targets_stack[DSUID_STACK_IDS];
+    size_t n_targets;
+    dsvdc_target_t *targets = dsvdc_registry_targets(handle,
+            msg->vdsm_send_save_scene->dsuid,
+            msg->vdsm_send_save_scene->n_dsuid, targets_stack,
+            DSUID_STACK_IDS, &n_targets);
+    if (targets)
+    {
+        dsvdc_notification_t notification = { 0 };
+        notification.type = DSVDC_NOTIFY_SAVE_SCENE;
+        notification.scene = msg->vdsm_send_save_scene->scene;
+        notification.group = group;
+        notification.zone_id = zone_id;
+        dsvdc_dispatch_targets(handle, targets, n_targets, &notification);
+        if (targets != targets_stack)
+        {
+            free(targets);
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_undo_scene(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -671,16 +1277,35 @@ static void dsvdc_process_undo_scene(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_undo_scene->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_undo_scene)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_undo_scene)
     {
-        handle->vdsm_send_undo_scene(handle,
+        cb.vdsm_send_undo_scene(handle,
                 msg->vdsm_send_undo_scene->dsuid,
                 msg->vdsm_send_undo_scene->n_dsuid,
                 msg->vdsm_send_undo_scene->scene,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_undo_scene_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_undo_scene->dsuid,
+                msg->vdsm_send_undo_scene->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_undo_scene_bin(handle, ids, n_ids,
+                    msg->vdsm_send_undo_scene->scene,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_set_local_prio(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -720,16 +1345,35 @@ static void dsvdc_process_set_local_prio(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_set_local_prio->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_set_local_prio)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_set_local_prio)
     {
-        handle->vdsm_send_set_local_prio(handle,
+        cb.vdsm_send_set_local_prio(handle,
                 msg->vdsm_send_set_local_prio->dsuid,
                 msg->vdsm_send_set_local_prio->n_dsuid,
                 msg->vdsm_send_set_local_prio->scene,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_set_local_prio_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_set_local_prio->dsuid,
+                msg->vdsm_send_set_local_prio->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_set_local_prio_bin(handle, ids, n_ids,
+                    msg->vdsm_send_set_local_prio->scene,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_call_min_scene(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -762,15 +1406,33 @@ static void dsvdc_process_call_min_scene(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_call_min_scene->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_call_min_scene)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_call_min_scene)
     {
-        handle->vdsm_send_call_min_scene(handle,
+        cb.vdsm_send_call_min_scene(handle,
                 msg->vdsm_send_call_min_scene->dsuid,
                 msg->vdsm_send_call_min_scene->n_dsuid,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_call_min_scene_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_call_min_scene->dsuid,
+                msg->vdsm_send_call_min_scene->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_call_min_scene_bin(handle, ids, n_ids,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_identify(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -802,15 +1464,52 @@ static void dsvdc_process_identify(dsvdc_t *handle, Vdcapi__Message *msg)
         zone_id = msg->vdsm_send_identify->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_identify)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_identify)
     {
-        handle->vdsm_send_identify(handle,
+        cb.vdsm_send_identify(handle,
                 msg->vdsm_send_identify->dsuid,
                 msg->vdsm_send_identify->n_dsuid,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_identify_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_identify->dsuid,
+                msg->vdsm_send_identify->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_identify_bin(handle, ids, n_ids,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
+    }
+
+    dsvdc_target_t targets_stack[DSUID_STACK_IDS];
+    size_t n_targets;
+    dsvdc_target_t *targets = dsvdc_registry_targets(handle,
+            msg->vdsm_send_identify->dsuid,
+            msg->vdsm_send_identify->n_dsuid, targets_stack,
+            DSUID_STACK_IDS, &n_targets);
+    if (targets)
+    {
+        dsvdc_notification_t notification = { 0 };
+        notification.type = DSVDC_NOTIFY_IDENTIFY;
+        notification.group = group;
+        notification.zone_id = zone_id;
+        dsvdc_dispatch_targets(handle, targets, n_targets, &notification);
+        if (targets != targets_stack)
+        {
+            free(targets);
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_set_control_value(dsvdc_t *handle,
@@ -850,16 +1549,35 @@ static void dsvdc_process_set_control_value(dsvdc_t *handle,
         zone_id = msg->vdsm_send_set_control_value->zone_id;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_set_control_value)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_set_control_value)
     {
-        handle->vdsm_send_set_control_value(handle,
+        cb.vdsm_send_set_control_value(handle,
                 msg->vdsm_send_set_control_value->dsuid,
                 msg->vdsm_send_set_control_value->n_dsuid,
                 msg->vdsm_send_set_control_value->value,
-                group, zone_id, handle->callback_userdata);
+                group, zone_id, cb.userdata);
+    }
+
+    if (cb.vdsm_send_set_control_value_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_set_control_value->dsuid,
+                msg->vdsm_send_set_control_value->n_dsuid, stack, &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_set_control_value_bin(handle, ids, n_ids,
+                    msg->vdsm_send_set_control_value->value,
+                    group, zone_id, cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 static void dsvdc_process_set_output_channel_value(dsvdc_t *handle, Vdcapi__Message *msg)
@@ -898,22 +1616,66 @@ static void dsvdc_process_set_output_channel_value(dsvdc_t *handle, Vdcapi__Mess
         return;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_send_output_channel_value)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_send_output_channel_value)
     {
-        handle->vdsm_send_output_channel_value(handle,
+        cb.vdsm_send_output_channel_value(handle,
                 msg->vdsm_send_output_channel_value->dsuid,
                 msg->vdsm_send_output_channel_value->n_dsuid,
                 msg->vdsm_send_output_channel_value->apply_now,
                 msg->vdsm_send_output_channel_value->channel,
                 msg->vdsm_send_output_channel_value->value,
-                handle->callback_userdata);
+                cb.userdata);
+    }
+
+    if (cb.vdsm_send_output_channel_value_bin)
+    {
+        dsvdc_dsuid_t stack[DSUID_STACK_IDS];
+        size_t n_ids;
+        dsvdc_dsuid_t *ids = dsvdc_parse_dsuids(
+                msg->vdsm_send_output_channel_value->dsuid,
+                msg->vdsm_send_output_channel_value->n_dsuid, stack,
+                &n_ids);
+        if (ids)
+        {
+            cb.vdsm_send_output_channel_value_bin(handle, ids, n_ids,
+                    msg->vdsm_send_output_channel_value->apply_now,
+                    msg->vdsm_send_output_channel_value->channel,
+                    msg->vdsm_send_output_channel_value->value,
+                    cb.userdata);
+            if (ids != stack)
+            {
+                free(ids);
+            }
+        }
+    }
+
+    dsvdc_target_t targets_stack[DSUID_STACK_IDS];
+    size_t n_targets;
+    dsvdc_target_t *targets = dsvdc_registry_targets(handle,
+            msg->vdsm_send_output_channel_value->dsuid,
+            msg->vdsm_send_output_channel_value->n_dsuid, targets_stack,
+            DSUID_STACK_IDS, &n_targets);
+    if (targets)
+    {
+        dsvdc_notification_t notification = { 0 };
+        notification.type = DSVDC_NOTIFY_OUTPUT_CHANNEL_VALUE;
+        notification.apply = msg->vdsm_send_output_channel_value->apply_now;
+        notification.channel = msg->vdsm_send_output_channel_value->channel;
+        notification.value = msg->vdsm_send_output_channel_value->value;
+        dsvdc_dispatch_targets(handle, targets, n_targets, &notification);
+        if (targets != targets_stack)
+        {
+            free(targets);
+        }
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
 
-static void dsvdc_process_get_property(dsvdc_t *handle, Vdcapi__Message *msg)
+static void dsvdc_process_get_property(dsvdc_t *handle,
+                                       dsvdc_session_t *session,
+                                       Vdcapi__Message *msg)
 {
     log("received VDSM_REQUEST_GET_PROPERTY\n");
 
@@ -939,77 +1701,64 @@ static void dsvdc_process_get_property(dsvdc_t *handle, Vdcapi__Message *msg)
     log("VDSM_REQUEST_GET_PROPERTY/%u: dSUID[ %s ]\n",
         msg->message_id, msg->vdsm_request_get_property->dsuid);
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_request_get_property)
+    if (dsvdc_propcache_answer(handle, session, msg))
+    {
+        return;
+    }
+
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_request_get_property)
     {
-        dsvdc_property_t *query = NULL;
+        dsvdc_property_t query;
         dsvdc_property_t *property = NULL;
         int ret = dsvdc_property_new(&property);
         if (ret == DSVDC_OK)
         {
             property->message_id = msg->message_id;
+            property->session = session->id;
         }
         else
         {
             log("VDSM_REQUEST_GET_PROPERTY: could not allocate new property, "
                 "error code: %d\n", ret);
 
-            dsvdc_send_error_message(handle,
-                                VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
-                                msg->message_id);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-            return;
-        }
-
-        ret = dsvdc_property_convert_query(
-                        msg->vdsm_request_get_property->query,
-                        msg->vdsm_request_get_property->n_query, &query);
-
-        if (ret != DSVDC_OK)
-        {
-            log("VDSM_REQUEST_GET_PROPERTY: could not allocate new property, "
-                "error code: %d\n", ret);
-
-            dsvdc_send_error_message(handle,
+            dsvdc_send_error_message(handle, session->id,
                                 VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
                                 msg->message_id);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
             return;
         }
 
-        handle->vdsm_request_get_property(handle,
+        /* the query borrows from the message while the callback runs */
+        dsvdc_property_view(&query, msg->vdsm_request_get_property->query,
+                            msg->vdsm_request_get_property->n_query);
+        cb.vdsm_request_get_property(handle,
                 msg->vdsm_request_get_property->dsuid,
-                property, query, handle->callback_userdata);
-        if (query)
-        {
-            dsvdc_property_free(query);
-        }
+                property, &query, cb.userdata);
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-static cached_request_t *dsvdc_get_cached_request(dsvdc_t *handle, uint32_t id)
+/* the entry goes back to the pool right away, the caller gets a copy */
+static bool dsvdc_get_cached_request(dsvdc_session_t *session, uint32_t id,
+                                     cached_request_t *copy)
 {
-    cached_request_t *request = NULL;
-    cached_request_t *tmp = NULL;
-
+    dsvdc_t *handle = session->handle;
+    cached_request_t *request;
 
     pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    LL_FOREACH_SAFE(handle->requests_list, request, tmp)
+    request = dsvdc_session_take_request(session, id);
+    if (request)
     {
-        if (request->message_id == id)
-        {
-            LL_DELETE(handle->requests_list, request);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-            return request;
-        }
+        *copy = *request;
+        dsvdc_request_release(handle, request);
     }
-
     pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-    return NULL;
+    return request != NULL;
 }
 
-static void dsvdc_process_set_property(dsvdc_t *handle, Vdcapi__Message *msg)
+static void dsvdc_process_set_property(dsvdc_t *handle,
+                                       dsvdc_session_t *session,
+                                       Vdcapi__Message *msg)
 {
     log("received VDSM_REQUEST_SET_PROPERTY\n");
 
@@ -1035,60 +1784,43 @@ static void dsvdc_process_set_property(dsvdc_t *handle, Vdcapi__Message *msg)
     log("VDSM_REQUEST_SET_PROPERTY/%u: dSUID[ %s ]\n",
         msg->message_id, msg->vdsm_request_set_property->dsuid);
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    if (handle->vdsm_request_set_property)
+    dsvdc_callbacks_t cb;
+    dsvdc_get_callbacks(handle, &cb);
+    if (cb.vdsm_request_set_property)
     {
-        dsvdc_property_t *properties = NULL;
+        dsvdc_property_t properties;
         dsvdc_property_t *property = NULL;
         int ret = dsvdc_property_new(&property);
         if (ret == DSVDC_OK)
         {
             property->message_id = msg->message_id;
+            property->session = session->id;
         }
         else
         {
             log("VDSM_REQUEST_SET_PROPERTY: could not allocate new property, "
                 "error code: %d\n", ret);
 
-            dsvdc_send_error_message(handle,
+            dsvdc_send_error_message(handle, session->id,
                                 VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
                                 msg->message_id);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
             return;
         }
 
-        ret = dsvdc_property_convert_query(
-                        msg->vdsm_request_set_property->properties,
-                        msg->vdsm_request_set_property->n_properties,
-                        &properties);
-
-        if (ret != DSVDC_OK)
-        {
-            log("VDSM_REQUEST_GET_PROPERTY: could not allocate new property, "
-                "error code: %d\n", ret);
-
-            dsvdc_send_error_message(handle,
-                                VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
-                                msg->message_id);
-            pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
-            return;
-        }
-
-        handle->vdsm_request_set_property(handle,
+        dsvdc_property_view(&properties,
+                            msg->vdsm_request_set_property->properties,
+                            msg->vdsm_request_set_property->n_properties);
+        cb.vdsm_request_set_property(handle,
                 msg->vdsm_request_set_property->dsuid,
-                property, properties, handle->callback_userdata);
-        if (properties)
-        {
-            dsvdc_property_free(properties);
-        }
+                property, &properties, cb.userdata);
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 static void dsvdc_process_generic_response(dsvdc_t *handle,
+                                           dsvdc_session_t *session,
                                            Vdcapi__Message *msg)
 {
     log("received GENERIC_RESPONSE\n");
-    cached_request_t *request;
+    cached_request_t request;
 
     if (!msg->generic_response)
     {
@@ -1104,40 +1836,45 @@ static void dsvdc_process_generic_response(dsvdc_t *handle,
         return;
     }
 
-    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
-    request = dsvdc_get_cached_request(handle, msg->message_id);
-    if (request)
+    if (dsvdc_get_cached_request(session, msg->message_id, &request))
     {
+        dsvdc_callbacks_t cb;
+        dsvdc_get_callbacks(handle, &cb);
+
         log("found matching request with id %u in cache\n",
-            request->message_id);
-        request->callback(handle, msg->generic_response->code,
-                          request->arg, handle->callback_userdata);
-        free(request);
+            request.message_id);
+        request.callback(handle, msg->generic_response->code,
+                         request.arg, cb.userdata);
     }
-    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
 }
 
-void dsvdc_process_message(dsvdc_t *handle, unsigned char *data, uint16_t len)
+void dsvdc_process_message(dsvdc_t *handle, dsvdc_session_t *session,
+                           unsigned char *data, uint16_t len)
 {
-    Vdcapi__Message *msg = vdcapi__message__unpack(NULL, len, data);
+    Vdcapi__Message *msg = vdcapi__message__unpack(&handle->rx_arena.allocator,
+                                                   len, data);
     if (!msg)
     {
         log("failed to unpack incoming message\n");
+        dsvdc_arena_reset(&handle->rx_arena);
         return;
     }
 
+    /* callbacks can ask which session the message came from */
+    dsvdc_session_t *previous = dsvdc_session_set_current(session);
+
     switch (msg->type)
     {
         case VDCAPI__TYPE__VDSM_REQUEST_HELLO:
-            dsvdc_process_hello(handle, msg);
+            dsvdc_process_hello(handle, session, msg);
             break;
 
         case VDCAPI__TYPE__VDSM_REQUEST_GET_PROPERTY:
-            dsvdc_process_get_property(handle, msg);
+            dsvdc_process_get_property(handle, session, msg);
             break;
 
         case VDCAPI__TYPE__VDSM_REQUEST_SET_PROPERTY:
-            dsvdc_process_set_property(handle, msg);
+            dsvdc_process_set_property(handle, session, msg);
             break;
 
         case VDCAPI__TYPE__VDSM_SEND_PING:
@@ -1147,11 +1884,11 @@ void dsvdc_process_message(dsvdc_t *handle, unsigned char *data, uint16_t len)
         case VDCAPI__TYPE__VDSM_SEND_REMOVE:
         {
             log("received VDSM_SEND_REMOVE\n");
-            dsvdc_process_remove(handle, msg);
+            dsvdc_process_remove(handle, session, msg);
             break;
         }
         case VDCAPI__TYPE__VDSM_SEND_BYE:
-            dsvdc_process_bye(handle, msg);
+            dsvdc_process_bye(handle, session, msg);
             break;
 
         case VDCAPI__TYPE__VDSM_NOTIFICATION_CALL_SCENE:
@@ -1187,14 +1924,18 @@ void dsvdc_process_message(dsvdc_t *handle, unsigned char *data, uint16_t len)
             break;
 
         case VDCAPI__TYPE__GENERIC_RESPONSE:
-            dsvdc_process_generic_response(handle, msg);
+            dsvdc_process_generic_response(handle, session, msg);
             break;
 
         default:
             log("unhandled message type %d\n", msg->type);
             break;
     }
-    vdcapi__message__free_unpacked(msg, NULL);
+
+    dsvdc_session_set_current(previous);
+
+    /* the whole message tree lives in the arena, release it in one go */
+    dsvdc_arena_reset(&handle->rx_arena);
 }
 
 #if __GNUC__ >= 4
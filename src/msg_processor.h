@@ -26,21 +26,99 @@
 #include <stdlib.h>
 
 #include "messages.pb-c.h"
+#include "common.h"
 
 #if __GNUC__ >= 4
     #pragma GCC visibility push(hidden)
 #endif
 
-/* sends a message to the vdSM via the connection socket in the handle */
+/* Sends a message to one session or to all established sessions if the id
+ * is ALL_SESSIONS. The message is serialized once and written right away if
+ * possible, otherwise it is appended to the send queue of the session, this
+ * function never blocks. A broadcast succeeds if at least one session took
+ * the message. */
+int dsvdc_send_message_to(dsvdc_t *handle, unsigned int session_id,
+                          Vdcapi__Message *msg);
+
+/* priority lane the message is sent in */
+dsvdc_tx_lane_t dsvdc_message_lane(const Vdcapi__Message *msg);
+
+/* Send one serialized message to the session. It is written right away if
+ * possible, otherwise it is appended to the send queue of the session. Must
+ * be called with an already locked handle mutex, or by the I/O thread, which
+ * owns the send queues while it runs. */
+int dsvdc_session_send(dsvdc_session_t *session, dsvdc_tx_lane_t lane,
+                       const uint8_t *data, size_t msg_len,
+                       uint32_t message_id);
+
+/* sends a message to all established sessions */
 int dsvdc_send_message(dsvdc_t *handle, Vdcapi__Message *msg);
 
+/* Assigns a new message id to the request, sends it to the session or to all
+ * established sessions and tracks the response of each of them, the
+ * callback is triggered once per session. The request fails with DSVDC_ERR_TIMEOUT if a
+ * session did not answer within timeout milliseconds, zero selects the
+ * default of the handle. If receivers is not NULL, it is set to the number
+ * of sessions that took the request under the handle mutex before any of
+ * the callbacks runs, it stays untouched if the function fails. While the
+ * I/O thread runs, it may be set to zero later, the callback then runs once
+ * with the error. */
+int dsvdc_send_request(dsvdc_t *handle, unsigned int session_id,
+                       Vdcapi__Message *msg, unsigned int timeout, void *arg,
+                       void (*function)(dsvdc_t *handle, int code, void *arg,
+                                        void *userdata),
+                       unsigned int *receivers);
+
+/* writes as much of the send queue as the socket takes, must be called with
+ * an already locked handle mutex or by the I/O thread */
+int dsvdc_flush_send_queue(dsvdc_session_t *session);
+
+/* Messages sent between these calls are only queued and then written
+ * together, the calls nest. Must be called with an already locked handle
+ * mutex or by the I/O thread. */
+void dsvdc_tx_cork(dsvdc_t *handle);
+void dsvdc_tx_uncork(dsvdc_t *handle);
+
+/* Runs the send complete callback for the messages that left the send
+ * queues, must be called after the handle mutex was released. The callback
+ * may send again, nothing is reported while sends are corked. */
+void dsvdc_report_send_done(dsvdc_t *handle);
+
+/* discards all queued messages and reports them with the given code, must be
+ * called with an already locked handle mutex */
+void dsvdc_drop_send_queue(dsvdc_session_t *session, int code);
+
 /* sends "generic response" type message with the given error code */
-void dsvdc_send_error_message(dsvdc_t *handle, Vdcapi__ResultCode code,
-                              uint32_t message_id);
+void dsvdc_send_error_message(dsvdc_t *handle, unsigned int session,
+                              Vdcapi__ResultCode code, uint32_t message_id);
+
+/* Answers a connection that is not going to be served with a "generic
+ * response" of the given code, the caller closes the descriptor. */
+void dsvdc_refuse_connection(int fd, Vdcapi__ResultCode code);
+
+/* dsvdc_announce_container() and dsvdc_announce_device() for a single
+ * session that also report the receivers of the request, see
+ * dsvdc_send_request() */
+int dsvdc_send_container_announcement(dsvdc_t *handle,
+                                      unsigned int session_id,
+                                      const char *dsuid, void *arg,
+                                      void (*function)(dsvdc_t *handle,
+                                                       int code, void *arg,
+                                                       void *userdata),
+                                      unsigned int *receivers);
+int dsvdc_send_device_announcement(dsvdc_t *handle, unsigned int session_id,
+                                   const char *container_dsuid,
+                                   const char *dsuid, void *arg,
+                                   void (*function)(dsvdc_t *handle, int code,
+                                                    void *arg, void *userdata),
+                                   unsigned int *receivers);
 
 /* Receives data buffer containing the protobuf message, attempts to decode it.
- * identifies the message and triggers appropriate callbacks or responses.  */
-void dsvdc_process_message(dsvdc_t *handle, unsigned char *data, uint16_t len);
+ * identifies the message and triggers appropriate callbacks or responses.
+ * The decoded message is allocated from the receive arena of the handle,
+ * which is reset before the function returns. */
+void dsvdc_process_message(dsvdc_t *handle, dsvdc_session_t *session,
+                           unsigned char *data, uint16_t len);
 
 #if __GNUC__ >= 4
     #pragma GCC visibility pop
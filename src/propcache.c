@@ -0,0 +1,414 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "callbacks.h"
+#include "arena.h"
+#include "msg_processor.h"
+#include "properties.h"
+#include "propcache.h"
+#include "query.h"
+#include "registry.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* the answer only holds the element structures and pointer arrays that
+ * differ from the cached tree */
+#define PROPCACHE_ARENA_BLOCK   1024
+
+dsvdc_propcache_t *dsvdc_propcache_new(dsvdc_property_t *properties,
+                                const dsvdc_property_provider_t *providers,
+                                size_t n_providers)
+{
+    size_t i;
+    dsvdc_propcache_t *cache = malloc(sizeof(dsvdc_propcache_t));
+    if (!cache)
+    {
+        log("could not allocate property cache\n");
+        return NULL;
+    }
+
+    cache->refs = 1;
+    cache->properties = properties;
+    cache->n_providers = 0;
+    cache->providers = NULL;
+    if (n_providers > 0)
+    {
+        cache->providers = malloc(sizeof(dsvdc_property_provider_t) *
+                                  n_providers);
+        if (!cache->providers)
+        {
+            log("could not allocate property cache\n");
+            free(cache);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < n_providers; i++)
+    {
+        cache->providers[i] = providers[i];
+        cache->providers[i].name = strdup(providers[i].name);
+        if (!cache->providers[i].name)
+        {
+            log("could not allocate property cache\n");
+            cache->properties = NULL;
+            dsvdc_propcache_release(cache);
+            return NULL;
+        }
+        cache->n_providers++;
+    }
+    return cache;
+}
+
+void dsvdc_propcache_release(dsvdc_propcache_t *cache)
+{
+    size_t i;
+
+    if (!cache ||
+        (__atomic_sub_fetch(&cache->refs, 1, __ATOMIC_ACQ_REL) > 0))
+    {
+        return;
+    }
+
+    for (i = 0; i < cache->n_providers; i++)
+    {
+        free((char *)cache->providers[i].name);
+    }
+    free(cache->providers);
+    dsvdc_property_free(cache->properties);
+    free(cache);
+}
+
+static const dsvdc_property_provider_t *dsvdc_propcache_provider(
+                                        const dsvdc_propcache_t *cache,
+                                        const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < cache->n_providers; i++)
+    {
+        if (strcmp(cache->providers[i].name, name) == 0)
+        {
+            return &cache->providers[i];
+        }
+    }
+    return NULL;
+}
+
+static Vdcapi__PropertyElement *dsvdc_propcache_find(
+                                        const dsvdc_propcache_t *cache,
+                                        const char *name)
+{
+    if (!cache->properties)
+    {
+        return NULL;
+    }
+    return dsvdc_query_find(cache->properties->properties,
+                            cache->properties->n_properties, name);
+}
+
+/* true if the tree alone answers the query */
+static bool dsvdc_propcache_complete(const dsvdc_propcache_t *cache,
+                                     Vdcapi__PropertyElement **query,
+                                     size_t n_query)
+{
+    size_t i;
+
+    for (i = 0; i < n_query; i++)
+    {
+        if (dsvdc_query_is_wildcard(query[i]))
+        {
+            if (cache->n_providers > 0)
+            {
+                return false;
+            }
+        }
+        else if (dsvdc_propcache_provider(cache, query[i]->name) ||
+                 !dsvdc_propcache_find(cache, query[i]->name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* state of an answer that needs providers or the callback */
+typedef struct dsvdc_propcache_answer
+{
+    dsvdc_t *handle;
+    const char *dsuid;
+    const dsvdc_propcache_t *cache;
+    dsvdc_arena_t *arena;
+    dsvdc_property_t *response;
+    /* query elements for the get property callback */
+    Vdcapi__PropertyElement **rest;
+    size_t n_rest;
+} dsvdc_propcache_answer_t;
+
+static int dsvdc_propcache_add_cached(dsvdc_propcache_answer_t *answer,
+                                      Vdcapi__PropertyElement *element,
+                                      Vdcapi__PropertyElement *query)
+{
+    element = dsvdc_query_answer(answer->arena, element, query);
+    if (!element)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+    return dsvdc_property_append_copy(answer->response, &element, 1);
+}
+
+/* The provider gets a view of the subquery that borrows from the message.
+ * Without a callback the property is asked from the get property callback,
+ * for a wildcard by its name. */
+static int dsvdc_propcache_add_provided(dsvdc_propcache_answer_t *answer,
+                                    const dsvdc_property_provider_t *provider,
+                                    Vdcapi__PropertyElement *query)
+{
+    if (provider->provide)
+    {
+        dsvdc_property_t subquery;
+
+        dsvdc_property_view(&subquery, query->elements, query->n_elements);
+        provider->provide(answer->handle, answer->dsuid, provider->name,
+                          &subquery, answer->response, provider->context);
+        return DSVDC_OK;
+    }
+
+    if (dsvdc_query_is_wildcard(query))
+    {
+        Vdcapi__PropertyElement *named = dsvdc_arena_alloc(answer->arena,
+                                            sizeof(Vdcapi__PropertyElement));
+        if (!named)
+        {
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+        vdcapi__property_element__init(named);
+        named->name = (char *)provider->name;
+        named->n_elements = query->n_elements;
+        named->elements = query->elements;
+        query = named;
+    }
+    answer->rest[answer->n_rest++] = query;
+    return DSVDC_OK;
+}
+
+static int dsvdc_propcache_add(dsvdc_propcache_answer_t *answer,
+                               Vdcapi__PropertyElement *query)
+{
+    const dsvdc_propcache_t *cache = answer->cache;
+    const dsvdc_property_provider_t *provider;
+    Vdcapi__PropertyElement *element;
+    size_t i;
+    int ret = DSVDC_OK;
+
+    if (dsvdc_query_is_wildcard(query))
+    {
+        /* cached properties in tree order, then the provided ones */
+        for (i = 0; cache->properties &&
+                    (i < cache->properties->n_properties) &&
+                    (ret == DSVDC_OK); i++)
+        {
+            element = cache->properties->properties[i];
+            if (!element->name ||
+                !dsvdc_propcache_provider(cache, element->name))
+            {
+                ret = dsvdc_propcache_add_cached(answer, element, query);
+            }
+        }
+        for (i = 0; (i < cache->n_providers) && (ret == DSVDC_OK); i++)
+        {
+            ret = dsvdc_propcache_add_provided(answer, &cache->providers[i],
+                                               query);
+        }
+        return ret;
+    }
+
+    provider = dsvdc_propcache_provider(cache, query->name);
+    if (provider)
+    {
+        return dsvdc_propcache_add_provided(answer, provider, query);
+    }
+
+    element = dsvdc_propcache_find(cache, query->name);
+    if (element)
+    {
+        return dsvdc_propcache_add_cached(answer, element, query);
+    }
+
+    answer->rest[answer->n_rest++] = query;
+    return DSVDC_OK;
+}
+
+static int dsvdc_propcache_send(dsvdc_t *handle, dsvdc_session_t *session,
+                                uint32_t message_id,
+                                Vdcapi__PropertyElement **properties,
+                                size_t n_properties)
+{
+    Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdcResponseGetProperty submsg =
+                                    VDCAPI__VDC__RESPONSE_GET_PROPERTY__INIT;
+
+    submsg.n_properties = n_properties;
+    submsg.properties = properties;
+    reply.type = VDCAPI__TYPE__VDC_RESPONSE_GET_PROPERTY;
+    reply.message_id = message_id;
+    reply.has_message_id = 1;
+    reply.vdc_response_get_property = &submsg;
+
+    int ret = dsvdc_send_message_to(handle, session->id, &reply);
+    log("VDC_RESPONSE_GET_PROPERTY/%u sent from cache with code %d\n",
+        message_id, ret);
+    return ret;
+}
+
+/* Builds the response in query order, calls the providers and passes what
+ * is left to the get property callback. */
+static int dsvdc_propcache_answer_mixed(dsvdc_t *handle,
+                                        dsvdc_session_t *session,
+                                        Vdcapi__Message *msg,
+                                        const dsvdc_propcache_t *cache,
+                                        dsvdc_arena_t *arena)
+{
+    Vdcapi__VdsmRequestGetProperty *request = msg->vdsm_request_get_property;
+    dsvdc_propcache_answer_t answer;
+    dsvdc_callbacks_t cb;
+    size_t size = 0;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < request->n_query; i++)
+    {
+        size += dsvdc_query_is_wildcard(request->query[i]) ?
+                cache->n_providers : 1;
+    }
+
+    answer.handle = handle;
+    answer.dsuid = request->dsuid;
+    answer.cache = cache;
+    answer.arena = arena;
+    answer.n_rest = 0;
+    answer.rest = dsvdc_arena_alloc(arena, sizeof(Vdcapi__PropertyElement *) *
+                                           (size ? size : 1));
+    if (!answer.rest)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    ret = dsvdc_property_new(&answer.response);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+    answer.response->message_id = msg->message_id;
+    answer.response->session = session->id;
+
+    for (i = 0; (i < request->n_query) && (ret == DSVDC_OK); i++)
+    {
+        ret = dsvdc_propcache_add(&answer, request->query[i]);
+    }
+
+    if (ret != DSVDC_OK)
+    {
+        dsvdc_property_free(answer.response);
+        return ret;
+    }
+
+    DSVDC_STAT_ADD(handle, property_cache_hits, 1);
+    dsvdc_get_callbacks(handle, &cb);
+    if ((answer.n_rest == 0) || !cb.vdsm_request_get_property)
+    {
+        return dsvdc_send_get_property_response(handle, answer.response);
+    }
+
+    /* the callback adds to the response and sends it, the query borrows
+     * from the message and the arena */
+    dsvdc_property_t query;
+    dsvdc_property_view(&query, answer.rest, answer.n_rest);
+    DSVDC_STAT_ADD(handle, property_cache_partial, 1);
+    cb.vdsm_request_get_property(handle, request->dsuid, answer.response,
+                                 &query, cb.userdata);
+    return DSVDC_OK;
+}
+
+bool dsvdc_propcache_answer(dsvdc_t *handle, dsvdc_session_t *session,
+                            Vdcapi__Message *msg)
+{
+    Vdcapi__VdsmRequestGetProperty *request = msg->vdsm_request_get_property;
+    Vdcapi__PropertyElement **answer;
+    size_t n_answer;
+    dsvdc_propcache_t *cache;
+    dsvdc_arena_t arena;
+    int ret;
+
+    cache = dsvdc_registry_properties(handle, request->dsuid);
+    if (!cache)
+    {
+        return false;
+    }
+
+    dsvdc_arena_init(&arena, PROPCACHE_ARENA_BLOCK);
+    if (cache->properties &&
+        dsvdc_propcache_complete(cache, request->query, request->n_query))
+    {
+        /* the answer borrows from the tree and is sent without a copy */
+        ret = dsvdc_query_select(&arena, request->query, request->n_query,
+                                 cache->properties->properties,
+                                 cache->properties->n_properties,
+                                 &answer, &n_answer);
+        if (ret == DSVDC_OK)
+        {
+            DSVDC_STAT_ADD(handle, property_cache_hits, 1);
+            ret = dsvdc_propcache_send(handle, session, msg->message_id,
+                                       answer, n_answer);
+        }
+    }
+    else
+    {
+        ret = dsvdc_propcache_answer_mixed(handle, session, msg, cache,
+                                           &arena);
+    }
+
+    if (ret == DSVDC_ERR_OUT_OF_MEMORY)
+    {
+        log("VDSM_REQUEST_GET_PROPERTY: could not allocate the answer\n");
+        dsvdc_send_error_message(handle, session->id,
+                                 VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE,
+                                 msg->message_id);
+    }
+
+    dsvdc_arena_cleanup(&arena);
+    dsvdc_propcache_release(cache);
+    return true;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_PROPCACHE_H__
+#define __DSVDC_PROPCACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dsvdc.h"
+#include "common.h"
+#include "messages.pb-c.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Property tree and providers of a registered container or device that
+ * answer get property requests, see dsvdc_set_property_cache(). A cache is
+ * never modified, a new one replaces it. Answers borrow from the tree and
+ * call the providers outside the lock, so they hold a reference. */
+typedef struct dsvdc_propcache
+{
+    unsigned int refs;
+    /* NULL if there are only providers */
+    dsvdc_property_t *properties;
+    /* the names are owned by the cache */
+    dsvdc_property_provider_t *providers;
+    size_t n_providers;
+} dsvdc_propcache_t;
+
+/* takes ownership of properties, the providers are copied, NULL on
+ * failure */
+dsvdc_propcache_t *dsvdc_propcache_new(dsvdc_property_t *properties,
+                                const dsvdc_property_provider_t *providers,
+                                size_t n_providers);
+void dsvdc_propcache_release(dsvdc_propcache_t *cache);
+
+/* Answers a get property request from the cache of its dSUID, the parts
+ * that the cache can not answer are passed to the get property callback.
+ * Returns false if there is no cache. */
+bool dsvdc_propcache_answer(dsvdc_t *handle, dsvdc_session_t *session,
+                            Vdcapi__Message *msg);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_PROPCACHE_H__*/
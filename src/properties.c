@@ -28,30 +28,169 @@
 #include <string.h>
 
 #include "properties.h"
+#include "arena.h"
 #include "dsvdc.h"
 #include "log.h"
 #include "msg_processor.h"
 
-static int dsvdc_property_add(dsvdc_property_t *property,
-                              Vdcapi__PropertyElement *element)
+/* the element array of a property doubles whenever it is full */
+#define PROPERTY_MIN_CAPACITY   4
+
+/* block size of the arena of dsvdc_property_new_arena() */
+#define PROPERTY_ARENA_BLOCK    8192
+
+/* the property and its arena are allocated together */
+typedef struct dsvdc_property_root
 {
-    if (!property)
+    dsvdc_property_t property;
+    dsvdc_arena_t arena;
+} dsvdc_property_root_t;
+
+static void dsvdc_property_init(dsvdc_property_t *property,
+                                dsvdc_arena_t *arena, bool owns_arena)
+{
+    property->message_id = 0;
+    property->session = ALL_SESSIONS;
+    property->properties = NULL;
+    property->n_properties = 0;
+    property->capacity = 0;
+    property->arena = arena;
+    property->owns_arena = owns_arena;
+}
+
+/* heap or arena memory, depending on where the property tree lives */
+static void *dsvdc_property_alloc(dsvdc_arena_t *arena, size_t size)
+{
+    if (arena)
     {
-        log("invalid property handle\n");
-        return DSVDC_ERR_PARAM;
+        return dsvdc_arena_alloc(arena, size);
+    }
+    return malloc(size);
+}
+
+static char *dsvdc_property_strdup(dsvdc_arena_t *arena, const char *str)
+{
+    if (!arena)
+    {
+        return strdup(str);
     }
 
+    size_t len = strlen(str) + 1;
+    char *copy = dsvdc_arena_alloc(arena, len);
+    if (copy)
+    {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+static void dsvdc_property_free_value(Vdcapi__PropertyValue *value)
+{
+    if (value)
+    {
+        if (value->v_string)
+        {
+            free(value->v_string);
+        }
+        else if (value->has_v_bytes)
+        {
+            if (value->v_bytes.data)
+            {
+                free(value->v_bytes.data);
+            }
+        }
+        free(value);
+    }
+}
+
+static void dsvdc_property_free_elements(Vdcapi__PropertyElement **elements,
+                                         size_t n_elements);
+
+static void dsvdc_property_free_element(Vdcapi__PropertyElement *el)
+{
+    if (el->name)
+    {
+        free(el->name);
+    }
+
+    dsvdc_property_free_value(el->value);
+
+    if (el->elements)
+    {
+        dsvdc_property_free_elements(el->elements, el->n_elements);
+    }
+
+    free(el);
+}
+
+static void dsvdc_property_free_elements(Vdcapi__PropertyElement **elements,
+                                         size_t n_elements)
+{
+    size_t j;
+    if (!elements)
+    {
+        return;
+    }
+
+    for (j = 0; j < n_elements; j++)
+    {
+        if (elements[j])
+        {
+            dsvdc_property_free_element(elements[j]);
+        }
+    }
+
+    free(elements);
+}
+
+/* releases an element that is not part of the tree (yet), arena memory is
+ * only reclaimed together with the whole arena */
+static void dsvdc_property_discard(dsvdc_property_t *property,
+                                   Vdcapi__PropertyElement *element)
+{
+    if (!property->arena)
+    {
+        dsvdc_property_free_element(element);
+    }
+}
+
+/* makes room for n_more elements, the capacity grows geometrically so that
+ * building a property of n elements takes O(n) */
+static int dsvdc_property_reserve(dsvdc_property_t *property, size_t n_more)
+{
     Vdcapi__PropertyElement **properties;
-    size_t new_count = (property->n_properties + 1);
+    size_t needed = property->n_properties + n_more;
+    size_t capacity = property->capacity;
+
+    if (needed <= capacity)
+    {
+        return DSVDC_OK;
+    }
+
+    if (capacity < PROPERTY_MIN_CAPACITY)
+    {
+        capacity = PROPERTY_MIN_CAPACITY;
+    }
+    while (capacity < needed)
+    {
+        capacity *= 2;
+    }
 
-    if (!(property->properties))
+    if (property->arena)
     {
-        properties = malloc(sizeof(Vdcapi__PropertyElement *) * new_count);
+        // the old array stays in the arena until the tree is freed
+        properties = dsvdc_arena_alloc(property->arena,
+                                sizeof(Vdcapi__PropertyElement *) * capacity);
+        if (properties && (property->n_properties > 0))
+        {
+            memcpy(properties, property->properties,
+                   sizeof(Vdcapi__PropertyElement *) * property->n_properties);
+        }
     }
     else
     {
         properties = realloc(property->properties,
-                         sizeof(Vdcapi__PropertyElement *) * new_count);
+                             sizeof(Vdcapi__PropertyElement *) * capacity);
     }
 
     if (!properties)
@@ -60,12 +199,29 @@ static int dsvdc_property_add(dsvdc_property_t *property,
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
-    properties[new_count - 1] = NULL;
-
     property->properties = properties;
-    property->n_properties = new_count;
-    property->properties[new_count - 1] = element;
+    property->capacity = capacity;
+    return DSVDC_OK;
+}
+
+static int dsvdc_property_add(dsvdc_property_t *property,
+                              Vdcapi__PropertyElement *element)
+{
+    int ret;
 
+    if (!property)
+    {
+        log("invalid property handle\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    ret = dsvdc_property_reserve(property, 1);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    property->properties[property->n_properties++] = element;
     return DSVDC_OK;
 }
 
@@ -81,7 +237,8 @@ static int dsvdc_property_prepare_element(dsvdc_property_t *property,
         return DSVDC_ERR_PARAM;
     }
 
-    Vdcapi__PropertyElement *el = malloc(sizeof(Vdcapi__PropertyElement));
+    Vdcapi__PropertyElement *el = dsvdc_property_alloc(property->arena,
+                                            sizeof(Vdcapi__PropertyElement));
     if (!el)
     {
         log("could not allocate property element\n");
@@ -92,20 +249,20 @@ static int dsvdc_property_prepare_element(dsvdc_property_t *property,
     // a property name is set, then there must be a value
     if (key)
     {
-        el->name = strdup(key);
+        el->name = dsvdc_property_strdup(property->arena, key);
         if (!el->name)
         {
             log("could not allocate memory for property name\n");
-            free(el);
+            dsvdc_property_discard(property, el);
             return DSVDC_ERR_OUT_OF_MEMORY;
         }
 
-        Vdcapi__PropertyValue *val = malloc(sizeof(Vdcapi__PropertyValue));
+        Vdcapi__PropertyValue *val = dsvdc_property_alloc(property->arena,
+                                            sizeof(Vdcapi__PropertyValue));
         if (!val)
         {
             log("could not allocate memory for property value\n");
-            free(el->name);
-            free(el);
+            dsvdc_property_discard(property, el);
             return DSVDC_ERR_OUT_OF_MEMORY;
         }
         vdcapi__property_value__init(val);
@@ -118,63 +275,11 @@ static int dsvdc_property_prepare_element(dsvdc_property_t *property,
     return DSVDC_OK;
 }
 
-static void dsvdc_property_free_value(Vdcapi__PropertyValue *value)
-{
-    if (value)
-    {
-        if (value->v_string)
-        {
-            free(value->v_string);
-        }
-        else if (value->has_v_bytes)
-        {
-            if (value->v_bytes.data)
-            {
-                free(value->v_bytes.data);
-            }
-        }
-        free(value);
-    }
-}
-
-static void dsvdc_property_free_elements(Vdcapi__PropertyElement **elements,
-                                         size_t n_elements)
-{
-    size_t j;
-    if (!elements)
-    {
-        return;
-    }
-
-    for (j = 0; j < n_elements; j++)
-    {
-        Vdcapi__PropertyElement *el = elements[j];
-        if (!el)
-        {
-            continue;
-        }
-
-        if (el->name)
-        {
-            free(el->name);
-        }
-
-        dsvdc_property_free_value(el->value);
-
-        if (el->n_elements > 0)
-        {
-            dsvdc_property_free_elements(el->elements, el->n_elements);
-        }
-
-        free(el);
-    } // for elements loop
-
-    free(elements);
-}
-static Vdcapi__PropertyValue *dsvdc_property_copy_value(
+static Vdcapi__PropertyValue *dsvdc_property_copy_value(dsvdc_arena_t *arena,
                                                 Vdcapi__PropertyValue *input)
 {
-    Vdcapi__PropertyValue *val = malloc(sizeof(Vdcapi__PropertyValue));
+    Vdcapi__PropertyValue *val = dsvdc_property_alloc(arena,
+                                            sizeof(Vdcapi__PropertyValue));
     if (!val)
     {
         log("could not allocate memory for property value");
@@ -191,11 +296,14 @@ static Vdcapi__PropertyValue *dsvdc_property_copy_value(
     val->v_double = input->v_double;
     if (input->v_string)
     {
-        val->v_string = strdup(input->v_string);
+        val->v_string = dsvdc_property_strdup(arena, input->v_string);
         if (!val->v_string)
         {
             log("could not allocate memory for property value");
-            free(val);
+            if (!arena)
+            {
+                free(val);
+            }
             return NULL;
         }
     }
@@ -207,15 +315,15 @@ static Vdcapi__PropertyValue *dsvdc_property_copy_value(
     if (input->has_v_bytes && (input->v_bytes.len > 0))
     {
         val->v_bytes.len = input->v_bytes.len;
-        val->v_bytes.data = malloc(sizeof(uint8_t)*val->v_bytes.len);
+        val->v_bytes.data = dsvdc_property_alloc(arena,
+                                        sizeof(uint8_t)*val->v_bytes.len);
         if (!val->v_bytes.data)
         {
             log("could not allocate memory for property value");
-            if (val->v_string)
+            if (!arena)
             {
-                free(val->v_string);
+                dsvdc_property_free_value(val);
             }
-            free(val);
             return NULL;
         }
         memcpy(val->v_bytes.data, input->v_bytes.data, val->v_bytes.len);
@@ -224,68 +332,89 @@ static Vdcapi__PropertyValue *dsvdc_property_copy_value(
     return val;
 }
 
-Vdcapi__PropertyElement **dsvdc_property_deep_copy(
+static Vdcapi__PropertyElement **dsvdc_property_copy_elements(
+                                    dsvdc_arena_t *arena,
                                     Vdcapi__PropertyElement **input,
-                                    size_t n_input)
+                                    size_t n_input);
+
+static Vdcapi__PropertyElement *dsvdc_property_copy_element(
+                                    dsvdc_arena_t *arena,
+                                    Vdcapi__PropertyElement *input)
 {
-    size_t i;
-    Vdcapi__PropertyElement **copy;
-    copy = malloc(sizeof(Vdcapi__PropertyElement) * n_input);
+    Vdcapi__PropertyElement *copy = dsvdc_property_alloc(arena,
+                                            sizeof(Vdcapi__PropertyElement));
     if (!copy)
     {
         log("could not allocate memory for properties");
         return NULL;
     }
+    vdcapi__property_element__init(copy);
 
-    for (i = 0; i < n_input; i++)
+    if (input->name)
     {
-        Vdcapi__PropertyElement *current_input = input[i];
-        copy[i] = malloc(sizeof(Vdcapi__PropertyElement));
-        if (!copy[i])
+        copy->name = dsvdc_property_strdup(arena, input->name);
+        if (!copy->name)
         {
-            log("could not allocate memory for properties");
-            dsvdc_property_free_elements(copy, n_input);
-            return NULL;
+            goto fail;
         }
+    }
 
-        Vdcapi__PropertyElement *current_copy = copy[i];
-        vdcapi__property_element__init(current_copy);
-
-        if (current_input->name)
+    if (input->value)
+    {
+        copy->value = dsvdc_property_copy_value(arena, input->value);
+        if (!copy->value)
         {
-            current_copy->name = strdup(current_input->name);
-            if (!current_copy->name)
-            {
-                log("could not allocate memory for properties");
-                dsvdc_property_free_elements(copy, n_input);
-                return NULL;
-            }
+            goto fail;
         }
+    }
 
-        if (current_input->value)
+    if (input->n_elements > 0)
+    {
+        copy->elements = dsvdc_property_copy_elements(arena, input->elements,
+                                                      input->n_elements);
+        if (!copy->elements)
         {
-            current_copy->value = dsvdc_property_copy_value(
-                                                        current_input->value);
-            if (!current_copy->value)
-            {
-                log("could not allocate memory for properties");
-                dsvdc_property_free_elements(copy, n_input);
-                return NULL;
-            }
+            goto fail;
         }
+        copy->n_elements = input->n_elements;
+    }
 
-        current_copy->n_elements = current_input->n_elements;
-        if (current_copy->n_elements > 0)
+    return copy;
+
+fail:
+    log("could not allocate memory for properties");
+    if (!arena)
+    {
+        dsvdc_property_free_element(copy);
+    }
+    return NULL;
+}
+
+static Vdcapi__PropertyElement **dsvdc_property_copy_elements(
+                                    dsvdc_arena_t *arena,
+                                    Vdcapi__PropertyElement **input,
+                                    size_t n_input)
+{
+    size_t i;
+    Vdcapi__PropertyElement **copy;
+    copy = dsvdc_property_alloc(arena,
+                                sizeof(Vdcapi__PropertyElement *) * n_input);
+    if (!copy)
+    {
+        log("could not allocate memory for properties");
+        return NULL;
+    }
+
+    for (i = 0; i < n_input; i++)
+    {
+        copy[i] = dsvdc_property_copy_element(arena, input[i]);
+        if (!copy[i])
         {
-            current_copy->elements = dsvdc_property_deep_copy(
-                                                    current_input->elements,
-                                                    current_input->n_elements);
-            if (!current_copy->elements)
+            if (!arena)
             {
-                log("could not allocate memory for properties");
-                dsvdc_property_free_elements(copy, n_input);
-                return NULL;
+                dsvdc_property_free_elements(copy, i);
             }
+            return NULL;
         }
     }
 
@@ -296,20 +425,53 @@ Vdcapi__PropertyElement **dsvdc_property_deep_copy(
     #pragma GCC visibility push(hidden)
 #endif
 
-int dsvdc_property_convert_query(Vdcapi__PropertyElement **query,
-                                 size_t n_query, dsvdc_property_t **property)
+void dsvdc_property_view(dsvdc_property_t *view,
+                         Vdcapi__PropertyElement **elements,
+                         size_t n_elements)
+{
+    dsvdc_property_init(view, NULL, false);
+    view->properties = elements;
+    view->n_properties = n_elements;
+    view->capacity = n_elements;
+}
+
+int dsvdc_property_append_copy(dsvdc_property_t *property,
+                               Vdcapi__PropertyElement **elements,
+                               size_t n_elements)
 {
+    size_t i;
     int ret;
-    *property = NULL;
 
-    ret = dsvdc_property_new(property);
+    if (n_elements == 0)
+    {
+        return DSVDC_OK;
+    }
+
+    ret = dsvdc_property_reserve(property, n_elements);
     if (ret != DSVDC_OK)
     {
         return ret;
     }
 
-    (*property)->n_properties = n_query;
-    (*property)->properties = dsvdc_property_deep_copy(query, n_query);
+    // copies go straight into the reserved slots
+    for (i = 0; i < n_elements; i++)
+    {
+        Vdcapi__PropertyElement *copy;
+        copy = dsvdc_property_copy_element(property->arena, elements[i]);
+        if (!copy)
+        {
+            Vdcapi__PropertyElement **added;
+            added = property->properties + property->n_properties;
+            while (i > 0)
+            {
+                dsvdc_property_discard(property, added[--i]);
+            }
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+        property->properties[property->n_properties + i] = copy;
+    }
+
+    property->n_properties += n_elements;
     return DSVDC_OK;
 }
 
@@ -330,8 +492,55 @@ int dsvdc_property_new(dsvdc_property_t **property)
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
-    p->n_properties = 0;
-    p->properties = NULL;
+    dsvdc_property_init(p, NULL, false);
+
+    *property = p;
+    return DSVDC_OK;
+}
+
+int dsvdc_property_new_arena(dsvdc_property_t **property)
+{
+    *property = NULL;
+
+    dsvdc_property_root_t *root = malloc(sizeof(dsvdc_property_root_t));
+    if (!root)
+    {
+        log("could not allocate new property instance\n");
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    dsvdc_arena_init(&root->arena, PROPERTY_ARENA_BLOCK);
+    dsvdc_property_init(&root->property, &root->arena, true);
+
+    *property = &root->property;
+    return DSVDC_OK;
+}
+
+int dsvdc_property_new_nested(dsvdc_property_t *parent,
+                              dsvdc_property_t **property)
+{
+    *property = NULL;
+
+    if (!parent)
+    {
+        log("invalid property handle\n");
+        return DSVDC_ERR_PARAM;
+    }
+
+    if (!parent->arena)
+    {
+        return dsvdc_property_new(property);
+    }
+
+    dsvdc_property_t *p = dsvdc_arena_alloc(parent->arena,
+                                            sizeof(struct dsvdc_property));
+    if (!p)
+    {
+        log("could not allocate new property instance\n");
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    dsvdc_property_init(p, parent->arena, false);
 
     *property = p;
     return DSVDC_OK;
@@ -344,16 +553,59 @@ void dsvdc_property_free(dsvdc_property_t *property)
         return;
     }
 
-    if (property->n_properties > 0)
+    if (property->arena)
     {
-        // will walk the properties recursively
-        dsvdc_property_free_elements(property->properties,
-                                     property->n_properties);
+        // the whole tree goes with the arena, nested properties leave that
+        // to their root
+        if (property->owns_arena)
+        {
+            dsvdc_arena_cleanup(property->arena);
+            free(property);
+        }
+        return;
     }
 
+    // will walk the properties recursively
+    dsvdc_property_free_elements(property->properties,
+                                 property->n_properties);
+
     free(property);
 }
 
+int dsvdc_property_clone(const dsvdc_property_t *property,
+                         dsvdc_property_t **clone)
+{
+    int ret;
+
+    if (!clone)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+    *clone = NULL;
+
+    if (!property)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    ret = dsvdc_property_new(clone);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    (*clone)->message_id = property->message_id;
+    (*clone)->session = property->session;
+    ret = dsvdc_property_append_copy(*clone, property->properties,
+                                     property->n_properties);
+    if (ret != DSVDC_OK)
+    {
+        dsvdc_property_free(*clone);
+        *clone = NULL;
+    }
+    return ret;
+}
+
 int dsvdc_property_add_int(dsvdc_property_t *property,
                            const char *key, int64_t value)
 {
@@ -378,9 +630,7 @@ int dsvdc_property_add_int(dsvdc_property_t *property,
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -411,9 +661,7 @@ int dsvdc_property_add_uint(dsvdc_property_t *property,
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -444,9 +692,7 @@ int dsvdc_property_add_bool(dsvdc_property_t *property, const char *key,
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -477,9 +723,7 @@ int dsvdc_property_add_double(dsvdc_property_t *property,
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -510,23 +754,18 @@ int dsvdc_property_add_string(dsvdc_property_t *property, const char *key,
         return ret;
     }
 
-    element->value->v_string = strdup(value);
+    element->value->v_string = dsvdc_property_strdup(property->arena, value);
     if (!element->value->v_string)
     {
         log("could not allocate memory for string value\n");
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
 
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value->v_string);
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -564,13 +803,12 @@ int dsvdc_property_add_bytes(dsvdc_property_t *property, const char *key,
     }
 
     element->value->v_bytes.len = length;
-    element->value->v_bytes.data = (uint8_t *)malloc(sizeof(uint8_t) * length);
+    element->value->v_bytes.data = dsvdc_property_alloc(property->arena,
+                                                sizeof(uint8_t) * length);
     if (!element->value->v_bytes.data)
     {
         log("could not allocate memory for data buffer\n");
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return DSVDC_ERR_OUT_OF_MEMORY;
     }
     memcpy(element->value->v_bytes.data, value, length);
@@ -579,10 +817,7 @@ int dsvdc_property_add_bytes(dsvdc_property_t *property, const char *key,
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
-        free(element->value->v_bytes.data);
-        free(element->value);
-        free(element->name);
-        free(element);
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -608,27 +843,46 @@ int dsvdc_property_add_property(dsvdc_property_t *property, const char *name,
 
     if (name)
     {
-        element->name = strdup(name);
+        element->name = dsvdc_property_strdup(property->arena, name);
         if (!element->name)
         {
             log("could not allocate memory for element name");
-            free(element);
+            dsvdc_property_discard(property, element);
             return DSVDC_ERR_OUT_OF_MEMORY;
         }
     }
 
-    element->elements = (*value)->properties;
-    element->n_elements = (*value)->n_properties;
+    if ((*value)->arena == property->arena)
+    {
+        // claim ownership of content and free value property structure
+        element->elements = (*value)->properties;
+        element->n_elements = (*value)->n_properties;
+        (*value)->properties = NULL;
+        (*value)->n_properties = 0;
+        (*value)->capacity = 0;
+    }
+    else if ((*value)->n_properties > 0)
+    {
+        // the content lives elsewhere, copy it so that the tree keeps a
+        // single owner
+        element->elements = dsvdc_property_copy_elements(property->arena,
+                                                    (*value)->properties,
+                                                    (*value)->n_properties);
+        if (!element->elements)
+        {
+            dsvdc_property_discard(property, element);
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+        element->n_elements = (*value)->n_properties;
+    }
 
-    // claim ownership of content and free value property structure
-    (*value)->properties = NULL;
-    (*value)->n_properties = 0;
-    free(*value);
+    dsvdc_property_free(*value);
     *value = NULL;
 
     ret = dsvdc_property_add(property, element);
     if (ret != DSVDC_OK)
     {
+        dsvdc_property_discard(property, element);
         return ret;
     }
 
@@ -664,7 +918,7 @@ int dsvdc_send_get_property_response(dsvdc_t *handle, dsvdc_property_t *property
     reply.has_message_id = 1;
     reply.vdc_response_get_property = &submsg;
 
-    int ret = dsvdc_send_message(handle, &reply);
+    int ret = dsvdc_send_message_to(handle, property->session, &reply);
     log("VDC_RESPONSE_GET_PROPERTY/%u sent with code %d\n",
         reply.message_id, ret);
     dsvdc_property_free(property);
@@ -697,8 +951,8 @@ int dsvdc_send_set_property_response(dsvdc_t *handle,
         return DSVDC_ERR_PARAM;
     }
 
-    dsvdc_send_error_message(handle, (Vdcapi__ResultCode)code,
-                             property->message_id);
+    dsvdc_send_error_message(handle, property->session,
+                             (Vdcapi__ResultCode)code, property->message_id);
     log("VDC_RESPONSE_SET_PROPERTY/%u sent\n", property->message_id);
     dsvdc_property_free(property);
     return DSVDC_OK;
@@ -997,30 +1251,28 @@ int dsvdc_property_get_property_by_name(const dsvdc_property_t *property,
             continue;
         }
 
-        if (strcmp(name, element->name) == 0)
+        if (element->name && (strcmp(name, element->name) == 0))
         {
-            prop = malloc(sizeof(dsvdc_property_t));
-            if (!prop)
+            int ret = dsvdc_property_new(&prop);
+            if (ret != DSVDC_OK)
             {
-                log("could not allocate memory for property");
-                return DSVDC_ERR_OUT_OF_MEMORY;
+                return ret;
             }
-            prop->properties = NULL;
-            prop->n_properties = element->n_elements;
-            if (prop->n_properties > 0)
+
+            if (element->n_elements > 0)
             {
-                prop->properties = dsvdc_property_deep_copy(element->elements,
-                                                           element->n_elements);
-                if (!prop->properties)
-                {
-                    free(prop);
-                    return DSVDC_ERR_OUT_OF_MEMORY;
-                }
+                ret = dsvdc_property_append_copy(prop, element->elements,
+                                                 element->n_elements);
             }
             else
             {
-                prop->n_properties = 1;
-                prop->properties = dsvdc_property_deep_copy(&element, 1);
+                ret = dsvdc_property_append_copy(prop, &element, 1);
+            }
+
+            if (ret != DSVDC_OK)
+            {
+                dsvdc_property_free(prop);
+                return ret;
             }
             break;
         }
@@ -1054,26 +1306,258 @@ int dsvdc_property_get_property_by_index(const dsvdc_property_t *property,
         return DSVDC_ERR_PROPERTY_INDEX;
     }
 
-    prop = malloc(sizeof(dsvdc_property_t));
-    if (!prop)
+    int ret = dsvdc_property_new(&prop);
+    if (ret != DSVDC_OK)
     {
-        log("could not allocate memory for property");
-        return DSVDC_ERR_OUT_OF_MEMORY;
+        return ret;
+    }
+
+    ret = dsvdc_property_append_copy(prop, element->elements,
+                                     element->n_elements);
+    if (ret != DSVDC_OK)
+    {
+        dsvdc_property_free(prop);
+        return ret;
+    }
+
+    *out = prop;
+
+    return DSVDC_OK;
+}
+
+/* element of the level a cursor points to, NULL if there is none */
+static Vdcapi__PropertyElement *dsvdc_property_cursor_element(
+                                    const dsvdc_property_cursor_t *cursor,
+                                    size_t index)
+{
+    if (!cursor || (index >= cursor->n_elements))
+    {
+        return NULL;
+    }
+    return ((Vdcapi__PropertyElement **)cursor->elements)[index];
+}
+
+/* The value getters of a property work on the level as a borrowed view, so
+ * that they need no allocation either. */
+static void dsvdc_property_cursor_view(const dsvdc_property_cursor_t *cursor,
+                                       dsvdc_property_t *view)
+{
+    dsvdc_property_view(view, (Vdcapi__PropertyElement **)cursor->elements,
+                        cursor->n_elements);
+}
+
+void dsvdc_property_cursor(const dsvdc_property_t *property,
+                           dsvdc_property_cursor_t *cursor)
+{
+    cursor->elements = NULL;
+    cursor->n_elements = 0;
+    if (property)
+    {
+        cursor->elements = (const void *const *)property->properties;
+        cursor->n_elements = property->n_properties;
+    }
+}
+
+int dsvdc_property_cursor_child(const dsvdc_property_cursor_t *cursor,
+                                size_t index, dsvdc_property_cursor_t *child)
+{
+    Vdcapi__PropertyElement *element;
+
+    element = dsvdc_property_cursor_element(cursor, index);
+    if (!element)
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    child->elements = (const void *const *)element->elements;
+    child->n_elements = element->n_elements;
+    return DSVDC_OK;
+}
+
+size_t dsvdc_property_cursor_count(const dsvdc_property_cursor_t *cursor)
+{
+    return cursor ? cursor->n_elements : 0;
+}
+
+int dsvdc_property_cursor_find(const dsvdc_property_cursor_t *cursor,
+                               const char *name, size_t *index)
+{
+    Vdcapi__PropertyElement *element;
+    size_t i;
+
+    if (!cursor || !name)
+    {
+        return DSVDC_ERR_PARAM;
     }
-    prop->properties = NULL;
-    prop->n_properties = element->n_elements;
-    if (prop->n_properties > 0)
+
+    for (i = 0; i < cursor->n_elements; i++)
     {
-        prop->properties = dsvdc_property_deep_copy(element->elements,
-                                                   element->n_elements);
-        if (!prop->properties)
+        element = dsvdc_property_cursor_element(cursor, i);
+        if (element && element->name && (strcmp(element->name, name) == 0))
         {
-            free(prop);
-            return DSVDC_ERR_OUT_OF_MEMORY;
+            *index = i;
+            return DSVDC_OK;
         }
     }
+    return DSVDC_ERR_DATA_NOT_FOUND;
+}
 
-    *out = prop;
+int dsvdc_property_cursor_child_by_name(const dsvdc_property_cursor_t *cursor,
+                                        const char *name,
+                                        dsvdc_property_cursor_t *child)
+{
+    size_t index;
+    int ret = dsvdc_property_cursor_find(cursor, name, &index);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+    return dsvdc_property_cursor_child(cursor, index, child);
+}
+
+int dsvdc_property_cursor_name(const dsvdc_property_cursor_t *cursor,
+                               size_t index, const char **name, size_t *len)
+{
+    Vdcapi__PropertyElement *element;
+
+    *name = NULL;
+    *len = 0;
+
+    element = dsvdc_property_cursor_element(cursor, index);
+    if (!element)
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    if (element->name)
+    {
+        *name = element->name;
+        *len = strlen(element->name);
+    }
+    return DSVDC_OK;
+}
+
+int dsvdc_property_cursor_value_type(const dsvdc_property_cursor_t *cursor,
+                                     size_t index,
+                                     dsvdc_property_value_t *type)
+{
+    dsvdc_property_t view;
+
+    *type = DSVDC_PROPERTY_VALUE_NONE;
+    if (!dsvdc_property_cursor_element(cursor, index))
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    dsvdc_property_cursor_view(cursor, &view);
+    return dsvdc_property_get_value_type(&view, index, type);
+}
+
+int dsvdc_property_cursor_bool(const dsvdc_property_cursor_t *cursor,
+                               size_t index, bool *out)
+{
+    dsvdc_property_t view;
+
+    if (!dsvdc_property_cursor_element(cursor, index))
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    dsvdc_property_cursor_view(cursor, &view);
+    return dsvdc_property_get_bool(&view, index, out);
+}
+
+int dsvdc_property_cursor_uint(const dsvdc_property_cursor_t *cursor,
+                               size_t index, uint64_t *out)
+{
+    dsvdc_property_t view;
+
+    if (!dsvdc_property_cursor_element(cursor, index))
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
 
+    dsvdc_property_cursor_view(cursor, &view);
+    return dsvdc_property_get_uint(&view, index, out);
+}
+
+int dsvdc_property_cursor_int(const dsvdc_property_cursor_t *cursor,
+                              size_t index, int64_t *out)
+{
+    dsvdc_property_t view;
+
+    if (!dsvdc_property_cursor_element(cursor, index))
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    dsvdc_property_cursor_view(cursor, &view);
+    return dsvdc_property_get_int(&view, index, out);
+}
+
+int dsvdc_property_cursor_double(const dsvdc_property_cursor_t *cursor,
+                                 size_t index, double *out)
+{
+    dsvdc_property_t view;
+
+    if (!dsvdc_property_cursor_element(cursor, index))
+    {
+        return DSVDC_ERR_PROPERTY_INDEX;
+    }
+
+    dsvdc_property_cursor_view(cursor, &view);
+    return dsvdc_property_get_double(&view, index, out);
+}
+
+int dsvdc_property_cursor_string(const dsvdc_property_cursor_t *cursor,
+                                 size_t index, const char **out, size_t *len)
+{
+    dsvdc_property_value_t type;
+
+    *out = NULL;
+    *len = 0;
+
+    int ret = dsvdc_property_cursor_value_type(cursor, index, &type);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    if (type != DSVDC_PROPERTY_VALUE_STRING)
+    {
+        return DSVDC_ERR_PROPERTY_VALUE_TYPE;
+    }
+
+    Vdcapi__PropertyValue *val =
+                        dsvdc_property_cursor_element(cursor, index)->value;
+    *out = val->v_string;
+    *len = strlen(val->v_string);
+    return DSVDC_OK;
+}
+
+int dsvdc_property_cursor_bytes(const dsvdc_property_cursor_t *cursor,
+                                size_t index, const uint8_t **out,
+                                size_t *len)
+{
+    dsvdc_property_value_t type;
+
+    *out = NULL;
+    *len = 0;
+
+    int ret = dsvdc_property_cursor_value_type(cursor, index, &type);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    if (type != DSVDC_PROPERTY_VALUE_BYTES)
+    {
+        return DSVDC_ERR_PROPERTY_VALUE_TYPE;
+    }
+
+    Vdcapi__PropertyValue *val =
+                        dsvdc_property_cursor_element(cursor, index)->value;
+    *out = val->v_bytes.data;
+    *len = val->v_bytes.len;
     return DSVDC_OK;
 }
@@ -22,6 +22,7 @@
 #ifndef __DSVDC_PROPERTIES_H__
 #define __DSVDC_PROPERTIES_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "dsvdc.h"
@@ -34,16 +35,30 @@
 struct dsvdc_property
 {
     uint32_t message_id;
+    unsigned int session; /* the response goes back to this vdSM session */
     Vdcapi__PropertyElement **properties;
     size_t n_properties;
+    size_t capacity; /* allocated slots in properties */
+
+    /* elements, names, values and element arrays of the whole tree are
+     * carved from the arena instead of the heap when it is set, see
+     * dsvdc_property_new_arena() */
+    struct dsvdc_arena *arena;
+    bool owns_arena; /* false for nested properties */
 };
 
-int dsvdc_property_convert_query(Vdcapi__PropertyElement **query,
-                                 size_t n_query, dsvdc_property_t **property);
+/* Read-only property that borrows the elements, usually from an unpacked
+ * message, for the duration of a callback. It is never freed, see
+ * dsvdc_property_clone(). */
+void dsvdc_property_view(dsvdc_property_t *view,
+                         Vdcapi__PropertyElement **elements,
+                         size_t n_elements);
+
+/* appends copies of the elements, they stay untouched on failure */
+int dsvdc_property_append_copy(dsvdc_property_t *property,
+                               Vdcapi__PropertyElement **elements,
+                               size_t n_elements);
 
-Vdcapi__PropertyElement **dsvdc_property_deep_copy(
-                                    Vdcapi__PropertyElement **input,
-                                    size_t n_input);
 #if __GNUC__ >= 4
     #pragma GCC visibility pop
 #endif
@@ -0,0 +1,189 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsvdc.h"
+#include "arena.h"
+#include "properties.h"
+#include "query.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* the answer only holds the element structures and pointer arrays of
+ * partially selected subtrees */
+#define QUERY_ARENA_BLOCK   1024
+
+bool dsvdc_query_is_wildcard(const Vdcapi__PropertyElement *query)
+{
+    return !query->name || (query->name[0] == '\0');
+}
+
+Vdcapi__PropertyElement *dsvdc_query_find(Vdcapi__PropertyElement **elements,
+                                          size_t n_elements, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < n_elements; i++)
+    {
+        if (elements[i]->name && (strcmp(elements[i]->name, name) == 0))
+        {
+            return elements[i];
+        }
+    }
+    return NULL;
+}
+
+/* Without a subquery the element itself is the answer, otherwise only the
+ * scaffolding is built and name and value are borrowed. */
+Vdcapi__PropertyElement *dsvdc_query_answer(dsvdc_arena_t *arena,
+                                            Vdcapi__PropertyElement *element,
+                                            Vdcapi__PropertyElement *query)
+{
+    Vdcapi__PropertyElement *answer;
+
+    if (query->n_elements == 0)
+    {
+        return element;
+    }
+
+    answer = dsvdc_arena_alloc(arena, sizeof(Vdcapi__PropertyElement));
+    if (!answer)
+    {
+        return NULL;
+    }
+
+    vdcapi__property_element__init(answer);
+    answer->name = element->name;
+    answer->value = element->value;
+    if (dsvdc_query_select(arena, query->elements, query->n_elements,
+                           element->elements, element->n_elements,
+                           &answer->elements, &answer->n_elements) != DSVDC_OK)
+    {
+        return NULL;
+    }
+    return answer;
+}
+
+int dsvdc_query_select(dsvdc_arena_t *arena,
+                       Vdcapi__PropertyElement **query, size_t n_query,
+                       Vdcapi__PropertyElement **elements, size_t n_elements,
+                       Vdcapi__PropertyElement ***out, size_t *n_out)
+{
+    size_t i;
+    size_t j;
+    size_t size = 0;
+    Vdcapi__PropertyElement *element;
+
+    *out = NULL;
+    *n_out = 0;
+
+    /* sized once, a wildcard yields the whole level, a name at most one */
+    for (i = 0; i < n_query; i++)
+    {
+        size += dsvdc_query_is_wildcard(query[i]) ? n_elements : 1;
+    }
+
+    if (size == 0)
+    {
+        return DSVDC_OK;
+    }
+
+    *out = dsvdc_arena_alloc(arena, sizeof(Vdcapi__PropertyElement *) * size);
+    if (!*out)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < n_query; i++)
+    {
+        if (dsvdc_query_is_wildcard(query[i]))
+        {
+            for (j = 0; j < n_elements; j++)
+            {
+                element = dsvdc_query_answer(arena, elements[j], query[i]);
+                if (!element)
+                {
+                    return DSVDC_ERR_OUT_OF_MEMORY;
+                }
+                (*out)[(*n_out)++] = element;
+            }
+            continue;
+        }
+
+        element = dsvdc_query_find(elements, n_elements, query[i]->name);
+        if (element)
+        {
+            element = dsvdc_query_answer(arena, element, query[i]);
+            if (!element)
+            {
+                return DSVDC_ERR_OUT_OF_MEMORY;
+            }
+            (*out)[(*n_out)++] = element;
+        }
+    }
+    return DSVDC_OK;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+/* public interface */
+
+int dsvdc_property_query(const dsvdc_property_t *source,
+                         const dsvdc_property_t *query,
+                         dsvdc_property_t *response)
+{
+    Vdcapi__PropertyElement **answer;
+    size_t n_answer;
+    dsvdc_arena_t arena;
+    int ret;
+
+    if (!source || !query || !response)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    dsvdc_arena_init(&arena, QUERY_ARENA_BLOCK);
+    ret = dsvdc_query_select(&arena, query->properties, query->n_properties,
+                             source->properties, source->n_properties,
+                             &answer, &n_answer);
+    if (ret == DSVDC_OK)
+    {
+        /* the only copy, of what was selected */
+        ret = dsvdc_property_append_copy(response, answer, n_answer);
+    }
+    else
+    {
+        log("could not allocate memory for the query answer\n");
+    }
+    dsvdc_arena_cleanup(&arena);
+    return ret;
+}
@@ -0,0 +1,63 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_QUERY_H__
+#define __DSVDC_QUERY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "messages.pb-c.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* An element without a name selects every element of its level. */
+bool dsvdc_query_is_wildcard(const Vdcapi__PropertyElement *query);
+
+/* first element of the level with the name, NULL if there is none */
+Vdcapi__PropertyElement *dsvdc_query_find(Vdcapi__PropertyElement **elements,
+                                          size_t n_elements, const char *name);
+
+/* Answer of a query element for a matching element of the source, see
+ * dsvdc_query_select(). */
+Vdcapi__PropertyElement *dsvdc_query_answer(dsvdc_arena_t *arena,
+                                            Vdcapi__PropertyElement *element,
+                                            Vdcapi__PropertyElement *query);
+
+/* Matches one level of a query against one level of a source tree and
+ * recurses into the subqueries, names that the source does not have are left
+ * out. The answer borrows names, values and whole subtrees from the source,
+ * only the element structures and arrays of partially selected subtrees are
+ * allocated from the arena. It is valid as long as the source and the arena
+ * are. */
+int dsvdc_query_select(dsvdc_arena_t *arena,
+                       Vdcapi__PropertyElement **query, size_t n_query,
+                       Vdcapi__PropertyElement **elements, size_t n_elements,
+                       Vdcapi__PropertyElement ***out, size_t *n_out);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_QUERY_H__*/
@@ -0,0 +1,895 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "announce.h"
+#include "propcache.h"
+#include "registry.h"
+#include "session.h"
+#include "log.h"
+#include "util.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+#define REGISTRY_MIN_SLOTS  64
+
+void dsvdc_registry_init(dsvdc_registry_t *registry)
+{
+    registry->containers = NULL;
+    registry->n_containers = 0;
+    registry->n_devices = 0;
+    registry->slots = NULL;
+    registry->mask = 0;
+    registry->count = 0;
+    registry->n_handlers = 0;
+    registry->n_caches = 0;
+    registry->window = DEFAULT_ANNOUNCE_WINDOW;
+}
+
+static void dsvdc_device_free(dsvdc_device_t *device)
+{
+    dsvdc_propcache_release(device->properties);
+    free(device);
+}
+
+void dsvdc_registry_cleanup(dsvdc_registry_t *registry)
+{
+    dsvdc_device_t *container;
+    dsvdc_device_t *device;
+    dsvdc_device_t *tmp;
+    dsvdc_device_t *tmp2;
+
+    DL_FOREACH_SAFE(registry->containers, container, tmp)
+    {
+        DL_FOREACH_SAFE(container->devices, device, tmp2)
+        {
+            dsvdc_device_free(device);
+        }
+        dsvdc_device_free(container);
+    }
+    free(registry->slots);
+
+    unsigned int window = registry->window;
+    dsvdc_registry_init(registry);
+    registry->window = window;
+}
+
+static dsvdc_device_t *dsvdc_registry_find(dsvdc_registry_t *registry,
+                                           const dsvdc_dsuid_t *id)
+{
+    size_t i;
+
+    if (registry->count == 0)
+    {
+        return NULL;
+    }
+
+    i = dsvdc_dsuid_hash(id) & registry->mask;
+    while (registry->slots[i])
+    {
+        if (dsvdc_dsuid_equal(&registry->slots[i]->id, id))
+        {
+            return registry->slots[i];
+        }
+        i = (i + 1) & registry->mask;
+    }
+    return NULL;
+}
+
+/* NULL for strings that are not a valid dSUID */
+static dsvdc_device_t *dsvdc_registry_lookup(dsvdc_registry_t *registry,
+                                             const char *dsuid)
+{
+    dsvdc_dsuid_t id;
+
+    if (dsvdc_dsuid_parse(dsuid, &id) != DSVDC_OK)
+    {
+        return NULL;
+    }
+    return dsvdc_registry_find(registry, &id);
+}
+
+static void dsvdc_registry_put(dsvdc_registry_t *registry,
+                               dsvdc_device_t *device)
+{
+    size_t i = dsvdc_dsuid_hash(&device->id) & registry->mask;
+
+    while (registry->slots[i])
+    {
+        i = (i + 1) & registry->mask;
+    }
+    registry->slots[i] = device;
+}
+
+static int dsvdc_registry_index(dsvdc_registry_t *registry,
+                                dsvdc_device_t *device)
+{
+    if (!registry->slots || ((registry->count + 1) * 2 > registry->mask + 1))
+    {
+        size_t size = registry->slots ? (registry->mask + 1) * 2 :
+                                        REGISTRY_MIN_SLOTS;
+        dsvdc_device_t **old = registry->slots;
+        size_t old_size = old ? registry->mask + 1 : 0;
+        size_t i;
+
+        registry->slots = calloc(size, sizeof(dsvdc_device_t *));
+        if (!registry->slots)
+        {
+            log("could not grow device registry to %zu slots\n", size);
+            registry->slots = old;
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+
+        registry->mask = size - 1;
+        for (i = 0; i < old_size; i++)
+        {
+            if (old[i])
+            {
+                dsvdc_registry_put(registry, old[i]);
+            }
+        }
+        free(old);
+    }
+
+    dsvdc_registry_put(registry, device);
+    registry->count++;
+    return DSVDC_OK;
+}
+
+/* backward shift, see dsvdc_reqmap_erase() */
+static void dsvdc_registry_unindex(dsvdc_registry_t *registry,
+                                   dsvdc_device_t *device)
+{
+    size_t i = dsvdc_dsuid_hash(&device->id) & registry->mask;
+    size_t j;
+
+    while (registry->slots[i] != device)
+    {
+        i = (i + 1) & registry->mask;
+    }
+
+    registry->slots[i] = NULL;
+    registry->count--;
+    if (device->handlers)
+    {
+        __atomic_sub_fetch(&registry->n_handlers, 1, __ATOMIC_RELAXED);
+    }
+    if (device->properties)
+    {
+        __atomic_sub_fetch(&registry->n_caches, 1, __ATOMIC_RELAXED);
+    }
+
+    for (j = i;;)
+    {
+        j = (j + 1) & registry->mask;
+        if (!registry->slots[j])
+        {
+            return;
+        }
+
+        size_t home = dsvdc_dsuid_hash(&registry->slots[j]->id) &
+                      registry->mask;
+        if (((j - home) & registry->mask) >= ((j - i) & registry->mask))
+        {
+            registry->slots[i] = registry->slots[j];
+            registry->slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static dsvdc_device_t *dsvdc_device_new(const dsvdc_dsuid_t *id,
+                                        dsvdc_device_t *container)
+{
+    dsvdc_device_t *device = malloc(sizeof(dsvdc_device_t) + DSUID_LENGTH + 1);
+    if (!device)
+    {
+        return NULL;
+    }
+
+    device->prev = NULL;
+    device->next = NULL;
+    device->container = container;
+    device->devices = NULL;
+    device->n_devices = 0;
+    device->status = DSVDC_ANNOUNCE_PENDING;
+    device->handlers = NULL;
+    device->context = NULL;
+    device->properties = NULL;
+    device->id = *id;
+    dsvdc_dsuid_format(id, device->dsuid);
+    return device;
+}
+
+/* one container and the devices that are announced after it */
+typedef struct dsvdc_announce_group
+{
+    struct dsvdc_announce_round *round;
+    const char *container;
+    const char **dsuids;
+    size_t n;
+} dsvdc_announce_group_t;
+
+/* A snapshot of (a part of) the registry that is being announced, freed
+ * when every entry was reported. Entries that are unregistered meanwhile are
+ * still announced, their status is dropped. */
+typedef struct dsvdc_announce_round
+{
+    dsvdc_t *handle;
+    unsigned int session_id;
+    uint64_t start;
+    /* the whole registry after a session start, measured */
+    bool full;
+    bool failed;
+    /* containers are announced first, their devices once they were
+     * accepted, otherwise only the devices are announced */
+    bool with_containers;
+    /* entries that were not reported yet, plus one while a thread still
+     * starts announcements */
+    size_t pending;
+    const char **containers;
+    dsvdc_announce_group_t *groups;
+    size_t n_groups;
+} dsvdc_announce_round_t;
+
+static void dsvdc_registry_set_status(dsvdc_t *handle, const char *dsuid,
+                                      dsvdc_announce_status_t status)
+{
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    dsvdc_device_t *device = dsvdc_registry_lookup(&handle->registry, dsuid);
+    if (device)
+    {
+        device->status = status;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+static void dsvdc_round_put(dsvdc_announce_round_t *round, size_t entries,
+                            bool failed)
+{
+    dsvdc_t *handle = round->handle;
+    bool done;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    round->pending -= entries;
+    round->failed |= failed;
+    done = (round->pending == 0);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (!done)
+    {
+        return;
+    }
+
+    if (round->full && !round->failed)
+    {
+        uint64_t duration = monotonic_ms() - round->start;
+        log("session %u fully announced after %llu ms\n", round->session_id,
+            (unsigned long long)duration);
+        __atomic_store_n(&handle->stats.announce_time_ms, duration,
+                         __ATOMIC_RELAXED);
+        __atomic_add_fetch(&handle->stats.announce_rounds, 1,
+                           __ATOMIC_RELAXED);
+    }
+    free(round);
+}
+
+static void dsvdc_round_device_done(dsvdc_t *handle, size_t index, int code,
+                                    void *arg, void *userdata)
+{
+    dsvdc_announce_group_t *group = (dsvdc_announce_group_t *)arg;
+    (void)userdata;
+
+    dsvdc_registry_set_status(handle, group->dsuids[index],
+                              (code == DSVDC_OK) ? DSVDC_ANNOUNCE_DONE :
+                                                   DSVDC_ANNOUNCE_FAILED);
+    dsvdc_round_put(group->round, 1, code != DSVDC_OK);
+}
+
+static void dsvdc_round_fail_devices(dsvdc_announce_group_t *group)
+{
+    size_t i;
+
+    for (i = 0; i < group->n; i++)
+    {
+        dsvdc_registry_set_status(group->round->handle, group->dsuids[i],
+                                  DSVDC_ANNOUNCE_FAILED);
+    }
+    dsvdc_round_put(group->round, group->n, true);
+}
+
+static void dsvdc_round_start_devices(dsvdc_announce_group_t *group)
+{
+    dsvdc_announce_round_t *round = group->round;
+    dsvdc_t *handle = round->handle;
+
+    if (group->n == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    unsigned int window = handle->registry.window;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (dsvdc_bulk_announce(handle, round->session_id, group->container,
+                            group->dsuids, group->n, window, group,
+                            dsvdc_round_device_done) != DSVDC_OK)
+    {
+        dsvdc_round_fail_devices(group);
+    }
+}
+
+static void dsvdc_round_container_done(dsvdc_t *handle, size_t index,
+                                       int code, void *arg, void *userdata)
+{
+    dsvdc_announce_round_t *round = (dsvdc_announce_round_t *)arg;
+    dsvdc_announce_group_t *group = &round->groups[index];
+    (void)userdata;
+
+    dsvdc_registry_set_status(handle, group->container,
+                              (code == DSVDC_OK) ? DSVDC_ANNOUNCE_DONE :
+                                                   DSVDC_ANNOUNCE_FAILED);
+
+    /* the vdSM does not take devices of a container it does not know */
+    if (code == DSVDC_OK)
+    {
+        dsvdc_round_start_devices(group);
+    }
+    else
+    {
+        dsvdc_round_fail_devices(group);
+    }
+    dsvdc_round_put(round, 1, code != DSVDC_OK);
+}
+
+/* Copy the containers and devices into a round, with_containers selects if
+ * the containers are announced too. only selects a single entry, NULL for
+ * all of them. Must be called with the handle mutex. */
+static dsvdc_announce_round_t *dsvdc_round_new(dsvdc_t *handle,
+                                               unsigned int session_id,
+                                               dsvdc_device_t *only)
+{
+    dsvdc_registry_t *registry = &handle->registry;
+    dsvdc_announce_round_t *round;
+    dsvdc_device_t *container;
+    dsvdc_device_t *device;
+    size_t n_groups = 0;
+    size_t n_devices = 0;
+    size_t strings = 0;
+
+    DL_FOREACH(registry->containers, container)
+    {
+        if (only && (only != container) && (only->container != container))
+        {
+            continue;
+        }
+
+        n_groups++;
+        strings += strlen(container->dsuid) + 1;
+        DL_FOREACH(container->devices, device)
+        {
+            if (!only || (only == device))
+            {
+                n_devices++;
+                strings += strlen(device->dsuid) + 1;
+            }
+        }
+    }
+
+    /* round, groups, container and device pointers and the dSUIDs in one
+     * block */
+    size_t size = sizeof(dsvdc_announce_round_t) +
+                  n_groups * sizeof(dsvdc_announce_group_t) +
+                  (n_groups + n_devices) * sizeof(const char *) + strings;
+    round = malloc(size);
+    if (!round)
+    {
+        log("could not allocate announcement of %zu devices\n", n_devices);
+        return NULL;
+    }
+
+    round->handle = handle;
+    round->session_id = session_id;
+    round->start = monotonic_ms();
+    round->full = (only == NULL);
+    round->failed = false;
+    round->with_containers = !only || !only->container;
+    round->groups = (dsvdc_announce_group_t *)(round + 1);
+    round->containers = (const char **)(round->groups + n_groups);
+    round->n_groups = n_groups;
+    /* the starting thread holds one */
+    round->pending = 1 + n_devices + (round->with_containers ? n_groups : 0);
+
+    const char **dsuids = round->containers + n_groups;
+    char *s = (char *)(dsuids + n_devices);
+    dsvdc_announce_group_t *group = round->groups;
+
+    DL_FOREACH(registry->containers, container)
+    {
+        if (only && (only != container) && (only->container != container))
+        {
+            continue;
+        }
+
+        group->round = round;
+        group->container = s;
+        group->dsuids = dsuids;
+        group->n = 0;
+        round->containers[group - round->groups] = s;
+        strcpy(s, container->dsuid);
+        s += strlen(s) + 1;
+        if (round->with_containers)
+        {
+            container->status = DSVDC_ANNOUNCE_SENT;
+        }
+
+        DL_FOREACH(container->devices, device)
+        {
+            if (only && (only != device))
+            {
+                continue;
+            }
+            group->dsuids[group->n++] = s;
+            strcpy(s, device->dsuid);
+            s += strlen(s) + 1;
+            device->status = DSVDC_ANNOUNCE_SENT;
+        }
+        dsuids += group->n;
+        group++;
+    }
+    return round;
+}
+
+static void dsvdc_round_start(dsvdc_announce_round_t *round)
+{
+    dsvdc_t *handle = round->handle;
+    size_t i;
+
+    if (round->with_containers && (round->n_groups > 0))
+    {
+        pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+        unsigned int window = handle->registry.window;
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+        if (dsvdc_bulk_announce(handle, round->session_id, NULL,
+                                round->containers, round->n_groups, window,
+                                round, dsvdc_round_container_done) !=
+            DSVDC_OK)
+        {
+            for (i = 0; i < round->n_groups; i++)
+            {
+                dsvdc_round_container_done(handle, i,
+                                           DSVDC_ERR_OUT_OF_MEMORY, round,
+                                           NULL);
+            }
+        }
+    }
+    else
+    {
+        for (i = 0; i < round->n_groups; i++)
+        {
+            dsvdc_round_start_devices(&round->groups[i]);
+        }
+    }
+    dsvdc_round_put(round, 1, false);
+}
+
+void dsvdc_registry_announce(dsvdc_t *handle, unsigned int session_id)
+{
+    dsvdc_announce_round_t *round = NULL;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (handle->registry.n_containers > 0)
+    {
+        round = dsvdc_round_new(handle, session_id, NULL);
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (round)
+    {
+        log("announcing %zu registered containers to session %u\n",
+            round->n_groups, session_id);
+        dsvdc_round_start(round);
+    }
+}
+
+/* entries that are registered while a vdSM is connected are announced to
+ * all sessions right away */
+static void dsvdc_registry_announce_entry(dsvdc_t *handle,
+                                          dsvdc_device_t *entry)
+{
+    dsvdc_announce_round_t *round = NULL;
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    if (dsvdc_session_any_established(handle))
+    {
+        round = dsvdc_round_new(handle, ALL_SESSIONS, entry);
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (round)
+    {
+        dsvdc_round_start(round);
+    }
+}
+
+dsvdc_target_t *dsvdc_registry_targets(dsvdc_t *handle, char **dsuid,
+                                       size_t n_dsuid, dsvdc_target_t *stack,
+                                       size_t size, size_t *n_targets)
+{
+    dsvdc_registry_t *registry = &handle->registry;
+    dsvdc_target_t *targets = stack;
+    dsvdc_dsuid_t id;
+    size_t i;
+
+    *n_targets = 0;
+    if (__atomic_load_n(&registry->n_handlers, __ATOMIC_RELAXED) == 0)
+    {
+        return NULL;
+    }
+
+    if (n_dsuid > size)
+    {
+        targets = malloc(n_dsuid * sizeof(dsvdc_target_t));
+        if (!targets)
+        {
+            log("could not allocate %zu notification targets\n", n_dsuid);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    for (i = 0; i < n_dsuid; i++)
+    {
+        if (!dsuid[i] || (dsvdc_dsuid_parse(dsuid[i], &id) != DSVDC_OK))
+        {
+            continue;
+        }
+
+        dsvdc_device_t *device = dsvdc_registry_find(registry, &id);
+        if (device && device->handlers)
+        {
+            targets[*n_targets].handlers = device->handlers;
+            targets[*n_targets].context = device->context;
+            targets[*n_targets].id = id;
+            (*n_targets)++;
+        }
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (*n_targets == 0)
+    {
+        if (targets != stack)
+        {
+            free(targets);
+        }
+        return NULL;
+    }
+    return targets;
+}
+
+struct dsvdc_propcache *dsvdc_registry_properties(dsvdc_t *handle,
+                                                  const char *dsuid)
+{
+    dsvdc_device_t *device;
+    dsvdc_propcache_t *cache = NULL;
+
+    if (__atomic_load_n(&handle->registry.n_caches, __ATOMIC_RELAXED) == 0)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    device = dsvdc_registry_lookup(&handle->registry, dsuid);
+    if (device && device->properties)
+    {
+        cache = device->properties;
+        __atomic_add_fetch(&cache->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return cache;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+/* public interface */
+int dsvdc_register_container(dsvdc_t *handle, const char *dsuid)
+{
+    dsvdc_device_t *container;
+    dsvdc_dsuid_t id;
+
+    if (!handle || (dsvdc_dsuid_parse(dsuid, &id) != DSVDC_OK))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    container = dsvdc_registry_find(&handle->registry, &id);
+    if (container)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return container->container ? DSVDC_ERR_PARAM : DSVDC_OK;
+    }
+
+    container = dsvdc_device_new(&id, NULL);
+    if (!container ||
+        (dsvdc_registry_index(&handle->registry, container) != DSVDC_OK))
+    {
+        free(container);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    DL_APPEND(handle->registry.containers, container);
+    handle->registry.n_containers++;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    dsvdc_registry_announce_entry(handle, container);
+    return DSVDC_OK;
+}
+
+int dsvdc_register_device(dsvdc_t *handle, const char *container_dsuid,
+                          const char *dsuid)
+{
+    dsvdc_device_t *container;
+    dsvdc_device_t *device;
+    dsvdc_dsuid_t id;
+
+    if (!handle || !container_dsuid ||
+        (dsvdc_dsuid_parse(dsuid, &id) != DSVDC_OK))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    container = dsvdc_registry_lookup(&handle->registry, container_dsuid);
+    if (!container || container->container)
+    {
+        log("container %s of device %s is not registered\n",
+            container_dsuid, dsuid);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_PARAM;
+    }
+
+    device = dsvdc_registry_find(&handle->registry, &id);
+    if (device)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return (device->container == container) ? DSVDC_OK : DSVDC_ERR_PARAM;
+    }
+
+    device = dsvdc_device_new(&id, container);
+    if (!device ||
+        (dsvdc_registry_index(&handle->registry, device) != DSVDC_OK))
+    {
+        free(device);
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    DL_APPEND(container->devices, device);
+    container->n_devices++;
+    handle->registry.n_devices++;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    dsvdc_registry_announce_entry(handle, device);
+    return DSVDC_OK;
+}
+
+int dsvdc_unregister(dsvdc_t *handle, const char *dsuid)
+{
+    dsvdc_registry_t *registry;
+    dsvdc_device_t *entry;
+    dsvdc_device_t *device;
+    dsvdc_device_t *tmp;
+
+    if (!handle || !dsuid)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    registry = &handle->registry;
+    entry = dsvdc_registry_lookup(registry, dsuid);
+    if (!entry)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        return DSVDC_ERR_DATA_NOT_FOUND;
+    }
+
+    if (entry->container)
+    {
+        DL_DELETE(entry->container->devices, entry);
+        entry->container->n_devices--;
+        registry->n_devices--;
+    }
+    else
+    {
+        DL_FOREACH_SAFE(entry->devices, device, tmp)
+        {
+            dsvdc_registry_unindex(registry, device);
+            dsvdc_device_free(device);
+        }
+        registry->n_devices -= entry->n_devices;
+        DL_DELETE(registry->containers, entry);
+        registry->n_containers--;
+    }
+
+    dsvdc_registry_unindex(registry, entry);
+    dsvdc_device_free(entry);
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
+}
+
+int dsvdc_get_announce_status(dsvdc_t *handle, const char *dsuid,
+                              dsvdc_announce_status_t *status)
+{
+    dsvdc_device_t *entry;
+
+    if (!handle || !dsuid || !status)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    entry = dsvdc_registry_lookup(&handle->registry, dsuid);
+    if (entry)
+    {
+        *status = entry->status;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return entry ? DSVDC_OK : DSVDC_ERR_DATA_NOT_FOUND;
+}
+
+int dsvdc_set_announce_window(dsvdc_t *handle, unsigned int window)
+{
+    if (!handle || (window == 0))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    handle->registry.window = window;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return DSVDC_OK;
+}
+
+int dsvdc_set_device_handlers(dsvdc_t *handle, const char *dsuid,
+                              const dsvdc_device_handlers_t *handlers,
+                              void *context)
+{
+    dsvdc_device_t *device;
+    int ret = DSVDC_OK;
+
+    if (!handle || !dsuid)
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    device = dsvdc_registry_lookup(&handle->registry, dsuid);
+    if (!device)
+    {
+        ret = DSVDC_ERR_DATA_NOT_FOUND;
+    }
+    else if (!device->container)
+    {
+        ret = DSVDC_ERR_PARAM;
+    }
+    else
+    {
+        if (!device->handlers && handlers)
+        {
+            __atomic_add_fetch(&handle->registry.n_handlers, 1,
+                               __ATOMIC_RELAXED);
+        }
+        else if (device->handlers && !handlers)
+        {
+            __atomic_sub_fetch(&handle->registry.n_handlers, 1,
+                               __ATOMIC_RELAXED);
+        }
+        device->handlers = handlers;
+        device->context = handlers ? context : NULL;
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+    return ret;
+}
+
+int dsvdc_set_property_cache(dsvdc_t *handle, const char *dsuid,
+                             dsvdc_property_t **properties,
+                             const dsvdc_property_provider_t *providers,
+                             size_t n_providers)
+{
+    dsvdc_device_t *device;
+    dsvdc_propcache_t *cache = NULL;
+    dsvdc_propcache_t *old;
+    size_t i;
+
+    if (!handle || !dsuid || ((n_providers > 0) && !providers))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    for (i = 0; i < n_providers; i++)
+    {
+        if (!providers[i].name)
+        {
+            return DSVDC_ERR_PARAM;
+        }
+    }
+
+    if ((properties && *properties) || (n_providers > 0))
+    {
+        cache = dsvdc_propcache_new(properties ? *properties : NULL,
+                                    providers, n_providers);
+        if (!cache)
+        {
+            return DSVDC_ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    device = dsvdc_registry_lookup(&handle->registry, dsuid);
+    if (!device)
+    {
+        pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+        if (cache)
+        {
+            /* the caller keeps the tree */
+            cache->properties = NULL;
+            dsvdc_propcache_release(cache);
+        }
+        return DSVDC_ERR_DATA_NOT_FOUND;
+    }
+
+    if (!device->properties && cache)
+    {
+        __atomic_add_fetch(&handle->registry.n_caches, 1, __ATOMIC_RELAXED);
+    }
+    else if (device->properties && !cache)
+    {
+        __atomic_sub_fetch(&handle->registry.n_caches, 1, __ATOMIC_RELAXED);
+    }
+    old = device->properties;
+    device->properties = cache;
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    /* answers that are being sent keep the old tree until they are done */
+    dsvdc_propcache_release(old);
+    if (properties)
+    {
+        *properties = NULL;
+    }
+    return DSVDC_OK;
+}
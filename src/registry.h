@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_REGISTRY_H__
+#define __DSVDC_REGISTRY_H__
+
+#include <stddef.h>
+
+#include "dsvdc.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* a registered container or device */
+typedef struct dsvdc_device
+{
+    /* containers in registration order, or the devices of a container */
+    struct dsvdc_device *prev;
+    struct dsvdc_device *next;
+    /* NULL for containers */
+    struct dsvdc_device *container;
+    struct dsvdc_device *devices;
+    size_t n_devices;
+    dsvdc_announce_status_t status;
+    /* per device dispatch, see dsvdc_set_device_handlers() */
+    const dsvdc_device_handlers_t *handlers;
+    void *context;
+    /* answers get property requests, see dsvdc_set_property_cache() */
+    struct dsvdc_propcache *properties;
+    dsvdc_dsuid_t id;
+    /* id formatted for the announcements */
+    char dsuid[];
+} dsvdc_device_t;
+
+/* Containers and devices that the library announces on its own whenever a
+ * vdSM session starts, protected by the handle mutex. The entries are also
+ * indexed by binary dSUID in an open addressing hash like the request
+ * map. */
+typedef struct dsvdc_registry
+{
+    dsvdc_device_t *containers;
+    size_t n_containers;
+    size_t n_devices;
+
+    dsvdc_device_t **slots;
+    size_t mask;
+    size_t count;
+    /* devices with handlers, read without the lock to skip the lookup */
+    size_t n_handlers;
+    /* entries with a property cache, read without the lock as well */
+    size_t n_caches;
+
+    /* announcements that may wait for their responses at the same time */
+    unsigned int window;
+} dsvdc_registry_t;
+
+/* a device a notification is dispatched to */
+typedef struct dsvdc_target
+{
+    const dsvdc_device_handlers_t *handlers;
+    void *context;
+    dsvdc_dsuid_t id;
+} dsvdc_target_t;
+
+void dsvdc_registry_init(dsvdc_registry_t *registry);
+void dsvdc_registry_cleanup(dsvdc_registry_t *registry);
+
+/* Announce all registered containers and their devices to the session that
+ * just completed the handshake. Must be called without the handle mutex. */
+void dsvdc_registry_announce(dsvdc_t *handle, unsigned int session_id);
+
+/* Looks up the devices with handlers among the dSUIDs of a notification.
+ * Returns stack if size is enough, an allocated array that the caller has
+ * to free otherwise, NULL if there is no such device. */
+dsvdc_target_t *dsvdc_registry_targets(dsvdc_t *handle, char **dsuid,
+                                       size_t n_dsuid, dsvdc_target_t *stack,
+                                       size_t size, size_t *n_targets);
+
+/* Property cache of a container or device with a reference for the caller,
+ * NULL if there is none. */
+struct dsvdc_propcache *dsvdc_registry_properties(dsvdc_t *handle,
+                                                  const char *dsuid);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_REGISTRY_H__*/
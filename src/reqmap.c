@@ -0,0 +1,181 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "reqmap.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+#define REQMAP_MIN_SLOTS    16
+
+/* message ids are sequential, multiplying spreads them over the table */
+static inline size_t dsvdc_reqmap_hash(uint32_t id)
+{
+    return (size_t)(id * 2654435761u);
+}
+
+void dsvdc_reqmap_init(dsvdc_reqmap_t *map)
+{
+    map->slots = NULL;
+    map->mask = 0;
+    map->count = 0;
+}
+
+void dsvdc_reqmap_free(dsvdc_reqmap_t *map)
+{
+    free(map->slots);
+    dsvdc_reqmap_init(map);
+}
+
+static void dsvdc_reqmap_put(dsvdc_reqmap_t *map, cached_request_t *request)
+{
+    size_t i = dsvdc_reqmap_hash(request->message_id) & map->mask;
+
+    while (map->slots[i])
+    {
+        i = (i + 1) & map->mask;
+    }
+    map->slots[i] = request;
+}
+
+static int dsvdc_reqmap_grow(dsvdc_reqmap_t *map)
+{
+    size_t size = map->slots ? (map->mask + 1) * 2 : REQMAP_MIN_SLOTS;
+    cached_request_t **old = map->slots;
+    size_t old_size = old ? map->mask + 1 : 0;
+    size_t i;
+
+    map->slots = calloc(size, sizeof(cached_request_t *));
+    if (!map->slots)
+    {
+        log("could not grow request table to %zu slots\n", size);
+        map->slots = old;
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    map->mask = size - 1;
+    for (i = 0; i < old_size; i++)
+    {
+        if (old[i])
+        {
+            dsvdc_reqmap_put(map, old[i]);
+        }
+    }
+    free(old);
+    return DSVDC_OK;
+}
+
+int dsvdc_reqmap_insert(dsvdc_reqmap_t *map, cached_request_t *request)
+{
+    if ((!map->slots || ((map->count + 1) * 2 > map->mask + 1)) &&
+        (dsvdc_reqmap_grow(map) != DSVDC_OK))
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    dsvdc_reqmap_put(map, request);
+    map->count++;
+    return DSVDC_OK;
+}
+
+/* empty the slot and move entries of the same probe sequence into the gap */
+static void dsvdc_reqmap_erase(dsvdc_reqmap_t *map, size_t i)
+{
+    size_t j = i;
+
+    map->slots[i] = NULL;
+    map->count--;
+
+    for (;;)
+    {
+        j = (j + 1) & map->mask;
+        if (!map->slots[j])
+        {
+            return;
+        }
+
+        /* the entry may move if its home is not between the gap and it */
+        size_t home = dsvdc_reqmap_hash(map->slots[j]->message_id) &
+                      map->mask;
+        if (((j - home) & map->mask) >= ((j - i) & map->mask))
+        {
+            map->slots[i] = map->slots[j];
+            map->slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+cached_request_t *dsvdc_reqmap_take(dsvdc_reqmap_t *map, uint32_t id)
+{
+    size_t i;
+
+    if (map->count == 0)
+    {
+        return NULL;
+    }
+
+    i = dsvdc_reqmap_hash(id) & map->mask;
+    while (map->slots[i])
+    {
+        cached_request_t *request = map->slots[i];
+        if (request->message_id == id)
+        {
+            dsvdc_reqmap_erase(map, i);
+            return request;
+        }
+        i = (i + 1) & map->mask;
+    }
+    return NULL;
+}
+
+void dsvdc_reqmap_clear(dsvdc_reqmap_t *map,
+                        void (*function)(cached_request_t *request,
+                                         void *arg),
+                        void *arg)
+{
+    cached_request_t **slots = map->slots;
+    size_t size = slots ? map->mask + 1 : 0;
+    size_t i;
+
+    dsvdc_reqmap_init(map);
+    for (i = 0; i < size; i++)
+    {
+        if (slots[i])
+        {
+            function(slots[i], arg);
+        }
+    }
+    free(slots);
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,63 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_REQMAP_H__
+#define __DSVDC_REQMAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+struct cached_request;
+
+/* Open addressing hash of the requests of a session by message id, linear
+ * probing, removal shifts the following entries back so there are no
+ * tombstones. The table doubles when it gets half full. */
+typedef struct dsvdc_reqmap
+{
+    struct cached_request **slots;
+    size_t mask;
+    size_t count;
+} dsvdc_reqmap_t;
+
+void dsvdc_reqmap_init(dsvdc_reqmap_t *map);
+void dsvdc_reqmap_free(dsvdc_reqmap_t *map);
+
+int dsvdc_reqmap_insert(dsvdc_reqmap_t *map, struct cached_request *request);
+
+/* removes and returns the request with the given id, NULL if there is none */
+struct cached_request *dsvdc_reqmap_take(dsvdc_reqmap_t *map, uint32_t id);
+
+/* Empties the map and passes every request that was in it to function, the
+ * map may be used again by the function. */
+void dsvdc_reqmap_clear(dsvdc_reqmap_t *map,
+                        void (*function)(struct cached_request *request,
+                                         void *arg),
+                        void *arg);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_REQMAP_H__*/
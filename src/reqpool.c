@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "reqpool.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* free entries are not armed, their timer links the free list */
+int dsvdc_reqpool_init(dsvdc_reqpool_t *pool, size_t capacity)
+{
+    size_t i;
+
+    pool->entries = calloc(capacity, sizeof(cached_request_t));
+    if (!pool->entries)
+    {
+        log("could not allocate pool of %zu requests\n", capacity);
+        pool->free = NULL;
+        pool->capacity = 0;
+        pool->used = 0;
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    pool->free = NULL;
+    for (i = capacity; i > 0; i--)
+    {
+        pool->entries[i - 1].timer.next = (dsvdc_timer_t *)pool->free;
+        pool->free = &pool->entries[i - 1];
+    }
+    pool->capacity = capacity;
+    pool->used = 0;
+    return DSVDC_OK;
+}
+
+void dsvdc_reqpool_cleanup(dsvdc_reqpool_t *pool)
+{
+    free(pool->entries);
+    pool->entries = NULL;
+    pool->free = NULL;
+    pool->capacity = 0;
+    pool->used = 0;
+}
+
+cached_request_t *dsvdc_reqpool_reserve(dsvdc_reqpool_t *pool)
+{
+    cached_request_t *request = pool->free;
+
+    if (!request)
+    {
+        return NULL;
+    }
+
+    pool->free = (cached_request_t *)request->timer.next;
+    pool->used++;
+    request->timer.next = NULL;
+    request->timer.pprev = NULL;
+    return request;
+}
+
+void dsvdc_reqpool_release(dsvdc_reqpool_t *pool, cached_request_t *request)
+{
+    request->session = NULL;
+    request->callback = NULL;
+    request->arg = NULL;
+    request->timer.pprev = NULL;
+    request->timer.next = (dsvdc_timer_t *)pool->free;
+    pool->free = request;
+    pool->used--;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
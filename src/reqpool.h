@@ -0,0 +1,58 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_REQPOOL_H__
+#define __DSVDC_REQPOOL_H__
+
+#include <stddef.h>
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+struct cached_request;
+
+/* Fixed number of request entries that are allocated up front. A request is
+ * reserved before its message goes out and released once it was answered,
+ * timed out or failed, so sending never allocates and the number of
+ * requests in flight is bounded. Not thread safe, the handle mutex
+ * protects it. */
+typedef struct dsvdc_reqpool
+{
+    struct cached_request *entries;
+    struct cached_request *free;
+    size_t capacity;
+    size_t used;
+} dsvdc_reqpool_t;
+
+int dsvdc_reqpool_init(dsvdc_reqpool_t *pool, size_t capacity);
+void dsvdc_reqpool_cleanup(dsvdc_reqpool_t *pool);
+
+/* NULL if all entries are in use */
+struct cached_request *dsvdc_reqpool_reserve(dsvdc_reqpool_t *pool);
+void dsvdc_reqpool_release(dsvdc_reqpool_t *pool,
+                           struct cached_request *request);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_REQPOOL_H__*/
@@ -0,0 +1,216 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsvdc.h"
+#include "ringbuf.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+int dsvdc_ring_init(dsvdc_ring_t *ring, size_t size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->size = 0;
+    ring->data = NULL;
+
+    if ((size == 0) || (size & (size - 1)))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    ring->data = malloc(size);
+    if (!ring->data)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    ring->size = size;
+    return DSVDC_OK;
+}
+
+int dsvdc_ring_resize(dsvdc_ring_t *ring, size_t size)
+{
+    struct iovec iov[2];
+    size_t used = dsvdc_ring_used(ring);
+    size_t offset = 0;
+    int i;
+
+    if ((size & (size - 1)) || (size < used))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    unsigned char *data = malloc(size);
+    if (!data)
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    int n = dsvdc_ring_read_iov(ring, used, iov);
+    for (i = 0; i < n; i++)
+    {
+        memcpy(data + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+
+    free(ring->data);
+    ring->data = data;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = used;
+    return DSVDC_OK;
+}
+
+void dsvdc_ring_free(dsvdc_ring_t *ring)
+{
+    if (ring->data)
+    {
+        free(ring->data);
+        ring->data = NULL;
+    }
+    ring->size = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+void dsvdc_ring_reset(dsvdc_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/* split len bytes starting at the free running position pos into up to two
+ * contiguous regions */
+static int dsvdc_ring_iov(const dsvdc_ring_t *ring, size_t pos, size_t len,
+                          struct iovec iov[2])
+{
+    size_t start = pos & (ring->size - 1);
+    size_t first = ring->size - start;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    iov[0].iov_base = ring->data + start;
+    if (len <= first)
+    {
+        iov[0].iov_len = len;
+        return 1;
+    }
+
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+int dsvdc_ring_write_iov(dsvdc_ring_t *ring, struct iovec iov[2])
+{
+    return dsvdc_ring_iov(ring, ring->tail, dsvdc_ring_space(ring), iov);
+}
+
+void dsvdc_ring_commit(dsvdc_ring_t *ring, size_t len)
+{
+    ring->tail += len;
+}
+
+int dsvdc_ring_read_iov(const dsvdc_ring_t *ring, size_t len,
+                        struct iovec iov[2])
+{
+    return dsvdc_ring_read_iov_at(ring, 0, len, iov);
+}
+
+int dsvdc_ring_read_iov_at(const dsvdc_ring_t *ring, size_t offset,
+                           size_t len, struct iovec iov[2])
+{
+    size_t used = dsvdc_ring_used(ring);
+    if (offset >= used)
+    {
+        return 0;
+    }
+
+    used -= offset;
+    return dsvdc_ring_iov(ring, ring->head + offset,
+                          (len < used) ? len : used, iov);
+}
+
+int dsvdc_ring_write(dsvdc_ring_t *ring, const void *data, size_t len)
+{
+    struct iovec iov[2];
+    int i;
+    int n;
+
+    if (len > dsvdc_ring_space(ring))
+    {
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    n = dsvdc_ring_iov(ring, ring->tail, len, iov);
+    for (i = 0; i < n; i++)
+    {
+        memcpy(iov[i].iov_base, data, iov[i].iov_len);
+        data = (const unsigned char *)data + iov[i].iov_len;
+    }
+
+    ring->tail += len;
+    return DSVDC_OK;
+}
+
+const unsigned char *dsvdc_ring_peek(const dsvdc_ring_t *ring, size_t offset,
+                                     size_t len, unsigned char *buf)
+{
+    struct iovec iov[2];
+
+    int n = dsvdc_ring_iov(ring, ring->head + offset, len, iov);
+    if (n < 2)
+    {
+        return n ? iov[0].iov_base : buf;
+    }
+
+    memcpy(buf, iov[0].iov_base, iov[0].iov_len);
+    memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+    return buf;
+}
+
+void dsvdc_ring_consume(dsvdc_ring_t *ring, size_t len)
+{
+    ring->head += len;
+    /* restart at the beginning of the buffer to keep data contiguous */
+    if (ring->head == ring->tail)
+    {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_RINGBUF_H__
+#define __DSVDC_RINGBUF_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Byte ring buffer, the size must be a power of two. Head and tail are free
+ * running counters, they are masked on access, so head == tail means empty
+ * and tail - head == size means full. */
+typedef struct dsvdc_ring
+{
+    unsigned char *data;
+    size_t size;
+    size_t head;
+    size_t tail;
+} dsvdc_ring_t;
+
+int dsvdc_ring_init(dsvdc_ring_t *ring, size_t size);
+/* grow to the given power of two size, stored data is preserved */
+int dsvdc_ring_resize(dsvdc_ring_t *ring, size_t size);
+void dsvdc_ring_free(dsvdc_ring_t *ring);
+void dsvdc_ring_reset(dsvdc_ring_t *ring);
+
+static inline size_t dsvdc_ring_used(const dsvdc_ring_t *ring)
+{
+    return ring->tail - ring->head;
+}
+
+static inline size_t dsvdc_ring_space(const dsvdc_ring_t *ring)
+{
+    return ring->size - (ring->tail - ring->head);
+}
+
+/* Describe the free space as up to two iovecs for a scattered read, returns
+ * the number of iovecs used. Call dsvdc_ring_commit() with the number of
+ * bytes actually stored. */
+int dsvdc_ring_write_iov(dsvdc_ring_t *ring, struct iovec iov[2]);
+void dsvdc_ring_commit(dsvdc_ring_t *ring, size_t len);
+
+/* Describe up to len bytes of stored data as up to two iovecs, returns the
+ * number of iovecs used. */
+int dsvdc_ring_read_iov(const dsvdc_ring_t *ring, size_t len,
+                        struct iovec iov[2]);
+/* same as above, starting offset bytes after the front */
+int dsvdc_ring_read_iov_at(const dsvdc_ring_t *ring, size_t offset,
+                           size_t len, struct iovec iov[2]);
+
+/* Copy data into the ring, fails if there is not enough space. */
+int dsvdc_ring_write(dsvdc_ring_t *ring, const void *data, size_t len);
+
+/* Returns a pointer to len stored bytes at offset, if they are contiguous
+ * in memory, otherwise the bytes are copied to buf which is returned. */
+const unsigned char *dsvdc_ring_peek(const dsvdc_ring_t *ring, size_t offset,
+                                     size_t len, unsigned char *buf);
+
+/* drop len bytes from the front */
+void dsvdc_ring_consume(dsvdc_ring_t *ring, size_t len);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_RINGBUF_H__*/
@@ -0,0 +1,294 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsvdc.h"
+#include "sendqueue.h"
+#include "log.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* initial sizes, both must be powers of two */
+#define TXQ_INITIAL_BYTES       4096
+#define TXQ_INITIAL_RECORDS     64
+
+void dsvdc_txq_init(dsvdc_txq_t *txq)
+{
+    memset(txq, 0, sizeof(dsvdc_txq_t));
+    txq->partial = -1;
+}
+
+void dsvdc_txq_cleanup(dsvdc_txq_t *txq)
+{
+    int i;
+
+    for (i = 0; i < DSVDC_TX_LANES; i++)
+    {
+        dsvdc_ring_free(&txq->lanes[i].data);
+        if (txq->lanes[i].records)
+        {
+            free(txq->lanes[i].records);
+        }
+    }
+    dsvdc_txq_init(txq);
+}
+
+static inline size_t dsvdc_lane_messages(const dsvdc_tx_lane_queue_t *lane)
+{
+    return lane->rec_tail - lane->rec_head;
+}
+
+static inline dsvdc_tx_record_t *dsvdc_lane_first(dsvdc_tx_lane_queue_t *lane)
+{
+    return &lane->records[lane->rec_head & (lane->rec_size - 1)];
+}
+
+static int dsvdc_lane_grow_records(dsvdc_tx_lane_queue_t *lane)
+{
+    size_t size = lane->rec_size ? lane->rec_size * 2 : TXQ_INITIAL_RECORDS;
+    size_t count = dsvdc_lane_messages(lane);
+    size_t i;
+
+    dsvdc_tx_record_t *records = malloc(sizeof(dsvdc_tx_record_t) * size);
+    if (!records)
+    {
+        log("could not allocate send queue records\n");
+        return DSVDC_ERR_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        records[i] = lane->records[(lane->rec_head + i) & (lane->rec_size - 1)];
+    }
+
+    if (lane->records)
+    {
+        free(lane->records);
+    }
+    lane->records = records;
+    lane->rec_size = size;
+    lane->rec_head = 0;
+    lane->rec_tail = count;
+    return DSVDC_OK;
+}
+
+/* drop up to len bytes from the front of one lane, returns the number of
+ * bytes that were dropped */
+static size_t dsvdc_lane_consume(dsvdc_txq_t *txq, dsvdc_tx_lane_queue_t *lane,
+                                 size_t len, dsvdc_txq_done_t done, void *ctx)
+{
+    size_t used = dsvdc_ring_used(&lane->data);
+    if (len > used)
+    {
+        len = used;
+    }
+
+    dsvdc_ring_consume(&lane->data, len);
+    txq->bytes -= len;
+
+    size_t left = len;
+    while ((left > 0) && (dsvdc_lane_messages(lane) > 0))
+    {
+        dsvdc_tx_record_t *record = dsvdc_lane_first(lane);
+        size_t rest = record->len - lane->sent;
+
+        if (left < rest)
+        {
+            lane->sent += left;
+            break;
+        }
+
+        left -= rest;
+        lane->sent = 0;
+        lane->rec_head++;
+        txq->messages--;
+        if (done)
+        {
+            done(ctx, record->message_id, DSVDC_OK);
+        }
+    }
+
+    return len;
+}
+
+int dsvdc_txq_push(dsvdc_txq_t *txq, dsvdc_tx_lane_t lane,
+                   const struct iovec *iov, int iovcnt, size_t sent,
+                   uint32_t message_id)
+{
+    dsvdc_tx_lane_queue_t *queue = &txq->lanes[lane];
+    size_t len = 0;
+    int ret;
+    int i;
+
+    if ((sent > 0) && (txq->messages > 0))
+    {
+        return DSVDC_ERR_PARAM;
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        len += iov[i].iov_len;
+    }
+
+    if (dsvdc_ring_space(&queue->data) < len)
+    {
+        size_t size = queue->data.size ? queue->data.size : TXQ_INITIAL_BYTES;
+        while (size - dsvdc_ring_used(&queue->data) < len)
+        {
+            size *= 2;
+        }
+
+        ret = dsvdc_ring_resize(&queue->data, size);
+        if (ret != DSVDC_OK)
+        {
+            log("could not grow send queue to %zu bytes\n", size);
+            return ret;
+        }
+    }
+
+    if (dsvdc_lane_messages(queue) == queue->rec_size)
+    {
+        ret = dsvdc_lane_grow_records(queue);
+        if (ret != DSVDC_OK)
+        {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        dsvdc_ring_write(&queue->data, iov[i].iov_base, iov[i].iov_len);
+    }
+
+    dsvdc_tx_record_t *record =
+                    &queue->records[queue->rec_tail & (queue->rec_size - 1)];
+    record->len = sent + len;
+    record->message_id = message_id;
+    queue->rec_tail++;
+
+    if (sent > 0)
+    {
+        queue->sent = sent;
+        txq->partial = lane;
+    }
+
+    txq->bytes += len;
+    txq->messages++;
+    return DSVDC_OK;
+}
+
+int dsvdc_txq_iov(const dsvdc_txq_t *txq, struct iovec *iov)
+{
+    size_t rest = 0;
+    int n = 0;
+    int i;
+
+    /* the rest of a partially written frame goes first */
+    if (txq->partial >= 0)
+    {
+        const dsvdc_tx_lane_queue_t *lane = &txq->lanes[txq->partial];
+        rest = lane->records[lane->rec_head & (lane->rec_size - 1)].len -
+               lane->sent;
+        n += dsvdc_ring_read_iov(&lane->data, rest, iov + n);
+    }
+
+    for (i = 0; i < DSVDC_TX_LANES; i++)
+    {
+        size_t offset = (i == txq->partial) ? rest : 0;
+        n += dsvdc_ring_read_iov_at(&txq->lanes[i].data, offset,
+                                    dsvdc_ring_used(&txq->lanes[i].data),
+                                    iov + n);
+    }
+
+    return n;
+}
+
+void dsvdc_txq_consume(dsvdc_txq_t *txq, size_t len, dsvdc_txq_done_t done,
+                       void *ctx)
+{
+    int i;
+
+    /* same order as dsvdc_txq_iov() */
+    if (txq->partial >= 0)
+    {
+        dsvdc_tx_lane_queue_t *lane = &txq->lanes[txq->partial];
+        size_t rest = dsvdc_lane_first(lane)->len - lane->sent;
+
+        len -= dsvdc_lane_consume(txq, lane, (len < rest) ? len : rest, done,
+                                  ctx);
+        if (lane->sent > 0)
+        {
+            return;
+        }
+        txq->partial = -1;
+    }
+
+    for (i = 0; (i < DSVDC_TX_LANES) && (len > 0); i++)
+    {
+        len -= dsvdc_lane_consume(txq, &txq->lanes[i], len, done, ctx);
+        if (txq->lanes[i].sent > 0)
+        {
+            txq->partial = i;
+            break;
+        }
+    }
+}
+
+void dsvdc_txq_drop(dsvdc_txq_t *txq, int code, dsvdc_txq_done_t done,
+                    void *ctx)
+{
+    int i;
+
+    for (i = 0; i < DSVDC_TX_LANES; i++)
+    {
+        dsvdc_tx_lane_queue_t *lane = &txq->lanes[i];
+        while (dsvdc_lane_messages(lane) > 0)
+        {
+            dsvdc_tx_record_t *record = dsvdc_lane_first(lane);
+            lane->rec_head++;
+            if (done)
+            {
+                done(ctx, record->message_id, code);
+            }
+        }
+
+        dsvdc_ring_reset(&lane->data);
+        lane->rec_head = 0;
+        lane->rec_tail = 0;
+        lane->sent = 0;
+    }
+
+    txq->partial = -1;
+    txq->bytes = 0;
+    txq->messages = 0;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
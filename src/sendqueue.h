@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_SENDQUEUE_H__
+#define __DSVDC_SENDQUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "ringbuf.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Priority lanes of the outbound path, lower values are sent first. */
+typedef enum dsvdc_tx_lane
+{
+    DSVDC_TX_LANE_CONTROL = 0,      /* pong, generic response, hello */
+    DSVDC_TX_LANE_INTERACTIVE = 1,  /* responses to property requests */
+    DSVDC_TX_LANE_BULK = 2,         /* push property, announcements */
+    DSVDC_TX_LANES
+} dsvdc_tx_lane_t;
+
+/* one queued frame, only the part that was not sent yet is in the ring */
+typedef struct dsvdc_tx_record
+{
+    size_t len;
+    uint32_t message_id;
+} dsvdc_tx_record_t;
+
+/* The wire bytes of all queued frames of one lane are stored back to back
+ * in a ring. The records keep the frame boundaries for the completion
+ * notifications. Both grow on demand. */
+typedef struct dsvdc_tx_lane_queue
+{
+    dsvdc_ring_t data;
+
+    dsvdc_tx_record_t *records;
+    size_t rec_size;
+    size_t rec_head;
+    size_t rec_tail;
+
+    /* bytes of the first record that were already written */
+    size_t sent;
+} dsvdc_tx_lane_queue_t;
+
+/* Outbound queue of one connection. Higher lanes always go out first, with
+ * one exception: a frame that was partially written has to be completed
+ * before anything else can be put on the connection. */
+typedef struct dsvdc_txq
+{
+    dsvdc_tx_lane_queue_t lanes[DSVDC_TX_LANES];
+    /* lane with a partially written first frame, -1 if there is none */
+    int partial;
+    size_t bytes;
+    size_t messages;
+} dsvdc_txq_t;
+
+/* maximum number of iovecs dsvdc_txq_iov() needs */
+#define DSVDC_TXQ_MAX_IOV   (2 * (DSVDC_TX_LANES + 1))
+
+/* called for each frame that left the queue, code is DSVDC_OK if it was
+ * written completely */
+typedef void (*dsvdc_txq_done_t)(void *ctx, uint32_t message_id, int code);
+
+void dsvdc_txq_init(dsvdc_txq_t *txq);
+void dsvdc_txq_cleanup(dsvdc_txq_t *txq);
+
+static inline size_t dsvdc_txq_bytes(const dsvdc_txq_t *txq)
+{
+    return txq->bytes;
+}
+
+static inline size_t dsvdc_txq_messages(const dsvdc_txq_t *txq)
+{
+    return txq->messages;
+}
+
+static inline size_t dsvdc_txq_lane_bytes(const dsvdc_txq_t *txq,
+                                          dsvdc_tx_lane_t lane)
+{
+    return dsvdc_ring_used(&txq->lanes[lane].data);
+}
+
+/* Queue the iovecs as one frame. If sent is not zero, the first sent bytes of
+ * the frame were already written and the iovecs only hold the rest, this is
+ * only allowed on an empty queue. */
+int dsvdc_txq_push(dsvdc_txq_t *txq, dsvdc_tx_lane_t lane,
+                   const struct iovec *iov, int iovcnt, size_t sent,
+                   uint32_t message_id);
+
+/* describe all queued bytes in sending order for a gathered write, iov must
+ * hold DSVDC_TXQ_MAX_IOV entries */
+int dsvdc_txq_iov(const dsvdc_txq_t *txq, struct iovec *iov);
+
+/* drop len written bytes in sending order, done is called for every
+ * completed frame */
+void dsvdc_txq_consume(dsvdc_txq_t *txq, size_t len, dsvdc_txq_done_t done,
+                       void *ctx);
+
+/* drop all frames, done is called with the given code for each of them */
+void dsvdc_txq_drop(dsvdc_txq_t *txq, int code, dsvdc_txq_done_t done,
+                    void *ctx);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_SENDQUEUE_H__*/
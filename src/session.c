@@ -0,0 +1,468 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <utlist.h>
+
+#include "common.h"
+#include "callbacks.h"
+#include "session.h"
+#include "msg_processor.h"
+#include "iothread.h"
+#include "log.h"
+#include "util.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* callbacks may run on the loop thread and, for send completions, on the
+ * sending threads, so the current session is tracked per thread */
+static __thread dsvdc_session_t *dsvdc_current_session = NULL;
+
+dsvdc_session_t *dsvdc_session_set_current(dsvdc_session_t *session)
+{
+    dsvdc_session_t *previous = dsvdc_current_session;
+    dsvdc_current_session = session;
+    return previous;
+}
+
+dsvdc_session_t *dsvdc_session_get_current(void)
+{
+    return dsvdc_current_session;
+}
+
+dsvdc_session_t *dsvdc_session_new(dsvdc_t *handle, int fd)
+{
+    dsvdc_session_t *session = malloc(sizeof(dsvdc_session_t));
+    if (!session)
+    {
+        log("could not allocate new session\n");
+        return NULL;
+    }
+
+    memset(session, 0, sizeof(dsvdc_session_t));
+    if (dsvdc_ring_init(&session->rx_ring, RX_RING_SIZE) != DSVDC_OK)
+    {
+        log("could not allocate receive buffer for new session\n");
+        free(session);
+        return NULL;
+    }
+
+    dsvdc_txq_init(&session->txq);
+    dsvdc_reqmap_init(&session->requests);
+    session->handle = handle;
+    session->fd = fd;
+
+    /* zero addresses all sessions */
+    if (++handle->session_id == ALL_SESSIONS)
+    {
+        ++handle->session_id;
+    }
+    session->id = handle->session_id;
+
+    LL_APPEND(handle->sessions, session);
+    handle->n_sessions++;
+    return session;
+}
+
+dsvdc_session_t *dsvdc_session_find(dsvdc_t *handle, unsigned int id)
+{
+    dsvdc_session_t *session;
+    LL_FOREACH(handle->sessions, session)
+    {
+        if ((session->id == id) && (session->fd > -1))
+        {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+dsvdc_session_t *dsvdc_session_find_fd(dsvdc_t *handle, int fd)
+{
+    dsvdc_session_t *session;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (session->fd == fd)
+        {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+bool dsvdc_session_any_established(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+    LL_FOREACH(handle->sessions, session)
+    {
+        if ((session->fd > -1) && session->established)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+cached_request_t *dsvdc_request_reserve(dsvdc_t *handle)
+{
+    cached_request_t *request = dsvdc_reqpool_reserve(&handle->request_pool);
+    if (!request)
+    {
+        log("all %zu request entries are in use\n",
+            handle->request_pool.capacity);
+        __atomic_add_fetch(&handle->stats.requests_rejected, 1,
+                           __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    /* the statistics are read without the mutex */
+    uint64_t used = handle->request_pool.used;
+    __atomic_store_n(&handle->stats.requests_pending, used, __ATOMIC_RELAXED);
+    if (used > handle->stats.requests_peak)
+    {
+        __atomic_store_n(&handle->stats.requests_peak, used, __ATOMIC_RELAXED);
+    }
+    return request;
+}
+
+void dsvdc_request_release(dsvdc_t *handle, cached_request_t *request)
+{
+    dsvdc_reqpool_release(&handle->request_pool, request);
+    __atomic_store_n(&handle->stats.requests_pending,
+                     (uint64_t)handle->request_pool.used, __ATOMIC_RELAXED);
+}
+
+int dsvdc_session_add_request(dsvdc_session_t *session,
+                              cached_request_t *request,
+                              unsigned int timeout)
+{
+    dsvdc_t *handle = session->handle;
+
+    int ret = dsvdc_reqmap_insert(&session->requests, request);
+    if (ret != DSVDC_OK)
+    {
+        return ret;
+    }
+
+    request->session = session;
+    dsvdc_wheel_add(&handle->request_timers, &request->timer, monotonic_ms(),
+                    timeout ? timeout : handle->request_timeout);
+    return DSVDC_OK;
+}
+
+cached_request_t *dsvdc_session_take_request(dsvdc_session_t *session,
+                                             uint32_t id)
+{
+    cached_request_t *request = dsvdc_reqmap_take(&session->requests, id);
+    if (request)
+    {
+        dsvdc_wheel_remove(&session->handle->request_timers, &request->timer);
+    }
+    return request;
+}
+
+void dsvdc_session_cancel_request(dsvdc_session_t *session, uint32_t id)
+{
+    cached_request_t *request = dsvdc_session_take_request(session, id);
+    if (request)
+    {
+        dsvdc_request_release(session->handle, request);
+    }
+}
+
+void dsvdc_select_receivers(dsvdc_t *handle, unsigned int session_id)
+{
+    dsvdc_session_t *session;
+
+    LL_FOREACH(handle->sessions, session)
+    {
+        session->tx_target = (session->fd > -1) && !session->close_pending &&
+                             ((session_id == ALL_SESSIONS) ?
+                                    session->established :
+                                    (session->id == session_id));
+    }
+}
+
+int dsvdc_register_requests(dsvdc_t *handle, uint32_t id,
+                            unsigned int timeout, void *arg,
+                            void (*function)(dsvdc_t *handle, int code,
+                                             void *arg, void *userdata))
+{
+    dsvdc_session_t *session;
+    dsvdc_session_t *added;
+    int ret = DSVDC_OK;
+
+    LL_FOREACH(handle->sessions, session)
+    {
+        if (!session->tx_target)
+        {
+            continue;
+        }
+
+        cached_request_t *request = dsvdc_request_reserve(handle);
+        if (!request)
+        {
+            ret = DSVDC_ERR_TOO_MANY_REQUESTS;
+            break;
+        }
+
+        request->message_id = id;
+        request->arg = arg;
+        request->callback = function;
+        ret = dsvdc_session_add_request(session, request, timeout);
+        if (ret != DSVDC_OK)
+        {
+            dsvdc_request_release(handle, request);
+            break;
+        }
+    }
+
+    if (ret != DSVDC_OK)
+    {
+        LL_FOREACH(handle->sessions, added)
+        {
+            if (added == session)
+            {
+                break;
+            }
+            if (added->tx_target)
+            {
+                dsvdc_session_cancel_request(added, id);
+            }
+        }
+    }
+    return ret;
+}
+
+static void dsvdc_session_fail_request(cached_request_t *request, void *arg)
+{
+    dsvdc_session_t *session = request->session;
+    dsvdc_t *handle = session->handle;
+    int code = *(int *)arg;
+
+    log("removing request with id %u\n", request->message_id);
+    dsvdc_wheel_remove(&handle->request_timers, &request->timer);
+
+    if (dsvdc_io_thread_self(handle))
+    {
+        dsvdc_io_post_request_done(handle, session, request, code);
+    }
+    else
+    {
+        dsvdc_callbacks_t cb;
+        dsvdc_session_t *previous = dsvdc_session_set_current(session);
+        dsvdc_get_callbacks(handle, &cb);
+        request->callback(handle, code, request->arg, cb.userdata);
+        dsvdc_session_set_current(previous);
+    }
+    dsvdc_request_release(handle, request);
+}
+
+void dsvdc_session_fail_requests(dsvdc_session_t *session, int code)
+{
+    dsvdc_reqmap_clear(&session->requests, dsvdc_session_fail_request,
+                       &code);
+}
+
+void dsvdc_expire_requests(dsvdc_t *handle)
+{
+    dsvdc_timer_t *expired;
+    dsvdc_callbacks_t cb;
+    bool io = dsvdc_io_thread_self(handle);
+
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    expired = dsvdc_wheel_advance(&handle->request_timers, monotonic_ms());
+
+    /* the responses can not arrive any more, the sessions are only freed
+     * by this thread */
+    dsvdc_timer_t *timer;
+    for (timer = expired; timer; timer = timer->next)
+    {
+        cached_request_t *request = (cached_request_t *)timer;
+        log("request with id %u timed out\n", request->message_id);
+        dsvdc_reqmap_take(&request->session->requests, request->message_id);
+    }
+
+    /* the event carries a copy of the request */
+    if (io)
+    {
+        while (expired)
+        {
+            cached_request_t *request = (cached_request_t *)expired;
+            expired = expired->next;
+            dsvdc_io_post_request_done(handle, request->session, request,
+                                       DSVDC_ERR_TIMEOUT);
+            dsvdc_request_release(handle, request);
+        }
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+
+    if (!expired)
+    {
+        return;
+    }
+
+    dsvdc_get_callbacks(handle, &cb);
+    for (timer = expired; timer; timer = timer->next)
+    {
+        cached_request_t *request = (cached_request_t *)timer;
+        dsvdc_session_t *previous = dsvdc_session_set_current(request->session);
+        request->callback(handle, DSVDC_ERR_TIMEOUT, request->arg,
+                          cb.userdata);
+        dsvdc_session_set_current(previous);
+    }
+
+    /* the entries are handed out again once all callbacks ran */
+    pthread_mutex_lock(&handle->dsvdc_handle_mutex);
+    while (expired)
+    {
+        cached_request_t *request = (cached_request_t *)expired;
+        expired = expired->next;
+        dsvdc_request_release(handle, request);
+    }
+    pthread_mutex_unlock(&handle->dsvdc_handle_mutex);
+}
+
+int dsvdc_requests_next_timeout(dsvdc_t *handle)
+{
+    uint64_t next = dsvdc_wheel_next(&handle->request_timers);
+    uint64_t now;
+
+    if (next == UINT64_MAX)
+    {
+        return -1;
+    }
+
+    now = monotonic_ms();
+    if (next <= now)
+    {
+        return 0;
+    }
+    return (next - now > INT_MAX) ? INT_MAX : (int)(next - now);
+}
+
+void dsvdc_session_close(dsvdc_session_t *session)
+{
+    dsvdc_t *handle = session->handle;
+
+    if (session->fd < 0)
+    {
+        return;
+    }
+
+    /* the I/O thread owns the connection, it closes it before it waits the
+     * next time */
+    if (dsvdc_io_mode(handle))
+    {
+        session->close_pending = true;
+        dsvdc_loop_wakeup(&handle->loop);
+        return;
+    }
+
+    dsvdc_loop_remove(&handle->loop, session->fd);
+    close(session->fd);
+    session->fd = -1;
+    handle->n_sessions--;
+
+    dsvdc_drop_send_queue(session, DSVDC_ERR_NOT_CONNECTED);
+    dsvdc_session_fail_requests(session, DSVDC_ERR_NOT_CONNECTED);
+
+    if (session->established)
+    {
+        session->established = false;
+        __atomic_sub_fetch(&handle->n_established, 1, __ATOMIC_RELEASE);
+        log("session %u with vdsm %s ended\n", session->id,
+            session->vdsm_dsuid);
+        if (dsvdc_io_thread_self(handle))
+        {
+            dsvdc_io_post_session_end(session);
+        }
+        else
+        {
+            dsvdc_callbacks_t cb;
+            dsvdc_get_callbacks(handle, &cb);
+            if (cb.vdsm_end_session)
+            {
+                dsvdc_session_t *previous = dsvdc_session_set_current(session);
+                cb.vdsm_end_session(handle, cb.userdata);
+                dsvdc_session_set_current(previous);
+            }
+        }
+    }
+}
+
+static void dsvdc_session_free(dsvdc_session_t *session)
+{
+    dsvdc_ring_free(&session->rx_ring);
+    dsvdc_txq_cleanup(&session->txq);
+    dsvdc_reqmap_free(&session->requests);
+    free(session);
+}
+
+void dsvdc_session_reap(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+    dsvdc_session_t *tmp;
+
+    LL_FOREACH_SAFE(handle->sessions, session, tmp)
+    {
+        /* events that still wait for dispatching point to it */
+        if ((session->fd < 0) &&
+            (__atomic_load_n(&session->refs, __ATOMIC_ACQUIRE) == 0))
+        {
+            LL_DELETE(handle->sessions, session);
+            dsvdc_session_free(session);
+        }
+    }
+}
+
+void dsvdc_session_cleanup_all(dsvdc_t *handle)
+{
+    dsvdc_session_t *session;
+
+    LL_FOREACH(handle->sessions, session)
+    {
+        dsvdc_session_close(session);
+    }
+
+    /* the dropped messages hold on to their sessions */
+    dsvdc_report_send_done(handle);
+    dsvdc_session_reap(handle);
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
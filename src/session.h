@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_SESSION_H__
+#define __DSVDC_SESSION_H__
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "common.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* All functions must be called with an already locked handle mutex. Sessions
+ * are only created, closed and freed by the thread that runs the loop. */
+
+/* create a session for an accepted connection, NULL if out of memory */
+dsvdc_session_t *dsvdc_session_new(dsvdc_t *handle, int fd);
+
+/* open sessions by id or by descriptor, NULL if there is no such session */
+dsvdc_session_t *dsvdc_session_find(dsvdc_t *handle, unsigned int id);
+dsvdc_session_t *dsvdc_session_find_fd(dsvdc_t *handle, int fd);
+
+/* true if at least one session completed the HELLO handshake */
+bool dsvdc_session_any_established(dsvdc_t *handle);
+
+/* Close the connection, fail queued messages and pending requests and end
+ * the session. The structure stays in the list until dsvdc_session_reap(),
+ * so that the receive path can still look at it. While the I/O thread runs,
+ * other threads only mark the session and the I/O thread closes it. */
+void dsvdc_session_close(dsvdc_session_t *session);
+
+/* free all closed sessions that no queued event refers to */
+void dsvdc_session_reap(dsvdc_t *handle);
+
+/* close and free all sessions */
+void dsvdc_session_cleanup_all(dsvdc_t *handle);
+
+/* Take an entry from the request pool before the request is sent, NULL if
+ * the limit is reached. Entries go back with dsvdc_request_release(). */
+cached_request_t *dsvdc_request_reserve(dsvdc_t *handle);
+void dsvdc_request_release(dsvdc_t *handle, cached_request_t *request);
+
+/* Track a request that is sent to the session until the response arrives
+ * or timeout milliseconds passed, zero selects the default of the handle.
+ * The request is added before the message goes out, so that the response
+ * always finds it. */
+int dsvdc_session_add_request(dsvdc_session_t *session,
+                              cached_request_t *request,
+                              unsigned int timeout);
+
+/* removes the request with the given id, NULL if it is not pending */
+cached_request_t *dsvdc_session_take_request(dsvdc_session_t *session,
+                                             uint32_t id);
+
+/* remove a request whose message could not be sent and release it, the
+ * callback is not run */
+void dsvdc_session_cancel_request(dsvdc_session_t *session, uint32_t id);
+
+/* Mark the receivers of a message in tx_target, either the session with the
+ * given id or all established sessions for ALL_SESSIONS. */
+void dsvdc_select_receivers(dsvdc_t *handle, unsigned int session_id);
+
+/* Add the request to every session that is marked in tx_target. If any of
+ * them fails, the ones that were added are cancelled and the error is
+ * returned, the marks are kept. */
+int dsvdc_register_requests(dsvdc_t *handle, uint32_t id,
+                            unsigned int timeout, void *arg,
+                            void (*function)(dsvdc_t *handle, int code,
+                                             void *arg, void *userdata));
+
+/* remove all pending requests, their callbacks receive the given code */
+void dsvdc_session_fail_requests(dsvdc_session_t *session, int code);
+
+/* Fail the requests of all sessions that timed out with DSVDC_ERR_TIMEOUT.
+ * Must be called without the handle mutex, unlike the functions above, the
+ * callbacks run without it unless the I/O thread posts them. */
+void dsvdc_expire_requests(dsvdc_t *handle);
+
+/* milliseconds until the next request times out, -1 if there is none */
+int dsvdc_requests_next_timeout(dsvdc_t *handle);
+
+/* Session the callback that is running on this thread was triggered by, the
+ * previous value is returned so that nested dispatching can restore it. */
+dsvdc_session_t *dsvdc_session_set_current(dsvdc_session_t *session);
+dsvdc_session_t *dsvdc_session_get_current(void);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_SESSION_H__*/
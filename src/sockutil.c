@@ -28,9 +28,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "sockutil.h"
 #include "log.h"
@@ -39,196 +39,95 @@
     #pragma GCC visibility push(hidden)
 #endif
 
-int sockread(int sockfd, unsigned char *data, size_t len, int timeout,
+int sockrecv(int sockfd, struct iovec *iov, int iovcnt,
              size_t *out_bytes_read)
 {
-    int ret;
-    struct timeval tv;
-    fd_set rfds;
-    unsigned char *p = data;
-    ssize_t bytes_total = 0;
-    ssize_t bytes_read = 0;
-    int eod = 0;
-    if (out_bytes_read)
-    {
-        *out_bytes_read = 0;
-    }
- 
-    while (1)
-    {
-        FD_ZERO(&rfds);
-        FD_SET(sockfd, &rfds);
+    struct msghdr msg;
+    ssize_t bytes_read;
 
-        if (timeout != 0)
-        {
-            if (!eod)
-            {
-                tv.tv_sec = timeout;
-                tv.tv_usec = 0;
-            }
-            else
-            {
-                tv.tv_sec = 0;
-                tv.tv_usec = 0;
-            }
-            ret = select(sockfd + 1, &rfds, NULL, NULL, &tv);
-        }
-        else
-        {
-            ret = select(sockfd + 1, &rfds, NULL, NULL, NULL);
-        }
+    *out_bytes_read = 0;
 
-        if (ret == -1)
-        {
-            if (errno == EINTR)
-            {
-                continue;
-            }
-            log("failed to select on socket: %s\n", strerror(errno));
-            if (out_bytes_read)
-            {
-                *out_bytes_read = bytes_total;
-            }
-            return socket_select_failed;
-        }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
 
-        if (ret == 0)
-        {
-            if (out_bytes_read)
-            {
-                *out_bytes_read = bytes_total;
-            }
-
-            if (eod)
-            {
-                return socket_ok;
-            }
-            else
-            {
-                return socket_operation_timed_out;
-            }
-        }
+    do
+    {
+        bytes_read = recvmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while ((bytes_read < 0) && (errno == EINTR));
 
-        if (FD_ISSET(sockfd, &rfds))
+    if (bytes_read < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
         {
-            if (timeout)
-            {
-                eod = 1;
-            }
-
-            bytes_read = recv(sockfd, p, len, MSG_NOSIGNAL);
-
-            if (bytes_read < 0)
-            {
-                if (out_bytes_read)
-                {
-                    *out_bytes_read = bytes_total;
-                }
-
-                log("recv failed: %s\n", strerror(errno));
-                return socket_recv_failed;
-            }
-
-            // remote socket was closed
-            if (bytes_read == 0)
-            {
-                if (out_bytes_read)
-                {
-                    *out_bytes_read = bytes_total;
-                }
-
-                return socket_closed;
-            }
-
-            bytes_total += bytes_read;
-            len -= bytes_read;
-
-            if (len <= 0)
-            {
-                break;
-            }
-
-            p = data + bytes_total;
+            return socket_ok;
         }
-    }
 
-    if (bytes_total < 0)
-    {
-        return socket_error;
+        log("recv failed: %s\n", strerror(errno));
+        return socket_recv_failed;
     }
 
-    if (out_bytes_read)
+    // remote socket was closed
+    if (bytes_read == 0)
     {
-        *out_bytes_read = bytes_total;
+        return socket_closed;
     }
 
+    *out_bytes_read = bytes_read;
     return socket_ok;
 }
 
-ssize_t sockwrite(int sockfd, unsigned char *data, size_t len, int timeout)
+ssize_t sockwritev(int sockfd, struct iovec *iov, int iovcnt,
+                   unsigned int *syscalls)
 {
-    int ret;
-    struct timeval tv;
-    fd_set wfds;
-    unsigned char *p = data;
+    struct msghdr msg;
     ssize_t bytes_total = 0;
-    ssize_t bytes_sent = 0;
+    ssize_t bytes_sent;
 
-    while (1)
-    {
-        FD_ZERO(&wfds);
-        FD_SET(sockfd, &wfds);
-
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
 
-        ret = select(sockfd + 1, NULL, &wfds, NULL, &tv);
+    while (msg.msg_iovlen > 0)
+    {
+        bytes_sent = sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        (*syscalls)++;
 
-        if (ret == -1)
+        if (bytes_sent < 0)
         {
             if (errno == EINTR)
             {
                 continue;
             }
 
-            log("Failed to read from socket: %s\n", strerror(errno));
-            return socket_select_failed;
-        }
-
-        if (ret == 0)
-        {
-            return socket_operation_timed_out;
-        }
-
-        if (FD_ISSET(sockfd, &wfds))
-        {
-            bytes_sent = send(sockfd, p, len, MSG_NOSIGNAL);
-
-            if (bytes_sent < 0)
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
             {
+                log("send failed: %s\n", strerror(errno));
                 return socket_send_failed;
             }
 
-            if (bytes_sent == 0)
-            {
-                break;
-            }
-
-            bytes_total += bytes_sent;
-            len -= bytes_sent;
+            /* the send buffer is full, the caller queues whatever is left */
+            break;
+        }
 
-            if (len <= 0)
-            {
-                break;
-            }
+        bytes_total += bytes_sent;
 
-            p = data + bytes_total;
+        /* skip what was sent, partial writes leave the rest in the iovecs */
+        while ((msg.msg_iovlen > 0) &&
+               ((size_t)bytes_sent >= msg.msg_iov->iov_len))
+        {
+            bytes_sent -= msg.msg_iov->iov_len;
+            msg.msg_iov->iov_len = 0;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
         }
-    }
 
-    if (bytes_total < 0)
-    {
-        return socket_error;
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (unsigned char *)msg.msg_iov->iov_base +
+                                    bytes_sent;
+            msg.msg_iov->iov_len -= bytes_sent;
+        }
     }
 
     return bytes_total;
@@ -23,6 +23,9 @@
 #ifndef __SOCKUTIL_H__
 #define __SOCKUTIL_H__
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #if __GNUC__ >= 4
     #pragma GCC visibility push(hidden)
 #endif
@@ -38,9 +41,18 @@ enum socket_ops
     socket_closed = -6
 };
 
-int sockread(int sockfd, unsigned char *data, size_t len, int timeout,
+/* Non-blocking scattered receive of whatever is available, out_bytes_read is
+ * zero if no data was pending. Returns socket_closed if the peer closed the
+ * connection. */
+int sockrecv(int sockfd, struct iovec *iov, int iovcnt,
              size_t *out_bytes_read);
-ssize_t sockwrite(int sockfd, unsigned char *data, size_t len, int timeout);
+/* Non-blocking gathered write, returns what could be written before the
+ * send buffer ran full. The iovecs are modified on partial writes, so that
+ * they describe what is left. The number of system calls that were needed
+ * is added to syscalls. Returns the number of bytes sent or a negative
+ * socket_ops code. */
+ssize_t sockwritev(int sockfd, struct iovec *iov, int iovcnt,
+                   unsigned int *syscalls);
 
 #if __GNUC__ >= 4
     #pragma GCC visibility pop
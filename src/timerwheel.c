@@ -0,0 +1,217 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "timerwheel.h"
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+#define DSVDC_WHEEL_MASK    (DSVDC_WHEEL_SLOTS - 1)
+
+void dsvdc_wheel_init(dsvdc_timer_wheel_t *wheel, uint64_t now)
+{
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+static void dsvdc_wheel_link(dsvdc_timer_t **head, dsvdc_timer_t *timer)
+{
+    timer->next = *head;
+    if (timer->next)
+    {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+/* The lowest level at which the deadline is less than 64 slots ahead gets
+ * the timer, the slot is reached before the wheel turned around once. */
+static void dsvdc_wheel_place(dsvdc_timer_wheel_t *wheel,
+                              dsvdc_timer_t *timer)
+{
+    uint64_t deadline = timer->deadline;
+    int level;
+
+    if (deadline <= wheel->now)
+    {
+        deadline = wheel->now + 1;
+    }
+
+    for (level = 0; level < DSVDC_WHEEL_LEVELS; level++)
+    {
+        int shift = level * DSVDC_WHEEL_BITS;
+        uint64_t ahead = (deadline >> shift) - (wheel->now >> shift);
+
+        if (ahead < DSVDC_WHEEL_SLOTS)
+        {
+            break;
+        }
+    }
+
+    /* out of range, the timer is placed again when its slot comes up */
+    if (level == DSVDC_WHEEL_LEVELS)
+    {
+        level = DSVDC_WHEEL_LEVELS - 1;
+        deadline = wheel->now + DSVDC_WHEEL_MAX_MS;
+    }
+
+    int slot = (deadline >> (level * DSVDC_WHEEL_BITS)) & DSVDC_WHEEL_MASK;
+    dsvdc_wheel_link(&wheel->slots[level][slot], timer);
+}
+
+void dsvdc_wheel_add(dsvdc_timer_wheel_t *wheel, dsvdc_timer_t *timer,
+                     uint64_t now, uint64_t timeout)
+{
+    /* an empty wheel is not advanced, catch up without walking the gap */
+    if ((wheel->count == 0) && (now > wheel->now))
+    {
+        wheel->now = now;
+    }
+
+    if (timeout > DSVDC_WHEEL_MAX_MS)
+    {
+        timeout = DSVDC_WHEEL_MAX_MS;
+    }
+
+    timer->deadline = now + timeout;
+    dsvdc_wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void dsvdc_wheel_remove(dsvdc_timer_wheel_t *wheel, dsvdc_timer_t *timer)
+{
+    if (!timer->pprev)
+    {
+        return;
+    }
+
+    *timer->pprev = timer->next;
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->count--;
+}
+
+static void dsvdc_wheel_cascade(dsvdc_timer_wheel_t *wheel, int level)
+{
+    int slot = (wheel->now >> (level * DSVDC_WHEEL_BITS)) & DSVDC_WHEEL_MASK;
+    dsvdc_timer_t *timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    while (timer)
+    {
+        dsvdc_timer_t *next = timer->next;
+        dsvdc_wheel_place(wheel, timer);
+        timer = next;
+    }
+}
+
+dsvdc_timer_t *dsvdc_wheel_advance(dsvdc_timer_wheel_t *wheel, uint64_t now)
+{
+    dsvdc_timer_t *expired = NULL;
+
+    while (wheel->now < now)
+    {
+        if (wheel->count == 0)
+        {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now++;
+
+        /* at the start of a span of a higher level its slot moves down,
+         * the highest level first */
+        int level = 0;
+        while ((level + 1 < DSVDC_WHEEL_LEVELS) &&
+               ((wheel->now &
+                 (((uint64_t)1 << ((level + 1) * DSVDC_WHEEL_BITS)) - 1)) ==
+                0))
+        {
+            level++;
+        }
+        for (; level > 0; level--)
+        {
+            dsvdc_wheel_cascade(wheel, level);
+        }
+
+        dsvdc_timer_t **head =
+                    &wheel->slots[0][wheel->now & DSVDC_WHEEL_MASK];
+        while (*head)
+        {
+            dsvdc_timer_t *timer = *head;
+            dsvdc_wheel_remove(wheel, timer);
+            timer->next = expired;
+            expired = timer;
+        }
+    }
+
+    return expired;
+}
+
+uint64_t dsvdc_wheel_next(const dsvdc_timer_wheel_t *wheel)
+{
+    uint64_t next = UINT64_MAX;
+    int level;
+    int i;
+
+    if (wheel->count == 0)
+    {
+        return next;
+    }
+
+    for (level = 0; level < DSVDC_WHEEL_LEVELS; level++)
+    {
+        int shift = level * DSVDC_WHEEL_BITS;
+        uint64_t base = wheel->now >> shift;
+
+        for (i = 1; i < DSVDC_WHEEL_SLOTS; i++)
+        {
+            if (wheel->slots[level][(base + i) & DSVDC_WHEEL_MASK])
+            {
+                uint64_t due = (base + i) << shift;
+                if (due < next)
+                {
+                    next = due;
+                }
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DSVDC_TIMERWHEEL_H__
+#define __DSVDC_TIMERWHEEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility push(hidden)
+#endif
+
+/* Hierarchical timer wheel with a resolution of one millisecond. Each level
+ * has 64 slots, a slot of level n spans 64^n milliseconds, four levels cover
+ * about four and a half hours. Adding and removing a timer is O(1), timers
+ * of the higher levels move down a level when their slot comes up. Later
+ * deadlines are clamped to the range of the wheel. */
+#define DSVDC_WHEEL_BITS    6
+#define DSVDC_WHEEL_SLOTS   (1 << DSVDC_WHEEL_BITS)
+#define DSVDC_WHEEL_LEVELS  4
+#define DSVDC_WHEEL_MAX_MS  ((uint64_t)(DSVDC_WHEEL_SLOTS - 1) << \
+                             (DSVDC_WHEEL_BITS * (DSVDC_WHEEL_LEVELS - 1)))
+
+/* embedded in the structure that is timed */
+typedef struct dsvdc_timer
+{
+    struct dsvdc_timer *next;
+    /* points to the pointer that points to us, NULL if not armed */
+    struct dsvdc_timer **pprev;
+    uint64_t deadline;
+} dsvdc_timer_t;
+
+typedef struct dsvdc_timer_wheel
+{
+    dsvdc_timer_t *slots[DSVDC_WHEEL_LEVELS][DSVDC_WHEEL_SLOTS];
+    /* last millisecond that was processed */
+    uint64_t now;
+    size_t count;
+} dsvdc_timer_wheel_t;
+
+void dsvdc_wheel_init(dsvdc_timer_wheel_t *wheel, uint64_t now);
+
+/* arm the timer to expire timeout milliseconds after now */
+void dsvdc_wheel_add(dsvdc_timer_wheel_t *wheel, dsvdc_timer_t *timer,
+                     uint64_t now, uint64_t timeout);
+void dsvdc_wheel_remove(dsvdc_timer_wheel_t *wheel, dsvdc_timer_t *timer);
+
+/* Moves the wheel forward to now, returns the timers that expired meanwhile
+ * as a list linked through next, they are no longer armed. */
+dsvdc_timer_t *dsvdc_wheel_advance(dsvdc_timer_wheel_t *wheel, uint64_t now);
+
+/* time at which the wheel has to be advanced next, either for an expiry or
+ * to move timers down a level, UINT64_MAX if no timer is armed */
+uint64_t dsvdc_wheel_next(const dsvdc_timer_wheel_t *wheel);
+
+#if __GNUC__ >= 4
+    #pragma GCC visibility pop
+#endif
+
+#endif/*__DSVDC_TIMERWHEEL_H__*/
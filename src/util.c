@@ -23,6 +23,7 @@
 #endif
 
 #include <sys/stat.h>
+#include <time.h>
 
 #include "util.h"
 
@@ -37,3 +38,19 @@ bool file_exists(const char *name)
 
 	return true;
 }
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
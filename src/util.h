@@ -22,6 +22,7 @@
 #define __UTIL_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #if __GNUC__ >= 4
     #pragma GCC visibility push(hidden)
@@ -29,6 +30,12 @@
 
 bool file_exists(const char *name);
 
+/* milliseconds from a monotonic clock, only useful for time differences */
+uint64_t monotonic_ms(void);
+
+/* the same in microseconds */
+uint64_t monotonic_us(void);
+
 #if __GNUC__ >= 4
     #pragma GCC visibility pop
 #endif
@@ -0,0 +1,912 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Simple benchmark suite, not run as part of "make check". Each benchmark
+ * prints one line per measured variant. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "dsvdc.h"
+#include "vdsm_sim.h"
+
+#define BENCH_VDC_DSUID     "3504175fe0000000000000000000000200"
+
+/* number of unrelated descriptors the application holds open, pushes the
+ * descriptors of the library towards FD_SETSIZE */
+#define BENCH_DUMMY_FDS     900
+
+/* threads that send while the application is busy in a callback */
+#define BENCH_SENDERS       4
+
+/* time a callback of the application takes */
+#define BENCH_CALLBACK_US   200
+
+/* devices a zone wide scene call names, and the time it takes to drive the
+ * bus of one of them */
+#define BENCH_ZONE_DEVICES  256
+#define BENCH_DEVICE_US     20
+
+/* sensors in the description of a large device */
+#define BENCH_SENSORS       500
+
+static int g_iterations = 20000;
+
+static void bench_report(const char *bench, const char *variant,
+                         uint64_t elapsed_us, int count)
+{
+    printf("%-24s %-12s %10d ops %12.3f us/op\n", bench, variant, count,
+           (double)elapsed_us / count);
+}
+
+/* system calls per message in both directions between two snapshots */
+static void bench_report_syscalls(const char *bench, const char *variant,
+                                  const dsvdc_stats_t *before,
+                                  const dsvdc_stats_t *after)
+{
+    uint64_t rx = after->rx_messages - before->rx_messages;
+    uint64_t tx = after->tx_messages - before->tx_messages;
+
+    printf("%-24s %-12s %10.3f rx syscalls/msg %6.3f tx syscalls/msg\n",
+           bench, variant,
+           rx ? (double)(after->rx_syscalls - before->rx_syscalls) / rx : 0.0,
+           tx ? (double)(after->tx_syscalls - before->tx_syscalls) / tx : 0.0);
+}
+
+static const char *bench_backend_name(dsvdc_io_backend_t backend)
+{
+    return (backend == DSVDC_IO_BACKEND_EPOLL) ? "epoll" : "select";
+}
+
+/* connect a simulated vdSM and complete the HELLO handshake */
+static int bench_connect(dsvdc_t *handle)
+{
+    int fd = vdsm_sim_connect(handle);
+    if ((fd < 0) || (vdsm_sim_send_hello(fd, 1) < 0))
+    {
+        fprintf(stderr, "could not connect to the vDC\n");
+        return -1;
+    }
+
+    while (!dsvdc_has_session(handle))
+    {
+        dsvdc_work(handle, 1);
+    }
+
+    Vdcapi__Message *reply = vdsm_sim_recv(fd, 1000);
+    if (!reply)
+    {
+        fprintf(stderr, "no HELLO response received\n");
+        close(fd);
+        return -1;
+    }
+    vdcapi__message__free_unpacked(reply, NULL);
+    return fd;
+}
+
+static int bench_event_loop(void)
+{
+    dsvdc_io_backend_t backends[] =
+    {
+        DSVDC_IO_BACKEND_SELECT,
+        DSVDC_IO_BACKEND_EPOLL
+    };
+    int dummy[BENCH_DUMMY_FDS];
+    dsvdc_t *handle;
+    size_t b;
+    int i;
+
+    for (i = 0; i < BENCH_DUMMY_FDS; i++)
+    {
+        dummy[i] = open("/dev/null", O_RDONLY);
+    }
+
+    if (dsvdc_new(0, BENCH_VDC_DSUID, "bench", true, NULL, &handle) !=
+        DSVDC_OK)
+    {
+        fprintf(stderr, "dsvdc_new() failed\n");
+        return -1;
+    }
+
+    int fd = bench_connect(handle);
+
+    for (b = 0; (fd >= 0) && (b < sizeof(backends) / sizeof(backends[0])); b++)
+    {
+        if (dsvdc_set_io_backend(handle, backends[b]) != DSVDC_OK)
+        {
+            printf("%-24s %-12s not available\n", "event_loop",
+                   bench_backend_name(backends[b]));
+            continue;
+        }
+
+        /* cost of one dsvdc_work() iteration without pending data */
+        uint64_t start = vdsm_sim_now_us();
+        for (i = 0; i < g_iterations; i++)
+        {
+            dsvdc_work(handle, 0);
+        }
+        bench_report("idle_work", bench_backend_name(backends[b]),
+                     vdsm_sim_now_us() - start, g_iterations);
+
+        /* ping addressed to the vDC itself is answered by the library */
+        dsvdc_stats_t before;
+        dsvdc_stats_t after;
+        dsvdc_get_stats(handle, &before);
+        start = vdsm_sim_now_us();
+        for (i = 0; i < g_iterations; i++)
+        {
+            vdsm_sim_send_ping(fd, BENCH_VDC_DSUID);
+            dsvdc_work(handle, 1);
+            Vdcapi__Message *pong = vdsm_sim_recv(fd, 1000);
+            if (!pong)
+            {
+                fprintf(stderr, "no pong received\n");
+                break;
+            }
+            vdcapi__message__free_unpacked(pong, NULL);
+        }
+        bench_report("ping_pong", bench_backend_name(backends[b]),
+                     vdsm_sim_now_us() - start, i);
+        dsvdc_get_stats(handle, &after);
+        bench_report_syscalls("ping_pong", bench_backend_name(backends[b]),
+                              &before, &after);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    dsvdc_cleanup(handle);
+
+    for (i = 0; i < BENCH_DUMMY_FDS; i++)
+    {
+        if (dummy[i] >= 0)
+        {
+            close(dummy[i]);
+        }
+    }
+
+    return 0;
+}
+
+static void bench_count_call_scene(dsvdc_t *handle, char **dsuid,
+                                   size_t n_dsuid, int32_t scene, bool force,
+                                   int32_t group, int32_t zone_id,
+                                   void *userdata)
+{
+    (void)handle;
+    (void)dsuid;
+    (void)n_dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    (*(int *)userdata)++;
+}
+
+/* a zone wide call scene arrives as a burst of notifications */
+static int bench_receive_burst(void)
+{
+    unsigned int budgets[] = { 1, 64, 0 };
+    unsigned char burst[256 * 64];
+    const int burst_count = 256;
+    dsvdc_t *handle;
+    size_t len = 0;
+    int count = 0;
+    size_t b;
+    int i;
+
+    if (dsvdc_new(0, BENCH_VDC_DSUID, "bench", true, &count, &handle) !=
+        DSVDC_OK)
+    {
+        fprintf(stderr, "dsvdc_new() failed\n");
+        return -1;
+    }
+    dsvdc_set_call_scene_notification_callback(handle, bench_count_call_scene);
+
+    int fd = bench_connect(handle);
+    if (fd < 0)
+    {
+        dsvdc_cleanup(handle);
+        return -1;
+    }
+
+    for (i = 0; i < burst_count; i++)
+    {
+        len += vdsm_sim_frame_call_scene(BENCH_VDC_DSUID, 5, burst + len,
+                                         sizeof(burst) - len);
+    }
+
+    for (b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+    {
+        char variant[32];
+        int rounds = g_iterations / burst_count;
+        unsigned long work_calls = 0;
+
+        if (rounds < 1)
+        {
+            rounds = 1;
+        }
+
+        snprintf(variant, sizeof(variant), "budget=%u", budgets[b]);
+        dsvdc_set_receive_budget(handle, budgets[b]);
+
+        dsvdc_stats_t before;
+        dsvdc_stats_t after;
+        dsvdc_get_stats(handle, &before);
+
+        uint64_t start = vdsm_sim_now_us();
+        for (i = 0; i < rounds; i++)
+        {
+            count = 0;
+            vdsm_sim_send_raw(fd, burst, len);
+            while (count < burst_count)
+            {
+                dsvdc_work(handle, 1);
+                work_calls++;
+            }
+        }
+        bench_report("call_scene_burst", variant, vdsm_sim_now_us() - start,
+                     rounds * burst_count);
+        printf("%-24s %-12s %10.3f dsvdc_work() calls per burst\n",
+               "call_scene_burst", variant, (double)work_calls / rounds);
+        dsvdc_get_stats(handle, &after);
+        bench_report_syscalls("call_scene_burst", variant, &before, &after);
+    }
+
+    close(fd);
+    dsvdc_cleanup(handle);
+    return 0;
+}
+
+/* ping while the bulk lane is kept saturated with pushed properties, the
+ * pong has to overtake everything the library still holds */
+static int bench_pong_under_load(void)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    vdsm_sim_stream_t *stream;
+    uint8_t blob[1024];
+    uint64_t total = 0;
+    uint64_t pushes = 0;
+    uint64_t overtaken = 0;
+    size_t queued;
+    int rounds = g_iterations / 100;
+    int i;
+
+    if (rounds < 10)
+    {
+        rounds = 10;
+    }
+
+    if (dsvdc_new(0, BENCH_VDC_DSUID, "bench", true, NULL, &handle) !=
+        DSVDC_OK)
+    {
+        fprintf(stderr, "could not create library instance\n");
+        return -1;
+    }
+
+    int fd = bench_connect(handle);
+    if (fd < 0)
+    {
+        dsvdc_cleanup(handle);
+        return -1;
+    }
+
+    memset(blob, 0x55, sizeof(blob));
+    dsvdc_property_new(&property);
+    dsvdc_property_add_bytes(property, "blob", blob, sizeof(blob));
+    stream = malloc(sizeof(vdsm_sim_stream_t));
+    vdsm_sim_stream_init(stream, fd);
+
+    for (i = 0; i < rounds; i++)
+    {
+        bool pong = false;
+
+        while (dsvdc_push_property(handle, BENCH_VDC_DSUID, property) ==
+               DSVDC_OK);
+
+        dsvdc_get_send_queue(handle, NULL, &queued);
+        overtaken += queued;
+
+        vdsm_sim_send_ping(fd, BENCH_VDC_DSUID);
+        uint64_t start = vdsm_sim_now_us();
+
+        while (!pong)
+        {
+            Vdcapi__Message *msg = vdsm_sim_stream_next(stream);
+            if (!msg)
+            {
+                /* keep the bulk lane full while waiting */
+                while (dsvdc_push_property(handle, BENCH_VDC_DSUID,
+                                           property) == DSVDC_OK);
+                dsvdc_work(handle, 0);
+                continue;
+            }
+
+            if (msg->type == VDCAPI__TYPE__VDC_SEND_PONG)
+            {
+                total += vdsm_sim_now_us() - start;
+                pong = true;
+            }
+            else
+            {
+                pushes++;
+            }
+            vdcapi__message__free_unpacked(msg, NULL);
+        }
+    }
+
+    bench_report("pong_under_load", "bulk", total, rounds);
+    printf("%-24s %-12s %10.3f pushed properties received before the pong\n",
+           "pong_under_load", "bulk", (double)pushes / rounds);
+    printf("%-24s %-12s %10.3f queued properties overtaken by the pong\n",
+           "pong_under_load", "bulk", (double)overtaken / rounds);
+
+    free(stream);
+    dsvdc_property_free(property);
+    close(fd);
+    dsvdc_cleanup(handle);
+    return 0;
+}
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* round trip of a ping answered by the library over each transport, with
+ * and without the I/O thread */
+static int bench_transports(void)
+{
+    struct
+    {
+        const char *name;
+        dsvdc_transport_t transport;
+        const char *path;
+        bool io_thread;
+    } variants[] =
+    {
+        { "tcp",        DSVDC_TRANSPORT_TCP,    NULL,           false },
+        { "tcp6",       DSVDC_TRANSPORT_TCP6,   NULL,           false },
+        { "unix",       DSVDC_TRANSPORT_UNIX,   "@dsvdc-bench", false },
+        { "tcp_io",     DSVDC_TRANSPORT_TCP,    NULL,           true },
+        { "unix_io",    DSVDC_TRANSPORT_UNIX,   "@dsvdc-bench", true }
+    };
+    dsvdc_options_t options;
+    dsvdc_t *handle;
+    size_t v;
+    int i;
+
+    uint64_t *rtt = malloc(g_iterations * sizeof(uint64_t));
+    if (!rtt)
+    {
+        return -1;
+    }
+
+    for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+    {
+        dsvdc_options_init(&options);
+        options.transport = variants[v].transport;
+        options.path = variants[v].path;
+        options.noauto = true;
+
+        if (dsvdc_new_ex(BENCH_VDC_DSUID, &options, &handle) != DSVDC_OK)
+        {
+            printf("%-24s %-12s not available\n", "transport_rtt",
+                   variants[v].name);
+            continue;
+        }
+
+        int fd = bench_connect(handle);
+        if ((fd < 0) ||
+            (variants[v].io_thread &&
+             (dsvdc_start_io_thread(handle) != DSVDC_OK)))
+        {
+            dsvdc_cleanup(handle);
+            free(rtt);
+            return -1;
+        }
+
+        uint64_t start = vdsm_sim_now_us();
+        for (i = 0; i < g_iterations; i++)
+        {
+            uint64_t sent = vdsm_sim_now_us();
+            vdsm_sim_send_ping(fd, BENCH_VDC_DSUID);
+            dsvdc_work(handle, 1);
+            Vdcapi__Message *pong = vdsm_sim_recv(fd, 1000);
+            if (!pong)
+            {
+                fprintf(stderr, "no pong received\n");
+                break;
+            }
+            vdcapi__message__free_unpacked(pong, NULL);
+            rtt[i] = vdsm_sim_now_us() - sent;
+        }
+
+        if (i > 0)
+        {
+            bench_report("transport_rtt", variants[v].name,
+                         vdsm_sim_now_us() - start, i);
+            qsort(rtt, i, sizeof(uint64_t), bench_compare_u64);
+            printf("%-24s %-12s %10llu us p50 %10llu us p99\n",
+                   "transport_rtt", variants[v].name,
+                   (unsigned long long)rtt[i / 2],
+                   (unsigned long long)rtt[(i * 99) / 100]);
+        }
+
+        close(fd);
+        dsvdc_cleanup(handle);
+    }
+
+    free(rtt);
+    return 0;
+}
+
+typedef struct bench_sender
+{
+    pthread_t thread;
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    bool *stop;
+    uint64_t *latency;
+    int capacity;
+    int count;
+} bench_sender_t;
+
+static void bench_slow_call_scene(dsvdc_t *handle, char **dsuid,
+                                  size_t n_dsuid, int32_t scene, bool force,
+                                  int32_t group, int32_t zone_id,
+                                  void *userdata)
+{
+    uint64_t start = vdsm_sim_now_us();
+
+    bench_count_call_scene(handle, dsuid, n_dsuid, scene, force, group,
+                           zone_id, userdata);
+    while (vdsm_sim_now_us() - start < BENCH_CALLBACK_US);
+}
+
+static void *bench_sender_thread(void *arg)
+{
+    bench_sender_t *sender = (bench_sender_t *)arg;
+
+    while (!__atomic_load_n(sender->stop, __ATOMIC_RELAXED) &&
+           (sender->count < sender->capacity))
+    {
+        uint64_t start = vdsm_sim_now_us();
+        dsvdc_push_property(sender->handle, BENCH_VDC_DSUID,
+                            sender->property);
+        sender->latency[sender->count++] = vdsm_sim_now_us() - start;
+        usleep(50);
+    }
+    return NULL;
+}
+
+/* throw away everything the library sends to the simulated vdSM */
+static void *bench_drain_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    unsigned char buf[65536];
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, 100) >= 0)
+    {
+        if ((pfd.revents & POLLIN) && (read(fd, buf, sizeof(buf)) <= 0))
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* latency of sends from other threads while the application thread is
+ * busy in slow callbacks or idle */
+static int bench_send_contention(void)
+{
+    bench_sender_t senders[BENCH_SENDERS];
+    unsigned char burst[64 * 64];
+    const int burst_count = 64;
+    bool stop;
+    pthread_t drain;
+    dsvdc_t *handle;
+    size_t len = 0;
+    int count = 0;
+    int slow;
+    int i;
+    int s;
+
+    if (dsvdc_new(0, BENCH_VDC_DSUID, "bench", true, &count, &handle) !=
+        DSVDC_OK)
+    {
+        fprintf(stderr, "dsvdc_new() failed\n");
+        return -1;
+    }
+    dsvdc_set_call_scene_notification_callback(handle, bench_slow_call_scene);
+
+    int fd = bench_connect(handle);
+    if (fd < 0)
+    {
+        dsvdc_cleanup(handle);
+        return -1;
+    }
+    pthread_create(&drain, NULL, bench_drain_thread, &fd);
+
+    for (i = 0; i < burst_count; i++)
+    {
+        len += vdsm_sim_frame_call_scene(BENCH_VDC_DSUID, 5, burst + len,
+                                         sizeof(burst) - len);
+    }
+
+    for (slow = 0; slow < 2; slow++)
+    {
+        const char *variant = slow ? "slow_cb" : "idle";
+        int rounds = g_iterations / (burst_count * 20);
+        uint64_t *all;
+        int total = 0;
+
+        if (rounds < 1)
+        {
+            rounds = 1;
+        }
+
+        __atomic_store_n(&stop, false, __ATOMIC_RELAXED);
+        for (s = 0; s < BENCH_SENDERS; s++)
+        {
+            senders[s].handle = handle;
+            senders[s].stop = &stop;
+            senders[s].capacity = rounds * burst_count * 4 + 1000;
+            senders[s].latency = malloc(senders[s].capacity *
+                                        sizeof(uint64_t));
+            senders[s].count = 0;
+            dsvdc_property_new(&senders[s].property);
+            dsvdc_property_add_uint(senders[s].property, "sender", s);
+            pthread_create(&senders[s].thread, NULL, bench_sender_thread,
+                           &senders[s]);
+        }
+
+        uint64_t start = vdsm_sim_now_us();
+        for (i = 0; i < rounds; i++)
+        {
+            count = 0;
+            if (slow)
+            {
+                vdsm_sim_send_raw(fd, burst, len);
+            }
+            while ((slow && (count < burst_count)) ||
+                   (!slow && (vdsm_sim_now_us() - start <
+                              (uint64_t)(i + 1) * burst_count *
+                              BENCH_CALLBACK_US)))
+            {
+                dsvdc_work(handle, 0);
+            }
+        }
+
+        __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+        for (s = 0; s < BENCH_SENDERS; s++)
+        {
+            pthread_join(senders[s].thread, NULL);
+            total += senders[s].count;
+        }
+
+        all = malloc(total * sizeof(uint64_t));
+        total = 0;
+        for (s = 0; s < BENCH_SENDERS; s++)
+        {
+            memcpy(all + total, senders[s].latency,
+                   senders[s].count * sizeof(uint64_t));
+            total += senders[s].count;
+            free(senders[s].latency);
+            dsvdc_property_free(senders[s].property);
+        }
+
+        if (total > 0)
+        {
+            qsort(all, total, sizeof(uint64_t), bench_compare_u64);
+            printf("%-24s %-12s %10d ops %7llu us p50 %7llu us p99 "
+                   "%7llu us max\n", "send_contention", variant, total,
+                   (unsigned long long)all[total / 2],
+                   (unsigned long long)all[((uint64_t)total * 99) / 100],
+                   (unsigned long long)all[total - 1]);
+        }
+        free(all);
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    pthread_join(drain, NULL);
+    close(fd);
+    dsvdc_cleanup(handle);
+    return 0;
+}
+
+static void bench_device_call_scene(dsvdc_t *handle,
+                                    const dsvdc_dsuid_t *dsuid,
+                                    int32_t scene, bool force, int32_t group,
+                                    int32_t zone_id, void *context)
+{
+    uint64_t start = vdsm_sim_now_us();
+
+    (void)handle;
+    (void)dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    (void)context;
+    while (vdsm_sim_now_us() - start < BENCH_DEVICE_US);
+}
+
+typedef struct bench_dispatch
+{
+    uint64_t elapsed_us;
+    int completions;
+} bench_dispatch_t;
+
+static void bench_dispatch_complete(dsvdc_t *handle, size_t n_devices,
+                                    uint64_t elapsed_us, void *userdata)
+{
+    bench_dispatch_t *state = (bench_dispatch_t *)userdata;
+
+    (void)handle;
+    (void)n_devices;
+    __atomic_add_fetch(&state->elapsed_us, elapsed_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&state->completions, 1, __ATOMIC_RELEASE);
+}
+
+/* time until a scene call was applied to every device of a zone, with the
+ * handlers on the application thread and on 1 to N workers */
+static int bench_dispatch_scaling(void)
+{
+    const dsvdc_device_handlers_t handlers = {
+        .call_scene = bench_device_call_scene
+    };
+    char names[BENCH_ZONE_DEVICES][35];
+    char *dsuids[BENCH_ZONE_DEVICES];
+    unsigned int variants[16];
+    size_t n_variants = 0;
+    size_t v;
+    bench_dispatch_t state;
+    pthread_t drain;
+    dsvdc_t *handle;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int rounds = g_iterations / 1000;
+    unsigned int workers;
+    int i;
+
+    if (dsvdc_new(0, BENCH_VDC_DSUID, "bench", true, &state, &handle) !=
+        DSVDC_OK)
+    {
+        fprintf(stderr, "dsvdc_new() failed\n");
+        return -1;
+    }
+    dsvdc_set_dispatch_complete_callback(handle, bench_dispatch_complete);
+
+    dsvdc_register_container(handle, BENCH_VDC_DSUID);
+    for (i = 0; i < BENCH_ZONE_DEVICES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%034x", i + 1);
+        dsuids[i] = names[i];
+        dsvdc_register_device(handle, BENCH_VDC_DSUID, names[i]);
+        dsvdc_set_device_handlers(handle, names[i], &handlers, NULL);
+    }
+
+    int fd = bench_connect(handle);
+    if (fd < 0)
+    {
+        dsvdc_cleanup(handle);
+        return -1;
+    }
+    pthread_create(&drain, NULL, bench_drain_thread, &fd);
+
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmNotificationCallScene call =
+                                VDCAPI__VDSM__NOTIFICATION_CALL_SCENE__INIT;
+    call.n_dsuid = BENCH_ZONE_DEVICES;
+    call.dsuid = dsuids;
+    call.has_scene = 1;
+    call.scene = 5;
+    call.has_force = 1;
+    msg.type = VDCAPI__TYPE__VDSM_NOTIFICATION_CALL_SCENE;
+    msg.vdsm_send_call_scene = &call;
+
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+    if ((cores < 1) || (cores > 64))
+    {
+        cores = (cores < 1) ? 1 : 64;
+    }
+
+    /* no workers as the baseline, then powers of two up to all cores */
+    variants[n_variants++] = 0;
+    for (workers = 1; workers < (unsigned int)cores; workers *= 2)
+    {
+        variants[n_variants++] = workers;
+    }
+    variants[n_variants++] = (unsigned int)cores;
+
+    for (v = 0; v < n_variants; v++)
+    {
+        char variant[16];
+
+        if (dsvdc_set_dispatch_workers(handle, variants[v]) != DSVDC_OK)
+        {
+            fprintf(stderr, "could not start %u workers\n", variants[v]);
+            break;
+        }
+
+        state.elapsed_us = 0;
+        state.completions = 0;
+        for (i = 0; i < rounds; i++)
+        {
+            vdsm_sim_send(fd, &msg);
+            while (__atomic_load_n(&state.completions, __ATOMIC_ACQUIRE) <=
+                   i)
+            {
+                dsvdc_work(handle, 1);
+                dsvdc_wait_dispatch(handle);
+            }
+        }
+
+        snprintf(variant, sizeof(variant), "%u workers", variants[v]);
+        bench_report("dispatch_scaling", variant, state.elapsed_us, rounds);
+    }
+
+    dsvdc_set_dispatch_workers(handle, 0);
+    shutdown(fd, SHUT_RDWR);
+    pthread_join(drain, NULL);
+    close(fd);
+    dsvdc_cleanup(handle);
+    return 0;
+}
+
+static dsvdc_property_t *bench_sensor_description(bool arena)
+{
+    dsvdc_property_t *property;
+    dsvdc_property_t *sensors;
+    dsvdc_property_t *sensor;
+    char name[16];
+    int i;
+
+    if (arena)
+    {
+        dsvdc_property_new_arena(&property);
+    }
+    else
+    {
+        dsvdc_property_new(&property);
+    }
+
+    dsvdc_property_new_nested(property, &sensors);
+    for (i = 0; i < BENCH_SENSORS; i++)
+    {
+        dsvdc_property_new_nested(sensors, &sensor);
+        dsvdc_property_add_string(sensor, "name", "temperature");
+        dsvdc_property_add_uint(sensor, "sensorType", 1);
+        dsvdc_property_add_uint(sensor, "sensorUsage", 0);
+        dsvdc_property_add_double(sensor, "min", -40.0);
+        dsvdc_property_add_double(sensor, "max", 80.0);
+        dsvdc_property_add_double(sensor, "resolution", 0.1);
+        dsvdc_property_add_uint(sensor, "updateInterval", 60);
+        snprintf(name, sizeof(name), "%d", i);
+        dsvdc_property_add_property(sensors, name, &sensor);
+    }
+    dsvdc_property_add_property(property, "sensorDescriptions", &sensors);
+    return property;
+}
+
+/* builds and frees the description of a device with many sensors, the way
+ * a get property callback would */
+static int bench_property_build(void)
+{
+    const char *variants[] = { "heap", "arena" };
+    int rounds = g_iterations / 100;
+    size_t v;
+    int i;
+
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+
+    for (v = 0; v < 2; v++)
+    {
+        uint64_t start = vdsm_sim_now_us();
+        for (i = 0; i < rounds; i++)
+        {
+            dsvdc_property_t *property = bench_sensor_description(v == 1);
+            if (!property)
+            {
+                fprintf(stderr, "could not build the sensor description\n");
+                return -1;
+            }
+            dsvdc_property_free(property);
+        }
+        bench_report("property_build", variants[v],
+                     vdsm_sim_now_us() - start, rounds);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        g_iterations = atoi(argv[1]);
+        if (g_iterations <= 0)
+        {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench_event_loop() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_receive_burst() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_pong_under_load() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_transports() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_send_contention() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_dispatch_scaling() < 0)
+    {
+        return 1;
+    }
+
+    if (bench_property_build() < 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
@@ -25,8 +25,18 @@
 
 #include <check.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "dsvdc.h"
+#include "vdsm_sim.h"
+
+#define TEST_VDC_DSUID  "3504175fe0000000000000000000000200"
 
 START_TEST(test_init_cleanup)
 {
@@ -44,12 +54,2497 @@ START_TEST(test_init_cleanup)
 }
 END_TEST
 
+/* drive the library from our own poll() loop until a message arrives */
+static Vdcapi__Message *external_loop_recv(dsvdc_t *handle, int fd)
+{
+    struct pollfd fds[16];
+    int i;
+
+    for (i = 0; i < 100; i++)
+    {
+        size_t nfds = 15;
+        if (dsvdc_get_pollfds(handle, fds, &nfds) != DSVDC_OK)
+        {
+            return NULL;
+        }
+
+        /* the simulated vdSM, the library must ignore it */
+        fds[nfds].fd = fd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+
+        int timeout = dsvdc_next_timeout_ms(handle);
+        if ((timeout < 0) || (timeout > 100))
+        {
+            timeout = 100;
+        }
+
+        if (poll(fds, nfds + 1, timeout) < 0)
+        {
+            return NULL;
+        }
+
+        if (fds[nfds].revents)
+        {
+            return vdsm_sim_recv(fd, 1000);
+        }
+
+        dsvdc_process_ready(handle, fds, nfds);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_external_loop)
+{
+    dsvdc_t *handle;
+    size_t nfds = 0;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, NULL, &handle) ==
+                  DSVDC_OK, "dsvdc_new() initialization failed");
+
+    ck_assert_msg(dsvdc_get_pollfds(handle, NULL, &nfds) == DSVDC_OK,
+                  "could not query number of descriptors");
+    ck_assert_msg(nfds >= 1, "listening socket not exposed");
+
+    int fd = vdsm_sim_connect(handle);
+    ck_assert_msg(fd >= 0, "could not connect to vDC");
+    ck_assert_msg(vdsm_sim_send_hello(fd, 1) == 0, "could not send hello");
+
+    Vdcapi__Message *msg = external_loop_recv(handle, fd);
+    ck_assert_msg(msg != NULL, "no reply to hello received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_RESPONSE_HELLO,
+                  "unexpected reply %d to hello", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+    ck_assert_msg(dsvdc_has_session(handle), "session not established");
+
+    ck_assert_msg(vdsm_sim_send_ping(fd, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    msg = external_loop_recv(handle, fd);
+    ck_assert_msg(msg != NULL, "no pong received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PONG,
+                  "unexpected reply %d to ping", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+/* connect and complete the HELLO handshake using dsvdc_work() */
+static int connect_session(dsvdc_t *handle)
+{
+    int fd = vdsm_sim_connect(handle);
+    if ((fd < 0) || (vdsm_sim_send_hello(fd, 1) < 0))
+    {
+        return -1;
+    }
+
+    unsigned int sessions = dsvdc_get_session_count(handle);
+    int i;
+    for (i = 0; (i < 10) && (dsvdc_get_session_count(handle) == sessions);
+         i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+
+    Vdcapi__Message *msg = vdsm_sim_recv(fd, 1000);
+    if (!msg)
+    {
+        close(fd);
+        return -1;
+    }
+    vdcapi__message__free_unpacked(msg, NULL);
+    return fd;
+}
+
+START_TEST(test_slow_sender)
+{
+    dsvdc_t *handle;
+    unsigned char frame[128];
+    uint64_t worst = 0;
+    size_t i;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, NULL, &handle) ==
+                  DSVDC_OK, "dsvdc_new() initialization failed");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    size_t len = vdsm_sim_frame_ping(TEST_VDC_DSUID, frame, sizeof(frame));
+    ck_assert_msg(len > 0, "could not pack ping");
+
+    /* trickle the frame byte by byte, the loop must never wait for the rest
+     * of the frame although dsvdc_work() is called with a large timeout */
+    for (i = 0; i < len; i++)
+    {
+        ck_assert_msg(vdsm_sim_send_raw(fd, frame + i, 1) == 0,
+                      "could not send");
+        usleep(2000);
+
+        uint64_t start = vdsm_sim_now_us();
+        dsvdc_work(handle, 5);
+        uint64_t elapsed = vdsm_sim_now_us() - start;
+        if (elapsed > worst)
+        {
+            worst = elapsed;
+        }
+
+        if (i < len - 1)
+        {
+            ck_assert_msg(vdsm_sim_recv(fd, 0) == NULL,
+                          "reply to incomplete frame");
+        }
+    }
+
+    ck_assert_msg(worst < 100000, "dsvdc_work() blocked for %llu us on a "
+                  "partial frame", (unsigned long long)worst);
+
+    Vdcapi__Message *msg = vdsm_sim_recv(fd, 1000);
+    ck_assert_msg(msg != NULL, "no pong received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PONG,
+                  "unexpected reply %d to ping", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    /* two frames in one segment must both be processed */
+    memcpy(frame + len, frame, len);
+    ck_assert_msg(vdsm_sim_send_raw(fd, frame, 2 * len) == 0,
+                  "could not send");
+    dsvdc_work(handle, 1);
+    for (i = 0; i < 2; i++)
+    {
+        msg = vdsm_sim_recv(fd, 1000);
+        ck_assert_msg(msg != NULL, "pong %zu missing", i);
+        vdcapi__message__free_unpacked(msg, NULL);
+    }
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+static void count_call_scene(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
+                             int32_t scene, bool force, int32_t group,
+                             int32_t zone_id, void *userdata)
+{
+    (void)handle;
+    (void)dsuid;
+    (void)n_dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    (*(int *)userdata)++;
+}
+
+START_TEST(test_receive_budget)
+{
+    dsvdc_t *handle;
+    unsigned char burst[4096];
+    size_t len = 0;
+    int count = 0;
+    int i;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &count,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback(handle, count_call_scene);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    for (i = 0; i < 10; i++)
+    {
+        len += vdsm_sim_frame_call_scene(TEST_VDC_DSUID, i, burst + len,
+                                         sizeof(burst) - len);
+    }
+
+    /* the whole burst arrives at once, but only the budget is processed
+     * per iteration, the rest must not wait for new socket events */
+    dsvdc_set_receive_budget(handle, 4);
+    ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0, "could not send");
+    usleep(10000);
+
+    dsvdc_work(handle, 1);
+    ck_assert_msg(count == 4, "expected 4 messages, got %d", count);
+    ck_assert_msg(dsvdc_next_timeout_ms(handle) == 0,
+                  "pending messages not signalled");
+
+    uint64_t start = vdsm_sim_now_us();
+    dsvdc_work(handle, 1);
+    dsvdc_work(handle, 1);
+    ck_assert_msg(count == 10, "expected 10 messages, got %d", count);
+    ck_assert_msg(vdsm_sim_now_us() - start < 500000,
+                  "left over messages waited for the timeout");
+
+    /* without a budget one iteration handles everything */
+    count = 0;
+    dsvdc_set_receive_budget(handle, 0);
+    ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0, "could not send");
+    usleep(10000);
+    dsvdc_work(handle, 1);
+    ck_assert_msg(count == 10, "expected 10 messages, got %d", count);
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+START_TEST(test_receive_allocations)
+{
+    dsvdc_t *handle;
+    dsvdc_stats_t warm;
+    dsvdc_stats_t stats;
+    unsigned char frame[128];
+    int count = 0;
+    int i;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &count,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback(handle, count_call_scene);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    size_t len = vdsm_sim_frame_call_scene(TEST_VDC_DSUID, 5, frame,
+                                           sizeof(frame));
+
+    /* first messages may size the arena */
+    for (i = 0; i < 10; i++)
+    {
+        vdsm_sim_send_raw(fd, frame, len);
+        dsvdc_work(handle, 1);
+    }
+    dsvdc_get_stats(handle, &warm);
+
+    for (i = 0; i < 100; i++)
+    {
+        vdsm_sim_send_raw(fd, frame, len);
+        dsvdc_work(handle, 1);
+    }
+    dsvdc_get_stats(handle, &stats);
+
+    ck_assert_msg(count == 110, "expected 110 messages, got %d", count);
+    ck_assert_msg(stats.rx_messages - warm.rx_messages == 100,
+                  "message counter mismatch");
+    ck_assert_msg(stats.rx_decoder_allocs - warm.rx_decoder_allocs >= 100,
+                  "decoder allocations not counted");
+    ck_assert_msg(stats.rx_heap_allocs == warm.rx_heap_allocs,
+                  "steady state receive allocated %llu times from the heap",
+                  (unsigned long long)(stats.rx_heap_allocs -
+                                       warm.rx_heap_allocs));
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+typedef struct send_results
+{
+    int sent;
+    int dropped;
+} send_results_t;
+
+static void count_send_complete(dsvdc_t *handle, uint32_t message_id,
+                                int code, void *userdata)
+{
+    send_results_t *results = (send_results_t *)userdata;
+    (void)handle;
+    (void)message_id;
+    if (code == DSVDC_OK)
+    {
+        results->sent++;
+    }
+    else
+    {
+        results->dropped++;
+    }
+}
+
+/* fill the send queue of a vdSM that does not read, returns the number of
+ * accepted messages or -1 if a push failed for another reason */
+static int fill_send_queue(dsvdc_t *handle, dsvdc_property_t *property)
+{
+    int accepted = 0;
+    int i;
+
+    for (i = 0; i < 100000; i++)
+    {
+        int ret = dsvdc_push_property(handle, TEST_VDC_DSUID, property);
+        if (ret == DSVDC_ERR_QUEUE_FULL)
+        {
+            break;
+        }
+        else if (ret != DSVDC_OK)
+        {
+            return -1;
+        }
+        accepted++;
+    }
+
+    return accepted;
+}
+
+START_TEST(test_send_queue)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    dsvdc_stats_t stats;
+    send_results_t results;
+    uint8_t blob[4000];
+    unsigned char buf[65536];
+    size_t bytes;
+    size_t messages;
+    int i;
+
+    memset(&results, 0, sizeof(results));
+    memset(blob, 0x55, sizeof(blob));
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &results,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_send_complete_callback(handle, count_send_complete);
+    ck_assert_msg(dsvdc_set_send_queue_limit(handle, 32768) == DSVDC_OK,
+                  "could not set queue limit");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+    ck_assert_msg(results.sent == 1, "hello response not reported");
+    results.sent = 0;
+
+    ck_assert_msg(dsvdc_property_new(&property) == DSVDC_OK,
+                  "could not allocate property");
+    dsvdc_property_add_bytes(property, "blob", blob, sizeof(blob));
+
+    /* the vdSM does not read, sending must not block once the socket buffer
+     * is full, messages are queued up to the limit instead */
+    uint64_t start = vdsm_sim_now_us();
+    int accepted = fill_send_queue(handle, property);
+    ck_assert_msg(accepted > 0, "could not fill send queue");
+    ck_assert_msg(vdsm_sim_now_us() - start < 1000000,
+                  "sending blocked on a full socket");
+
+    dsvdc_get_send_queue(handle, &bytes, &messages);
+    ck_assert_msg((bytes > 0) && (bytes <= 32768), "queue holds %zu bytes",
+                  bytes);
+    ck_assert_msg(messages > 0, "queue is empty");
+    dsvdc_get_stats(handle, &stats);
+    ck_assert_msg(stats.tx_rejected == 1, "rejection not counted");
+    ck_assert_msg(stats.tx_queued >= messages, "queued messages not counted");
+
+    /* once the vdSM reads, the loop flushes the queue */
+    for (i = 0; (i < 1000) && (results.sent < accepted); i++)
+    {
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+        dsvdc_work(handle, 0);
+    }
+
+    dsvdc_get_send_queue(handle, &bytes, &messages);
+    ck_assert_msg((bytes == 0) && (messages == 0), "queue was not flushed");
+    ck_assert_msg(results.sent == accepted, "%d of %d messages completed",
+                  results.sent, accepted);
+    ck_assert_msg(results.dropped == 0, "messages dropped");
+
+    /* queued messages are reported as dropped when the connection closes */
+    results.sent = 0;
+    accepted = fill_send_queue(handle, property);
+    dsvdc_get_send_queue(handle, NULL, &messages);
+    close(fd);
+    for (i = 0; (i < 100) && dsvdc_has_session(handle); i++)
+    {
+        dsvdc_work(handle, 0);
+    }
+
+    ck_assert_msg(!dsvdc_has_session(handle), "session did not end");
+    ck_assert_msg(results.dropped == (int)messages,
+                  "%d of %zu queued messages reported as dropped",
+                  results.dropped, messages);
+    ck_assert_msg(results.sent + results.dropped == accepted,
+                  "not all messages were reported");
+
+    dsvdc_property_free(property);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+START_TEST(test_pong_priority)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    vdsm_sim_stream_t *stream;
+    uint8_t blob[4000];
+    size_t queued;
+    int pushes = 0;
+    int i;
+
+    memset(blob, 0x55, sizeof(blob));
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, NULL,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    ck_assert_msg(dsvdc_property_new(&property) == DSVDC_OK,
+                  "could not allocate property");
+    dsvdc_property_add_bytes(property, "blob", blob, sizeof(blob));
+
+    /* saturate the bulk lane, then ping while the vdSM is not reading */
+    int accepted = fill_send_queue(handle, property);
+    ck_assert_msg(accepted > 0, "could not fill send queue");
+    dsvdc_get_send_queue(handle, NULL, &queued);
+    ck_assert_msg(queued > 1, "bulk lane not saturated");
+
+    ck_assert_msg(vdsm_sim_send_ping(fd, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    dsvdc_work(handle, 1);
+
+    /* the pong must overtake everything that is still queued, only the
+     * frames that were handed to the socket and one partially written frame
+     * may arrive before it */
+    stream = malloc(sizeof(vdsm_sim_stream_t));
+    vdsm_sim_stream_init(stream, fd);
+    uint64_t start = vdsm_sim_now_us();
+    uint64_t latency = 0;
+    for (i = 0; (i < 100000) && (latency == 0); i++)
+    {
+        Vdcapi__Message *msg = vdsm_sim_stream_next(stream);
+        if (!msg)
+        {
+            dsvdc_work(handle, 0);
+            continue;
+        }
+
+        if (msg->type == VDCAPI__TYPE__VDC_SEND_PONG)
+        {
+            latency = vdsm_sim_now_us() - start;
+        }
+        else
+        {
+            pushes++;
+        }
+        vdcapi__message__free_unpacked(msg, NULL);
+    }
+
+    ck_assert_msg(latency > 0, "no pong received");
+    ck_assert_msg(pushes <= accepted - (int)queued + 1,
+                  "pong waited behind %d pushed properties, only %d were "
+                  "sent before the ping", pushes, accepted - (int)queued + 1);
+    ck_assert_msg(latency < 1000000, "pong took %llu us",
+                  (unsigned long long)latency);
+
+    free(stream);
+    close(fd);
+    dsvdc_property_free(property);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+typedef struct session_ids
+{
+    unsigned int ids[4];
+    int n;
+} session_ids_t;
+
+static void track_new_session(dsvdc_t *handle, void *userdata)
+{
+    session_ids_t *sessions = (session_ids_t *)userdata;
+    if (sessions->n < 4)
+    {
+        sessions->ids[sessions->n++] = dsvdc_get_current_session(handle);
+    }
+}
+
+START_TEST(test_multiple_sessions)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    session_ids_t sessions;
+    char dsuid[64];
+    int i;
+
+    memset(&sessions, 0, sizeof(sessions));
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &sessions,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_new_session_callback(handle, track_new_session);
+    ck_assert_msg(dsvdc_set_max_sessions(handle, 2) == DSVDC_OK,
+                  "could not set session limit");
+
+    int fd1 = connect_session(handle);
+    int fd2 = connect_session(handle);
+    ck_assert_msg((fd1 >= 0) && (fd2 >= 0), "could not establish sessions");
+    ck_assert_msg(dsvdc_get_session_count(handle) == 2,
+                  "expected 2 sessions, got %u",
+                  dsvdc_get_session_count(handle));
+    ck_assert_msg(sessions.n == 2, "new session callback triggered %d times",
+                  sessions.n);
+    ck_assert_msg((sessions.ids[0] != 0) && (sessions.ids[1] != 0) &&
+                  (sessions.ids[0] != sessions.ids[1]),
+                  "invalid session ids %u, %u", sessions.ids[0],
+                  sessions.ids[1]);
+    ck_assert_msg(dsvdc_get_current_session(handle) == 0,
+                  "current session outside of a callback");
+    ck_assert_msg(dsvdc_get_vdsm_dsuid(handle, sessions.ids[1], dsuid,
+                  sizeof(dsuid)) == DSVDC_OK, "no vdSM dSUID for session");
+    ck_assert_msg(strcmp(dsuid, VDSM_SIM_DSUID) == 0,
+                  "unexpected vdSM dSUID %s", dsuid);
+
+    /* messages the vDC sends on its own go to all sessions */
+    ck_assert_msg(dsvdc_property_new(&property) == DSVDC_OK,
+                  "could not allocate property");
+    ck_assert_msg(dsvdc_push_property(handle, TEST_VDC_DSUID, property) ==
+                  DSVDC_OK, "could not push property");
+    dsvdc_property_free(property);
+
+    int fds[2] = { fd1, fd2 };
+    for (i = 0; i < 2; i++)
+    {
+        Vdcapi__Message *msg = vdsm_sim_recv(fds[i], 1000);
+        ck_assert_msg(msg != NULL, "session %d did not get the push", i);
+        ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PUSH_PROPERTY,
+                      "unexpected message %d", msg->type);
+        vdcapi__message__free_unpacked(msg, NULL);
+    }
+
+    /* responses only go back to the session that asked */
+    ck_assert_msg(vdsm_sim_send_ping(fd2, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    Vdcapi__Message *msg = NULL;
+    for (i = 0; (i < 10) && !msg; i++)
+    {
+        dsvdc_work(handle, 1);
+        msg = vdsm_sim_recv(fd2, 0);
+    }
+    ck_assert_msg(msg != NULL, "no pong received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PONG,
+                  "unexpected reply %d to ping", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+    ck_assert_msg(vdsm_sim_recv(fd1, 100) == NULL,
+                  "pong went to the wrong session");
+
+    /* no free session slot */
+    int fd3 = vdsm_sim_connect(handle);
+    ck_assert_msg(fd3 >= 0, "could not connect to vDC");
+    dsvdc_work(handle, 1);
+    msg = vdsm_sim_recv(fd3, 1000);
+    ck_assert_msg(msg != NULL, "excess connection not answered");
+    ck_assert_msg((msg->type == VDCAPI__TYPE__GENERIC_RESPONSE) &&
+                  (msg->generic_response->code ==
+                   VDCAPI__RESULT_CODE__ERR_SERVICE_NOT_AVAILABLE),
+                  "excess connection was not refused");
+    vdcapi__message__free_unpacked(msg, NULL);
+    close(fd3);
+
+    /* the remaining session is not affected when another one goes away */
+    close(fd1);
+    for (i = 0; (i < 10) && (dsvdc_get_session_count(handle) > 1); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(dsvdc_get_session_count(handle) == 1,
+                  "closed session still counted");
+    ck_assert_msg(dsvdc_has_session(handle), "all sessions ended");
+
+    ck_assert_msg(vdsm_sim_send_ping(fd2, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    msg = NULL;
+    for (i = 0; (i < 10) && !msg; i++)
+    {
+        dsvdc_work(handle, 1);
+        msg = vdsm_sim_recv(fd2, 0);
+    }
+    ck_assert_msg(msg != NULL, "no pong after the other session closed");
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    close(fd2);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+/* complete the handshake and a ping over the given transport */
+static void check_transport(const dsvdc_options_t *options)
+{
+    dsvdc_t *handle;
+    int i;
+
+    ck_assert_msg(dsvdc_new_ex(TEST_VDC_DSUID, options, &handle) == DSVDC_OK,
+                  "dsvdc_new_ex() failed for transport %d",
+                  options->transport);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session over transport %d",
+                  options->transport);
+
+    ck_assert_msg(vdsm_sim_send_ping(fd, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    Vdcapi__Message *msg = NULL;
+    for (i = 0; (i < 10) && !msg; i++)
+    {
+        dsvdc_work(handle, 1);
+        msg = vdsm_sim_recv(fd, 0);
+    }
+    ck_assert_msg(msg != NULL, "no pong over transport %d",
+                  options->transport);
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PONG,
+                  "unexpected reply %d to ping", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+
+START_TEST(test_transports)
+{
+    dsvdc_options_t options;
+    dsvdc_t *first;
+    dsvdc_t *second;
+    char path[64];
+
+    dsvdc_options_init(&options);
+    options.noauto = true;
+    options.transport = DSVDC_TRANSPORT_TCP6;
+
+    /* the preferred port is taken by the first instance */
+    ck_assert_msg(dsvdc_new_ex(TEST_VDC_DSUID, &options, &first) == DSVDC_OK,
+                  "dsvdc_new_ex() failed");
+    check_transport(&options);
+    dsvdc_cleanup(first);
+
+    options.transport = DSVDC_TRANSPORT_UNIX;
+    snprintf(path, sizeof(path), "@dsvdc-test-%d", (int)getpid());
+    options.path = path;
+    check_transport(&options);
+
+    snprintf(path, sizeof(path), "/tmp/dsvdc-test-%d.sock", (int)getpid());
+    check_transport(&options);
+    ck_assert_msg(access(path, F_OK) != 0, "socket file was not removed");
+
+    /* the socket of a running instance is not taken over */
+    ck_assert_msg(dsvdc_new_ex(TEST_VDC_DSUID, &options, &first) == DSVDC_OK,
+                  "dsvdc_new_ex() failed");
+    ck_assert_msg(dsvdc_new_ex(TEST_VDC_DSUID, &options, &second) ==
+                  DSVDC_ERR_SOCKET, "socket of a running instance taken");
+    int fd = connect_session(first);
+    ck_assert_msg(fd >= 0, "running instance became unreachable");
+    close(fd);
+    dsvdc_cleanup(first);
+
+    /* while a socket nobody listens on is replaced */
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ck_assert_msg((fd >= 0) &&
+                  (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0),
+                  "could not create stale socket");
+    close(fd);
+    check_transport(&options);
+
+    options.path = NULL;
+    ck_assert_msg(dsvdc_new_ex(TEST_VDC_DSUID, &options, &first) ==
+                  DSVDC_ERR_PARAM, "Unix transport without a path accepted");
+}
+END_TEST
+
+typedef struct io_thread_state
+{
+    dsvdc_t *handle;
+    pthread_t dispatcher;
+    int completed;
+    int ended;
+    bool foreign;
+} io_thread_state_t;
+
+static void io_send_complete(dsvdc_t *handle, uint32_t message_id, int code,
+                             void *userdata)
+{
+    io_thread_state_t *state = (io_thread_state_t *)userdata;
+    (void)handle;
+    (void)message_id;
+
+    if (!pthread_equal(pthread_self(), state->dispatcher))
+    {
+        state->foreign = true;
+    }
+    if (code == DSVDC_OK)
+    {
+        state->completed++;
+    }
+}
+
+static void io_end_session(dsvdc_t *handle, void *userdata)
+{
+    io_thread_state_t *state = (io_thread_state_t *)userdata;
+
+    if (!pthread_equal(pthread_self(), state->dispatcher) ||
+        (dsvdc_get_current_session(handle) == 0))
+    {
+        state->foreign = true;
+    }
+    state->ended++;
+}
+
+static void *io_push_property(void *arg)
+{
+    io_thread_state_t *state = (io_thread_state_t *)arg;
+    dsvdc_property_t *property;
+
+    if (dsvdc_property_new(&property) != DSVDC_OK)
+    {
+        return NULL;
+    }
+    dsvdc_property_add_uint(property, "value", 1);
+    dsvdc_push_property(state->handle, TEST_VDC_DSUID, property);
+    dsvdc_property_free(property);
+    return NULL;
+}
+
+START_TEST(test_io_thread)
+{
+    dsvdc_t *handle;
+    io_thread_state_t state;
+    struct pollfd pfd;
+    pthread_t sender;
+    size_t nfds = 1;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    state.dispatcher = pthread_self();
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    state.handle = handle;
+    dsvdc_set_send_complete_callback(handle, io_send_complete);
+    dsvdc_set_end_session_callback(handle, io_end_session);
+
+    ck_assert_msg(dsvdc_stop_io_thread(handle) == DSVDC_ERR_PARAM,
+                  "stopped an I/O thread that was not started");
+    ck_assert_msg(dsvdc_start_io_thread(handle) == DSVDC_OK,
+                  "could not start I/O thread");
+    ck_assert_msg(dsvdc_start_io_thread(handle) == DSVDC_ERR_PARAM,
+                  "started a second I/O thread");
+    ck_assert_msg(dsvdc_set_io_backend(handle, DSVDC_IO_BACKEND_DEFAULT) ==
+                  DSVDC_ERR_PARAM, "switched backend under the I/O thread");
+
+    /* only the event pipe is left for an external loop */
+    ck_assert_msg((dsvdc_get_pollfds(handle, &pfd, &nfds) == DSVDC_OK) &&
+                  (nfds == 1), "expected one descriptor, got %zu", nfds);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    /* another thread sends, the I/O thread writes it without our help */
+    ck_assert_msg(pthread_create(&sender, NULL, io_push_property,
+                  &state) == 0, "could not start sender thread");
+    pthread_join(sender, NULL);
+    Vdcapi__Message *msg = vdsm_sim_recv(fd, 1000);
+    ck_assert_msg(msg != NULL, "push from another thread not received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PUSH_PROPERTY,
+                  "unexpected message %d", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    /* completions are dispatched on the thread that calls dsvdc_work() */
+    for (i = 0; (i < 10) && (state.completed < 2); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(state.completed == 2, "expected 2 completions, got %d",
+                  state.completed);
+
+    ck_assert_msg(vdsm_sim_send_ping(fd, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    msg = NULL;
+    for (i = 0; (i < 10) && !msg; i++)
+    {
+        dsvdc_work(handle, 1);
+        msg = vdsm_sim_recv(fd, 100);
+    }
+    ck_assert_msg(msg != NULL, "no pong received");
+    ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_PONG,
+                  "unexpected reply %d to ping", msg->type);
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    /* back to dsvdc_work() driving the sockets */
+    ck_assert_msg(dsvdc_stop_io_thread(handle) == DSVDC_OK,
+                  "could not stop I/O thread");
+    ck_assert_msg(vdsm_sim_send_ping(fd, TEST_VDC_DSUID) == 0,
+                  "could not send ping");
+    msg = NULL;
+    for (i = 0; (i < 10) && !msg; i++)
+    {
+        dsvdc_work(handle, 1);
+        msg = vdsm_sim_recv(fd, 0);
+    }
+    ck_assert_msg(msg != NULL, "no pong after stopping the I/O thread");
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    ck_assert_msg(dsvdc_start_io_thread(handle) == DSVDC_OK,
+                  "could not restart I/O thread");
+    close(fd);
+    for (i = 0; (i < 10) && (state.ended == 0); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(state.ended == 1, "end of session not dispatched");
+    ck_assert_msg(!state.foreign, "callback ran on the wrong thread");
+
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_REQUESTS   200
+#define TEST_UNANSWERED 10
+
+typedef struct request_state
+{
+    int codes[TEST_REQUESTS];
+    int answered;
+    int timed_out;
+} request_state_t;
+
+static void track_request(dsvdc_t *handle, int code, void *arg,
+                          void *userdata)
+{
+    request_state_t *state = (request_state_t *)userdata;
+    (void)handle;
+
+    state->codes[(intptr_t)arg] = code;
+    if (code == DSVDC_ERR_TIMEOUT)
+    {
+        state->timed_out++;
+    }
+    else
+    {
+        state->answered++;
+    }
+}
+
+START_TEST(test_request_tracking)
+{
+    dsvdc_t *handle;
+    request_state_t state;
+    uint32_t ids[TEST_REQUESTS];
+    unsigned char burst[TEST_REQUESTS * 16];
+    size_t len = 0;
+    intptr_t i;
+
+    memset(&state, 0, sizeof(state));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    ck_assert_msg(dsvdc_set_request_timeout(handle, 0) == DSVDC_ERR_PARAM,
+                  "accepted a zero timeout");
+    ck_assert_msg(dsvdc_set_request_timeout(handle, 200) == DSVDC_OK,
+                  "could not set the request timeout");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    for (i = 0; i < TEST_REQUESTS; i++)
+    {
+        ck_assert_msg(dsvdc_announce_device(handle, TEST_VDC_DSUID,
+                      TEST_VDC_DSUID, (void *)i, track_request) == DSVDC_OK,
+                      "could not announce device %d", (int)i);
+    }
+
+    for (i = 0; i < TEST_REQUESTS; i++)
+    {
+        Vdcapi__Message *msg = NULL;
+        int n;
+        for (n = 0; (n < 10) && !msg; n++)
+        {
+            msg = vdsm_sim_recv(fd, 100);
+            if (!msg)
+            {
+                dsvdc_work(handle, 1);
+            }
+        }
+        ck_assert_msg(msg != NULL, "announcement %d not received", (int)i);
+        ids[i] = msg->message_id;
+        vdcapi__message__free_unpacked(msg, NULL);
+    }
+
+    /* answered in reverse order, the last ones never */
+    for (i = TEST_REQUESTS - TEST_UNANSWERED - 1; i >= 0; i--)
+    {
+        Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+        Vdcapi__GenericResponse response = VDCAPI__GENERIC_RESPONSE__INIT;
+
+        reply.type = VDCAPI__TYPE__GENERIC_RESPONSE;
+        reply.message_id = ids[i];
+        reply.has_message_id = 1;
+        reply.generic_response = &response;
+        len += vdsm_sim_frame(&reply, burst + len, sizeof(burst) - len);
+    }
+    ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0, "could not send");
+
+    uint64_t start = vdsm_sim_now_us();
+    for (i = 0; (i < 100) &&
+                (state.answered < TEST_REQUESTS - TEST_UNANSWERED); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(state.answered == TEST_REQUESTS - TEST_UNANSWERED,
+                  "expected %d responses, got %d",
+                  TEST_REQUESTS - TEST_UNANSWERED, state.answered);
+    ck_assert_msg(state.codes[0] == DSVDC_OK, "response not matched");
+
+    int next = dsvdc_next_timeout_ms(handle);
+    ck_assert_msg((next >= 0) && (next <= 200),
+                  "next timeout %d ms not within the request timeout", next);
+
+    /* dsvdc_work() wakes up for the expiry, not after its own timeout */
+    while ((state.timed_out < TEST_UNANSWERED) &&
+           (vdsm_sim_now_us() - start < 2000000))
+    {
+        dsvdc_work(handle, 5);
+    }
+    ck_assert_msg(state.timed_out == TEST_UNANSWERED,
+                  "expected %d timeouts, got %d", TEST_UNANSWERED,
+                  state.timed_out);
+    ck_assert_msg(vdsm_sim_now_us() - start < 1000000,
+                  "requests timed out late");
+    ck_assert_msg(state.codes[TEST_REQUESTS - 1] == DSVDC_ERR_TIMEOUT,
+                  "unanswered request not failed");
+    ck_assert_msg(dsvdc_next_timeout_ms(handle) < 0,
+                  "timer left after all requests completed");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_POOL_SIZE  8
+
+START_TEST(test_request_pool)
+{
+    dsvdc_t *handle;
+    dsvdc_stats_t stats;
+    request_state_t state;
+    intptr_t i;
+
+    memset(&state, 0, sizeof(state));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    ck_assert_msg(dsvdc_set_max_requests(handle, 0) == DSVDC_ERR_PARAM,
+                  "accepted an empty pool");
+    ck_assert_msg(dsvdc_set_max_requests(handle, TEST_POOL_SIZE) == DSVDC_OK,
+                  "could not set the request limit");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    for (i = 0; i < TEST_POOL_SIZE; i++)
+    {
+        ck_assert_msg(dsvdc_announce_device(handle, TEST_VDC_DSUID,
+                      TEST_VDC_DSUID, (void *)i, track_request) == DSVDC_OK,
+                      "could not announce device %d", (int)i);
+    }
+    ck_assert_msg(dsvdc_announce_device(handle, TEST_VDC_DSUID,
+                  TEST_VDC_DSUID, (void *)i, track_request) ==
+                  DSVDC_ERR_TOO_MANY_REQUESTS, "request beyond the limit sent");
+    ck_assert_msg(dsvdc_set_max_requests(handle, 2 * TEST_POOL_SIZE) ==
+                  DSVDC_ERR_PARAM, "pool resized while requests are pending");
+
+    dsvdc_get_stats(handle, &stats);
+    ck_assert_msg(stats.requests_pending == TEST_POOL_SIZE,
+                  "%u requests pending", (unsigned int)stats.requests_pending);
+    ck_assert_msg(stats.requests_peak == TEST_POOL_SIZE,
+                  "peak of %u requests", (unsigned int)stats.requests_peak);
+    ck_assert_msg(stats.requests_rejected == 1,
+                  "%u requests rejected",
+                  (unsigned int)stats.requests_rejected);
+
+    /* only the announcements within the limit went out */
+    Vdcapi__Message *msg = NULL;
+    for (i = 0; i < 10 && !msg; i++)
+    {
+        msg = vdsm_sim_recv(fd, 100);
+        if (!msg)
+        {
+            dsvdc_work(handle, 1);
+        }
+    }
+    ck_assert_msg(msg != NULL, "announcement not received");
+
+    Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+    Vdcapi__GenericResponse response = VDCAPI__GENERIC_RESPONSE__INIT;
+    reply.type = VDCAPI__TYPE__GENERIC_RESPONSE;
+    reply.message_id = msg->message_id;
+    reply.has_message_id = 1;
+    reply.generic_response = &response;
+    ck_assert_msg(vdsm_sim_send(fd, &reply) == 0, "could not send response");
+    vdcapi__message__free_unpacked(msg, NULL);
+
+    for (i = 0; (i < 100) && (state.answered == 0); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(state.answered == 1, "response not matched");
+
+    /* the answered request made room for another one */
+    dsvdc_get_stats(handle, &stats);
+    ck_assert_msg(stats.requests_pending == TEST_POOL_SIZE - 1,
+                  "%u requests pending", (unsigned int)stats.requests_pending);
+    ck_assert_msg(dsvdc_announce_device(handle, TEST_VDC_DSUID,
+                  TEST_VDC_DSUID, (void *)i, track_request) == DSVDC_OK,
+                  "released entry not reused");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+    ck_assert_msg(state.answered == TEST_POOL_SIZE + 1,
+                  "pending requests not failed on cleanup");
+}
+END_TEST
+
+#define TEST_BULK_DEVICES   100
+#define TEST_BULK_WINDOW    16
+
+typedef struct bulk_state
+{
+    int reported[TEST_BULK_DEVICES];
+    int codes[TEST_BULK_DEVICES];
+    size_t done;
+} bulk_state_t;
+
+static void bulk_progress(dsvdc_t *handle, size_t index, int code, void *arg,
+                          void *userdata)
+{
+    bulk_state_t *state = (bulk_state_t *)arg;
+    (void)handle;
+    (void)userdata;
+
+    state->reported[index]++;
+    state->codes[index] = code;
+    state->done++;
+}
+
+START_TEST(test_bulk_announce)
+{
+    dsvdc_t *handle;
+    dsvdc_stats_t before;
+    dsvdc_stats_t after;
+    bulk_state_t state;
+    char names[TEST_BULK_DEVICES][35];
+    const char *dsuids[TEST_BULK_DEVICES];
+    size_t received = 0;
+    size_t answered = 0;
+    size_t i;
+
+    memset(&state, 0, sizeof(state));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, NULL,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+
+    for (i = 0; i < TEST_BULK_DEVICES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%034zx", i);
+        dsuids[i] = names[i];
+    }
+
+    ck_assert_msg(dsvdc_announce_devices(handle, TEST_VDC_DSUID, dsuids,
+                  TEST_BULK_DEVICES, TEST_BULK_WINDOW, &state,
+                  bulk_progress) == DSVDC_ERR_NOT_CONNECTED,
+                  "announced without a session");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    dsvdc_get_stats(handle, &before);
+    ck_assert_msg(dsvdc_announce_devices(handle, TEST_VDC_DSUID, dsuids,
+                  TEST_BULK_DEVICES, TEST_BULK_WINDOW, &state,
+                  bulk_progress) == DSVDC_OK, "could not start announcement");
+
+    /* the vdSM answers everything it got so far at once */
+    uint64_t start = vdsm_sim_now_us();
+    while ((state.done < TEST_BULK_DEVICES) &&
+           (vdsm_sim_now_us() - start < 3000000))
+    {
+        unsigned char burst[TEST_BULK_WINDOW * 16];
+        size_t len = 0;
+        Vdcapi__Message *msg;
+
+        while ((msg = vdsm_sim_recv(fd, 10)) != NULL)
+        {
+            ck_assert_msg(msg->type == VDCAPI__TYPE__VDC_SEND_ANNOUNCE_DEVICE,
+                          "unexpected message %d", msg->type);
+            received++;
+            ck_assert_msg(received - answered <= TEST_BULK_WINDOW,
+                          "%zu announcements outstanding",
+                          received - answered);
+
+            Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+            Vdcapi__GenericResponse response = VDCAPI__GENERIC_RESPONSE__INIT;
+            reply.type = VDCAPI__TYPE__GENERIC_RESPONSE;
+            reply.message_id = msg->message_id;
+            reply.has_message_id = 1;
+            reply.generic_response = &response;
+            len += vdsm_sim_frame(&reply, burst + len, sizeof(burst) - len);
+            vdcapi__message__free_unpacked(msg, NULL);
+        }
+
+        if (len > 0)
+        {
+            ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0,
+                          "could not send responses");
+            answered = received;
+        }
+        dsvdc_work(handle, 1);
+    }
+
+    ck_assert_msg(state.done == TEST_BULK_DEVICES, "%zu of %d devices done",
+                  state.done, TEST_BULK_DEVICES);
+    ck_assert_msg(received == TEST_BULK_DEVICES, "%zu announcements sent",
+                  received);
+    for (i = 0; i < TEST_BULK_DEVICES; i++)
+    {
+        ck_assert_msg(state.reported[i] == 1, "device %zu reported %d times",
+                      i, state.reported[i]);
+        ck_assert_msg(state.codes[i] == DSVDC_OK, "device %zu failed: %d", i,
+                      state.codes[i]);
+    }
+
+    /* announcements of one round share a write */
+    dsvdc_get_stats(handle, &after);
+    ck_assert_msg(after.tx_syscalls - before.tx_syscalls <
+                  TEST_BULK_DEVICES / 4, "%u writes for %d announcements",
+                  (unsigned int)(after.tx_syscalls - before.tx_syscalls),
+                  TEST_BULK_DEVICES);
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_NESTED_PUSHES      8
+#define TEST_NESTED_DEVICES     4
+
+typedef struct nested_state
+{
+    dsvdc_property_t *property;
+    bulk_state_t bulk;
+    int sent;
+    int dropped;
+    int pushed;
+    bool announced;
+} nested_state_t;
+
+/* sends again while the send queue is being flushed */
+static void nested_send_complete(dsvdc_t *handle, uint32_t message_id,
+                                 int code, void *userdata)
+{
+    nested_state_t *state = (nested_state_t *)userdata;
+    const char *dsuids[TEST_NESTED_DEVICES];
+    char names[TEST_NESTED_DEVICES][35];
+    size_t i;
+    (void)message_id;
+
+    if (code != DSVDC_OK)
+    {
+        state->dropped++;
+        return;
+    }
+    state->sent++;
+
+    if (!state->property)
+    {
+        return;
+    }
+
+    if ((state->pushed < TEST_NESTED_PUSHES) &&
+        (dsvdc_push_property(handle, TEST_VDC_DSUID,
+                             state->property) == DSVDC_OK))
+    {
+        state->pushed++;
+    }
+
+    /* a corked batch is flushed when the announcement returns */
+    if (!state->announced)
+    {
+        state->announced = true;
+        for (i = 0; i < TEST_NESTED_DEVICES; i++)
+        {
+            snprintf(names[i], sizeof(names[i]), "%034zx", i);
+            dsuids[i] = names[i];
+        }
+        ck_assert_msg(dsvdc_announce_devices(handle, TEST_VDC_DSUID, dsuids,
+                      TEST_NESTED_DEVICES, TEST_NESTED_DEVICES, &state->bulk,
+                      bulk_progress) == DSVDC_OK,
+                      "could not announce from the callback");
+    }
+}
+
+START_TEST(test_nested_send)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *property;
+    vdsm_sim_stream_t *stream;
+    nested_state_t state;
+    uint8_t blob[1000];
+    size_t bytes;
+    size_t messages;
+    int pushes = 0;
+    int announcements = 0;
+
+    memset(&state, 0, sizeof(state));
+    memset(blob, 0x55, sizeof(blob));
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_send_complete_callback(handle, nested_send_complete);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+    state.sent = 0;
+
+    ck_assert_msg(dsvdc_property_new(&property) == DSVDC_OK,
+                  "could not allocate property");
+    dsvdc_property_add_bytes(property, "blob", blob, sizeof(blob));
+
+    /* the queue is flushed with many messages per write, each completion
+     * sends again */
+    int accepted = fill_send_queue(handle, property);
+    ck_assert_msg(accepted > 0, "could not fill send queue");
+    state.property = property;
+
+    stream = malloc(sizeof(vdsm_sim_stream_t));
+    vdsm_sim_stream_init(stream, fd);
+    uint64_t start = vdsm_sim_now_us();
+    while (((pushes < accepted + state.pushed) ||
+            (state.bulk.done < TEST_NESTED_DEVICES)) &&
+           (vdsm_sim_now_us() - start < 3000000))
+    {
+        Vdcapi__Message *msg = vdsm_sim_stream_next(stream);
+        if (!msg)
+        {
+            dsvdc_work(handle, 0);
+            continue;
+        }
+
+        if (msg->type == VDCAPI__TYPE__VDC_SEND_PUSH_PROPERTY)
+        {
+            pushes++;
+        }
+        else
+        {
+            ck_assert_msg(msg->type ==
+                          VDCAPI__TYPE__VDC_SEND_ANNOUNCE_DEVICE,
+                          "unexpected message %d", msg->type);
+            announcements++;
+
+            Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+            Vdcapi__GenericResponse response =
+                VDCAPI__GENERIC_RESPONSE__INIT;
+            reply.type = VDCAPI__TYPE__GENERIC_RESPONSE;
+            reply.message_id = msg->message_id;
+            reply.has_message_id = 1;
+            reply.generic_response = &response;
+            ck_assert_msg(vdsm_sim_send(fd, &reply) == 0,
+                          "could not send response");
+        }
+        vdcapi__message__free_unpacked(msg, NULL);
+    }
+
+    ck_assert_msg(state.pushed == TEST_NESTED_PUSHES,
+                  "%d properties pushed from the callback", state.pushed);
+    ck_assert_msg(pushes == accepted + state.pushed,
+                  "%d of %d pushed properties arrived", pushes,
+                  accepted + state.pushed);
+    ck_assert_msg(announcements == TEST_NESTED_DEVICES,
+                  "%d announcements arrived", announcements);
+    ck_assert_msg(state.bulk.done == TEST_NESTED_DEVICES,
+                  "%zu of %d devices done", state.bulk.done,
+                  TEST_NESTED_DEVICES);
+
+    /* every message is reported once, after the queue is consistent */
+    dsvdc_get_send_queue(handle, &bytes, &messages);
+    ck_assert_msg((bytes == 0) && (messages == 0),
+                  "queue holds %zu bytes in %zu messages", bytes, messages);
+    ck_assert_msg(state.sent == accepted + state.pushed + TEST_NESTED_DEVICES,
+                  "%d of %d messages completed", state.sent,
+                  accepted + state.pushed + TEST_NESTED_DEVICES);
+    ck_assert_msg(state.dropped == 0, "messages dropped");
+
+    free(stream);
+    close(fd);
+    state.property = NULL;
+    dsvdc_property_free(property);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_REGISTRY_DEVICES   20
+
+/* answers the announcements that arrived, returns how many of them there
+ * were and counts containers and devices */
+static size_t answer_announcements(int fd, size_t *containers,
+                                   size_t *devices)
+{
+    unsigned char burst[64 * 16];
+    size_t len = 0;
+    size_t n = 0;
+    Vdcapi__Message *msg;
+
+    while ((n < 64) && ((msg = vdsm_sim_recv(fd, 10)) != NULL))
+    {
+        if (msg->type == VDCAPI__TYPE__VDC_SEND_ANNOUNCE_VDC)
+        {
+            (*containers)++;
+        }
+        else if (msg->type == VDCAPI__TYPE__VDC_SEND_ANNOUNCE_DEVICE)
+        {
+            (*devices)++;
+        }
+
+        Vdcapi__Message reply = VDCAPI__MESSAGE__INIT;
+        Vdcapi__GenericResponse response = VDCAPI__GENERIC_RESPONSE__INIT;
+        reply.type = VDCAPI__TYPE__GENERIC_RESPONSE;
+        reply.message_id = msg->message_id;
+        reply.has_message_id = 1;
+        reply.generic_response = &response;
+        len += vdsm_sim_frame(&reply, burst + len, sizeof(burst) - len);
+        vdcapi__message__free_unpacked(msg, NULL);
+        n++;
+    }
+
+    if (len > 0)
+    {
+        vdsm_sim_send_raw(fd, burst, len);
+    }
+    return n;
+}
+
+START_TEST(test_device_registry)
+{
+    dsvdc_t *handle;
+    dsvdc_stats_t stats;
+    dsvdc_announce_status_t status;
+    char names[TEST_REGISTRY_DEVICES][35];
+    size_t containers = 0;
+    size_t devices = 0;
+    size_t i;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, NULL,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+
+    ck_assert_msg(dsvdc_register_device(handle, TEST_VDC_DSUID,
+                  "00000000000000000000000000000000ff") == DSVDC_ERR_PARAM,
+                  "registered a device without its container");
+    ck_assert_msg(dsvdc_register_container(handle, TEST_VDC_DSUID) ==
+                  DSVDC_OK, "could not register container");
+    for (i = 0; i < TEST_REGISTRY_DEVICES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%034zx", i);
+        ck_assert_msg(dsvdc_register_device(handle, TEST_VDC_DSUID,
+                      names[i]) == DSVDC_OK, "could not register %s",
+                      names[i]);
+    }
+    ck_assert_msg(dsvdc_register_device(handle, TEST_VDC_DSUID, names[0]) ==
+                  DSVDC_OK, "registering again failed");
+    ck_assert_msg(dsvdc_register_container(handle, names[0]) ==
+                  DSVDC_ERR_PARAM, "device registered as container");
+    ck_assert_msg((dsvdc_get_announce_status(handle, names[0], &status) ==
+                  DSVDC_OK) && (status == DSVDC_ANNOUNCE_PENDING),
+                  "device not pending before the session");
+
+    /* everything is announced on its own after the handshake */
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    uint64_t start = vdsm_sim_now_us();
+    do
+    {
+        answer_announcements(fd, &containers, &devices);
+        dsvdc_work(handle, 1);
+        dsvdc_get_stats(handle, &stats);
+    } while ((stats.announce_rounds == 0) &&
+             (vdsm_sim_now_us() - start < 3000000));
+
+    ck_assert_msg(stats.announce_rounds == 1, "session not announced");
+    ck_assert_msg((containers == 1) && (devices == TEST_REGISTRY_DEVICES),
+                  "%zu containers and %zu devices announced", containers,
+                  devices);
+    for (i = 0; i < TEST_REGISTRY_DEVICES; i++)
+    {
+        ck_assert_msg((dsvdc_get_announce_status(handle, names[i],
+                      &status) == DSVDC_OK) && (status == DSVDC_ANNOUNCE_DONE),
+                      "device %zu not announced", i);
+    }
+
+    /* new devices go out while connected */
+    ck_assert_msg(dsvdc_register_device(handle, TEST_VDC_DSUID,
+                  "00000000000000000000000000000000ff") == DSVDC_OK,
+                  "could not register device while connected");
+    for (i = 0; (i < 100) && (devices == TEST_REGISTRY_DEVICES); i++)
+    {
+        answer_announcements(fd, &containers, &devices);
+        dsvdc_work(handle, 1);
+    }
+    for (i = 0; (i < 100) && (status != DSVDC_ANNOUNCE_DONE); i++)
+    {
+        dsvdc_work(handle, 1);
+        dsvdc_get_announce_status(handle,
+                    "00000000000000000000000000000000ff", &status);
+    }
+    ck_assert_msg(status == DSVDC_ANNOUNCE_DONE, "new device not announced");
+    ck_assert_msg((containers == 1) && (devices == TEST_REGISTRY_DEVICES + 1),
+                  "announced again: %zu containers and %zu devices",
+                  containers, devices);
+
+    ck_assert_msg(dsvdc_unregister(handle, TEST_VDC_DSUID) == DSVDC_OK,
+                  "could not unregister container");
+    ck_assert_msg(dsvdc_get_announce_status(handle, names[0], &status) ==
+                  DSVDC_ERR_DATA_NOT_FOUND, "device left after its container");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_DSUID_TARGETS      100
+
+typedef struct dsuid_targets
+{
+    dsvdc_dsuid_t ids[TEST_DSUID_TARGETS];
+    size_t n;
+    int calls;
+} dsuid_targets_t;
+
+static void record_call_scene_bin(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                                  size_t n_dsuid, int32_t scene, bool force,
+                                  int32_t group, int32_t zone_id,
+                                  void *userdata)
+{
+    dsuid_targets_t *targets = (dsuid_targets_t *)userdata;
+
+    (void)handle;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    memcpy(targets->ids, dsuid, n_dsuid * sizeof(dsvdc_dsuid_t));
+    targets->n = n_dsuid;
+    targets->calls++;
+}
+
+START_TEST(test_dsuid)
+{
+    dsvdc_t *handle;
+    dsvdc_dsuid_t a;
+    dsvdc_dsuid_t b;
+    char str[DSVDC_DSUID_BYTES * 2 + 1];
+    char bad[DSVDC_DSUID_BYTES * 2 + 1];
+    const char invalid[] = { 'g', 'G', ':', '/', '@', '`', ' ', '\x80' };
+    size_t i;
+    size_t j;
+
+    ck_assert_msg(dsvdc_dsuid_parse(VDSM_SIM_DSUID, &a) == DSVDC_OK,
+                  "could not parse %s", VDSM_SIM_DSUID);
+    ck_assert_msg((a.id[0] == 0x35) && (a.id[3] == 0x5f) &&
+                  (a.id[15] == 0x01) && (a.id[16] == 0x00),
+                  "wrong bytes parsed");
+    dsvdc_dsuid_format(&a, str);
+    ck_assert_msg(strcmp(str, "3504175fe0000000000000000000000100") == 0,
+                  "formatted as %s", str);
+
+    /* every byte value in every position survives the round trip */
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 0; j < DSVDC_DSUID_BYTES; j++)
+        {
+            a.id[j] = (uint8_t)(i + j * 37);
+        }
+        dsvdc_dsuid_format(&a, str);
+        ck_assert_msg((dsvdc_dsuid_parse(str, &b) == DSVDC_OK) &&
+                      dsvdc_dsuid_equal(&a, &b) &&
+                      (dsvdc_dsuid_hash(&a) == dsvdc_dsuid_hash(&b)),
+                      "round trip failed for %s", str);
+    }
+
+    /* a non hex digit is found in every position */
+    for (i = 0; i < strlen(str); i++)
+    {
+        for (j = 0; j < sizeof(invalid); j++)
+        {
+            strcpy(bad, str);
+            bad[i] = invalid[j];
+            ck_assert_msg(dsvdc_dsuid_parse(bad, &b) == DSVDC_ERR_PARAM,
+                          "accepted 0x%02x at %zu", (uint8_t)invalid[j], i);
+        }
+    }
+    strcpy(bad, str);
+    bad[33] = '\0';
+    ck_assert_msg(dsvdc_dsuid_parse(bad, &b) == DSVDC_ERR_PARAM,
+                  "accepted short dSUID");
+    ck_assert_msg(dsvdc_dsuid_parse("3504175fe00000000000000000000001000",
+                  &b) == DSVDC_ERR_PARAM, "accepted long dSUID");
+
+    b = a;
+    b.id[16] ^= 1;
+    ck_assert_msg(!dsvdc_dsuid_equal(&a, &b) &&
+                  (dsvdc_dsuid_hash(&a) != dsvdc_dsuid_hash(&b)),
+                  "last byte ignored");
+
+    /* the vdSM may write our dSUID in upper case */
+    ck_assert_msg(dsvdc_new(0, "3504175FE0000000000000000000000200", "test",
+                  true, NULL, &handle) == DSVDC_OK,
+                  "dsvdc_new() initialization failed");
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+    ck_assert_msg(vdsm_sim_send_ping(fd, "3504175Fe0000000000000000000000200")
+                  == 0, "could not send ping");
+    dsvdc_work(handle, 1);
+    Vdcapi__Message *reply = vdsm_sim_recv(fd, 1000);
+    ck_assert_msg(reply && (reply->type == VDCAPI__TYPE__VDC_SEND_PONG) &&
+                  (strcmp(reply->vdc_send_pong->dsuid, TEST_VDC_DSUID) == 0),
+                  "ping not answered with our dSUID");
+    vdcapi__message__free_unpacked(reply, NULL);
+    close(fd);
+    dsvdc_cleanup(handle);
+
+    /* binary targets, more than fit on the stack, the invalid one is left
+     * out */
+    dsuid_targets_t *targets = calloc(1, sizeof(dsuid_targets_t));
+    char names[TEST_DSUID_TARGETS][DSVDC_DSUID_BYTES * 2 + 1];
+    char *dsuids[TEST_DSUID_TARGETS];
+    for (i = 0; i < TEST_DSUID_TARGETS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%034zX", i * 7919);
+        dsuids[i] = names[i];
+    }
+    names[10][5] = 'x';
+
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmNotificationCallScene call =
+                                VDCAPI__VDSM__NOTIFICATION_CALL_SCENE__INIT;
+    call.n_dsuid = TEST_DSUID_TARGETS;
+    call.dsuid = dsuids;
+    call.has_scene = 1;
+    call.scene = 5;
+    call.has_force = 1;
+    msg.type = VDCAPI__TYPE__VDSM_NOTIFICATION_CALL_SCENE;
+    msg.vdsm_send_call_scene = &call;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, targets,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback_bin(handle,
+                                                   record_call_scene_bin);
+    fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+    ck_assert_msg(vdsm_sim_send(fd, &msg) == 0, "could not send call scene");
+    for (i = 0; (i < 100) && (targets->calls == 0); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+
+    ck_assert_msg((targets->calls == 1) &&
+                  (targets->n == TEST_DSUID_TARGETS - 1),
+                  "%d calls with %zu targets", targets->calls, targets->n);
+    for (i = 0, j = 0; i < TEST_DSUID_TARGETS; i++)
+    {
+        if (i == 10)
+        {
+            continue;
+        }
+        ck_assert_msg((dsvdc_dsuid_parse(names[i], &a) == DSVDC_OK) &&
+                      dsvdc_dsuid_equal(&a, &targets->ids[j++]),
+                      "target %zu differs", i);
+    }
+
+    free(targets);
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+typedef struct device_context
+{
+    dsvdc_dsuid_t id;
+    int scenes;
+    int32_t scene;
+    int channels;
+    double value;
+} device_context_t;
+
+static void device_call_scene(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                              int32_t scene, bool force, int32_t group,
+                              int32_t zone_id, void *context)
+{
+    device_context_t *device = (device_context_t *)context;
+
+    (void)handle;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    ck_assert_msg(dsvdc_dsuid_equal(dsuid, &device->id),
+                  "handler called with the context of another device");
+    device->scenes++;
+    device->scene = scene;
+}
+
+static void device_channel_value(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                                 bool apply, int32_t channel, double value,
+                                 void *context)
+{
+    device_context_t *device = (device_context_t *)context;
+
+    (void)handle;
+    (void)dsuid;
+    (void)apply;
+    (void)channel;
+    device->channels++;
+    device->value = value;
+}
+
+static void send_call_scene(int fd, char **dsuids, size_t n, int32_t scene)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmNotificationCallScene call =
+                                VDCAPI__VDSM__NOTIFICATION_CALL_SCENE__INIT;
+
+    call.n_dsuid = n;
+    call.dsuid = dsuids;
+    call.has_scene = 1;
+    call.scene = scene;
+    call.has_force = 1;
+    msg.type = VDCAPI__TYPE__VDSM_NOTIFICATION_CALL_SCENE;
+    msg.vdsm_send_call_scene = &call;
+    vdsm_sim_send(fd, &msg);
+}
+
+START_TEST(test_device_handlers)
+{
+    dsvdc_t *handle;
+    const dsvdc_device_handlers_t lights = {
+        .call_scene = device_call_scene,
+        .output_channel_value = device_channel_value
+    };
+    char *names[] = {
+        "00000000000000000000000000000000a1",
+        "00000000000000000000000000000000a2",
+        "00000000000000000000000000000000a3",
+        "00000000000000000000000000000000ff",   /* not registered */
+        "not a dSUID",
+        "00000000000000000000000000000000A1"
+    };
+    device_context_t devices[3];
+    int count = 0;
+    int i;
+
+    memset(devices, 0, sizeof(devices));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &count,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback(handle, count_call_scene);
+    ck_assert_msg(dsvdc_register_container(handle, TEST_VDC_DSUID) ==
+                  DSVDC_OK, "could not register container");
+    for (i = 0; i < 3; i++)
+    {
+        dsvdc_dsuid_parse(names[i], &devices[i].id);
+        ck_assert_msg(dsvdc_register_device(handle, TEST_VDC_DSUID,
+                      names[i]) == DSVDC_OK, "could not register %s",
+                      names[i]);
+    }
+
+    /* the first two share the class, the third has no handlers */
+    ck_assert_msg(dsvdc_set_device_handlers(handle, names[0], &lights,
+                  &devices[0]) == DSVDC_OK, "could not set handlers");
+    ck_assert_msg(dsvdc_set_device_handlers(handle, names[1], &lights,
+                  &devices[1]) == DSVDC_OK, "could not set handlers");
+    ck_assert_msg(dsvdc_set_device_handlers(handle, names[3], &lights,
+                  NULL) == DSVDC_ERR_DATA_NOT_FOUND,
+                  "handlers set for an unknown device");
+    ck_assert_msg(dsvdc_set_device_handlers(handle, TEST_VDC_DSUID, &lights,
+                  NULL) == DSVDC_ERR_PARAM, "handlers set for a container");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    send_call_scene(fd, names, 6, 17);
+    for (i = 0; (i < 100) && (count == 0); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(count == 1, "global callback not called");
+    ck_assert_msg((devices[0].scenes == 2) && (devices[0].scene == 17),
+                  "first device called %d times", devices[0].scenes);
+    ck_assert_msg((devices[1].scenes == 1) && (devices[1].scene == 17),
+                  "second device called %d times", devices[1].scenes);
+    ck_assert_msg(devices[2].scenes == 0, "device without handlers called");
+
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmNotificationSetOutputChannelValue set =
+                VDCAPI__VDSM__NOTIFICATION_SET_OUTPUT_CHANNEL_VALUE__INIT;
+    set.n_dsuid = 1;
+    set.dsuid = &names[1];
+    set.has_channel = 1;
+    set.channel = 1;
+    set.has_value = 1;
+    set.value = 42.5;
+    set.has_apply_now = 1;
+    set.apply_now = 1;
+    msg.type = VDCAPI__TYPE__VDSM_NOTIFICATION_SET_OUTPUT_CHANNEL_VALUE;
+    msg.vdsm_send_output_channel_value = &set;
+    vdsm_sim_send(fd, &msg);
+    for (i = 0; (i < 100) && (devices[1].channels == 0); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg((devices[1].channels == 1) && (devices[1].value == 42.5) &&
+                  (devices[0].channels == 0), "channel value not dispatched");
+
+    /* removed handlers and devices are no longer called */
+    ck_assert_msg(dsvdc_set_device_handlers(handle, names[1], NULL, NULL) ==
+                  DSVDC_OK, "could not clear handlers");
+    ck_assert_msg(dsvdc_unregister(handle, names[0]) == DSVDC_OK,
+                  "could not unregister device");
+    send_call_scene(fd, names, 6, 18);
+    for (i = 0; (i < 100) && (count == 1); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(count == 2, "global callback not called");
+    ck_assert_msg((devices[0].scene == 17) && (devices[1].scene == 17),
+                  "handlers called after they were removed");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_DISPATCH_DEVICES   64
+#define TEST_DISPATCH_SCENES    5
+
+typedef struct ordered_device
+{
+    int32_t scenes[TEST_DISPATCH_SCENES];
+    int n;
+    pthread_t thread;
+} ordered_device_t;
+
+typedef struct dispatch_state
+{
+    int notifications;
+    int completions;
+    size_t devices;
+} dispatch_state_t;
+
+static void ordered_call_scene(dsvdc_t *handle, const dsvdc_dsuid_t *dsuid,
+                               int32_t scene, bool force, int32_t group,
+                               int32_t zone_id, void *context)
+{
+    ordered_device_t *device = (ordered_device_t *)context;
+
+    (void)handle;
+    (void)dsuid;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    usleep(100);
+    if (device->n < TEST_DISPATCH_SCENES)
+    {
+        device->scenes[device->n] = scene;
+    }
+    device->n++;
+    device->thread = pthread_self();
+}
+
+static void count_notification(dsvdc_t *handle, char **dsuid,
+                               size_t n_dsuid, int32_t scene, bool force,
+                               int32_t group, int32_t zone_id,
+                               void *userdata)
+{
+    (void)handle;
+    (void)dsuid;
+    (void)n_dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    ((dispatch_state_t *)userdata)->notifications++;
+}
+
+static void count_dispatch_complete(dsvdc_t *handle, size_t n_devices,
+                                    uint64_t elapsed_us, void *userdata)
+{
+    dispatch_state_t *state = (dispatch_state_t *)userdata;
+
+    (void)handle;
+    (void)elapsed_us;
+    __atomic_add_fetch(&state->devices, n_devices, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&state->completions, 1, __ATOMIC_RELAXED);
+}
+
+START_TEST(test_dispatch_workers)
+{
+    dsvdc_t *handle;
+    const dsvdc_device_handlers_t handlers = {
+        .call_scene = ordered_call_scene
+    };
+    dispatch_state_t state;
+    ordered_device_t devices[TEST_DISPATCH_DEVICES];
+    char names[TEST_DISPATCH_DEVICES][35];
+    char *dsuids[TEST_DISPATCH_DEVICES];
+    int threads = 0;
+    int i;
+    int j;
+
+    memset(&state, 0, sizeof(state));
+    memset(devices, 0, sizeof(devices));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback(handle, count_notification);
+    dsvdc_set_dispatch_complete_callback(handle, count_dispatch_complete);
+    ck_assert_msg(dsvdc_set_dispatch_workers(handle, 65) == DSVDC_ERR_PARAM,
+                  "accepted too many workers");
+    ck_assert_msg(dsvdc_set_dispatch_workers(handle, 4) == DSVDC_OK,
+                  "could not start workers");
+
+    ck_assert_msg(dsvdc_register_container(handle, TEST_VDC_DSUID) ==
+                  DSVDC_OK, "could not register container");
+    for (i = 0; i < TEST_DISPATCH_DEVICES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%034x", i + 1);
+        dsuids[i] = names[i];
+        ck_assert_msg((dsvdc_register_device(handle, TEST_VDC_DSUID,
+                      names[i]) == DSVDC_OK) &&
+                      (dsvdc_set_device_handlers(handle, names[i], &handlers,
+                      &devices[i]) == DSVDC_OK), "could not add %s",
+                      names[i]);
+    }
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    for (i = 0; i < TEST_DISPATCH_SCENES; i++)
+    {
+        send_call_scene(fd, dsuids, TEST_DISPATCH_DEVICES, i + 1);
+    }
+
+    /* the notifications are not held up by the handlers */
+    for (i = 0; (i < 100) && (state.notifications < TEST_DISPATCH_SCENES);
+         i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(state.notifications == TEST_DISPATCH_SCENES,
+                  "%d notifications", state.notifications);
+
+    dsvdc_wait_dispatch(handle);
+    ck_assert_msg((state.completions == TEST_DISPATCH_SCENES) &&
+                  (state.devices == TEST_DISPATCH_SCENES *
+                                    TEST_DISPATCH_DEVICES),
+                  "%d completions for %zu devices", state.completions,
+                  state.devices);
+
+    for (i = 0; i < TEST_DISPATCH_DEVICES; i++)
+    {
+        ck_assert_msg(devices[i].n == TEST_DISPATCH_SCENES,
+                      "device %d called %d times", i, devices[i].n);
+        for (j = 0; j < TEST_DISPATCH_SCENES; j++)
+        {
+            ck_assert_msg(devices[i].scenes[j] == j + 1,
+                          "device %d got scene %d as %d", i,
+                          devices[i].scenes[j], j + 1);
+        }
+
+        for (j = 0; j < i; j++)
+        {
+            if (pthread_equal(devices[i].thread, devices[j].thread))
+            {
+                break;
+            }
+        }
+        threads += (j == i);
+    }
+    ck_assert_msg(threads == 4, "handlers ran on %d threads", threads);
+
+    /* without workers the handlers run directly */
+    ck_assert_msg(dsvdc_set_dispatch_workers(handle, 0) == DSVDC_OK,
+                  "could not stop workers");
+    send_call_scene(fd, dsuids, 1, 9);
+    for (i = 0; (i < 100) && (devices[0].n == TEST_DISPATCH_SCENES); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg((devices[0].n == TEST_DISPATCH_SCENES + 1) &&
+                  pthread_equal(devices[0].thread, pthread_self()) &&
+                  (state.completions == TEST_DISPATCH_SCENES + 1),
+                  "handler not called directly");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+#define TEST_RECONFIGURE_SCENES 200
+
+typedef struct reconfigure_state
+{
+    dsvdc_t *handle;
+    int32_t scenes[TEST_RECONFIGURE_SCENES];
+    int n;
+    int active;
+    bool overlap;
+    bool done;
+} reconfigure_state_t;
+
+static void reconfigure_call_scene(dsvdc_t *handle,
+                                   const dsvdc_dsuid_t *dsuid, int32_t scene,
+                                   bool force, int32_t group,
+                                   int32_t zone_id, void *context)
+{
+    reconfigure_state_t *state = (reconfigure_state_t *)context;
+
+    (void)handle;
+    (void)dsuid;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    if (__atomic_add_fetch(&state->active, 1, __ATOMIC_ACQ_REL) > 1)
+    {
+        __atomic_store_n(&state->overlap, true, __ATOMIC_RELAXED);
+    }
+    usleep(50);
+    if (state->n < TEST_RECONFIGURE_SCENES)
+    {
+        state->scenes[state->n] = scene;
+    }
+    state->n++;
+    __atomic_sub_fetch(&state->active, 1, __ATOMIC_ACQ_REL);
+}
+
+static void *reconfigure_thread(void *arg)
+{
+    reconfigure_state_t *state = (reconfigure_state_t *)arg;
+    unsigned int workers = 1;
+
+    while (!__atomic_load_n(&state->done, __ATOMIC_ACQUIRE))
+    {
+        dsvdc_set_dispatch_workers(state->handle, workers);
+        workers = (workers + 1) % 5;
+        usleep(200);
+    }
+    return NULL;
+}
+
+START_TEST(test_dispatch_reconfigure)
+{
+    dsvdc_t *handle;
+    const dsvdc_device_handlers_t handlers = {
+        .call_scene = reconfigure_call_scene
+    };
+    dispatch_state_t state;
+    reconfigure_state_t device;
+    char name[35];
+    char *dsuid = name;
+    pthread_t thread;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    memset(&device, 0, sizeof(device));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_call_scene_notification_callback(handle, count_notification);
+    snprintf(name, sizeof(name), "%034x", 1);
+    ck_assert_msg((dsvdc_register_container(handle, TEST_VDC_DSUID) ==
+                  DSVDC_OK) &&
+                  (dsvdc_register_device(handle, TEST_VDC_DSUID, name) ==
+                  DSVDC_OK) &&
+                  (dsvdc_set_device_handlers(handle, name, &handlers,
+                  &device) == DSVDC_OK), "could not add device");
+    ck_assert_msg(dsvdc_set_dispatch_workers(handle, 2) == DSVDC_OK,
+                  "could not start workers");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    /* the pool is replaced while handler calls of the device are queued */
+    device.handle = handle;
+    pthread_create(&thread, NULL, reconfigure_thread, &device);
+    for (i = 0; i < TEST_RECONFIGURE_SCENES; i++)
+    {
+        int tries;
+
+        send_call_scene(fd, &dsuid, 1, i + 1);
+        for (tries = 0; (tries < 100) && (state.notifications <= i);
+             tries++)
+        {
+            dsvdc_work(handle, 1);
+        }
+        usleep(20);
+    }
+    __atomic_store_n(&device.done, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    dsvdc_set_dispatch_workers(handle, 0);
+
+    ck_assert_msg(state.notifications == TEST_RECONFIGURE_SCENES,
+                  "%d notifications", state.notifications);
+    ck_assert_msg(!device.overlap, "handlers of the device overlapped");
+    ck_assert_msg(device.n == TEST_RECONFIGURE_SCENES,
+                  "handler called %d times", device.n);
+    for (i = 0; i < TEST_RECONFIGURE_SCENES; i++)
+    {
+        ck_assert_msg(device.scenes[i] == i + 1, "got scene %d as %d",
+                      device.scenes[i], i + 1);
+    }
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+typedef struct property_state
+{
+    int calls;
+    size_t n_query;
+    char first[32];
+    int provided;
+    size_t n_subquery;
+} property_state_t;
+
+/* answers the dynamic part and remembers what it was asked for */
+static void cache_getprop(dsvdc_t *handle, const char *dsuid,
+                          dsvdc_property_t *property,
+                          const dsvdc_property_t *query, void *userdata)
+{
+    property_state_t *state = (property_state_t *)userdata;
+    char *name = NULL;
+
+    (void)dsuid;
+    state->calls++;
+    state->n_query = dsvdc_property_get_num_properties(query);
+    state->first[0] = '\0';
+    if ((dsvdc_property_get_name(query, 0, &name) == DSVDC_OK) && name)
+    {
+        snprintf(state->first, sizeof(state->first), "%s", name);
+        free(name);
+    }
+    dsvdc_property_add_uint(property, "channelStates", 5);
+    dsvdc_send_get_property_response(handle, property);
+}
+
+static void provide_output(dsvdc_t *handle, const char *dsuid,
+                           const char *name, const dsvdc_property_t *query,
+                           dsvdc_property_t *response, void *context)
+{
+    property_state_t *state = (property_state_t *)context;
+
+    (void)handle;
+    (void)dsuid;
+    state->provided++;
+    state->n_subquery = dsvdc_property_get_num_properties(query);
+    dsvdc_property_add_uint(response, name, 1);
+}
+
+/* sends a get property request and waits for the response */
+static Vdcapi__VdcResponseGetProperty *query_properties(dsvdc_t *handle,
+                                int fd, const char *dsuid,
+                                Vdcapi__PropertyElement **query, size_t n,
+                                Vdcapi__Message **reply)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmRequestGetProperty get =
+                                    VDCAPI__VDSM__REQUEST_GET_PROPERTY__INIT;
+    int i;
+
+    get.dsuid = (char *)dsuid;
+    get.n_query = n;
+    get.query = query;
+    msg.type = VDCAPI__TYPE__VDSM_REQUEST_GET_PROPERTY;
+    msg.message_id = 77;
+    msg.has_message_id = 1;
+    msg.vdsm_request_get_property = &get;
+    vdsm_sim_send(fd, &msg);
+
+    *reply = NULL;
+    for (i = 0; (i < 100) && !*reply; i++)
+    {
+        dsvdc_work(handle, 1);
+        *reply = vdsm_sim_recv(fd, 10);
+    }
+    if (!*reply ||
+        ((*reply)->type != VDCAPI__TYPE__VDC_RESPONSE_GET_PROPERTY) ||
+        ((*reply)->message_id != 77))
+    {
+        return NULL;
+    }
+    return (*reply)->vdc_response_get_property;
+}
+
+START_TEST(test_property_cache)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *tree;
+    dsvdc_property_t *buttons;
+    dsvdc_property_t *button;
+    dsvdc_stats_t stats;
+    property_state_t state;
+    Vdcapi__Message *reply;
+    Vdcapi__VdcResponseGetProperty *response;
+    const char *device = "00000000000000000000000000000000b1";
+    const dsvdc_property_provider_t providers[] = {
+        { "channelStates", NULL, NULL },
+        { "outputState", provide_output, &state }
+    };
+
+    memset(&state, 0, sizeof(state));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_get_property_callback(handle, cache_getprop);
+    ck_assert_msg((dsvdc_register_container(handle, TEST_VDC_DSUID) ==
+                   DSVDC_OK) &&
+                  (dsvdc_register_device(handle, TEST_VDC_DSUID, device) ==
+                   DSVDC_OK), "could not register device");
+
+    /* name plus two button descriptions */
+    dsvdc_property_new(&tree);
+    dsvdc_property_add_string(tree, "name", "lamp");
+    dsvdc_property_new(&buttons);
+    dsvdc_property_new(&button);
+    dsvdc_property_add_string(button, "name", "up");
+    dsvdc_property_add_property(buttons, "0", &button);
+    dsvdc_property_new(&button);
+    dsvdc_property_add_string(button, "name", "down");
+    dsvdc_property_add_property(buttons, "1", &button);
+    dsvdc_property_add_property(tree, "buttonInputDescriptions", &buttons);
+
+    ck_assert_msg(dsvdc_set_property_cache(handle,
+                  "00000000000000000000000000000000ff", &tree, NULL, 0) ==
+                  DSVDC_ERR_DATA_NOT_FOUND, "cache set for unknown device");
+    ck_assert_msg(tree != NULL, "tree taken on failure");
+    ck_assert_msg(dsvdc_set_property_cache(handle, device, &tree, providers,
+                  2) == DSVDC_OK, "could not set the property cache");
+    ck_assert_msg(tree == NULL, "tree not taken");
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+    size_t containers = 0;
+    size_t devices = 0;
+    uint64_t start = vdsm_sim_now_us();
+    do
+    {
+        answer_announcements(fd, &containers, &devices);
+        dsvdc_work(handle, 1);
+        dsvdc_get_stats(handle, &stats);
+    } while ((stats.announce_rounds == 0) &&
+             (vdsm_sim_now_us() - start < 3000000));
+    ck_assert_msg(devices == 1, "device not announced");
+
+    /* static properties and a nested query are answered from the cache */
+    Vdcapi__PropertyElement name = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement second = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement descriptions = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement channels = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement output = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement wildcard = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement *sub[] = { &second };
+    name.name = "name";
+    second.name = "1";
+    descriptions.name = "buttonInputDescriptions";
+    descriptions.n_elements = 1;
+    descriptions.elements = sub;
+    channels.name = "channelStates";
+    output.name = "outputState";
+    output.n_elements = 1;
+    output.elements = sub;
+    wildcard.name = "";
+
+    Vdcapi__PropertyElement *query[] = { &name, &descriptions };
+    response = query_properties(handle, fd, device, query, 2, &reply);
+    ck_assert_msg(response != NULL, "no response from the cache");
+    ck_assert_msg(state.calls == 0, "callback called for cached properties");
+    ck_assert_msg((response->n_properties == 2) &&
+                  (strcmp(response->properties[0]->value->v_string,
+                          "lamp") == 0), "cached name not returned");
+    Vdcapi__PropertyElement *answer = response->properties[1];
+    ck_assert_msg((answer->n_elements == 1) &&
+                  (strcmp(answer->elements[0]->name, "1") == 0) &&
+                  (answer->elements[0]->n_elements == 1) &&
+                  (strcmp(answer->elements[0]->elements[0]->value->v_string,
+                          "down") == 0), "nested query not evaluated");
+    vdcapi__message__free_unpacked(reply, NULL);
+
+    /* dynamic properties are asked from the callback, the rest is cached or
+     * provided, in the order of the query */
+    Vdcapi__PropertyElement *mixed[] = { &name, &channels, &output };
+    response = query_properties(handle, fd, device, mixed, 3, &reply);
+    ck_assert_msg(response != NULL, "no response for the dynamic property");
+    ck_assert_msg((state.calls == 1) && (state.n_query == 1) &&
+                  (strcmp(state.first, "channelStates") == 0),
+                  "callback not asked for the dynamic property only");
+    ck_assert_msg((state.provided == 1) && (state.n_subquery == 1),
+                  "provider not called with the subquery");
+    ck_assert_msg((response->n_properties == 3) &&
+                  (strcmp(response->properties[0]->name, "name") == 0) &&
+                  (strcmp(response->properties[1]->name, "outputState") ==
+                   0) &&
+                  (response->properties[2]->value->v_uint64 == 5),
+                  "cached, provided and dynamic part not combined");
+    vdcapi__message__free_unpacked(reply, NULL);
+
+    /* a wildcard expands to the cached, provided and dynamic properties */
+    Vdcapi__PropertyElement *all[] = { &wildcard };
+    response = query_properties(handle, fd, device, all, 1, &reply);
+    ck_assert_msg((response != NULL) && (state.calls == 2) &&
+                  (state.n_query == 1) &&
+                  (strcmp(state.first, "channelStates") == 0) &&
+                  (state.provided == 2), "wildcard not expanded");
+    ck_assert_msg(response->n_properties == 4,
+                  "wildcard answered with %zu properties",
+                  response->n_properties);
+    vdcapi__message__free_unpacked(reply, NULL);
+
+    dsvdc_get_stats(handle, &stats);
+    ck_assert_msg((stats.property_cache_hits == 3) &&
+                  (stats.property_cache_partial == 2),
+                  "cache statistics not counted");
+
+    /* without the cache everything goes to the callback */
+    ck_assert_msg(dsvdc_set_property_cache(handle, device, NULL, NULL, 0) ==
+                  DSVDC_OK, "could not remove the property cache");
+    response = query_properties(handle, fd, device, query, 2, &reply);
+    ck_assert_msg((response != NULL) && (state.calls == 3) &&
+                  (state.n_query == 2), "query not passed to callback");
+    vdcapi__message__free_unpacked(reply, NULL);
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+/* keeps the properties of a set property request beyond the callback */
+static void keep_setprop(dsvdc_t *handle, const char *dsuid,
+                         dsvdc_property_t *property,
+                         const dsvdc_property_t *properties, void *userdata)
+{
+    dsvdc_property_t **kept = (dsvdc_property_t **)userdata;
+
+    (void)dsuid;
+    ck_assert_msg(dsvdc_property_get_num_properties(properties) == 2,
+                  "view does not show the request");
+    ck_assert_msg(dsvdc_property_clone(properties, kept) == DSVDC_OK,
+                  "could not clone the view");
+    dsvdc_send_set_property_response(handle, property,
+                                     VDCAPI__RESULT_CODE__ERR_OK);
+}
+
+START_TEST(test_property_views)
+{
+    dsvdc_t *handle;
+    dsvdc_property_t *kept = NULL;
+    dsvdc_property_t *zone = NULL;
+    int64_t value = 0;
+    int i;
+
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &kept,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    dsvdc_set_set_property_callback(handle, keep_setprop);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmRequestSetProperty set =
+                                    VDCAPI__VDSM__REQUEST_SET_PROPERTY__INIT;
+    Vdcapi__PropertyElement name = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement settings = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement zone_id = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyValue name_value = VDCAPI__PROPERTY_VALUE__INIT;
+    Vdcapi__PropertyValue zone_value = VDCAPI__PROPERTY_VALUE__INIT;
+    Vdcapi__PropertyElement *nested[] = { &zone_id };
+    Vdcapi__PropertyElement *elements[] = { &name, &settings };
+
+    name_value.v_string = "kitchen";
+    name.name = "name";
+    name.value = &name_value;
+    zone_value.has_v_int64 = 1;
+    zone_value.v_int64 = 42;
+    zone_id.name = "zoneID";
+    zone_id.value = &zone_value;
+    settings.name = "settings";
+    settings.n_elements = 1;
+    settings.elements = nested;
+    set.dsuid = TEST_VDC_DSUID;
+    set.n_properties = 2;
+    set.properties = elements;
+    msg.type = VDCAPI__TYPE__VDSM_REQUEST_SET_PROPERTY;
+    msg.message_id = 5;
+    msg.has_message_id = 1;
+    msg.vdsm_request_set_property = &set;
+    vdsm_sim_send(fd, &msg);
+
+    for (i = 0; (i < 100) && !kept; i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg(kept != NULL, "set property callback not called");
+
+    /* the received message is gone, the clone still holds everything */
+    ck_assert_msg(dsvdc_property_get_property_by_name(kept, "settings",
+                  &zone) == DSVDC_OK, "nested property not cloned");
+    ck_assert_msg((dsvdc_property_get_int(zone, 0, &value) == DSVDC_OK) &&
+                  (value == 42), "nested value not cloned");
+
+    Vdcapi__Message *reply = vdsm_sim_recv(fd, 1000);
+    ck_assert_msg((reply != NULL) &&
+                  (reply->type == VDCAPI__TYPE__GENERIC_RESPONSE),
+                  "set property not answered");
+    vdcapi__message__free_unpacked(reply, NULL);
+
+    dsvdc_property_free(zone);
+    dsvdc_property_free(kept);
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
+typedef struct swap_state
+{
+    dsvdc_t *handle;
+    int first;
+    int second;
+    bool stop;
+} swap_state_t;
+
+static void swap_first(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
+                       int32_t scene, bool force, int32_t group,
+                       int32_t zone_id, void *userdata)
+{
+    (void)handle;
+    (void)dsuid;
+    (void)n_dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    ((swap_state_t *)userdata)->first++;
+}
+
+static void swap_second(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
+                        int32_t scene, bool force, int32_t group,
+                        int32_t zone_id, void *userdata)
+{
+    (void)handle;
+    (void)dsuid;
+    (void)n_dsuid;
+    (void)scene;
+    (void)force;
+    (void)group;
+    (void)zone_id;
+    ((swap_state_t *)userdata)->second++;
+}
+
+/* replaces itself, setters may be called from within a callback */
+static void swap_reentrant(dsvdc_t *handle, char **dsuid, size_t n_dsuid,
+                           int32_t scene, bool force, int32_t group,
+                           int32_t zone_id, void *userdata)
+{
+    swap_first(handle, dsuid, n_dsuid, scene, force, group, zone_id,
+               userdata);
+    dsvdc_set_call_scene_notification_callback(handle, swap_second);
+}
+
+static void *swap_callbacks(void *arg)
+{
+    swap_state_t *state = (swap_state_t *)arg;
+
+    while (!__atomic_load_n(&state->stop, __ATOMIC_RELAXED))
+    {
+        dsvdc_set_call_scene_notification_callback(state->handle,
+                                                   swap_first);
+        dsvdc_set_call_scene_notification_callback(state->handle,
+                                                   swap_second);
+    }
+    return NULL;
+}
+
+START_TEST(test_callback_swap)
+{
+    dsvdc_t *handle;
+    swap_state_t state;
+    pthread_t swapper;
+    unsigned char burst[4096];
+    size_t len = 0;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    ck_assert_msg(dsvdc_new(0, TEST_VDC_DSUID, "test", true, &state,
+                  &handle) == DSVDC_OK, "dsvdc_new() initialization failed");
+    state.handle = handle;
+    dsvdc_set_call_scene_notification_callback(handle, swap_first);
+
+    int fd = connect_session(handle);
+    ck_assert_msg(fd >= 0, "could not establish session");
+
+    for (i = 0; i < 50; i++)
+    {
+        len += vdsm_sim_frame_call_scene(TEST_VDC_DSUID, i, burst + len,
+                                         sizeof(burst) - len);
+    }
+
+    /* every notification reaches one of the tables, no matter how often
+     * they are replaced meanwhile */
+    ck_assert_msg(pthread_create(&swapper, NULL, swap_callbacks,
+                  &state) == 0, "could not start swapper thread");
+    for (i = 0; i < 4; i++)
+    {
+        ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0,
+                      "could not send");
+    }
+    for (i = 0; (i < 100) && (state.first + state.second < 200); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    __atomic_store_n(&state.stop, true, __ATOMIC_RELAXED);
+    pthread_join(swapper, NULL);
+    ck_assert_msg(state.first + state.second == 200,
+                  "expected 200 notifications, got %d",
+                  state.first + state.second);
+
+    state.first = 0;
+    state.second = 0;
+    dsvdc_set_call_scene_notification_callback(handle, swap_reentrant);
+    len = vdsm_sim_frame_call_scene(TEST_VDC_DSUID, 1, burst, sizeof(burst));
+    len += vdsm_sim_frame_call_scene(TEST_VDC_DSUID, 2, burst + len,
+                                     sizeof(burst) - len);
+    ck_assert_msg(vdsm_sim_send_raw(fd, burst, len) == 0, "could not send");
+    for (i = 0; (i < 10) && (state.first + state.second < 2); i++)
+    {
+        dsvdc_work(handle, 1);
+    }
+    ck_assert_msg((state.first == 1) && (state.second == 1),
+                  "callback replaced from within itself not used");
+
+    close(fd);
+    dsvdc_cleanup(handle);
+}
+END_TEST
+
 Suite *dsvdc_suite()
 {
     Suite *s = suite_create("dSvDC");
     TCase *tc_init_cleanup = tcase_create("dSvDC");
     tcase_set_timeout(tc_init_cleanup, 4);
     tcase_add_test(tc_init_cleanup, test_init_cleanup);
+    tcase_add_test(tc_init_cleanup, test_external_loop);
+    tcase_add_test(tc_init_cleanup, test_slow_sender);
+    tcase_add_test(tc_init_cleanup, test_receive_budget);
+    tcase_add_test(tc_init_cleanup, test_receive_allocations);
+    tcase_add_test(tc_init_cleanup, test_send_queue);
+    tcase_add_test(tc_init_cleanup, test_pong_priority);
+    tcase_add_test(tc_init_cleanup, test_multiple_sessions);
+    tcase_add_test(tc_init_cleanup, test_transports);
+    tcase_add_test(tc_init_cleanup, test_io_thread);
+    tcase_add_test(tc_init_cleanup, test_callback_swap);
+    tcase_add_test(tc_init_cleanup, test_request_tracking);
+    tcase_add_test(tc_init_cleanup, test_request_pool);
+    tcase_add_test(tc_init_cleanup, test_bulk_announce);
+    tcase_add_test(tc_init_cleanup, test_nested_send);
+    tcase_add_test(tc_init_cleanup, test_device_registry);
+    tcase_add_test(tc_init_cleanup, test_dsuid);
+    tcase_add_test(tc_init_cleanup, test_device_handlers);
+    tcase_add_test(tc_init_cleanup, test_dispatch_workers);
+    tcase_add_test(tc_init_cleanup, test_dispatch_reconfigure);
+    tcase_add_test(tc_init_cleanup, test_property_cache);
+    tcase_add_test(tc_init_cleanup, test_property_views);
     suite_add_tcase(s, tc_init_cleanup);
     return s;
 }
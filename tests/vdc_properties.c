@@ -27,7 +27,9 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "dsvdc.h"
 #include "properties.h"
@@ -131,11 +133,225 @@ START_TEST(create_valid_property)
 }
 END_TEST
 
+START_TEST(query_property)
+{
+    dsvdc_property_t *source = NULL;
+    dsvdc_property_t *response = NULL;
+    dsvdc_property_t *buttons = NULL;
+    dsvdc_property_t *button = NULL;
+    dsvdc_property_t *sub = NULL;
+    char *name;
+    int ret;
+
+    dsvdc_property_new(&source);
+    dsvdc_property_add_string(source, "name", "switch");
+    dsvdc_property_new(&buttons);
+    dsvdc_property_new(&button);
+    dsvdc_property_add_string(button, "name", "up");
+    dsvdc_property_add_uint(button, "group", 1);
+    dsvdc_property_add_property(buttons, "0", &button);
+    dsvdc_property_new(&button);
+    dsvdc_property_add_string(button, "name", "down");
+    dsvdc_property_add_uint(button, "group", 1);
+    dsvdc_property_add_property(buttons, "1", &button);
+    dsvdc_property_add_property(source, "buttonInputDescriptions", &buttons);
+
+    // buttonInputDescriptions/*/name and a name the source does not have
+    Vdcapi__PropertyElement leaf = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement any = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement descriptions = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement missing = VDCAPI__PROPERTY_ELEMENT__INIT;
+    Vdcapi__PropertyElement *leaves[] = { &leaf };
+    Vdcapi__PropertyElement *children[] = { &any };
+    Vdcapi__PropertyElement *elements[] = { &descriptions, &missing };
+    leaf.name = "name";
+    any.n_elements = 1;
+    any.elements = leaves;
+    descriptions.name = "buttonInputDescriptions";
+    descriptions.n_elements = 1;
+    descriptions.elements = children;
+    missing.name = "missing";
+
+    struct dsvdc_property query = {
+        .properties = elements,
+        .n_properties = 2
+    };
+
+    dsvdc_property_new(&response);
+    ret = dsvdc_property_query(source, &query, response);
+    ck_assert_msg(ret == DSVDC_OK, "dsvdc_property_query() returned %d", ret);
+    ck_assert_msg(dsvdc_property_get_num_properties(response) == 1,
+                  "unknown names not left out");
+
+    ret = dsvdc_property_get_property_by_name(response,
+                                              "buttonInputDescriptions", &sub);
+    ck_assert_msg(ret == DSVDC_OK, "nested answer missing");
+    ck_assert_msg(dsvdc_property_get_num_properties(sub) == 2,
+                  "wildcard not expanded");
+    ck_assert_msg(sub->properties[1]->n_elements == 1,
+                  "subquery not applied below the wildcard");
+    ret = dsvdc_property_get_name(sub, 1, &name);
+    ck_assert_msg((ret == DSVDC_OK) && (strcmp(name, "1") == 0),
+                  "wildcard answer out of order");
+    free(name);
+    ck_assert_msg(strcmp(sub->properties[1]->elements[0]->value->v_string,
+                         "down") == 0, "wrong value selected");
+    dsvdc_property_free(sub);
+
+    // an empty name on the top level selects everything, it is appended
+    query.properties = children;
+    query.n_properties = 1;
+    any.n_elements = 0;
+    ret = dsvdc_property_query(source, &query, response);
+    ck_assert_msg((ret == DSVDC_OK) &&
+                  (dsvdc_property_get_num_properties(response) == 3),
+                  "top level wildcard not appended");
+
+    dsvdc_property_free(response);
+    dsvdc_property_free(source);
+}
+END_TEST
+
+START_TEST(cursor_property)
+{
+    dsvdc_property_t *property = NULL;
+    dsvdc_property_t *channels = NULL;
+    dsvdc_property_t *channel = NULL;
+    dsvdc_property_cursor_t top;
+    dsvdc_property_cursor_t level;
+    dsvdc_property_cursor_t leaf;
+    const uint8_t raw[] = { 1, 2, 3 };
+    const uint8_t *bytes;
+    const char *str;
+    size_t len;
+    size_t index;
+    double value;
+    int ret;
+
+    dsvdc_property_new(&property);
+    dsvdc_property_add_string(property, "name", "dimmer");
+    dsvdc_property_add_bytes(property, "raw", raw, sizeof(raw));
+    dsvdc_property_new(&channels);
+    dsvdc_property_new(&channel);
+    dsvdc_property_add_double(channel, "value", 42.5);
+    dsvdc_property_add_property(channels, "brightness", &channel);
+    dsvdc_property_add_property(property, "channelStates", &channels);
+
+    // three levels down without a single copy
+    dsvdc_property_cursor(property, &top);
+    ck_assert_msg(dsvdc_property_cursor_count(&top) == 3,
+                  "unexpected number of elements");
+    ret = dsvdc_property_cursor_child_by_name(&top, "channelStates", &level);
+    ck_assert_msg(ret == DSVDC_OK, "channelStates not found, %d", ret);
+    ret = dsvdc_property_cursor_child(&level, 0, &leaf);
+    ck_assert_msg(ret == DSVDC_OK, "brightness not found, %d", ret);
+    ret = dsvdc_property_cursor_name(&level, 0, &str, &len);
+    ck_assert_msg((ret == DSVDC_OK) && (len == 10) &&
+                  (str == property->properties[2]->elements[0]->name),
+                  "name not borrowed");
+    ret = dsvdc_property_cursor_double(&leaf, 0, &value);
+    ck_assert_msg((ret == DSVDC_OK) && (value == 42.5),
+                  "unexpected value, %d", ret);
+
+    ret = dsvdc_property_cursor_find(&top, "raw", &index);
+    ck_assert_msg((ret == DSVDC_OK) && (index == 1), "raw not found");
+    ret = dsvdc_property_cursor_bytes(&top, index, &bytes, &len);
+    ck_assert_msg((ret == DSVDC_OK) && (len == 3) && (bytes[2] == 3) &&
+                  (bytes == property->properties[1]->value->v_bytes.data),
+                  "bytes not borrowed");
+    ret = dsvdc_property_cursor_string(&top, 0, &str, &len);
+    ck_assert_msg((ret == DSVDC_OK) && (len == 6) &&
+                  (str == property->properties[0]->value->v_string),
+                  "string not borrowed");
+
+    ret = dsvdc_property_cursor_string(&top, 1, &str, &len);
+    ck_assert_msg(ret == DSVDC_ERR_PROPERTY_VALUE_TYPE,
+                  "value type not checked, %d", ret);
+    ret = dsvdc_property_cursor_child(&top, 3, &level);
+    ck_assert_msg(ret == DSVDC_ERR_PROPERTY_INDEX, "index not checked");
+    ret = dsvdc_property_cursor_find(&top, "missing", &index);
+    ck_assert_msg(ret == DSVDC_ERR_DATA_NOT_FOUND, "unknown name found");
+
+    dsvdc_property_free(property);
+}
+END_TEST
+
+START_TEST(arena_property)
+{
+    dsvdc_property_t *property = NULL;
+    dsvdc_property_t *sensors = NULL;
+    dsvdc_property_t *sensor = NULL;
+    dsvdc_property_t *heap = NULL;
+    dsvdc_property_t *copy = NULL;
+    dsvdc_property_t *wrapper = NULL;
+    char name[16];
+    char *str = NULL;
+    uint64_t uvalue;
+    int i;
+
+    ck_assert_msg(dsvdc_property_new_arena(&property) == DSVDC_OK,
+                  "could not allocate arena property");
+    ck_assert_msg(dsvdc_property_new_nested(property, &sensors) == DSVDC_OK,
+                  "could not allocate nested property");
+    for (i = 0; i < 100; i++)
+    {
+        dsvdc_property_new_nested(sensors, &sensor);
+        dsvdc_property_add_uint(sensor, "sensorType", i);
+        dsvdc_property_add_string(sensor, "name", "temperature");
+        snprintf(name, sizeof(name), "%d", i);
+        dsvdc_property_add_property(sensors, name, &sensor);
+        ck_assert_msg(sensor == NULL, "nested property not consumed");
+    }
+    // the elements of the nested property are moved, not copied
+    Vdcapi__PropertyElement **elements = sensors->properties;
+    dsvdc_property_add_property(property, "sensorDescriptions", &sensors);
+    ck_assert_msg(property->properties[0]->elements == elements,
+                  "nested content was copied");
+    ck_assert_msg(property->properties[0]->n_elements == 100,
+                  "unexpected number of sensors");
+    ck_assert_msg(property->capacity >= property->n_properties,
+                  "capacity below size");
+
+    // heap properties are copied into the arena
+    dsvdc_property_new(&heap);
+    dsvdc_property_add_string(heap, "vendor", "aizo");
+    dsvdc_property_add_property(property, "info", &heap);
+    ck_assert_msg(heap == NULL, "heap property not consumed");
+
+    dsvdc_property_get_property_by_name(property, "sensorDescriptions", &copy);
+    ck_assert_msg(copy && (dsvdc_property_get_num_properties(copy) == 100),
+                  "could not get sensors");
+    dsvdc_property_get_property_by_index(copy, 42, &sensor);
+    dsvdc_property_get_uint(sensor, 0, &uvalue);
+    ck_assert_msg(uvalue == 42, "unexpected sensor type %llu",
+                  (unsigned long long)uvalue);
+    dsvdc_property_get_string(sensor, 1, &str);
+    ck_assert_msg(str && (strcmp(str, "temperature") == 0),
+                  "unexpected sensor name");
+    free(str);
+    dsvdc_property_free(sensor);
+    dsvdc_property_free(copy);
+
+    // and arena properties into heap ones
+    dsvdc_property_new(&wrapper);
+    dsvdc_property_add_property(wrapper, "device", &property);
+    ck_assert_msg(property == NULL, "arena property not consumed");
+    dsvdc_property_get_property_by_name(wrapper, "device", &copy);
+    ck_assert_msg(copy && (dsvdc_property_get_num_properties(copy) == 2),
+                  "arena content not copied");
+    dsvdc_property_free(copy);
+    dsvdc_property_free(wrapper);
+}
+END_TEST
+
 Suite *dsvdc_suite()
 {
     Suite *s = suite_create("dSvDC Properties");
     TCase *tc_valid_property = tcase_create("valid property");
     tcase_add_test(tc_valid_property, create_valid_property);
+    tcase_add_test(tc_valid_property, query_property);
+    tcase_add_test(tc_valid_property, cursor_property);
+    tcase_add_test(tc_valid_property, arena_property);
     suite_add_tcase(s, tc_valid_property);
 
     return s;
@@ -0,0 +1,286 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "vdsm_sim.h"
+
+uint64_t vdsm_sim_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int vdsm_sim_connect(dsvdc_t *handle)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int nodelay = 1;
+
+    /* connect to whatever the instance listens on, via loopback for TCP */
+    if (getsockname(handle->listen_fd, (struct sockaddr *)&addr,
+                    &addrlen) < 0)
+    {
+        return -1;
+    }
+
+    if (addr.ss_family == AF_INET)
+    {
+        ((struct sockaddr_in *)&addr)->sin_addr.s_addr =
+                                                    htonl(INADDR_LOOPBACK);
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        ((struct sockaddr_in6 *)&addr)->sin6_addr = in6addr_loopback;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, addrlen) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (addr.ss_family != AF_UNIX)
+    {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    return fd;
+}
+
+int vdsm_sim_send_raw(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+size_t vdsm_sim_frame(const Vdcapi__Message *msg, unsigned char *buf,
+                      size_t size)
+{
+    size_t len = vdcapi__message__get_packed_size(msg);
+    uint16_t netlen;
+
+    if ((len > MAX_DATA_SIZE) || (len + sizeof(uint16_t) > size))
+    {
+        return 0;
+    }
+
+    netlen = htons((uint16_t)len);
+    memcpy(buf, &netlen, sizeof(uint16_t));
+    vdcapi__message__pack(msg, buf + sizeof(uint16_t));
+    return len + sizeof(uint16_t);
+}
+
+int vdsm_sim_send(int fd, const Vdcapi__Message *msg)
+{
+    unsigned char buf[MAX_DATA_SIZE + sizeof(uint16_t)];
+    size_t len = vdsm_sim_frame(msg, buf, sizeof(buf));
+
+    if (len == 0)
+    {
+        return -1;
+    }
+
+    return vdsm_sim_send_raw(fd, buf, len);
+}
+
+int vdsm_sim_send_hello(int fd, uint32_t message_id)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmRequestHello hello = VDCAPI__VDSM__REQUEST_HELLO__INIT;
+
+    hello.dsuid = VDSM_SIM_DSUID;
+    hello.has_api_version = 1;
+    hello.api_version = SUPPORTED_API_VERSION;
+
+    msg.type = VDCAPI__TYPE__VDSM_REQUEST_HELLO;
+    msg.has_message_id = 1;
+    msg.message_id = message_id;
+    msg.vdsm_request_hello = &hello;
+    return vdsm_sim_send(fd, &msg);
+}
+
+size_t vdsm_sim_frame_ping(const char *dsuid, unsigned char *buf, size_t size)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmSendPing ping = VDCAPI__VDSM__SEND_PING__INIT;
+
+    ping.dsuid = (char *)dsuid;
+    msg.type = VDCAPI__TYPE__VDSM_SEND_PING;
+    msg.vdsm_send_ping = &ping;
+    return vdsm_sim_frame(&msg, buf, size);
+}
+
+size_t vdsm_sim_frame_call_scene(const char *dsuid, int32_t scene,
+                                 unsigned char *buf, size_t size)
+{
+    Vdcapi__Message msg = VDCAPI__MESSAGE__INIT;
+    Vdcapi__VdsmNotificationCallScene call =
+                                VDCAPI__VDSM__NOTIFICATION_CALL_SCENE__INIT;
+    char *dsuids[1] = { (char *)dsuid };
+
+    call.n_dsuid = 1;
+    call.dsuid = dsuids;
+    call.has_scene = 1;
+    call.scene = scene;
+    call.has_force = 1;
+    call.force = 0;
+    msg.type = VDCAPI__TYPE__VDSM_NOTIFICATION_CALL_SCENE;
+    msg.vdsm_send_call_scene = &call;
+    return vdsm_sim_frame(&msg, buf, size);
+}
+
+int vdsm_sim_send_ping(int fd, const char *dsuid)
+{
+    unsigned char buf[128];
+    size_t len = vdsm_sim_frame_ping(dsuid, buf, sizeof(buf));
+
+    if (len == 0)
+    {
+        return -1;
+    }
+
+    return vdsm_sim_send_raw(fd, buf, len);
+}
+
+static int vdsm_sim_read(int fd, unsigned char *data, size_t len, int timeout)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (len > 0)
+    {
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, timeout);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return -1;
+        }
+
+        ssize_t got = recv(fd, data, len, 0);
+        if (got <= 0)
+        {
+            return -1;
+        }
+        data += got;
+        len -= got;
+    }
+    return 0;
+}
+
+Vdcapi__Message *vdsm_sim_recv(int fd, int timeout)
+{
+    unsigned char buf[MAX_DATA_SIZE];
+    uint16_t netlen;
+
+    if (vdsm_sim_read(fd, (unsigned char *)&netlen, sizeof(uint16_t),
+                      timeout) < 0)
+    {
+        return NULL;
+    }
+
+    size_t len = ntohs(netlen);
+    if ((len > MAX_DATA_SIZE) || (vdsm_sim_read(fd, buf, len, timeout) < 0))
+    {
+        return NULL;
+    }
+
+    return vdcapi__message__unpack(NULL, len, buf);
+}
+
+void vdsm_sim_stream_init(vdsm_sim_stream_t *stream, int fd)
+{
+    stream->fd = fd;
+    stream->len = 0;
+}
+
+Vdcapi__Message *vdsm_sim_stream_next(vdsm_sim_stream_t *stream)
+{
+    uint16_t netlen;
+
+    if (stream->len < sizeof(stream->buf))
+    {
+        ssize_t got = recv(stream->fd, stream->buf + stream->len,
+                           sizeof(stream->buf) - stream->len, MSG_DONTWAIT);
+        if (got > 0)
+        {
+            stream->len += got;
+        }
+    }
+
+    if (stream->len < sizeof(uint16_t))
+    {
+        return NULL;
+    }
+
+    memcpy(&netlen, stream->buf, sizeof(uint16_t));
+    size_t len = ntohs(netlen);
+    if (stream->len < sizeof(uint16_t) + len)
+    {
+        return NULL;
+    }
+
+    Vdcapi__Message *msg = vdcapi__message__unpack(NULL, len,
+                                            stream->buf + sizeof(uint16_t));
+    stream->len -= sizeof(uint16_t) + len;
+    memmove(stream->buf, stream->buf + sizeof(uint16_t) + len, stream->len);
+    return msg;
+}
@@ -0,0 +1,78 @@
+/*
+    Copyright (c) 2016 digitalSTROM AG, Zurich, Switzerland
+
+    Author: Sergey 'Jin' Bostandzhyan <jin@dev.digitalstrom.org>
+
+    This file is part of libdSvDC.
+
+    libdsvdc is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libdsvdc is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdsvdc. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Minimal vdSM side of the protocol, used by the tests and benchmarks to
+ * talk to a library instance over a real socket. */
+
+#ifndef __VDSM_SIM_H__
+#define __VDSM_SIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dsvdc.h"
+#include "messages.pb-c.h"
+
+#define VDSM_SIM_DSUID  "3504175FE0000000000000000000000100"
+
+/* connect to the listening socket of the given library instance */
+int vdsm_sim_connect(dsvdc_t *handle);
+
+/* send a raw, already framed buffer */
+int vdsm_sim_send_raw(int fd, const unsigned char *data, size_t len);
+
+/* pack a message including the length prefix, returns the frame length or
+ * zero if it does not fit into the buffer */
+size_t vdsm_sim_frame(const Vdcapi__Message *msg, unsigned char *buf,
+                      size_t size);
+size_t vdsm_sim_frame_ping(const char *dsuid, unsigned char *buf, size_t size);
+size_t vdsm_sim_frame_call_scene(const char *dsuid, int32_t scene,
+                                 unsigned char *buf, size_t size);
+
+/* pack and send a message including the length prefix */
+int vdsm_sim_send(int fd, const Vdcapi__Message *msg);
+
+int vdsm_sim_send_hello(int fd, uint32_t message_id);
+int vdsm_sim_send_ping(int fd, const char *dsuid);
+
+/* Wait up to timeout milliseconds for a message, returns NULL on timeout or
+ * error. The message must be freed with vdcapi__message__free_unpacked(). */
+Vdcapi__Message *vdsm_sim_recv(int fd, int timeout);
+
+/* Incremental reader for a connection that is read without blocking, e.g.
+ * while the library runs in the same thread. */
+typedef struct vdsm_sim_stream
+{
+    int fd;
+    size_t len;
+    unsigned char buf[65536];
+} vdsm_sim_stream_t;
+
+void vdsm_sim_stream_init(vdsm_sim_stream_t *stream, int fd);
+
+/* Returns the next complete message, reading whatever is available from the
+ * socket. NULL if no complete message arrived yet. */
+Vdcapi__Message *vdsm_sim_stream_next(vdsm_sim_stream_t *stream);
+
+/* monotonic time in microseconds */
+uint64_t vdsm_sim_now_us(void);
+
+#endif/*__VDSM_SIM_H__*/